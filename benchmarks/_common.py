@@ -0,0 +1,14 @@
+"""Helpers shared by the benchmark scripts."""
+
+import os
+
+import pybtrfs
+
+
+def fresh_root(btrfs, name):
+    """Create subvolume btrfs/name, deleting a leftover from a past run."""
+    root = os.path.join(btrfs, name)
+    if os.path.exists(root):
+        pybtrfs.delete_subvolume(root, recursive=True)
+    pybtrfs.create_subvolume(root)
+    return root
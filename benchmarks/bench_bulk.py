@@ -0,0 +1,93 @@
+"""Compare bulk creation with a Python thread pool.
+
+Replays the TestStressSnapshots / TestStressSubvolumes scenarios: one
+source with a payload snapshotted BTRFS_BENCH_COUNT times, then the same
+number of empty subvolumes.  Each is done with a ThreadPool calling
+create_snapshot() / create_subvolume() per path, and with a single
+create_snapshots() / create_subvolumes() call.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_bulk.py
+"""
+
+import os
+import sys
+import time
+from multiprocessing.pool import ThreadPool
+
+import pybtrfs
+from _common import fresh_root
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_COUNT", "1000"))
+WORKERS = 64
+
+
+def timed(fn):
+    start = time.perf_counter()
+    fn()
+    return time.perf_counter() - start
+
+
+def threaded(fn, args):
+    pool = ThreadPool(WORKERS)
+    list(pool.imap_unordered(fn, args, chunksize=128))
+    pool.close()
+    pool.join()
+
+
+def bench_snapshots(btrfs):
+    rates = []
+    for bulk in (False, True):
+        root = fresh_root(btrfs, "_bench_bulk_snap")
+        source = os.path.join(root, "source")
+        pybtrfs.create_subvolume(source)
+        with open(os.path.join(source, "payload.txt"), "w") as f:
+            f.write("snapshot stress data")
+        paths = [os.path.join(root, f"snap_{i:05d}") for i in range(COUNT)]
+
+        if bulk:
+            elapsed = timed(lambda: pybtrfs.create_snapshots(
+                source, paths, workers=WORKERS,
+            ))
+        else:
+            elapsed = timed(lambda: threaded(
+                lambda p: pybtrfs.create_snapshot(source, p), paths,
+            ))
+        rates.append(COUNT / elapsed)
+        pybtrfs.delete_subvolume(root, recursive=True)
+    return rates
+
+
+def bench_subvolumes(btrfs):
+    rates = []
+    for bulk in (False, True):
+        root = fresh_root(btrfs, "_bench_bulk_sv")
+        paths = [os.path.join(root, f"sv_{i:05d}") for i in range(COUNT)]
+
+        if bulk:
+            elapsed = timed(lambda: pybtrfs.create_subvolumes(
+                paths, workers=WORKERS,
+            ))
+        else:
+            elapsed = timed(lambda: threaded(pybtrfs.create_subvolume, paths))
+        rates.append(COUNT / elapsed)
+        pybtrfs.delete_subvolume(root, recursive=True)
+    return rates
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    print(f"{COUNT} targets, {WORKERS} workers")
+    for label, fn in (("snapshots", bench_snapshots),
+                      ("subvolumes", bench_subvolumes)):
+        pool, bulk = fn(btrfs)
+        print(f"  {label:11s} ThreadPool {pool:10,.0f}/s"
+              f"   bulk {bulk:10,.0f}/s   x{bulk / pool:.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+"""Measure per-call cost of the cheap binding entry points.
+
+Each function is called BTRFS_BENCH_CALLS times per round on the BTRFS
+mount, both positionally and with keywords, and the best of ROUNDS is
+reported in ns/call.  These are calls where argument parsing is a visible
+share of the total, so the numbers track binding overhead.
+
+To compare two builds, save the results of one run as JSON and pass them
+as the baseline of the next:
+
+Usage:
+    sudo BTRFS=/mnt/btrfs BTRFS_BENCH_SAVE=before.json \\
+        PYTHONPATH=. python benchmarks/bench_calls.py
+    sudo BTRFS=/mnt/btrfs BTRFS_BENCH_BASELINE=before.json \\
+        PYTHONPATH=. python benchmarks/bench_calls.py
+"""
+
+import json
+import os
+import sys
+import time
+
+import pybtrfs
+from pybtrfs import quota
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_CALLS", "100000"))
+ROUNDS = 5
+
+
+def cases(btrfs, fs):
+    return [
+        ("is_subvolume(path)",
+         lambda: pybtrfs.is_subvolume(btrfs)),
+        ("is_subvolume(path=)",
+         lambda: pybtrfs.is_subvolume(path=btrfs)),
+        ("subvolume_id(path)",
+         lambda: pybtrfs.subvolume_id(btrfs)),
+        ("subvolume_info(path, id)",
+         lambda: pybtrfs.subvolume_info(btrfs, 5)),
+        ("subvolume_info(path=, id=)",
+         lambda: pybtrfs.subvolume_info(path=btrfs, id=5)),
+        ("get_subvolume_read_only(path)",
+         lambda: pybtrfs.get_subvolume_read_only(btrfs)),
+        ("wait_sync(path, transid)",
+         lambda: pybtrfs.wait_sync(btrfs, 1)),
+        ("Filesystem.subvolume_info(id=)",
+         lambda: fs.subvolume_info(id=5)),
+        ("quota.qgroup_info(fd)",
+         lambda: quota.qgroup_info(fs.fileno())),
+        ("quota.quota_rescan_status(fd)",
+         lambda: quota.quota_rescan_status(fs.fileno())),
+    ]
+
+
+def bench(fn):
+    best = float("inf")
+    for _ in range(ROUNDS):
+        start = time.perf_counter_ns()
+        for _ in range(COUNT):
+            fn()
+        best = min(best, time.perf_counter_ns() - start)
+    return best / COUNT
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    baseline = {}
+    if os.environ.get("BTRFS_BENCH_BASELINE"):
+        with open(os.environ["BTRFS_BENCH_BASELINE"]) as f:
+            baseline = json.load(f)
+
+    results = {}
+    print(f"{COUNT} calls, best of {ROUNDS}")
+    with pybtrfs.Filesystem(btrfs) as fs:
+        for label, fn in cases(btrfs, fs):
+            try:
+                fn()
+            except OSError as e:
+                # e.g. quotas not enabled on this filesystem
+                print(f"  {label:38s} skipped: {e}")
+                continue
+            ns = results[label] = bench(fn)
+            line = f"  {label:38s} {ns:9,.0f} ns/call"
+            if label in baseline:
+                line += f"   was {baseline[label]:9,.0f}" \
+                        f"   x{baseline[label] / ns:.2f}"
+            print(line)
+
+    if os.environ.get("BTRFS_BENCH_SAVE"):
+        with open(os.environ["BTRFS_BENCH_SAVE"], "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
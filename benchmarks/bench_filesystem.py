@@ -0,0 +1,78 @@
+"""Compare path-based calls with a persistent Filesystem handle.
+
+Runs the same subvolume_info()/get_subvolume_read_only() mix through the
+module functions (one open/close and path walk per call) and through
+Filesystem methods, single-threaded and from many threads.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_filesystem.py
+"""
+
+import os
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import pybtrfs
+
+
+CALLS = int(os.environ.get("BTRFS_BENCH_COUNT", "20000"))
+THREADS = (1, 8, 64)
+ROUNDS = 3
+DEPTH = 4
+
+
+def by_path(path, n):
+    for _ in range(n):
+        pybtrfs.subvolume_info(path)
+        pybtrfs.get_subvolume_read_only(path)
+
+
+def by_handle(fs, rel):
+    def run(_, n):
+        for _ in range(n):
+            fs.subvolume_info(rel)
+            fs.get_subvolume_read_only(rel)
+    return run
+
+
+def bench(fn, arg, threads):
+    per_thread = CALLS // threads
+    best = float("inf")
+    with ThreadPoolExecutor(threads) as pool:
+        for _ in range(ROUNDS):
+            start = time.perf_counter()
+            list(pool.map(lambda _: fn(arg, per_thread), range(threads)))
+            best = min(best, time.perf_counter() - start)
+    return per_thread * threads * 2 / best
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    # a few levels of nesting so the path walk is not free
+    rel = os.path.join(*[f"_bench_fs_{i}" for i in range(DEPTH)])
+    top = os.path.join(btrfs, "_bench_fs_0")
+    if os.path.exists(top):
+        pybtrfs.delete_subvolume(top, recursive=True)
+    for i in range(1, DEPTH + 1):
+        parts = [f"_bench_fs_{k}" for k in range(i)]
+        pybtrfs.create_subvolume(os.path.join(btrfs, *parts))
+
+    try:
+        path = os.path.join(btrfs, rel)
+        with pybtrfs.Filesystem(btrfs) as fs:
+            print(f"{CALLS * 2} calls, depth {DEPTH}, best of {ROUNDS}")
+            for threads in THREADS:
+                a = bench(by_path, path, threads)
+                b = bench(by_handle(fs, rel), None, threads)
+                print(f"  threads={threads:<3d} path {a:12,.0f} calls/s"
+                      f"   Filesystem {b:12,.0f} calls/s")
+    finally:
+        pybtrfs.delete_subvolume(top, recursive=True)
+
+
+if __name__ == "__main__":
+    main()
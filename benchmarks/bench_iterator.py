@@ -0,0 +1,85 @@
+"""Compare SubvolumeIterator throughput: per-item vs batched fetching.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_iterator.py
+"""
+
+import os
+import sys
+import time
+
+import pybtrfs
+from _common import fresh_root
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_COUNT", "5000"))
+ROUNDS = 5
+
+
+def per_item(root, info):
+    # next_batch(1) pays one GIL round trip and one call per subvolume,
+    # which is what __next__ used to do
+    n = 0
+    with pybtrfs.SubvolumeIterator(root, info=info) as it:
+        while it.next_batch(1):
+            n += 1
+    return n
+
+
+def iterate(root, info):
+    n = 0
+    with pybtrfs.SubvolumeIterator(root, info=info) as it:
+        for _ in it:
+            n += 1
+    return n
+
+
+def batched(size):
+    def run(root, info):
+        n = 0
+        with pybtrfs.SubvolumeIterator(root, info=info) as it:
+            while True:
+                batch = it.next_batch(size)
+                if not batch:
+                    return n
+                n += len(batch)
+    return run
+
+
+def bench(fn, root, info):
+    best = float("inf")
+    for _ in range(ROUNDS):
+        start = time.perf_counter()
+        n = fn(root, info)
+        best = min(best, time.perf_counter() - start)
+    assert n == COUNT, n
+    return n / best
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    root = fresh_root(btrfs, "_bench_iter")
+    try:
+        for i in range(COUNT):
+            pybtrfs.create_subvolume(os.path.join(root, f"sv_{i:06d}"))
+
+        cases = [
+            ("per-item (next_batch(1))", per_item),
+            ("for-loop (__next__)", iterate),
+            ("next_batch(256)", batched(256)),
+            ("next_batch(4096)", batched(4096)),
+        ]
+        print(f"{COUNT} subvolumes, best of {ROUNDS}")
+        for info in (False, True):
+            print(f"\ninfo={info}")
+            for name, fn in cases:
+                print(f"  {name:28s} {bench(fn, root, info):12,.0f} items/s")
+    finally:
+        pybtrfs.delete_subvolume(root, recursive=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+"""Measure qgroup_info() time and memory at 10k and 100k qgroups.
+
+Enables quotas on the BTRFS mount, creates level-1 qgroups up to each
+count in BTRFS_BENCH_QGROUPS and times qgroup_info() (best of ROUNDS),
+reporting the memory the returned QgroupInfo list retains and the peak
+while it is built.  The same numbers for the list converted with
+as_dict() show what the former list-of-dicts result cost, and streaming
+through QgroupIterator shows the peak staying flat.  The qgroups are
+destroyed afterwards.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_qgroup_info.py
+"""
+
+import os
+import sys
+import time
+import tracemalloc
+
+import pybtrfs
+from pybtrfs import quota
+
+
+COUNTS = [int(n) for n in
+          os.environ.get("BTRFS_BENCH_QGROUPS", "10000,100000").split(",")]
+ROUNDS = 5
+FIRST_ID = 1 << 20  # clear of qgroups the tests or tools create
+
+
+def level1(i):
+    return (1 << 48) | (FIRST_ID + i)
+
+
+def best_of(fn):
+    best = float("inf")
+    for _ in range(ROUNDS):
+        start = time.perf_counter()
+        fn()
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def measure(fn):
+    tracemalloc.start()
+    result = fn()
+    size, peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+    del result
+    return size, peak
+
+
+def stream(fd):
+    count = 0
+    with quota.QgroupIterator(fd) as it:
+        while batch := it.next_batch(4096):
+            count += len(batch)
+    return count
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    with pybtrfs.Filesystem(btrfs) as fs:
+        fd = fs.fileno()
+        quota.quota_enable(fd)
+        quota.quota_rescan_wait(fd)
+        created = 0
+        try:
+            for count in COUNTS:
+                for i in range(created, count):
+                    quota.qgroup_create(fd, level1(i))
+                created = count
+                total = len(quota.qgroup_info(fd))
+
+                def as_dicts():
+                    return [q.as_dict() for q in quota.qgroup_info(fd)]
+
+                print(f"{total} qgroups")
+                for label, fn in (
+                        ("qgroup_info()", lambda: quota.qgroup_info(fd)),
+                        ("as dicts", as_dicts),
+                        ("QgroupIterator", lambda: stream(fd))):
+                    elapsed = best_of(fn)
+                    size, peak = measure(fn)
+                    print(f"  {label:14s} {elapsed * 1000:9.1f} ms"
+                          f"   {size / total:7.1f} bytes/qgroup"
+                          f"   {peak / 2**20:8.1f} MiB peak")
+        finally:
+            for i in range(created):
+                quota.qgroup_destroy(fd, level1(i))
+
+
+if __name__ == "__main__":
+    main()
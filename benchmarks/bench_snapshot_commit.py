@@ -0,0 +1,63 @@
+"""Measure snapshot throughput with one commit wait per snapshot vs per group.
+
+Takes BTRFS_BENCH_COUNT snapshots of one source, waiting for each
+snapshot's transaction before taking the next, and again with
+create_snapshot_async() for all of them followed by one commit_group().
+On kernels without async snapshot creation (5.7+) both modes commit per
+snapshot and should perform alike.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_snapshot_commit.py
+"""
+
+import os
+import sys
+import time
+
+import pybtrfs
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_COUNT", "200"))
+
+
+def per_snapshot(btrfs, source, paths):
+    for p in paths:
+        transid = pybtrfs.create_snapshot_async(source, p)
+        pybtrfs.wait_sync(btrfs, transid)
+
+
+def grouped(btrfs, source, paths):
+    transids = [pybtrfs.create_snapshot_async(source, p) for p in paths]
+    pybtrfs.commit_group(btrfs, transids)
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    root = os.path.join(btrfs, "_bench_snap_commit")
+    if os.path.exists(root):
+        pybtrfs.delete_subvolume_tree(root)
+    pybtrfs.create_subvolume(root)
+    source = os.path.join(root, "source")
+    pybtrfs.create_subvolume(source)
+    with open(os.path.join(source, "payload.txt"), "w") as f:
+        f.write("snapshot payload")
+
+    print(f"{COUNT} snapshots")
+    try:
+        for label, fn in (("wait per snapshot", per_snapshot),
+                          ("commit_group", grouped)):
+            paths = [os.path.join(root, f"{fn.__name__}_{i:05d}")
+                     for i in range(COUNT)]
+            start = time.perf_counter()
+            fn(btrfs, source, paths)
+            elapsed = time.perf_counter() - start
+            print(f"  {label:18s} {COUNT / elapsed:10,.0f} snapshots/s")
+    finally:
+        pybtrfs.delete_subvolume_tree(root)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+"""Measure SubvolumeInfo memory and attribute access cost.
+
+Builds BTRFS_BENCH_INFOS infos (by querying the same subvolume repeatedly,
+so no subvolumes have to be created) and reports the memory they retain
+and the time to read the integer fields only vs every field.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_subvol_info.py
+"""
+
+import os
+import sys
+import time
+import tracemalloc
+
+import pybtrfs
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_INFOS", "100000"))
+ROUNDS = 5
+
+INT_FIELDS = ("id", "parent_id", "generation")
+ALL_FIELDS = INT_FIELDS + (
+    "uuid", "parent_uuid", "received_uuid",
+    "ctime", "otime", "stime", "rtime",
+)
+
+
+def build(path):
+    return [pybtrfs.subvolume_info(path) for _ in range(COUNT)]
+
+
+def read(infos, fields):
+    for info in infos:
+        for name in fields:
+            getattr(info, name)
+
+
+def bench_read(path, fields):
+    best = float("inf")
+    for _ in range(ROUNDS):
+        # fresh infos every round so cached attributes are not reused
+        infos = build(path)
+        start = time.perf_counter()
+        read(infos, fields)
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    tracemalloc.start()
+    infos = build(btrfs)
+    built, _ = tracemalloc.get_traced_memory()
+    read(infos, ALL_FIELDS)
+    touched, _ = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+    del infos
+
+    print(f"{COUNT} SubvolumeInfo objects")
+    print(f"  retained after build        {built / COUNT:8.1f} bytes/info")
+    print(f"  after reading every field   {touched / COUNT:8.1f} bytes/info")
+
+    print(f"\nattribute reads, best of {ROUNDS}")
+    for label, fields in (("id/parent_id/generation", INT_FIELDS),
+                          ("all fields", ALL_FIELDS)):
+        elapsed = bench_read(btrfs, fields)
+        print(f"  {label:28s} {COUNT / elapsed:12,.0f} infos/s")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+"""Compare subvolume_usage() with joining the listing and qgroups in Python.
+
+Enables quotas, creates BTRFS_BENCH_COUNT subvolumes (each gets its
+level-0 qgroup) and times, best of ROUNDS, a billing-style report built
+by SubvolumeIterator(info=True) plus qgroup_info() and a dict join,
+against subvolume_usage(), which sweeps both trees and joins them in C.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_subvolume_usage.py
+"""
+
+import os
+import sys
+import time
+
+import pybtrfs
+from _common import fresh_root
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_COUNT", "5000"))
+ROUNDS = 5
+
+
+def python_join(root):
+    usage = {q.qgroupid: q for q in pybtrfs.qgroup_info(root)}
+    rows = []
+    with pybtrfs.SubvolumeIterator(root, info=True) as it:
+        for path, info in it:
+            q = usage.get(info.id)
+            rows.append((path, info.id, q.rfer if q else 0,
+                         q.excl if q else 0))
+    return len(rows)
+
+
+def native(root):
+    return len(pybtrfs.subvolume_usage(root)["id"])
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    pybtrfs.quota_enable(btrfs)
+    root = fresh_root(btrfs, "_bench_usage")
+    try:
+        for i in range(COUNT):
+            pybtrfs.create_subvolume(os.path.join(root, f"sv_{i:06d}"))
+        pybtrfs.quota_rescan_wait(btrfs)
+
+        print(f"{COUNT} subvolumes")
+        for label, fn in (
+                ("iterator + qgroup_info", python_join),
+                ("subvolume_usage()", native)):
+            best = float("inf")
+            for _ in range(ROUNDS):
+                start = time.perf_counter()
+                n = fn(root)
+                best = min(best, time.perf_counter() - start)
+            assert n == COUNT, n
+            print(f"  {label:24s} {best * 1000:9.1f} ms")
+    finally:
+        pybtrfs.delete_subvolume(root, recursive=True)
+
+
+if __name__ == "__main__":
+    main()
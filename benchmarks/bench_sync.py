@@ -0,0 +1,67 @@
+"""Compare concurrent sync() calls with and without coalescing.
+
+Each of N threads writes a small file and then syncs, BTRFS_BENCH_COUNT
+times in total, once with plain sync() and once with
+sync(coalesce=True).  Reports syncs/s and the worst per-call latency.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_sync.py
+"""
+
+import os
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import pybtrfs
+
+
+CALLS = int(os.environ.get("BTRFS_BENCH_COUNT", "512"))
+THREADS = (1, 8, 64)
+
+
+def bench(root, threads, coalesce):
+    per_thread = CALLS // threads
+
+    def run(t):
+        path = os.path.join(root, f"t{t}")
+        worst = 0.0
+        for i in range(per_thread):
+            with open(path, "w") as f:
+                f.write(str(i))
+            start = time.perf_counter()
+            pybtrfs.sync(root, coalesce=coalesce)
+            worst = max(worst, time.perf_counter() - start)
+        return worst
+
+    with ThreadPoolExecutor(threads) as pool:
+        start = time.perf_counter()
+        worst = max(pool.map(run, range(threads)))
+        elapsed = time.perf_counter() - start
+    return per_thread * threads / elapsed, worst
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    root = os.path.join(btrfs, "_bench_sync")
+    if os.path.exists(root):
+        pybtrfs.delete_subvolume(root, recursive=True)
+    pybtrfs.create_subvolume(root)
+
+    print(f"{CALLS} sync calls")
+    try:
+        for threads in THREADS:
+            for coalesce in (False, True):
+                rate, worst = bench(root, threads, coalesce)
+                label = "coalesced" if coalesce else "plain"
+                print(f"  threads={threads:<3d} {label:10s}"
+                      f" {rate:10,.0f} syncs/s   worst {worst * 1e3:8.1f} ms")
+    finally:
+        pybtrfs.delete_subvolume(root, recursive=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+"""Measure how create/snapshot/list throughput scales with threads.
+
+Each Python thread works on its own slice of BTRFS_BENCH_COUNT targets,
+calling create_subvolume(), create_snapshot() or listing its own tree
+with SubvolumeIterator.  Thread counts run from 1 up to os.cpu_count()
+in powers of two.  On a free-threaded interpreter the Python side of
+each call runs in parallel too, not only the ioctls, so the speedup
+over one thread should track the core count more closely.
+
+Usage:
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python benchmarks/bench_threads.py
+    sudo BTRFS=/mnt/btrfs PYTHONPATH=. python3.13t benchmarks/bench_threads.py
+"""
+
+import os
+import sys
+import threading
+import time
+
+import pybtrfs
+from _common import fresh_root
+
+
+COUNT = int(os.environ.get("BTRFS_BENCH_COUNT", "1024"))
+LIST_ROUNDS = 20
+
+
+def thread_counts():
+    counts, n = [], 1
+    while n < (os.cpu_count() or 1):
+        counts.append(n)
+        n *= 2
+    return counts + [os.cpu_count() or 1]
+
+
+def run(threads, fn):
+    """Run fn(i) in *threads* threads released together; return seconds."""
+    barrier = threading.Barrier(threads + 1)
+
+    def worker(i):
+        barrier.wait()
+        fn(i)
+
+    pool = [threading.Thread(target=worker, args=(i,))
+            for i in range(threads)]
+    for t in pool:
+        t.start()
+    barrier.wait()
+    start = time.perf_counter()
+    for t in pool:
+        t.join()
+    return time.perf_counter() - start
+
+
+def slices(root, threads, prefix):
+    per = COUNT // threads
+    return [[os.path.join(root, f"t{i:03d}", f"{prefix}_{j:05d}")
+             for j in range(per)] for i in range(threads)]
+
+
+def bench_subvolumes(btrfs, threads):
+    root = fresh_root(btrfs, "_bench_threads_sv")
+    work = slices(root, threads, "sv")
+    for i in range(threads):
+        os.mkdir(os.path.join(root, f"t{i:03d}"))
+
+    def fn(i):
+        for path in work[i]:
+            pybtrfs.create_subvolume(path)
+
+    elapsed = run(threads, fn)
+    pybtrfs.delete_subvolume(root, recursive=True)
+    return threads * len(work[0]) / elapsed
+
+
+def bench_snapshots(btrfs, threads):
+    root = fresh_root(btrfs, "_bench_threads_snap")
+    source = os.path.join(root, "source")
+    pybtrfs.create_subvolume(source)
+    with open(os.path.join(source, "payload.txt"), "w") as f:
+        f.write("snapshot scaling data")
+    work = slices(root, threads, "snap")
+    for i in range(threads):
+        os.mkdir(os.path.join(root, f"t{i:03d}"))
+
+    def fn(i):
+        for path in work[i]:
+            pybtrfs.create_snapshot(source, path)
+
+    elapsed = run(threads, fn)
+    pybtrfs.delete_subvolume(root, recursive=True)
+    return threads * len(work[0]) / elapsed
+
+
+def bench_list(btrfs, threads):
+    root = fresh_root(btrfs, "_bench_threads_list")
+    work = slices(root, threads, "sv")
+    for i in range(threads):
+        pybtrfs.create_subvolume(os.path.join(root, f"t{i:03d}"))
+        pybtrfs.create_subvolumes(work[i])
+
+    def fn(i):
+        top = os.path.join(root, f"t{i:03d}")
+        for _ in range(LIST_ROUNDS):
+            with pybtrfs.SubvolumeIterator(top, info=True) as it:
+                while it.next_batch(4096):
+                    pass
+
+    elapsed = run(threads, fn)
+    pybtrfs.delete_subvolume(root, recursive=True)
+    return threads * len(work[0]) * LIST_ROUNDS / elapsed
+
+
+def main():
+    btrfs = os.environ.get("BTRFS")
+    if not btrfs:
+        sys.exit("BTRFS env var not set")
+
+    gil = getattr(sys, "_is_gil_enabled", lambda: True)()
+    print(f"{COUNT} targets, GIL {'enabled' if gil else 'disabled'}")
+    for label, fn in (("subvolumes", bench_subvolumes),
+                      ("snapshots", bench_snapshots),
+                      ("list", bench_list)):
+        base = None
+        for threads in thread_counts():
+            rate = fn(btrfs, threads)
+            base = base or rate
+            print(f"  {label:11s} {threads:3d} threads {rate:12,.0f}/s"
+                  f"   x{rate / base:.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -39,14 +39,21 @@ def fmt_func(name: str, obj) -> str:
     return f"def {name}(*args, **kwargs): ..."
 
 
-def fmt_member(name: str, mdef) -> str:
-    """Guess type from T_* member type codes or object type."""
-    if "uuid" in name:
-        return f"    {name}: bytes"
+def guess_type(name: str) -> str:
+    """Guess an attribute type from its name."""
+    if "uuid" in name or name == "fsid":
+        return "bytes"
+    if name == "path":
+        return "str"
     if "time" in name and name not in ("stransid", "rtransid", "ctransid",
                                        "otransid"):
-        return f"    {name}: float"
-    return f"    {name}: int"
+        return "float"
+    return "int"
+
+
+def fmt_member(name: str, mdef) -> str:
+    """Guess type from T_* member type codes or object type."""
+    return f"    {name}: {guess_type(name)}"
 
 
 def collect_members(cls) -> list[str]:
@@ -64,7 +71,8 @@ def collect_members(cls) -> list[str]:
             else:
                 lines.append(fmt_member(name, obj))
         elif tp == "getset_descriptor":
-            type_name = annotations[name].__name__ if name in annotations else "int"
+            type_name = (annotations[name].__name__ if name in annotations
+                         else guess_type(name))
             lines.append("    @property")
             lines.append(f"    def {name}(self) -> {type_name}: ...")
     return lines
@@ -133,8 +141,16 @@ def generate_for_module(module) -> str:
         if needs_self:
             break
 
+    # Callable annotations come from collections.abc
+    needs_callable = any(
+        "Callable[" in (obj.__doc__ or "") for _, obj in funcs
+    )
+
+    if needs_callable:
+        out.append("from collections.abc import Callable")
     if needs_self:
         out.append("from typing import Self")
+    if needs_callable or needs_self:
         out.append("")
 
     # Constants
@@ -1,24 +1,39 @@
+import os
 from enum import IntEnum
 
+from .btrfsutils import Filesystem as _Filesystem
 from .btrfsutils import (
     BtrfsUtilError,
     QgroupInherit,
     SubvolumeInfo,
     SubvolumeIterator,
+    commit_group,
     create_snapshot,
+    create_snapshot_async,
+    create_snapshot_tree,
+    create_snapshots,
     create_subvolume,
+    create_subvolumes,
     delete_subvolume,
+    delete_subvolume_tree,
     deleted_subvolumes,
+    deleted_subvolumes_array,
+    find_subvolume_by_received_uuid,
+    find_subvolume_by_uuid,
+    find_subvolumes_by_uuid,
     get_default_subvolume,
     get_subvolume_read_only,
     is_subvolume,
     set_default_subvolume,
     set_subvolume_read_only,
     start_sync,
+    subvolume_columns,
     subvolume_id,
     subvolume_info,
+    subvolume_list,
     subvolume_path,
     sync,
+    wait_subvolumes_cleaned,
     wait_sync,
 )
 from .btrfsutils import (
@@ -48,6 +63,8 @@ from .mount import (
     MNT_EXPIRE,
 )
 from .quota import (
+    QgroupInfo,
+    QgroupIterator,
     quota_enable,
     quota_enable_simple,
     quota_disable,
@@ -59,7 +76,10 @@ from .quota import (
     qgroup_assign,
     qgroup_remove,
     qgroup_limit,
+    qgroup_batch,
     qgroup_info,
+    qgroup_graph,
+    subvolume_usage,
 )
 from .quota import (
     BTRFS_QUOTA_CTL_ENABLE,
@@ -175,6 +195,82 @@ class QgroupLimitFlags(IntEnum):
     RSV_EXCL = BTRFS_QGROUP_LIMIT_RSV_EXCL
 
 
+class Filesystem(_Filesystem):
+    """Handle on a mounted Btrfs filesystem.
+
+    Keeps one directory fd on *path* open and runs subvolume, sync and
+    quota operations against it instead of resolving a path on every call.
+    Relative paths passed to methods are resolved from *path*.
+    """
+
+    def _quota(self, func, *args, **kwargs):
+        # A duplicate rather than fileno(): close() from another thread
+        # must not hand the number to another file while func runs on it.
+        fd = self._dup()
+        try:
+            return func(fd, *args, **kwargs)
+        finally:
+            os.close(fd)
+
+    def quota_enable(self) -> None:
+        self._quota(quota_enable)
+
+    def quota_enable_simple(self) -> None:
+        self._quota(quota_enable_simple)
+
+    def quota_disable(self) -> None:
+        self._quota(quota_disable)
+
+    def quota_rescan(self) -> None:
+        self._quota(quota_rescan)
+
+    def quota_rescan_status(self) -> dict:
+        return self._quota(quota_rescan_status)
+
+    def quota_rescan_wait(self, timeout: float | None = None) -> bool:
+        return self._quota(quota_rescan_wait, timeout)
+
+    def qgroup_create(self, qgroupid: int) -> None:
+        self._quota(qgroup_create, qgroupid)
+
+    def qgroup_destroy(self, qgroupid: int) -> None:
+        self._quota(qgroup_destroy, qgroupid)
+
+    def qgroup_assign(self, src: int, dst: int) -> None:
+        self._quota(qgroup_assign, src, dst)
+
+    def qgroup_remove(self, src: int, dst: int) -> None:
+        self._quota(qgroup_remove, src, dst)
+
+    def qgroup_limit(
+        self, qgroupid: int, max_rfer: int = 0, max_excl: int = 0,
+    ) -> None:
+        self._quota(qgroup_limit, qgroupid, max_rfer, max_excl)
+
+    def qgroup_batch(
+        self, ops: list[tuple], rescan: bool = True,
+    ) -> tuple[list[OSError | None], bool, OSError | None]:
+        return self._quota(qgroup_batch, ops, rescan)
+
+    def qgroup_info(self) -> list[QgroupInfo]:
+        return self._quota(qgroup_info)
+
+    def qgroup_graph(self) -> dict:
+        return self._quota(qgroup_graph)
+
+    def subvolume_usage(self, top: int = 0) -> dict:
+        return self._quota(subvolume_usage, top)
+
+    def qgroup_iterator(
+        self, *, min_id: int = 0, max_id: int = (1 << 48) - 1,
+        level: int | None = None, min_transid: int = 0,
+    ) -> QgroupIterator:
+        return self._quota(
+            QgroupIterator, min_id=min_id, max_id=max_id, level=level,
+            min_transid=min_transid,
+        )
+
+
 def mount_data(**kwargs: str) -> str:
     """Build a comma-separated mount data string from keyword arguments.
 
@@ -198,8 +294,13 @@ def mkfs(
     uuid: str = "",
     force: bool = False,
     no_discard: bool = False,
+    timeout: float | None = None,
 ) -> None:
-    """Create a Btrfs filesystem on the specified devices."""
+    """Create a Btrfs filesystem on the specified devices.
+
+    Raises TimeoutError if timeout seconds pass before the filesystem
+    starts being written; once it has, the call runs to completion.
+    """
     return _mkfs(
         *devices,
         label=label,
@@ -214,6 +315,7 @@ def mkfs(
         uuid=uuid,
         force=force,
         no_discard=no_discard,
+        timeout=timeout,
     )
 
 
@@ -221,23 +323,39 @@ __all__ = [
     # btrfsutils classes
     "BtrfsUtilError",
     "QgroupInherit",
+    "QgroupInfo",
+    "QgroupIterator",
+    "Filesystem",
     "SubvolumeInfo",
     "SubvolumeIterator",
     # btrfsutils functions
+    "commit_group",
     "create_snapshot",
+    "create_snapshot_async",
+    "create_snapshot_tree",
+    "create_snapshots",
     "create_subvolume",
+    "create_subvolumes",
     "delete_subvolume",
+    "delete_subvolume_tree",
     "deleted_subvolumes",
+    "deleted_subvolumes_array",
+    "find_subvolume_by_received_uuid",
+    "find_subvolume_by_uuid",
+    "find_subvolumes_by_uuid",
     "get_default_subvolume",
     "get_subvolume_read_only",
     "is_subvolume",
     "set_default_subvolume",
     "set_subvolume_read_only",
     "start_sync",
+    "subvolume_columns",
     "subvolume_id",
     "subvolume_info",
+    "subvolume_list",
     "subvolume_path",
     "sync",
+    "wait_subvolumes_cleaned",
     "wait_sync",
     # mount functions
     "mount",
@@ -257,7 +375,10 @@ __all__ = [
     "qgroup_assign",
     "qgroup_remove",
     "qgroup_limit",
+    "qgroup_batch",
     "qgroup_info",
+    "qgroup_graph",
+    "subvolume_usage",
     # enum classes
     "CreateSnapshotFlags",
     "DeleteSubvolumeFlags",
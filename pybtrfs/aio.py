@@ -0,0 +1,162 @@
+"""Coroutine versions of the blocking pybtrfs calls.
+
+Each event loop gets its own pool of C worker threads.  A call is queued
+to the pool without creating a thread-pool future, runs there without
+the GIL, and reports back through an eventfd the loop watches with
+add_reader(); every request finished since the last wakeup is resolved
+in one pass.  Compared with ``loop.run_in_executor()`` this avoids the
+concurrent.futures round trip and a self-pipe write per call.
+
+    async def main():
+        await pybtrfs.aio.create_snapshot("/mnt/data", "/mnt/snap")
+        async for batch in pybtrfs.aio.subvolume_batches("/mnt"):
+            ...
+
+Cancelling an awaiting task, including through asyncio.timeout() or
+asyncio.wait_for(), drops its request if no worker has picked it up yet.
+quota_rescan_wait() polls the rescan and stops at the next poll; other
+requests are single ioctls that run to completion, and their result is
+dropped when it arrives.  Threads are started as requests arrive, up to
+the size of the default executor, since wait_sync() holds a worker until
+the transaction commits.  A loop that is closed or dropped without
+shutdown() takes its pool with it.
+"""
+
+import asyncio
+import os
+import weakref
+from typing import AsyncIterator
+
+from .btrfsutils import QgroupInherit, SubvolumeInfo
+from .btrfsutils import _AioCursor, _AioQueue
+
+WORKERS = min(32, (os.cpu_count() or 1) + 4)
+
+# loop -> weakref.ref(_Queue).  The loop keeps its _Queue alive through
+# the add_reader() callback, and closing the loop releases it.  Requests
+# in flight hold futures that refer back to the loop, so this map must
+# not hold the _Queue strongly.
+_queues: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+
+class _Queue:
+    """An _AioQueue registered with one event loop."""
+
+    def __init__(self, loop: asyncio.AbstractEventLoop) -> None:
+        self.queue = _AioQueue(WORKERS)
+        self.fd = self.queue.fileno()
+        loop.add_reader(self.fd, self.complete)
+
+    def complete(self) -> None:
+        for future, exc, result in self.queue.complete():
+            if future.done():
+                continue  # cancelled while the request ran
+            if exc is None:
+                future.set_result(result)
+            else:
+                future.set_exception(exc)
+
+
+async def _call(method, *args):
+    loop = asyncio.get_running_loop()
+    ref = _queues.get(loop)
+    q = ref() if ref is not None else None
+    if q is None:
+        q = _Queue(loop)
+        _queues[loop] = weakref.ref(q)
+    future = loop.create_future()
+    method(q.queue, future, *args)
+    try:
+        return await future
+    except asyncio.CancelledError:
+        q.queue.cancel(future)
+        raise
+
+
+async def create_snapshot(
+    source: str,
+    path: str,
+    recursive: bool = False,
+    read_only: bool = False,
+    qgroup_inherit: QgroupInherit | None = None,
+) -> None:
+    """Create a snapshot of a subvolume."""
+    await _call(_AioQueue.snapshot, source, path, recursive, read_only,
+                qgroup_inherit)
+
+
+async def delete_subvolume(path: str, recursive: bool = False) -> None:
+    """Delete a subvolume or snapshot."""
+    await _call(_AioQueue.delete, path, recursive)
+
+
+async def sync(path: str, coalesce: bool = False) -> None:
+    """Force a sync on a Btrfs filesystem; see pybtrfs.sync()."""
+    await _call(_AioQueue.sync, path, coalesce)
+
+
+async def start_sync(path: str) -> int:
+    """Start a sync and return the transaction ID."""
+    return await _call(_AioQueue.start_sync, path)
+
+
+async def wait_sync(path: str, transid: int = 0) -> None:
+    """Wait for a transaction to sync."""
+    await _call(_AioQueue.wait_sync, path, transid)
+
+
+async def quota_rescan_wait(path: str) -> None:
+    """Wait until the current quota rescan completes."""
+    await _call(_AioQueue.quota_rescan_wait, path)
+
+
+async def subvolume_batches(
+    path: str,
+    top: int = 0,
+    post_order: bool = False,
+    info: bool = False,
+    n: int = 256,
+) -> AsyncIterator[list[tuple[str, int | SubvolumeInfo]]]:
+    """Yield the subvolumes below path in lists of up to n entries.
+
+    Entries are the (path, id) or (path, SubvolumeInfo) tuples
+    SubvolumeIterator returns.  Each batch, including opening the
+    iterator for the first one, is fetched on a worker thread.
+    """
+    cursor = _AioCursor(path, top, post_order, info)
+    while True:
+        batch = await _call(_AioQueue.subvolumes, cursor, n)
+        if not batch:
+            return
+        yield batch
+
+
+async def shutdown() -> None:
+    """Stop the running loop's worker threads.
+
+    Requests already running finish first, except quota_rescan_wait()
+    which stops polling; requests still queued are cancelled.  The next
+    call on this loop starts a new pool.
+    """
+    loop = asyncio.get_running_loop()
+    ref = _queues.pop(loop, None)
+    q = ref() if ref is not None else None
+    if q is None:
+        return
+    loop.remove_reader(q.fd)
+    abandoned = await loop.run_in_executor(None, q.queue.close)
+    q.complete()
+    for future in abandoned:
+        future.cancel()
+
+
+__all__ = [
+    "create_snapshot",
+    "delete_subvolume",
+    "sync",
+    "start_sync",
+    "wait_sync",
+    "quota_rescan_wait",
+    "subvolume_batches",
+    "shutdown",
+]
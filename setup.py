@@ -12,30 +12,52 @@ pybtrfs = Extension(
         "src/btrfsutils/module.c",
         "src/btrfsutils/error.c",
         "src/btrfsutils/subvol_info.c",
+        "src/btrfsutils/columns.c",
+        "src/btrfsutils/filesystem.c",
+        "src/btrfsutils/pool.c",
+        "src/btrfsutils/bulk.c",
         "src/btrfsutils/iterator.c",
         "src/btrfsutils/qgroup.c",
         "src/btrfsutils/sync.c",
+        "src/btrfsutils/aio.c",
         "src/btrfsutils/subvolume.c",
+        "src/btrfsutils/search.c",
+        "src/btrfsutils/rootscan.c",
         "vendor/btrfs-progs/libbtrfsutil/errors.c",
         "vendor/btrfs-progs/libbtrfsutil/filesystem.c",
         "vendor/btrfs-progs/libbtrfsutil/qgroup.c",
         "vendor/btrfs-progs/libbtrfsutil/subvolume.c",
         "vendor/btrfs-progs/libbtrfsutil/stubs.c",
     ],
-    include_dirs=["src/btrfsutils", "vendor/btrfs-progs/libbtrfsutil"],
+    include_dirs=[
+        "src/btrfsutils",
+        "src/common",
+        "vendor/btrfs-progs",
+        "vendor/btrfs-progs/libbtrfsutil",
+    ],
     define_macros=[("_GNU_SOURCE", "1")],
 )
 
 mount_ext = Extension(
     "pybtrfs.mount",
     sources=["src/mount/mount.c"],
+    include_dirs=["src/common"],
     define_macros=[("_GNU_SOURCE", "1")],
 )
 
 quota_ext = Extension(
     "pybtrfs.quota",
-    sources=["src/quota/quota.c"],
-    include_dirs=["vendor/btrfs-progs"],
+    sources=[
+        "src/quota/quota.c",
+        "src/quota/qgroup_info.c",
+        "src/quota/qgroup_iterator.c",
+        "src/quota/usage.c",
+        "src/btrfsutils/columns.c",
+        "src/btrfsutils/search.c",
+        "src/btrfsutils/rootscan.c",
+    ],
+    include_dirs=["src/quota", "src/common", "src/btrfsutils",
+                  "vendor/btrfs-progs", "vendor/btrfs-progs/libbtrfsutil"],
     define_macros=[("_GNU_SOURCE", "1")],
 )
 
@@ -129,6 +151,7 @@ mkfs_ext = Extension(
     ],
     include_dirs=[
         "src/mkfs",
+        "src/common",
         _VENDOR,
         f"{_VENDOR}/include",
         f"{_VENDOR}/libbtrfsutil",
@@ -0,0 +1,1053 @@
+#include "module.h"
+#include "pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kernel-shared/uapi/btrfs.h"
+
+/*
+ * Completion queue behind pybtrfs.aio.
+ *
+ * Requests are queued to pthreads that run them without the GIL.  The
+ * threads are started on demand, one whenever a request is queued and
+ * no idle thread is left for it, up to the size given to the queue.  A
+ * finished request moves to the done list, and the one that finds that
+ * list empty writes the eventfd the event loop watches with add_reader().
+ * complete() then returns every finished request at once, so a burst of
+ * completions costs the loop a single wakeup and no thread ever needs the
+ * GIL to report back.
+ *
+ * cancel() drops a request that has not started.  A running one is only
+ * flagged: quota rescan waits poll and stop at the next poll, anything
+ * else is a single ioctl that finishes and has its result discarded.
+ * Either way the queue lets go of the future at once.
+ *
+ * Futures refer to their event loop, so the queue is tracked by the
+ * garbage collector: a loop that is dropped with requests in flight,
+ * without shutdown(), is collected along with its queue.
+ */
+
+/* longest sleep between quota rescan status polls */
+#define AIO_RESCAN_POLL_MAX_MS 250
+
+enum aio_op {
+    AIO_SNAPSHOT,
+    AIO_DELETE,
+    AIO_SYNC,
+    AIO_START_SYNC,
+    AIO_WAIT_SYNC,
+    AIO_RESCAN_WAIT,
+    AIO_SUBVOLUMES,
+};
+
+struct aio_job {
+    struct aio_job *next;
+    enum aio_op op;
+    PyObject *future;           /* owned, NULL once cancelled; only
+                                   touched with the GIL */
+    PyObject *cursor;           /* AIO_SUBVOLUMES: owned, claimed */
+    char *path;
+    char *source;               /* AIO_SNAPSHOT */
+    int flags;                  /* libbtrfsutil flags; coalesce for sync */
+    uint64_t transid;           /* in for wait_sync, out for start_sync */
+    struct btrfs_util_qgroup_inherit *qg;
+    struct iter_entry *entries; /* AIO_SUBVOLUMES: want slots, got filled */
+    size_t want;
+    size_t got;
+    enum btrfs_util_error err;
+    int err_no;
+    int cancelled;              /* set under the queue lock, read atomically */
+    int abandoned;              /* stopped early because of cancelled */
+};
+
+typedef struct {
+    PyObject_HEAD
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct aio_job *pending, **pending_tail;
+    struct aio_job *running;    /* unordered */
+    struct aio_job *done, **done_tail;
+    size_t npending;
+    int efd;
+    int stopping;
+    pthread_t *threads;         /* started on demand, up to max_threads */
+    unsigned int nthreads;
+    unsigned int max_threads;
+    unsigned int idle;          /* threads waiting for a request */
+} AioQueueObject;
+
+/*
+ * State of one subvolume iteration.  The libbtrfsutil iterator is
+ * created by the first batch, on a worker, so opening it does not block
+ * the loop either.  A cursor is claimed by one batch at a time.
+ */
+typedef struct {
+    PyObject_HEAD
+    char *path;
+    uint64_t top;
+    int flags;
+    int info_flag;
+    struct btrfs_util_subvolume_iterator *iter;
+    /* error hit after a partial batch, reported by the next one */
+    enum btrfs_util_error pending_err;
+    int pending_errno;
+    int busy;
+} AioCursorObject;
+
+/* -- cursor ---------------------------------------------------------- */
+
+static PyObject *
+AioCursor_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kw[] = {"path", "top", "post_order", "info", NULL};
+    const char *path;
+    unsigned long long top = 0;
+    int post_order = 0, info = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Kpp", kw,
+                                     &path, &top, &post_order, &info))
+        return NULL;
+
+    AioCursorObject *self = (AioCursorObject *)type->tp_alloc(type, 0);
+    if (!self)
+        return NULL;
+    self->path = strdup(path);
+    if (!self->path) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    self->top = top;
+    self->flags = post_order ? BTRFS_UTIL_SUBVOLUME_ITERATOR_POST_ORDER : 0;
+    self->info_flag = info;
+    return (PyObject *)self;
+}
+
+static void
+AioCursor_dealloc(AioCursorObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    if (self->iter)
+        btrfs_util_destroy_subvolume_iterator(self->iter);
+    free(self->path);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static int
+AioCursor_claim(AioCursorObject *self)
+{
+    int ret = -1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->busy)
+        PyErr_SetString(PyExc_RuntimeError,
+                        "cursor already has a batch in flight");
+    else {
+        self->busy = 1;
+        ret = 0;
+    }
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static void
+AioCursor_release(AioCursorObject *self)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->busy = 0;
+    Py_END_CRITICAL_SECTION();
+}
+
+/* Fill job->entries from the claimed cursor.  Runs without the GIL. */
+static enum btrfs_util_error
+aio_fetch(struct aio_job *job)
+{
+    AioCursorObject *c = (AioCursorObject *)job->cursor;
+    enum btrfs_util_error err;
+
+    if (c->pending_err) {
+        err = c->pending_err;
+        errno = c->pending_errno;
+        c->pending_err = BTRFS_UTIL_OK;
+        return err;
+    }
+    if (!c->iter) {
+        err = btrfs_util_create_subvolume_iterator(c->path, c->top, c->flags,
+                                                   &c->iter);
+        if (err)
+            return err;
+    }
+
+    err = iterator_fetch(c->iter, c->info_flag, job->entries, job->want,
+                         &job->got);
+    if (err == BTRFS_UTIL_ERROR_STOP_ITERATION)
+        return BTRFS_UTIL_OK;
+    if (err && job->got) {
+        /* deliver what was read; the error comes with the next batch */
+        c->pending_err = err;
+        c->pending_errno = errno;
+        return BTRFS_UTIL_OK;
+    }
+    return err;
+}
+
+/* -- workers --------------------------------------------------------- */
+
+static void
+aio_signal(AioQueueObject *q)
+{
+    uint64_t one = 1;
+
+    /* only fails if the counter would overflow, which it cannot here */
+    if (write(q->efd, &one, sizeof(one)) < 0)
+        return;
+}
+
+/*
+ * Poll BTRFS_IOC_QUOTA_RESCAN_STATUS until no rescan runs, with a backoff,
+ * rather than block in BTRFS_IOC_QUOTA_RESCAN_WAIT, so a cancelled wait
+ * gives its worker back.  Failures are left in errno, to be reported as
+ * OSError like quota_rescan_wait().
+ */
+static void
+aio_rescan_wait(struct aio_job *job)
+{
+    struct btrfs_ioctl_quota_rescan_args rargs;
+    int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return;
+    for (long ms = 1;; ms = ms * 2 > AIO_RESCAN_POLL_MAX_MS
+                                ? AIO_RESCAN_POLL_MAX_MS : ms * 2) {
+        memset(&rargs, 0, sizeof(rargs));
+        if (ioctl(fd, BTRFS_IOC_QUOTA_RESCAN_STATUS, &rargs) < 0)
+            break;
+        if (!rargs.flags) {
+            errno = 0;
+            break;
+        }
+        if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED)) {
+            job->abandoned = 1;
+            errno = ECANCELED;
+            break;
+        }
+
+        struct timespec ts = {
+            .tv_sec = ms / 1000,
+            .tv_nsec = (ms % 1000) * 1000000L,
+        };
+        nanosleep(&ts, NULL);
+    }
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+}
+
+static void
+aio_run(struct aio_job *job)
+{
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+
+    errno = 0;
+    switch (job->op) {
+    case AIO_SNAPSHOT:
+        err = btrfs_util_create_snapshot(job->source, job->path, job->flags,
+                                         NULL, job->qg);
+        break;
+    case AIO_DELETE:
+        err = btrfs_util_delete_subvolume(job->path, job->flags);
+        break;
+    case AIO_SYNC:
+        err = job->flags ? sync_coalesced(job->path)
+                         : btrfs_util_sync(job->path);
+        break;
+    case AIO_START_SYNC:
+        err = btrfs_util_start_sync(job->path, &job->transid);
+        break;
+    case AIO_WAIT_SYNC:
+        err = btrfs_util_wait_sync(job->path, job->transid);
+        break;
+    case AIO_RESCAN_WAIT:
+        aio_rescan_wait(job);
+        break;
+    case AIO_SUBVOLUMES:
+        err = aio_fetch(job);
+        break;
+    }
+    job->err = err;
+    job->err_no = errno;
+}
+
+static void *
+aio_worker(void *arg)
+{
+    AioQueueObject *q = arg;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        q->idle++;
+        while (!q->pending && !q->stopping)
+            pthread_cond_wait(&q->wake, &q->lock);
+        q->idle--;
+        if (q->stopping)
+            break;
+
+        struct aio_job *job = q->pending;
+        q->pending = job->next;
+        if (!q->pending)
+            q->pending_tail = &q->pending;
+        q->npending--;
+        job->next = q->running;
+        q->running = job;
+        pthread_mutex_unlock(&q->lock);
+
+        aio_run(job);
+
+        pthread_mutex_lock(&q->lock);
+        struct aio_job **link = &q->running;
+        while (*link != job)
+            link = &(*link)->next;
+        *link = job->next;
+        job->next = NULL;
+        if (!q->done)
+            aio_signal(q);
+        *q->done_tail = job;
+        q->done_tail = &job->next;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+/* -- jobs ------------------------------------------------------------ */
+
+static void
+aio_job_free(struct aio_job *job)
+{
+    Py_XDECREF(job->future);
+    if (job->cursor) {
+        AioCursor_release((AioCursorObject *)job->cursor);
+        Py_DECREF(job->cursor);
+    }
+    if (job->entries) {
+        free_entries(job->entries, job->got);
+        free(job->entries);
+    }
+    qgroup_inherit_free(job->qg);
+    free(job->path);
+    free(job->source);
+    free(job);
+}
+
+/* Start a job for *future* on *path*; NULL with an exception on failure. */
+static struct aio_job *
+aio_job_new(enum aio_op op, PyObject *future, const char *path)
+{
+    struct aio_job *job = calloc(1, sizeof(*job));
+
+    if (!job || !(job->path = strdup(path))) {
+        free(job);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    job->op = op;
+    job->future = Py_NewRef(future);
+    return job;
+}
+
+/*
+ * Queue *job*, starting another worker if every thread is busy with or
+ * about to pick up an earlier request.  With no worker at all the job
+ * cannot run, so failing to start the first one is an error.
+ */
+static PyObject *
+aio_submit(AioQueueObject *q, struct aio_job *job)
+{
+    const char *error = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->stopping) {
+        error = "queue is closed";
+    }
+    else {
+        if (q->idle <= q->npending && q->nthreads < q->max_threads &&
+            pthread_create(&q->threads[q->nthreads], NULL, aio_worker,
+                           q) == 0)
+            q->nthreads++;
+        if (q->nthreads) {
+            *q->pending_tail = job;
+            q->pending_tail = &job->next;
+            q->npending++;
+            pthread_cond_signal(&q->wake);
+        }
+        else {
+            error = "can't start new thread";
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (error) {
+        aio_job_free(job);
+        PyErr_SetString(PyExc_RuntimeError, error);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/* the exception just raised, as an instance */
+static PyObject *
+aio_take_error(void)
+{
+#if PY_VERSION_HEX >= 0x030C0000
+    return PyErr_GetRaisedException();
+#else
+    PyObject *type, *value, *tb;
+
+    PyErr_Fetch(&type, &value, &tb);
+    PyErr_NormalizeException(&type, &value, &tb);
+    if (tb)
+        PyException_SetTraceback(value, tb);
+    Py_XDECREF(type);
+    Py_XDECREF(tb);
+    return value;
+#endif
+}
+
+static PyObject *
+aio_batch(module_state *st, struct aio_job *job)
+{
+    AioCursorObject *c = (AioCursorObject *)job->cursor;
+    PyObject *list = PyList_New((Py_ssize_t)job->got);
+
+    for (size_t i = 0; list && i < job->got; i++) {
+        PyObject *t = iter_entry_tuple(st, &job->entries[i], c->info_flag);
+        if (!t) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, t);
+    }
+    return list;
+}
+
+/*
+ * Fill (future, exception, result) for a finished job; a failure while
+ * converting the result becomes the job's exception.
+ */
+static void
+aio_job_result(module_state *st, struct aio_job *job, PyObject *tuple)
+{
+    PyObject *exc = NULL, *result = NULL;
+
+    if (job->op == AIO_RESCAN_WAIT) {
+        if (job->err_no) {
+            errno = job->err_no;
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, job->path);
+        }
+        else {
+            result = Py_NewRef(Py_None);
+        }
+    }
+    else if (job->err) {
+        exc = make_error(st, job->err, job->err_no);
+    }
+    else if (job->op == AIO_START_SYNC) {
+        result = PyLong_FromUnsignedLongLong(job->transid);
+    }
+    else if (job->op == AIO_SUBVOLUMES) {
+        result = aio_batch(st, job);
+    }
+    else {
+        result = Py_NewRef(Py_None);
+    }
+    if (!exc && !result)
+        exc = aio_take_error();
+
+    PyTuple_SET_ITEM(tuple, 0, Py_NewRef(job->future));
+    PyTuple_SET_ITEM(tuple, 1, exc ? exc : Py_NewRef(Py_None));
+    PyTuple_SET_ITEM(tuple, 2, result ? result : Py_NewRef(Py_None));
+}
+
+/* -- queue ----------------------------------------------------------- */
+
+/*
+ * Stop the workers after their current job and wait for them.  Running
+ * jobs are cancelled, so that rescan waits do not hold this up.
+ */
+static void
+aio_stop(AioQueueObject *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->stopping = 1;
+    for (struct aio_job *job = q->running; job; job = job->next)
+        __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+
+    /* no new thread is started once stopping is set */
+    if (q->nthreads) {
+        Py_BEGIN_ALLOW_THREADS
+        for (unsigned int t = 0; t < q->nthreads; t++)
+            pthread_join(q->threads[t], NULL);
+        Py_END_ALLOW_THREADS
+        q->nthreads = 0;
+    }
+}
+
+static PyObject *
+AioQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kw[] = {"workers", NULL};
+    unsigned int workers = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kw, &workers))
+        return NULL;
+
+    AioQueueObject *q = (AioQueueObject *)type->tp_alloc(type, 0);
+    if (!q)
+        return NULL;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+    q->pending_tail = &q->pending;
+    q->done_tail = &q->done;
+
+    q->max_threads = workers ? workers : pool_default_workers();
+    q->threads = malloc(q->max_threads * sizeof(*q->threads));
+    if (!q->threads) {
+        Py_DECREF(q);
+        return PyErr_NoMemory();
+    }
+
+    q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->efd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        Py_DECREF(q);
+        return NULL;
+    }
+    return (PyObject *)q;
+}
+
+static void
+aio_free_list(struct aio_job *job)
+{
+    while (job) {
+        struct aio_job *next = job->next;
+        aio_job_free(job);
+        job = next;
+    }
+}
+
+/* Futures of every job still held, for the garbage collector. */
+static int
+AioQueue_traverse(AioQueueObject *self, visitproc visit, void *arg)
+{
+    struct aio_job *lists[3];
+    int ret = 0;
+
+    Py_VISIT(Py_TYPE(self));
+    pthread_mutex_lock(&self->lock);
+    lists[0] = self->pending;
+    lists[1] = self->running;
+    lists[2] = self->done;
+    for (int l = 0; !ret && l < 3; l++) {
+        for (struct aio_job *job = lists[l]; !ret && job; job = job->next) {
+            if (job->future)
+                ret = visit(job->future, arg);
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+    return ret;
+}
+
+/* Drop the futures; the jobs themselves go with the queue. */
+static int
+AioQueue_clear(AioQueueObject *self)
+{
+    struct aio_job *lists[3];
+    PyObject **futures = NULL;
+    size_t n = 0;
+
+    pthread_mutex_lock(&self->lock);
+    lists[0] = self->pending;
+    lists[1] = self->running;
+    lists[2] = self->done;
+    for (int l = 0; l < 3; l++)
+        for (struct aio_job *job = lists[l]; job; job = job->next)
+            n++;
+    if (n)
+        futures = malloc(n * sizeof(*futures));
+    n = 0;
+    for (int l = 0; futures && l < 3; l++) {
+        for (struct aio_job *job = lists[l]; job; job = job->next) {
+            futures[n++] = job->future;
+            job->future = NULL;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    /* outside the lock: a finalizer may call back into the queue */
+    for (size_t i = 0; i < n; i++)
+        Py_XDECREF(futures[i]);
+    free(futures);
+    return 0;
+}
+
+static void
+AioQueue_dealloc(AioQueueObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    PyObject_GC_UnTrack(self);
+    aio_stop(self);
+    aio_free_list(self->pending);
+    aio_free_list(self->done);
+    free(self->threads);
+    if (self->efd >= 0)
+        close(self->efd);
+    pthread_cond_destroy(&self->wake);
+    pthread_mutex_destroy(&self->lock);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static PyObject *
+AioQueue_fileno(AioQueueObject *self, PyObject *Py_UNUSED(a))
+{
+    if (self->efd < 0) {
+        PyErr_SetString(PyExc_ValueError, "queue is closed");
+        return NULL;
+    }
+    return PyLong_FromLong(self->efd);
+}
+
+static PyObject *
+AioQueue_complete(AioQueueObject *self, PyObject *Py_UNUSED(a))
+{
+    module_state *st = PyType_GetModuleState(Py_TYPE(self));
+    struct aio_job *jobs;
+    Py_ssize_t n = 0;
+    uint64_t count;
+
+    pthread_mutex_lock(&self->lock);
+    /* reset the counter under the lock: later jobs write it again */
+    if (self->efd >= 0 && read(self->efd, &count, sizeof(count)) < 0)
+        count = 0;
+    jobs = self->done;
+    self->done = NULL;
+    self->done_tail = &self->done;
+    pthread_mutex_unlock(&self->lock);
+
+    for (struct aio_job *job = jobs; job; job = job->next)
+        if (job->future)
+            n++;
+
+    /* allocate everything first, so a failure leaves the jobs queued */
+    PyObject *list = PyList_New(n);
+    for (Py_ssize_t i = 0; list && i < n; i++) {
+        PyObject *t = PyTuple_New(3);
+        if (!t) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, t);
+    }
+    if (!list) {
+        if (jobs) {
+            struct aio_job *last = jobs;
+            while (last->next)
+                last = last->next;
+            pthread_mutex_lock(&self->lock);
+            if (!self->done)
+                self->done_tail = &last->next;
+            last->next = self->done;
+            self->done = jobs;
+            aio_signal(self);
+            pthread_mutex_unlock(&self->lock);
+        }
+        return NULL;
+    }
+
+    /* cancelled jobs have no future left to resolve */
+    Py_ssize_t i = 0;
+    for (struct aio_job *job = jobs; job; job = job->next) {
+        if (job->future)
+            aio_job_result(st, job, PyList_GET_ITEM(list, i++));
+    }
+    aio_free_list(jobs);
+    return list;
+}
+
+static PyObject *
+AioQueue_close(AioQueueObject *self, PyObject *Py_UNUSED(a))
+{
+    struct aio_job *jobs;
+    Py_ssize_t n = 0;
+
+    aio_stop(self);
+
+    pthread_mutex_lock(&self->lock);
+    jobs = self->pending;
+    self->pending = NULL;
+    self->pending_tail = &self->pending;
+    self->npending = 0;
+
+    /* rescan waits the stop cut short have no result either */
+    struct aio_job **tail = &jobs, **link = &self->done;
+    while (*tail)
+        tail = &(*tail)->next;
+    self->done_tail = &self->done;
+    while (*link) {
+        struct aio_job *job = *link;
+        if (job->abandoned) {
+            *link = job->next;
+            job->next = NULL;
+            *tail = job;
+            tail = &job->next;
+        }
+        else {
+            link = &job->next;
+            self->done_tail = link;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    for (struct aio_job *job = jobs; job; job = job->next)
+        if (job->future)
+            n++;
+    PyObject *list = PyList_New(n);
+    Py_ssize_t i = 0;
+    for (struct aio_job *job = jobs; list && job; job = job->next) {
+        if (job->future) {
+            PyList_SET_ITEM(list, i++, job->future);
+            job->future = NULL;
+        }
+    }
+    aio_free_list(jobs);
+
+    if (self->efd >= 0) {
+        close(self->efd);
+        self->efd = -1;
+    }
+    return list;
+}
+
+/* -- submission ------------------------------------------------------ */
+
+/*
+ * A running job keeps going, but gives up its future here, so that
+ * nothing waits for the worker to let go of the future and its loop.
+ */
+static PyObject *
+AioQueue_cancel(AioQueueObject *self, PyObject *future)
+{
+    struct aio_job *dropped = NULL;
+    PyObject *released = NULL;
+    int found = 0;
+
+    pthread_mutex_lock(&self->lock);
+    for (struct aio_job **link = &self->pending; *link;
+         link = &(*link)->next) {
+        if ((*link)->future == future) {
+            dropped = *link;
+            *link = dropped->next;
+            if (!*link)
+                self->pending_tail = link;
+            self->npending--;
+            found = 1;
+            break;
+        }
+    }
+    for (struct aio_job *job = self->running; !found && job;
+         job = job->next) {
+        if (job->future == future) {
+            __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+            released = job->future;
+            job->future = NULL;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    if (dropped)
+        aio_job_free(dropped);
+    Py_XDECREF(released);
+    return PyBool_FromLong(found);
+}
+
+static PyObject *
+AioQueue_snapshot(AioQueueObject *self, PyObject *const *args,
+                  Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "source", "path", "recursive",
+                         "read_only", "qgroup_inherit", NULL};
+    static FastArgsParser parser = {kw, "Oss|ppO", "snapshot"};
+    module_state *st = PyType_GetModuleState(Py_TYPE(self));
+    PyObject *future, *qg_obj = Py_None;
+    const char *source, *path;
+    int recursive = 0, read_only = 0;
+    struct btrfs_util_qgroup_inherit *qg = NULL;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &source,
+                        &path, &recursive, &read_only, &qg_obj))
+        return NULL;
+    if (qg_obj != Py_None &&
+        !PyObject_TypeCheck(qg_obj, st->QgroupInheritType)) {
+        fastargs_type_error(&parser, 5, "QgroupInherit or None", qg_obj);
+        return NULL;
+    }
+    if (qg_obj != Py_None &&
+        qgroup_inherit_copy(st, (QgroupInheritObject *)qg_obj, &qg) < 0)
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_SNAPSHOT, future, path);
+    if (!job || !(job->source = strdup(source))) {
+        if (job) {
+            aio_job_free(job);
+            PyErr_NoMemory();
+        }
+        qgroup_inherit_free(qg);
+        return NULL;
+    }
+    job->qg = qg;
+    if (recursive)
+        job->flags |= BTRFS_UTIL_CREATE_SNAPSHOT_RECURSIVE;
+    if (read_only)
+        job->flags |= BTRFS_UTIL_CREATE_SNAPSHOT_READ_ONLY;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_delete(AioQueueObject *self, PyObject *const *args,
+                Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "path", "recursive", NULL};
+    static FastArgsParser parser = {kw, "Os|p", "delete"};
+    PyObject *future;
+    const char *path;
+    int recursive = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &path,
+                        &recursive))
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_DELETE, future, path);
+    if (!job)
+        return NULL;
+    if (recursive)
+        job->flags = BTRFS_UTIL_DELETE_SUBVOLUME_RECURSIVE;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_sync(AioQueueObject *self, PyObject *const *args,
+              Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "path", "coalesce", NULL};
+    static FastArgsParser parser = {kw, "Os|p", "sync"};
+    PyObject *future;
+    const char *path;
+    int coalesce = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &path,
+                        &coalesce))
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_SYNC, future, path);
+    if (!job)
+        return NULL;
+    job->flags = coalesce;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_start_sync(AioQueueObject *self, PyObject *const *args,
+                    Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "path", NULL};
+    static FastArgsParser parser = {kw, "Os", "start_sync"};
+    PyObject *future;
+    const char *path;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &path))
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_START_SYNC, future, path);
+    if (!job)
+        return NULL;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_wait_sync(AioQueueObject *self, PyObject *const *args,
+                   Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "path", "transid", NULL};
+    static FastArgsParser parser = {kw, "Os|K", "wait_sync"};
+    PyObject *future;
+    const char *path;
+    unsigned long long transid = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &path,
+                        &transid))
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_WAIT_SYNC, future, path);
+    if (!job)
+        return NULL;
+    job->transid = transid;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_quota_rescan_wait(AioQueueObject *self, PyObject *const *args,
+                           Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "path", NULL};
+    static FastArgsParser parser = {kw, "Os", "quota_rescan_wait"};
+    PyObject *future;
+    const char *path;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future, &path))
+        return NULL;
+
+    struct aio_job *job = aio_job_new(AIO_RESCAN_WAIT, future, path);
+    if (!job)
+        return NULL;
+    return aio_submit(self, job);
+}
+
+static PyObject *
+AioQueue_subvolumes(AioQueueObject *self, PyObject *const *args,
+                    Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"future", "cursor", "n", NULL};
+    static FastArgsParser parser = {kw, "OO!|n", "subvolumes"};
+    module_state *st = PyType_GetModuleState(Py_TYPE(self));
+    PyObject *future;
+    AioCursorObject *cursor;
+    Py_ssize_t want = 256;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &future,
+                        st->AioCursorType, &cursor, &want))
+        return NULL;
+    if (want <= 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be positive");
+        return NULL;
+    }
+
+    struct aio_job *job = aio_job_new(AIO_SUBVOLUMES, future, cursor->path);
+    if (!job)
+        return NULL;
+    job->want = (size_t)want;
+    job->entries = calloc(job->want, sizeof(*job->entries));
+    if (!job->entries) {
+        aio_job_free(job);
+        return PyErr_NoMemory();
+    }
+    if (AioCursor_claim(cursor) < 0) {
+        aio_job_free(job);
+        return NULL;
+    }
+    job->cursor = Py_NewRef(cursor);
+    return aio_submit(self, job);
+}
+
+/* -- type tables ----------------------------------------------------- */
+
+static PyMethodDef AioQueue_methods[] = {
+    {"fileno", (PyCFunction)AioQueue_fileno, METH_NOARGS,
+     "fileno() -> int\n\n"
+     "The eventfd that becomes readable when requests have finished."},
+    {"complete", (PyCFunction)AioQueue_complete, METH_NOARGS,
+     "complete() -> list[tuple[object, BaseException | None, object]]\n\n"
+     "Take every finished request as (future, exception, result) and\n"
+     "reset the eventfd."},
+    {"close", (PyCFunction)AioQueue_close, METH_NOARGS,
+     "close() -> list[object]\n\n"
+     "Stop the workers once their current request is done (releases the\n"
+     "GIL while waiting) and return the futures of requests that never\n"
+     "started or were cut short. Finished requests are still returned by\n"
+     "complete()."},
+    {"cancel", (PyCFunction)AioQueue_cancel, METH_O,
+     "cancel(future: object) -> bool\n\n"
+     "Drop the request for future if it has not started, or ask it to\n"
+     "stop if it is running; the future is never resolved after a drop.\n"
+     "Returns False if the request has already finished."},
+    {"snapshot", (PyCFunction)AioQueue_snapshot,
+     METH_FASTCALL | METH_KEYWORDS,
+     "snapshot(future: object, source: str, path: str, "
+     "recursive: bool = False, read_only: bool = False, "
+     "qgroup_inherit: QgroupInherit | None = None) -> None\n\n"
+     "Queue create_snapshot(); the result is None."},
+    {"delete", (PyCFunction)AioQueue_delete,
+     METH_FASTCALL | METH_KEYWORDS,
+     "delete(future: object, path: str, recursive: bool = False) -> None\n\n"
+     "Queue delete_subvolume(); the result is None."},
+    {"sync", (PyCFunction)AioQueue_sync,
+     METH_FASTCALL | METH_KEYWORDS,
+     "sync(future: object, path: str, coalesce: bool = False) -> None\n\n"
+     "Queue sync(); the result is None."},
+    {"start_sync", (PyCFunction)AioQueue_start_sync,
+     METH_FASTCALL | METH_KEYWORDS,
+     "start_sync(future: object, path: str) -> None\n\n"
+     "Queue start_sync(); the result is the transaction ID."},
+    {"wait_sync", (PyCFunction)AioQueue_wait_sync,
+     METH_FASTCALL | METH_KEYWORDS,
+     "wait_sync(future: object, path: str, transid: int = 0) -> None\n\n"
+     "Queue wait_sync(); the result is None."},
+    {"quota_rescan_wait", (PyCFunction)AioQueue_quota_rescan_wait,
+     METH_FASTCALL | METH_KEYWORDS,
+     "quota_rescan_wait(future: object, path: str) -> None\n\n"
+     "Queue a wait for the quota rescan, polled so that cancel() stops\n"
+     "it; the result is None and failures are OSError, as with\n"
+     "quota_rescan_wait()."},
+    {"subvolumes", (PyCFunction)AioQueue_subvolumes,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolumes(future: object, cursor: _AioCursor, n: int = 256) -> None\n\n"
+     "Queue the next batch of up to n entries from cursor; the result is\n"
+     "a list like SubvolumeIterator.next_batch() returns."},
+    {NULL}
+};
+
+static PyType_Slot AioQueue_slots[] = {
+    {Py_tp_dealloc, AioQueue_dealloc},
+    {Py_tp_traverse, AioQueue_traverse},
+    {Py_tp_clear,   AioQueue_clear},
+    {Py_tp_doc,     "_AioQueue(workers: int = 0)\n\n"
+                    "Worker threads and completion eventfd behind "
+                    "pybtrfs.aio.\nUp to workers threads (0: one per CPU) "
+                    "are started as requests\nare queued."},
+    {Py_tp_methods, AioQueue_methods},
+    {Py_tp_new,     AioQueue_new},
+    {0, NULL}
+};
+
+PyType_Spec AioQueue_spec = {
+    .name      = "pybtrfs.btrfsutils._AioQueue",
+    .basicsize = sizeof(AioQueueObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE
+               | Py_TPFLAGS_HAVE_GC,
+    .slots     = AioQueue_slots,
+};
+
+static PyType_Slot AioCursor_slots[] = {
+    {Py_tp_dealloc, AioCursor_dealloc},
+    {Py_tp_doc,     "_AioCursor(path: str, top: int = 0, "
+                    "post_order: bool = False, info: bool = False)\n\n"
+                    "Subvolume iteration state for _AioQueue.subvolumes()."},
+    {Py_tp_new,     AioCursor_new},
+    {0, NULL}
+};
+
+PyType_Spec AioCursor_spec = {
+    .name      = "pybtrfs.btrfsutils._AioCursor",
+    .basicsize = sizeof(AioCursorObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = AioCursor_slots,
+};
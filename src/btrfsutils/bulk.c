@@ -0,0 +1,1067 @@
+#include "module.h"
+#include "pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Bulk operations: the paths are copied out of Python, grouped by parent
+ * directory so each parent is opened once, and the ioctls are issued from
+ * a worker pool with the GIL released for the whole batch.  Failures are
+ * recorded per path and returned as exception instances instead of
+ * aborting the batch.
+ */
+
+/* -- path batches ---------------------------------------------------- */
+
+struct bulk_target {
+    char *buf;                  /* copy of the path, split in place */
+    const char *dir;            /* parent directory */
+    const char *name;           /* final component */
+    size_t parent;              /* index into bulk.parents */
+    uint64_t transid;
+    enum btrfs_util_error err;
+    int err_no;
+};
+
+struct bulk_parent {
+    const char *dir;
+    int fd;
+    int err_no;
+};
+
+struct bulk {
+    struct bulk_target *t;
+    size_t n;
+    struct bulk_parent *parents;
+    size_t nparents;
+    struct btrfs_util_qgroup_inherit *qg;
+    int src_fd;                 /* snapshot source */
+    int flags;
+};
+
+static void
+bulk_free(struct bulk *b)
+{
+    for (size_t i = 0; i < b->nparents; i++)
+        if (b->parents[i].fd >= 0)
+            close(b->parents[i].fd);
+    for (size_t i = 0; i < b->n; i++)
+        free(b->t[i].buf);
+    free(b->parents);
+    free(b->t);
+    qgroup_inherit_free(b->qg);
+    memset(b, 0, sizeof(*b));
+}
+
+/* Copy *paths* (an iterable of str / os.PathLike) into *b*. */
+static int
+bulk_load(struct bulk *b, PyObject *paths)
+{
+    PyObject *seq = PySequence_Fast(paths, "paths must be an iterable");
+    if (!seq)
+        return -1;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    memset(b, 0, sizeof(*b));
+    b->t = calloc((size_t)n + 1, sizeof(*b->t));
+    if (!b->t) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *bytes;
+        if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, i), &bytes))
+            goto fail;
+        b->t[i].buf = strdup(PyBytes_AS_STRING(bytes));
+        Py_DECREF(bytes);
+        if (!b->t[i].buf) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        b->n++;
+    }
+    Py_DECREF(seq);
+    return 0;
+
+fail:
+    Py_DECREF(seq);
+    bulk_free(b);
+    return -1;
+}
+
+static void
+split_path(struct bulk_target *t)
+{
+    size_t len = strlen(t->buf);
+    char *slash;
+
+    while (len > 1 && t->buf[len - 1] == '/')
+        t->buf[--len] = '\0';
+
+    slash = strrchr(t->buf, '/');
+    if (!slash) {
+        t->dir = ".";
+        t->name = t->buf;
+    }
+    else if (slash == t->buf) {
+        t->dir = "/";
+        t->name = t->buf + 1;
+    }
+    else {
+        *slash = '\0';
+        t->dir = t->buf;
+        t->name = slash + 1;
+    }
+}
+
+static int
+cmp_dir(const void *a, const void *b, void *arg)
+{
+    const struct bulk_target *t = arg;
+    return strcmp(t[*(const size_t *)a].dir, t[*(const size_t *)b].dir);
+}
+
+static void
+open_parent(void *ctx, size_t i)
+{
+    struct bulk_parent *p = &((struct bulk *)ctx)->parents[i];
+
+    p->fd = open(p->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (p->fd < 0)
+        p->err_no = errno;
+}
+
+/* Split every path and open each distinct parent once; runs without the GIL. */
+static int
+bulk_open_parents(struct bulk *b, unsigned int workers)
+{
+    size_t *order;
+
+    for (size_t i = 0; i < b->n; i++)
+        split_path(&b->t[i]);
+
+    order = malloc((b->n + 1) * sizeof(*order));
+    b->parents = malloc((b->n + 1) * sizeof(*b->parents));
+    if (!order || !b->parents) {
+        free(order);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < b->n; i++)
+        order[i] = i;
+    qsort_r(order, b->n, sizeof(*order), cmp_dir, b->t);
+
+    for (size_t k = 0; k < b->n; k++) {
+        struct bulk_target *t = &b->t[order[k]];
+        if (!b->nparents ||
+            strcmp(b->parents[b->nparents - 1].dir, t->dir) != 0) {
+            b->parents[b->nparents].dir = t->dir;
+            b->parents[b->nparents].fd = -1;
+            b->parents[b->nparents].err_no = 0;
+            b->nparents++;
+        }
+        t->parent = b->nparents - 1;
+    }
+    free(order);
+
+    pool_run(b->nparents, workers, open_parent, b);
+    return 0;
+}
+
+/* parent fd of *t*, or -1 with the failure recorded in *t* */
+static int
+target_parent_fd(struct bulk *b, struct bulk_target *t)
+{
+    struct bulk_parent *p = &b->parents[t->parent];
+
+    if (p->fd < 0) {
+        t->err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+        t->err_no = p->err_no;
+    }
+    return p->fd;
+}
+
+/*
+ * One entry per target: None (or the transid with *with_transid*) on
+ * success, else a BtrfsUtilError.
+ */
+static PyObject *
+bulk_results(module_state *st, struct bulk *b, int with_transid)
+{
+    PyObject *list = PyList_New((Py_ssize_t)b->n);
+    if (!list)
+        return NULL;
+
+    for (size_t i = 0; i < b->n; i++) {
+        struct bulk_target *t = &b->t[i];
+        PyObject *v;
+        if (t->err)
+            v = make_error(st, t->err, t->err_no);
+        else if (with_transid)
+            v = PyLong_FromUnsignedLongLong(t->transid);
+        else
+            v = Py_NewRef(Py_None);
+        if (!v) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, v);
+    }
+    return list;
+}
+
+static int
+parse_workers(int workers, unsigned int *out)
+{
+    if (workers < 0) {
+        PyErr_SetString(PyExc_ValueError, "workers must be >= 0");
+        return -1;
+    }
+    *out = (unsigned int)workers;
+    return 0;
+}
+
+/* -- create_subvolumes ----------------------------------------------- */
+
+static void
+create_one(void *ctx, size_t i)
+{
+    struct bulk *b = ctx;
+    struct bulk_target *t = &b->t[i];
+    int fd = target_parent_fd(b, t);
+
+    if (fd < 0)
+        return;
+    t->err = btrfs_util_create_subvolume_fd(fd, t->name, 0, NULL, b->qg);
+    if (t->err)
+        t->err_no = errno;
+}
+
+static PyObject *
+mod_create_subvolumes(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                      PyObject *kwnames)
+{
+    static char *kw[] = {"paths", "qgroup_inherit", "workers", NULL};
+    static FastArgsParser parser = {kw, "O|O!i", "create_subvolumes"};
+    module_state *st = get_module_state(self);
+    PyObject *paths;
+    QgroupInheritObject *qg_obj = NULL;
+    int workers_arg = 0;
+    unsigned int workers;
+    struct bulk b;
+    int ret;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &paths,
+                        st->QgroupInheritType, &qg_obj, &workers_arg))
+        return NULL;
+    if (parse_workers(workers_arg, &workers) < 0)
+        return NULL;
+    if (bulk_load(&b, paths) < 0)
+        return NULL;
+    if (qgroup_inherit_copy(st, qg_obj, &b.qg) < 0) {
+        bulk_free(&b);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = bulk_open_parents(&b, workers);
+    if (ret == 0)
+        pool_run(b.n, workers, create_one, &b);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result = ret < 0 ? PyErr_NoMemory() : bulk_results(st, &b, 0);
+    bulk_free(&b);
+    return result;
+}
+
+/* -- create_snapshots ------------------------------------------------ */
+
+static void
+snapshot_one(void *ctx, size_t i)
+{
+    struct bulk *b = ctx;
+    struct bulk_target *t = &b->t[i];
+    struct btrfs_util_subvolume_info info;
+    int fd = target_parent_fd(b, t);
+
+    if (fd < 0)
+        return;
+    t->err = btrfs_util_create_snapshot_fd2(b->src_fd, fd, t->name,
+                                            b->flags, NULL, b->qg);
+    if (t->err) {
+        t->err_no = errno;
+        return;
+    }
+
+    /*
+     * The snapshot's otransid is the transaction that will commit it.  The
+     * snapshot exists whether or not that can be read back, so a failure
+     * here leaves transid 0 (the running transaction for wait_sync())
+     * instead of reporting the create as failed.
+     */
+    int snap_fd = openat(fd, t->name, O_RDONLY | O_CLOEXEC);
+    if (snap_fd < 0)
+        return;
+    if (btrfs_util_subvolume_info_fd(snap_fd, 0, &info) == BTRFS_UTIL_OK)
+        t->transid = info.otransid;
+    close(snap_fd);
+}
+
+static PyObject *
+mod_create_snapshots(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     PyObject *kwnames)
+{
+    static char *kw[] = {"source", "paths", "read_only", "qgroup_inherit",
+                         "workers", NULL};
+    static FastArgsParser parser = {kw, "sO|pO!i", "create_snapshots"};
+    module_state *st = get_module_state(self);
+    const char *source;
+    PyObject *paths;
+    int read_only = 0;
+    QgroupInheritObject *qg_obj = NULL;
+    int workers_arg = 0;
+    unsigned int workers;
+    struct bulk b;
+    int ret;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &source, &paths,
+                        &read_only, st->QgroupInheritType, &qg_obj,
+                        &workers_arg))
+        return NULL;
+    if (parse_workers(workers_arg, &workers) < 0)
+        return NULL;
+    if (bulk_load(&b, paths) < 0)
+        return NULL;
+    if (qgroup_inherit_copy(st, qg_obj, &b.qg) < 0) {
+        bulk_free(&b);
+        return NULL;
+    }
+    if (read_only)
+        b.flags |= BTRFS_UTIL_CREATE_SNAPSHOT_READ_ONLY;
+
+    Py_BEGIN_ALLOW_THREADS
+    b.src_fd = open(source, O_RDONLY | O_CLOEXEC);
+    ret = b.src_fd < 0 ? -1 : bulk_open_parents(&b, workers);
+    if (ret == 0)
+        pool_run(b.n, workers, snapshot_one, &b);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result;
+    if (b.src_fd < 0)
+        result = set_error(st, BTRFS_UTIL_ERROR_OPEN_FAILED);
+    else if (ret < 0)
+        result = PyErr_NoMemory();
+    else
+        result = bulk_results(st, &b, 1);
+
+    if (b.src_fd >= 0)
+        close(b.src_fd);
+    bulk_free(&b);
+    return result;
+}
+
+/* -- subvolume trees ------------------------------------------------- */
+
+/*
+ * The subvolumes below a top are listed once and linked to their parents.
+ * Workers then pull nodes from a ready stack and run tree.fn on them:
+ * bottom-up, a node becomes ready once all its children are finished (a
+ * failed child still releases its parent); top-down, the children of a
+ * node become ready once it succeeds, and the first failure cancels the
+ * rest.  The calling thread only reports progress and watches for signals.
+ */
+
+#define TREE_NONE SIZE_MAX
+
+struct tree_node {
+    char *path;                 /* relative to the top; NULL for the top */
+    uint64_t id;
+    uint64_t parent_id;
+    size_t parent;              /* index of the parent node */
+    size_t child;               /* first child, then its siblings */
+    size_t sibling;
+    size_t pending;             /* children not finished yet */
+    uint64_t new_id;            /* subvolume created for this node */
+    enum btrfs_util_error err;
+    int err_no;
+};
+
+struct subvol_tree {
+    int top_fd;
+    struct bulk_target at;      /* where the tree is deleted or created */
+    int at_fd;                  /* directory containing it */
+    int dst_fd;                 /* the created top, for top-down jobs */
+    struct btrfs_util_qgroup_inherit *qg;
+    void (*fn)(struct subvol_tree *t, struct tree_node *node);
+    int top_down;
+    struct tree_node *nodes;
+    size_t n;
+    size_t top;
+    size_t *ready;              /* nodes that can run now */
+    size_t nready;
+    size_t finished;
+    int cancel;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* ready nodes, completion or cancel */
+    pthread_cond_t progress;    /* a node finished */
+};
+
+static int
+tree_init(struct subvol_tree *t, const char *at)
+{
+    memset(t, 0, sizeof(*t));
+    t->top_fd = -1;
+    t->at_fd = -1;
+    t->dst_fd = -1;
+    t->at.buf = strdup(at);
+    if (!t->at.buf) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->work, NULL);
+    pthread_cond_init(&t->progress, NULL);
+    return 0;
+}
+
+static void
+tree_free(struct subvol_tree *t)
+{
+    for (size_t i = 0; i < t->n; i++)
+        free(t->nodes[i].path);
+    free(t->nodes);
+    free(t->ready);
+    free(t->at.buf);
+    qgroup_inherit_free(t->qg);
+    if (t->top_fd >= 0)
+        close(t->top_fd);
+    if (t->at_fd >= 0)
+        close(t->at_fd);
+    if (t->dst_fd >= 0)
+        close(t->dst_fd);
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->work);
+    pthread_cond_destroy(&t->progress);
+}
+
+static int
+cmp_node_id(const void *a, const void *b)
+{
+    uint64_t x = ((const struct tree_node *)a)->id;
+    uint64_t y = ((const struct tree_node *)b)->id;
+    return (x > y) - (x < y);
+}
+
+/* Link every node to its parent and seed the ready stack. */
+static enum btrfs_util_error
+tree_link(struct subvol_tree *t, uint64_t top_id)
+{
+    struct tree_node key, *found;
+
+    t->ready = malloc(t->n * sizeof(*t->ready));
+    if (!t->ready)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+
+    qsort(t->nodes, t->n, sizeof(*t->nodes), cmp_node_id);
+    key.id = top_id;
+    found = bsearch(&key, t->nodes, t->n, sizeof(*t->nodes), cmp_node_id);
+    t->top = (size_t)(found - t->nodes);
+
+    for (size_t i = 0; i < t->n; i++)
+        t->nodes[i].child = TREE_NONE;
+    for (size_t i = 0; i < t->n; i++) {
+        struct tree_node *node = &t->nodes[i];
+        if (i == t->top) {
+            node->parent = TREE_NONE;
+            continue;
+        }
+        key.id = node->parent_id;
+        found = bsearch(&key, t->nodes, t->n, sizeof(*t->nodes),
+                        cmp_node_id);
+        node->parent = found ? (size_t)(found - t->nodes) : t->top;
+
+        struct tree_node *parent = &t->nodes[node->parent];
+        parent->pending++;
+        node->sibling = parent->child;
+        parent->child = i;
+    }
+
+    if (t->top_down)
+        t->ready[t->nready++] = t->top;
+    else
+        for (size_t i = 0; i < t->n; i++)
+            if (!t->nodes[i].pending)
+                t->ready[t->nready++] = i;
+    return BTRFS_UTIL_OK;
+}
+
+/* Open *top* and list everything below it; runs without the GIL. */
+static enum btrfs_util_error
+tree_load(struct subvol_tree *t, const char *top)
+{
+    struct btrfs_util_subvolume_iterator *iter;
+    struct btrfs_util_subvolume_info info;
+    enum btrfs_util_error err;
+    uint64_t top_id;
+    size_t cap = 64;
+    char *rel;
+
+    t->top_fd = open(top, O_RDONLY | O_CLOEXEC);
+    if (t->top_fd < 0)
+        return BTRFS_UTIL_ERROR_OPEN_FAILED;
+    /* never walk the enclosing subvolume of a plain directory */
+    err = btrfs_util_is_subvolume_fd(t->top_fd);
+    if (err)
+        return err;
+    err = btrfs_util_subvolume_id_fd(t->top_fd, &top_id);
+    if (err)
+        return err;
+
+    split_path(&t->at);
+    t->at_fd = open(t->at.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (t->at_fd < 0)
+        return BTRFS_UTIL_ERROR_OPEN_FAILED;
+
+    t->nodes = malloc(cap * sizeof(*t->nodes));
+    if (!t->nodes)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+    memset(&t->nodes[0], 0, sizeof(t->nodes[0]));
+    t->nodes[0].id = top_id;
+    t->n = 1;
+
+    err = btrfs_util_create_subvolume_iterator_fd(t->top_fd, 0, 0, &iter);
+    if (err)
+        return err;
+    while (!(err = btrfs_util_subvolume_iterator_next_info(iter, &rel,
+                                                            &info))) {
+        if (t->n == cap) {
+            struct tree_node *grown =
+                realloc(t->nodes, 2 * cap * sizeof(*t->nodes));
+            if (!grown) {
+                free(rel);
+                err = BTRFS_UTIL_ERROR_NO_MEMORY;
+                break;
+            }
+            t->nodes = grown;
+            cap *= 2;
+        }
+        struct tree_node *node = &t->nodes[t->n++];
+        memset(node, 0, sizeof(*node));
+        node->path = rel;
+        node->id = info.id;
+        node->parent_id = info.parent_id;
+    }
+    btrfs_util_destroy_subvolume_iterator(iter);
+    if (err != BTRFS_UTIL_ERROR_STOP_ITERATION)
+        return err;
+
+    return tree_link(t, top_id);
+}
+
+/*
+ * Directory fd and final component for *rel* below *base_fd*: base_fd
+ * itself for a single component, else a new fd the caller closes.
+ * Returns -1 and records the failure in *node*.
+ */
+static int
+tree_open_dir(int base_fd, char *rel, const char **name,
+              struct tree_node *node)
+{
+    char *slash = strrchr(rel, '/');
+    int fd;
+
+    if (!slash) {
+        *name = rel;
+        return base_fd;
+    }
+
+    *slash = '\0';
+    fd = openat(base_fd, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    *slash = '/';
+    if (fd < 0) {
+        node->err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+        node->err_no = errno;
+    }
+    *name = slash + 1;
+    return fd;
+}
+
+static void *
+tree_worker(void *arg)
+{
+    struct subvol_tree *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (!t->nready && !t->cancel && t->finished < t->n)
+            pthread_cond_wait(&t->work, &t->lock);
+        if (t->cancel || t->finished == t->n)
+            break;
+
+        struct tree_node *node = &t->nodes[t->ready[--t->nready]];
+        pthread_mutex_unlock(&t->lock);
+        t->fn(t, node);
+        pthread_mutex_lock(&t->lock);
+
+        t->finished++;
+        if (t->top_down) {
+            if (node->err)
+                t->cancel = 1;
+            else
+                for (size_t c = node->child; c != TREE_NONE;
+                     c = t->nodes[c].sibling)
+                    t->ready[t->nready++] = c;
+            pthread_cond_broadcast(&t->work);
+        }
+        else if (node->parent != TREE_NONE &&
+                 --t->nodes[node->parent].pending == 0) {
+            t->ready[t->nready++] = node->parent;
+            pthread_cond_signal(&t->work);
+        }
+        if (t->finished == t->n)
+            pthread_cond_broadcast(&t->work);
+        pthread_cond_signal(&t->progress);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/*
+ * Wait up to 100 ms for more nodes to finish; returns the finished count,
+ * or TREE_NONE once the job is cancelled.
+ */
+static size_t
+tree_wait(struct subvol_tree *t, size_t seen)
+{
+    struct timespec ts;
+    size_t done;
+
+    pthread_mutex_lock(&t->lock);
+    if (t->finished == seen && t->finished < t->n && !t->cancel) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000 * 1000 * 1000;
+        }
+        pthread_cond_timedwait(&t->progress, &t->lock, &ts);
+    }
+    done = t->cancel ? TREE_NONE : t->finished;
+    pthread_mutex_unlock(&t->lock);
+    return done;
+}
+
+/*
+ * Run the job on up to *workers* threads and wait for it, calling
+ * progress(done, total) as nodes finish.  Returns -1 with an exception
+ * set if progress or a signal handler raised; no new nodes are started
+ * after that, but the ones in flight are waited for.
+ */
+static int
+tree_run(struct subvol_tree *t, unsigned int workers, PyObject *progress)
+{
+    struct pool_threads pool;
+    size_t seen = 0;
+    int interrupted = 0;
+
+    if (!workers)
+        workers = pool_default_workers();
+    if (workers > t->n)
+        workers = (unsigned int)t->n;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (!pool_start(&pool, workers, tree_worker, t))
+        tree_worker(t);
+    Py_END_ALLOW_THREADS
+
+    for (;;) {
+        size_t done;
+
+        Py_BEGIN_ALLOW_THREADS
+        done = tree_wait(t, seen);
+        Py_END_ALLOW_THREADS
+
+        if (done == TREE_NONE)
+            break;
+        if (PyErr_CheckSignals() < 0) {
+            interrupted = 1;
+            break;
+        }
+        if (done != seen && progress != Py_None) {
+            PyObject *r = PyObject_CallFunction(progress, "nn",
+                                                (Py_ssize_t)done,
+                                                (Py_ssize_t)t->n);
+            if (!r) {
+                interrupted = 1;
+                break;
+            }
+            Py_DECREF(r);
+        }
+        seen = done;
+        if (done == t->n)
+            break;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (interrupted) {
+        pthread_mutex_lock(&t->lock);
+        t->cancel = 1;
+        pthread_cond_broadcast(&t->work);
+        pthread_mutex_unlock(&t->lock);
+    }
+    pool_join(&pool);
+    Py_END_ALLOW_THREADS
+
+    return interrupted ? -1 : 0;
+}
+
+static int
+check_progress(PyObject *progress)
+{
+    if (progress != Py_None && !PyCallable_Check(progress)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        return -1;
+    }
+    return 0;
+}
+
+/* *path* joined with a node path, decoded like os.fsdecode() */
+static PyObject *
+tree_node_path(const char *path, const struct tree_node *node)
+{
+    size_t len = strlen(path);
+
+    if (!node->path)
+        return PyUnicode_DecodeFSDefault(path);
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+
+    char *buf = malloc(len + strlen(node->path) + 2);
+    if (!buf)
+        return PyErr_NoMemory();
+    sprintf(buf, "%.*s/%s", (int)len, path, node->path);
+    PyObject *ret = PyUnicode_DecodeFSDefault(buf);
+    free(buf);
+    return ret;
+}
+
+/* -- delete_subvolume_tree ------------------------------------------- */
+
+static void
+delete_node(struct subvol_tree *t, struct tree_node *node)
+{
+    const char *name = t->at.name;
+    int fd = t->at_fd;
+
+    if (node->path) {
+        fd = tree_open_dir(t->top_fd, node->path, &name, node);
+        if (fd < 0)
+            return;
+    }
+
+    node->err = btrfs_util_delete_subvolume_fd(fd, name, 0);
+    if (node->err)
+        node->err_no = errno;
+    if (fd != t->at_fd && fd != t->top_fd)
+        close(fd);
+}
+
+static PyObject *
+delete_failures(module_state *st, struct subvol_tree *t, const char *path)
+{
+    PyObject *list = PyList_New(0);
+    if (!list)
+        return NULL;
+
+    for (size_t i = 0; i < t->n; i++) {
+        struct tree_node *node = &t->nodes[i];
+        if (!node->err)
+            continue;
+
+        PyObject *item = Py_BuildValue(
+            "(NN)", tree_node_path(path, node),
+            make_error(st, node->err, node->err_no));
+        if (!item || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return list;
+}
+
+static PyObject *
+mod_delete_subvolume_tree(PyObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "workers", "progress", NULL};
+    static FastArgsParser parser = {kw, "s|iO", "delete_subvolume_tree"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    int workers_arg = 0;
+    unsigned int workers;
+    PyObject *progress = Py_None;
+    struct subvol_tree t;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &workers_arg,
+                        &progress))
+        return NULL;
+    if (check_progress(progress) < 0)
+        return NULL;
+    if (parse_workers(workers_arg, &workers) < 0)
+        return NULL;
+    if (tree_init(&t, path) < 0)
+        return NULL;
+    t.fn = delete_node;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = tree_load(&t, path);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result = NULL;
+    if (err)
+        set_error(st, err);
+    else if (tree_run(&t, workers, progress) == 0)
+        result = delete_failures(st, &t, path);
+    tree_free(&t);
+    return result;
+}
+
+/* -- create_snapshot_tree -------------------------------------------- */
+
+static void
+snapshot_node(struct subvol_tree *t, struct tree_node *node)
+{
+    const char *name = t->at.name;
+    int parent_fd = t->at_fd;
+    int src_fd = t->top_fd;
+    int snap_fd;
+
+    if (node->path) {
+        /* nested subvolumes show up as empty directories in the copy */
+        parent_fd = tree_open_dir(t->dst_fd, node->path, &name, node);
+        if (parent_fd < 0)
+            return;
+        src_fd = openat(t->top_fd, node->path, O_RDONLY | O_CLOEXEC);
+        if (src_fd < 0 || unlinkat(parent_fd, name, AT_REMOVEDIR) < 0) {
+            node->err = src_fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                                   : BTRFS_UTIL_ERROR_RMDIR_FAILED;
+            node->err_no = errno;
+            goto out;
+        }
+    }
+
+    node->err = btrfs_util_create_snapshot_fd2(src_fd, parent_fd, name, 0,
+                                               NULL, node->path ? NULL
+                                                                : t->qg);
+    if (node->err) {
+        node->err_no = errno;
+        goto out;
+    }
+
+    snap_fd = openat(parent_fd, name, O_RDONLY | O_CLOEXEC);
+    if (snap_fd < 0) {
+        node->err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+        node->err_no = errno;
+        goto out;
+    }
+    node->err = btrfs_util_subvolume_id_fd(snap_fd, &node->new_id);
+    if (node->err)
+        node->err_no = errno;
+    if (node->path)
+        close(snap_fd);
+    else
+        t->dst_fd = snap_fd;    /* children run after the top finishes */
+
+out:
+    if (node->path) {
+        if (src_fd >= 0)
+            close(src_fd);
+        if (parent_fd != t->dst_fd)
+            close(parent_fd);
+    }
+}
+
+/* Make every created snapshot read-only; a pool job over the nodes. */
+static void
+read_only_node(void *ctx, size_t i)
+{
+    struct subvol_tree *t = ctx;
+    struct tree_node *node = &t->nodes[i];
+    int fd = t->dst_fd;
+
+    if (node->path) {
+        fd = openat(t->dst_fd, node->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            node->err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+            node->err_no = errno;
+            return;
+        }
+    }
+    node->err = btrfs_util_set_subvolume_read_only_fd(fd, true);
+    if (node->err)
+        node->err_no = errno;
+    if (fd != t->dst_fd)
+        close(fd);
+}
+
+static PyObject *
+snapshot_result(module_state *st, struct subvol_tree *t)
+{
+    for (size_t i = 0; i < t->n; i++) {
+        struct tree_node *node = &t->nodes[i];
+        if (node->err) {
+            PyObject *exc = make_error(st, node->err, node->err_no);
+            if (exc) {
+                PyErr_SetObject((PyObject *)Py_TYPE(exc), exc);
+                Py_DECREF(exc);
+            }
+            return NULL;
+        }
+    }
+
+    PyObject *ids = PySet_New(NULL);
+    if (!ids)
+        return NULL;
+    for (size_t i = 0; i < t->n; i++) {
+        PyObject *id = PyLong_FromUnsignedLongLong(t->nodes[i].new_id);
+        if (!id || PySet_Add(ids, id) < 0) {
+            Py_XDECREF(id);
+            Py_DECREF(ids);
+            return NULL;
+        }
+        Py_DECREF(id);
+    }
+    return ids;
+}
+
+static PyObject *
+mod_create_snapshot_tree(PyObject *self, PyObject *const *args,
+                         Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"source", "path", "read_only", "qgroup_inherit",
+                         "workers", NULL};
+    static FastArgsParser parser = {kw, "ss|pO!i", "create_snapshot_tree"};
+    module_state *st = get_module_state(self);
+    const char *source, *path;
+    int read_only = 0;
+    QgroupInheritObject *qg_obj = NULL;
+    int workers_arg = 0;
+    unsigned int workers;
+    struct subvol_tree t;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &source, &path,
+                        &read_only, st->QgroupInheritType, &qg_obj,
+                        &workers_arg))
+        return NULL;
+    if (parse_workers(workers_arg, &workers) < 0)
+        return NULL;
+    if (tree_init(&t, path) < 0)
+        return NULL;
+    t.fn = snapshot_node;
+    t.top_down = 1;
+    if (qgroup_inherit_copy(st, qg_obj, &t.qg) < 0) {
+        tree_free(&t);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = tree_load(&t, source);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result = NULL;
+    if (err) {
+        set_error(st, err);
+        goto out;
+    }
+    if (tree_run(&t, workers, Py_None) < 0)
+        goto out;
+
+    /* children are snapshotted into the copy, so it stays writable until now */
+    if (read_only && t.finished == t.n && !t.cancel) {
+        Py_BEGIN_ALLOW_THREADS
+        pool_run(t.n, workers, read_only_node, &t);
+        Py_END_ALLOW_THREADS
+    }
+    result = snapshot_result(st, &t);
+
+out:
+    tree_free(&t);
+    return result;
+}
+
+/* -- exported method table ------------------------------------------- */
+
+PyMethodDef bulk_methods[] = {
+    {"create_subvolumes", (PyCFunction)mod_create_subvolumes,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_subvolumes(paths: list[str], "
+     "qgroup_inherit: QgroupInherit | None = None, "
+     "workers: int = 0) -> list[BtrfsUtilError | None]\n\n"
+     "Create many subvolumes in one call. Paths are grouped by parent\n"
+     "directory so each parent is opened once, and the creations run on\n"
+     "up to workers native threads (0: one per CPU) without the GIL.\n"
+     "Returns one entry per path, in order: None on success or the\n"
+     "BtrfsUtilError that creating it raised. Failures do not stop\n"
+     "the rest of the batch."},
+
+    {"create_snapshots", (PyCFunction)mod_create_snapshots,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_snapshots(source: str, paths: list[str], "
+     "read_only: bool = False, "
+     "qgroup_inherit: QgroupInherit | None = None, "
+     "workers: int = 0) -> list[int | BtrfsUtilError]\n\n"
+     "Snapshot source into every path in one call. The source is opened\n"
+     "once, each destination parent is opened once, and the snapshots\n"
+     "are created on up to workers native threads (0: one per CPU)\n"
+     "without the GIL. Returns one entry per path, in order: the\n"
+     "transaction ID that creates the snapshot (pass the largest to\n"
+     "wait_sync() to make them all durable) or the BtrfsUtilError\n"
+     "raised for that path. A snapshot that was created but whose\n"
+     "transaction ID could not be read back reports 0, which\n"
+     "wait_sync() takes as the running transaction."},
+
+    {"delete_subvolume_tree", (PyCFunction)mod_delete_subvolume_tree,
+     METH_FASTCALL | METH_KEYWORDS,
+     "delete_subvolume_tree(path: str, workers: int = 0, "
+     "progress: Callable[[int, int], object] | None = None) "
+     "-> list[tuple[str, BtrfsUtilError]]\n\n"
+     "Delete the subvolume at path and every subvolume nested below it.\n"
+     "Like delete_subvolume(path, recursive=True), but the tree is listed\n"
+     "once and independent subvolumes are deleted concurrently on up to\n"
+     "workers native threads (0: one per CPU); a subvolume is only\n"
+     "deleted after everything nested in it. progress(done, total) is\n"
+     "called from the calling thread as deletions finish; if it raises,\n"
+     "or a signal handler does, no further deletions are started and the\n"
+     "exception propagates. Returns (path, BtrfsUtilError) for every\n"
+     "subvolume that could not be deleted."},
+
+    {"create_snapshot_tree", (PyCFunction)mod_create_snapshot_tree,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_snapshot_tree(source: str, path: str, "
+     "read_only: bool = False, "
+     "qgroup_inherit: QgroupInherit | None = None, "
+     "workers: int = 0) -> set[int]\n\n"
+     "Snapshot source and every subvolume nested below it to path.\n"
+     "Like create_snapshot(source, path, recursive=True), but once the\n"
+     "top level is snapshotted, nested subvolumes are snapshotted\n"
+     "concurrently on up to workers native threads (0: one per CPU), each\n"
+     "after its parent. With read_only, the whole new tree is made\n"
+     "read-only at the end. qgroup_inherit applies to the top snapshot.\n"
+     "Returns the IDs of the created subvolumes. The first failure stops\n"
+     "the job and is raised; snapshots already created are left in place."},
+
+    {NULL}
+};
@@ -0,0 +1,23 @@
+#ifndef PYBTRFS_COLUMN_H
+#define PYBTRFS_COLUMN_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+/*
+ * Packed result arrays handed to Python as read-only memoryviews.  No
+ * module state of its own, so any extension module can create the type
+ * from Column_spec and pass it to column_view().
+ */
+
+extern PyType_Spec Column_spec;
+
+/*
+ * Take ownership of malloc'd *data* (n items, or n rows of *width* items
+ * if width is nonzero) and return a read-only memoryview over it.
+ * *data* is freed on failure.
+ */
+PyObject *column_view(PyTypeObject *type, void *data, Py_ssize_t n,
+                      Py_ssize_t width, char format, Py_ssize_t itemsize);
+
+#endif /* PYBTRFS_COLUMN_H */
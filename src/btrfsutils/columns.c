@@ -0,0 +1,101 @@
+#include "column.h"
+
+#include <stdlib.h>
+
+/* -- Column buffer --------------------------------------------------- */
+
+/*
+ * Read-only owner of one malloc'd C array, exported through the buffer
+ * protocol.  Users only ever see memoryviews over it; unlike casting a
+ * bytearray this keeps an (n, 16) shape even when n is zero.
+ */
+typedef struct {
+    PyObject_HEAD
+    void *data;
+    int ndim;
+    Py_ssize_t itemsize;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    char format[2];
+} ColumnObject;
+
+static void
+Column_dealloc(ColumnObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    free(self->data);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static int
+Column_getbuffer(ColumnObject *self, Py_buffer *view, int flags)
+{
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "column is read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    view->buf = self->data;
+    view->obj = Py_NewRef(self);
+    view->len = self->shape[0] * self->strides[0];
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+        ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyType_Slot Column_slots[] = {
+    {Py_tp_dealloc,    Column_dealloc},
+    {Py_bf_getbuffer,  Column_getbuffer},
+    {Py_tp_doc,        "Buffer backing a memoryview of packed results, e.g. "
+                       "from subvolume_columns()."},
+    {0, NULL}
+};
+
+PyType_Spec Column_spec = {
+    .name      = "pybtrfs._Column",
+    .basicsize = sizeof(ColumnObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE
+               | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots     = Column_slots,
+};
+
+PyObject *
+column_view(PyTypeObject *type, void *data, Py_ssize_t n, Py_ssize_t width,
+            char format, Py_ssize_t itemsize)
+{
+    ColumnObject *col = PyObject_New(ColumnObject, type);
+    if (!col) {
+        free(data);
+        return NULL;
+    }
+
+    col->data = data;
+    col->itemsize = itemsize;
+    col->format[0] = format;
+    col->format[1] = '\0';
+    col->shape[0] = n;
+    if (width) {
+        col->ndim = 2;
+        col->shape[1] = width;
+        col->strides[1] = itemsize;
+        col->strides[0] = width * itemsize;
+    }
+    else {
+        col->ndim = 1;
+        col->strides[0] = itemsize;
+    }
+
+    PyObject *view = PyMemoryView_FromObject((PyObject *)col);
+    Py_DECREF(col);
+    return view;
+}
@@ -3,8 +3,6 @@
 
 /* -- exception type -------------------------------------------------- */
 
-PyObject *BtrfsUtilError = NULL;
-
 typedef struct {
     PyOSErrorObject base;
     int btrfsutil_code;
@@ -39,45 +37,54 @@ static PyType_Slot BtrfsUtilError_slots[] = {
     {0, NULL}
 };
 
-PyType_Spec BtrfsUtilError_spec = {
+static PyType_Spec BtrfsUtilError_spec = {
     .name      = "pybtrfs.BtrfsUtilError",
     .basicsize = sizeof(BtrfsUtilErrorObject),
     .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
     .slots     = BtrfsUtilError_slots,
 };
 
-/* -- helper: raise BtrfsUtilError from an error code ----------------- */
+/* -- helpers: build / raise BtrfsUtilError from an error code -------- */
 
 PyObject *
-set_error(enum btrfs_util_error err)
+make_error(module_state *st, enum btrfs_util_error err, int errnum)
 {
-    int saved_errno = errno;
     const char *msg = btrfs_util_strerror(err);
 
-    PyObject *exc_args = Py_BuildValue("(is)", saved_errno, msg);
+    PyObject *exc_args = Py_BuildValue("(is)", errnum, msg);
     if (!exc_args)
         return NULL;
 
-    PyObject *exc = PyObject_Call(BtrfsUtilError, exc_args, NULL);
+    PyObject *exc = PyObject_Call(st->BtrfsUtilError, exc_args, NULL);
     Py_DECREF(exc_args);
     if (!exc)
         return NULL;
 
     ((BtrfsUtilErrorObject *)exc)->btrfsutil_code = (int)err;
+    return exc;
+}
+
+PyObject *
+set_error(module_state *st, enum btrfs_util_error err)
+{
+    PyObject *exc = make_error(st, err, errno);
+    if (!exc)
+        return NULL;
 
-    PyErr_SetObject(BtrfsUtilError, exc);
+    PyErr_SetObject(st->BtrfsUtilError, exc);
     Py_DECREF(exc);
     return NULL;
 }
 
-/* called from module init */
+/* called from module exec */
 PyObject *
-BtrfsUtilError_type_new(void)
+BtrfsUtilError_type_new(PyObject *module)
 {
     PyObject *bases = PyTuple_Pack(1, PyExc_OSError);
     if (!bases)
         return NULL;
-    PyObject *type = PyType_FromSpecWithBases(&BtrfsUtilError_spec, bases);
+    PyObject *type = PyType_FromModuleAndSpec(module, &BtrfsUtilError_spec,
+                                              bases);
     Py_DECREF(bases);
     return type;
 }
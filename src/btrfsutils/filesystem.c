@@ -0,0 +1,1150 @@
+#include "module.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "kernel-shared/uapi/btrfs.h"
+
+/*
+ * A Filesystem keeps one O_DIRECTORY fd on a btrfs mount open and runs
+ * every operation against it through the libbtrfsutil *_fd variants,
+ * resolving relative paths with openat() instead of walking them from
+ * the process cwd on each call.
+ */
+typedef struct {
+    PyObject_HEAD
+    module_state *state;    /* from tp_new; the type may be a subclass */
+    int fd;
+    int users;              /* calls using fd without the GIL */
+    int detached_fd;        /* closed while in use; the last call closes it */
+    PyObject *path;
+    PyObject *fsid;
+    uint64_t num_devices;
+    uint32_t nodesize;
+    uint32_t sectorsize;
+    uint16_t csum_type;
+} FilesystemObject;
+
+/* -- helpers --------------------------------------------------------- */
+
+static int
+fs_get_fd(FilesystemObject *self)
+{
+    int fd;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    fd = self->fd;
+    Py_END_CRITICAL_SECTION();
+    return fd;
+}
+
+static int
+fs_check_open(FilesystemObject *self)
+{
+    if (fs_get_fd(self) < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "I/O operation on closed Filesystem");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Take a use of the handle fd for one call, which then runs on the
+ * returned fd with the GIL released.  While any call holds a use, close()
+ * only detaches the fd and the last fs_put() closes it, so the number
+ * cannot be reused for another file under a running ioctl.
+ */
+static int
+fs_acquire(FilesystemObject *self)
+{
+    int fd;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    fd = self->fd;
+    if (fd >= 0)
+        self->users++;
+    Py_END_CRITICAL_SECTION();
+
+    if (fd < 0)
+        PyErr_SetString(PyExc_ValueError,
+                        "I/O operation on closed Filesystem");
+    return fd;
+}
+
+static void
+fs_put(FilesystemObject *self)
+{
+    int fd = -1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (--self->users == 0) {
+        fd = self->detached_fd;
+        self->detached_fd = -1;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (fd >= 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+}
+
+/* Open *path* relative to *base*; "" and "." reuse *base* itself. */
+static int
+fs_openat(int base, const char *path)
+{
+    if (!path[0] || !strcmp(path, "."))
+        return base;
+    return openat(base, path, O_RDONLY | O_CLOEXEC);
+}
+
+static void
+fs_release(int base, int fd)
+{
+    if (fd >= 0 && fd != base) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+}
+
+/* parent directory fd and final component of a path, for create/delete */
+struct fs_child {
+    int parent_fd;
+    char *buf;
+    const char *name;
+};
+
+static int
+fs_open_parent(int base, const char *path, struct fs_child *c)
+{
+    size_t len;
+    char *slash;
+
+    c->buf = strdup(path);
+    if (!c->buf)
+        return -1;
+
+    len = strlen(c->buf);
+    while (len > 1 && c->buf[len - 1] == '/')
+        c->buf[--len] = '\0';
+
+    slash = strrchr(c->buf, '/');
+    if (!slash) {
+        c->parent_fd = base;
+        c->name = c->buf;
+        return 0;
+    }
+
+    c->name = slash + 1;
+    if (slash == c->buf) {
+        c->parent_fd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    else {
+        *slash = '\0';
+        c->parent_fd = openat(base, c->buf,
+                              O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (c->parent_fd < 0) {
+        int saved_errno = errno;
+        free(c->buf);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+fs_child_release(int base, struct fs_child *c)
+{
+    int saved_errno = errno;
+    fs_release(base, c->parent_fd);
+    free(c->buf);
+    errno = saved_errno;
+}
+
+/* -- lifecycle ------------------------------------------------------- */
+
+static PyObject *
+Filesystem_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    module_state *st = find_module_state(type);
+    if (!st)
+        return NULL;
+
+    FilesystemObject *self = (FilesystemObject *)type->tp_alloc(type, 0);
+    if (self) {
+        self->state = st;
+        self->fd = -1;
+        self->detached_fd = -1;
+    }
+    return (PyObject *)self;
+}
+
+static void
+Filesystem_close_fd(FilesystemObject *self)
+{
+    int fd;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    fd = self->fd;
+    self->fd = -1;
+    if (fd >= 0 && self->users) {
+        /* the last call still using it closes it */
+        self->detached_fd = fd;
+        fd = -1;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (fd >= 0)
+        close(fd);
+}
+
+static void
+Filesystem_dealloc(FilesystemObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    /* no call can be running on it: each holds a reference */
+    if (self->fd >= 0)
+        close(self->fd);
+    Py_XDECREF(self->path);
+    Py_XDECREF(self->fsid);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static int
+Filesystem_init(FilesystemObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kw[] = {"path", NULL};
+    const char *path;
+    struct btrfs_ioctl_fs_info_args fi;
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+    int fd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+        return -1;
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = BTRFS_FS_INFO_FLAG_CSUM_INFO;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+    }
+    else if (ioctl(fd, BTRFS_IOC_FS_INFO, &fi) < 0) {
+        err = errno == ENOTTY ? BTRFS_UTIL_ERROR_NOT_BTRFS
+                              : BTRFS_UTIL_ERROR_FS_INFO_FAILED;
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    Py_END_ALLOW_THREADS
+
+    if (err) {
+        set_error(self->state, err);
+        return -1;
+    }
+
+    PyObject *path_obj = PyUnicode_DecodeFSDefault(path);
+    PyObject *fsid = PyBytes_FromStringAndSize((const char *)fi.fsid,
+                                               sizeof(fi.fsid));
+    if (!path_obj || !fsid) {
+        Py_XDECREF(path_obj);
+        Py_XDECREF(fsid);
+        close(fd);
+        return -1;
+    }
+
+    /*
+     * Re-initialisation replaces the previous handle, which must not be
+     * swapped out from under calls still running on it.
+     */
+    int busy, old_fd = -1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->users > 0;
+    if (!busy) {
+        old_fd = self->fd;
+        self->fd = fd;
+        Py_XSETREF(self->path, path_obj);
+        Py_XSETREF(self->fsid, fsid);
+        self->num_devices = fi.num_devices;
+        self->nodesize = fi.nodesize;
+        self->sectorsize = fi.sectorsize;
+        /* kernels before 5.5 leave the flag clear and only support crc32c */
+        self->csum_type = (fi.flags & BTRFS_FS_INFO_FLAG_CSUM_INFO)
+            ? fi.csum_type : 0;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (busy) {
+        Py_DECREF(path_obj);
+        Py_DECREF(fsid);
+        close(fd);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Filesystem is in use by another thread");
+        return -1;
+    }
+    if (old_fd >= 0)
+        close(old_fd);
+    return 0;
+}
+
+static PyObject *
+Filesystem_repr(FilesystemObject *self)
+{
+    if (!self->path)
+        return PyUnicode_FromString("<Filesystem (uninitialized)>");
+    return PyUnicode_FromFormat("<Filesystem %R%s>", self->path,
+                                fs_get_fd(self) < 0 ? " (closed)" : "");
+}
+
+static PyObject *
+Filesystem_fileno(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    int fd = fs_get_fd(self);
+
+    if (fd < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "I/O operation on closed Filesystem");
+        return NULL;
+    }
+    return PyLong_FromLong(fd);
+}
+
+/*
+ * A duplicate of the handle fd, taken under a use so that it is never a
+ * number close() has already given back.  The caller owns and closes it;
+ * the Python quota wrappers run on it.
+ */
+static PyObject *
+Filesystem_dup(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    int fd = fcntl(base, F_DUPFD_CLOEXEC, 0);
+    fs_put(self);
+
+    if (fd < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    return PyLong_FromLong(fd);
+}
+
+static PyObject *
+Filesystem_close(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    Filesystem_close_fd(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_enter(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    if (fs_check_open(self) < 0)
+        return NULL;
+    return Py_NewRef(self);
+}
+
+static PyObject *
+Filesystem_exit(FilesystemObject *self, PyObject *args)
+{
+    Filesystem_close_fd(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_get_closed(FilesystemObject *self, void *closure)
+{
+    return PyBool_FromLong(fs_get_fd(self) < 0);
+}
+
+/* -- sync ------------------------------------------------------------ */
+
+static PyObject *
+Filesystem_sync(FilesystemObject *self, PyObject *const *args,
+                Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"coalesce", NULL};
+    static FastArgsParser parser = {kw, "|p", "sync"};
+    int coalesce = 0;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &coalesce))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = coalesce ? sync_coalesced_fd(base) : btrfs_util_sync_fd(base);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_start_sync(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    uint64_t transid;
+    enum btrfs_util_error err;
+
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = btrfs_util_start_sync_fd(base, &transid);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    return PyLong_FromUnsignedLongLong(transid);
+}
+
+static PyObject *
+Filesystem_wait_sync(FilesystemObject *self, PyObject *const *args,
+                     Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"transid", "timeout", NULL};
+    static FastArgsParser parser = {kw, "|KO", "wait_sync"};
+    uint64_t transid = 0;
+    PyObject *timeout = Py_None;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &transid, &timeout))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = wait_sync_fd(self->state, base, transid, timeout);
+    fs_put(self);
+    return result;
+}
+
+/* -- queries --------------------------------------------------------- */
+
+static PyObject *
+Filesystem_is_subvolume(FilesystemObject *self, PyObject *const *args,
+                        Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "is_subvolume"};
+    const char *path;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_is_subvolume_fd(fd);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err == BTRFS_UTIL_OK)
+        Py_RETURN_TRUE;
+    if (err == BTRFS_UTIL_ERROR_NOT_BTRFS ||
+        err == BTRFS_UTIL_ERROR_NOT_SUBVOLUME)
+        Py_RETURN_FALSE;
+    return set_error(self->state, err);
+}
+
+static PyObject *
+Filesystem_subvolume_id(FilesystemObject *self, PyObject *const *args,
+                        Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "|s", "subvolume_id"};
+    const char *path = ".";
+    uint64_t id;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_subvolume_id_fd(fd, &id);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    return PyLong_FromUnsignedLongLong(id);
+}
+
+static PyObject *
+Filesystem_subvolume_path(FilesystemObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "|sK", "subvolume_path"};
+    const char *path = ".";
+    uint64_t id = 0;
+    char *subvol_path = NULL;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_subvolume_path_fd(fd, id, &subvol_path);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+
+    PyObject *result = PyUnicode_DecodeFSDefault(subvol_path);
+    free(subvol_path);
+    return result;
+}
+
+static PyObject *
+Filesystem_subvolume_info(FilesystemObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "|sK", "subvolume_info"};
+    const char *path = ".";
+    uint64_t id = 0;
+    struct btrfs_util_subvolume_info info;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_subvolume_info_fd(fd, id, &info);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    return SubvolumeInfo_from_struct(self->state, &info);
+}
+
+static PyObject *
+Filesystem_subvolume_list(FilesystemObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"top", "info", "min_transid", NULL};
+    static FastArgsParser parser = {kw, "|KpK", "subvolume_list"};
+    uint64_t top = 0, min_transid = 0;
+    int info = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &top, &info,
+                        &min_transid))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = subvolume_list_fd(self->state, base, top, info,
+                                         min_transid);
+    fs_put(self);
+    return result;
+}
+
+static PyObject *
+Filesystem_subvolume_columns(FilesystemObject *self, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"top", "min_transid", NULL};
+    static FastArgsParser parser = {kw, "|KK", "subvolume_columns"};
+    uint64_t top = 0, min_transid = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &top, &min_transid))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = subvolume_columns_fd(self->state, base, top,
+                                            min_transid);
+    fs_put(self);
+    return result;
+}
+
+static char *find_one_kw[] = {"uuid", NULL};
+
+static PyObject *
+Filesystem_find_one(FilesystemObject *self, FastArgsParser *parser,
+                    PyObject *const *args, Py_ssize_t nargs,
+                    PyObject *kwnames, int received)
+{
+    const char *uuid;
+    Py_ssize_t uuid_len;
+
+    if (!fastargs_parse(parser, args, nargs, kwnames, &uuid, &uuid_len))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = find_subvolume_fd(self->state, base, uuid,
+                                         uuid_len, received);
+    fs_put(self);
+    return result;
+}
+
+static PyObject *
+Filesystem_find_subvolume_by_uuid(FilesystemObject *self,
+                                  PyObject *const *args, Py_ssize_t nargs,
+                                  PyObject *kwnames)
+{
+    static FastArgsParser parser = {find_one_kw, "y#",
+                                    "find_subvolume_by_uuid"};
+    return Filesystem_find_one(self, &parser, args, nargs, kwnames, 0);
+}
+
+static PyObject *
+Filesystem_find_subvolume_by_received_uuid(FilesystemObject *self,
+                                           PyObject *const *args,
+                                           Py_ssize_t nargs, PyObject *kwnames)
+{
+    static FastArgsParser parser = {find_one_kw, "y#",
+                                    "find_subvolume_by_received_uuid"};
+    return Filesystem_find_one(self, &parser, args, nargs, kwnames, 1);
+}
+
+static PyObject *
+Filesystem_find_subvolumes_by_uuid(FilesystemObject *self,
+                                   PyObject *const *args, Py_ssize_t nargs,
+                                   PyObject *kwnames)
+{
+    static char *kw[] = {"uuids", "received", NULL};
+    static FastArgsParser parser = {kw, "O|p", "find_subvolumes_by_uuid"};
+    PyObject *uuids;
+    int received = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &uuids, &received))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = find_subvolumes_fd(self->state, base, uuids, received);
+    fs_put(self);
+    return result;
+}
+
+/* -- read-only flag and default subvolume ---------------------------- */
+
+static PyObject *
+Filesystem_get_subvolume_read_only(FilesystemObject *self,
+                                   PyObject *const *args, Py_ssize_t nargs,
+                                   PyObject *kwnames)
+{
+    static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "get_subvolume_read_only"};
+    const char *path;
+    bool ro = false;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_get_subvolume_read_only_fd(fd, &ro);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    return PyBool_FromLong(ro);
+}
+
+static PyObject *
+Filesystem_set_subvolume_read_only(FilesystemObject *self,
+                                   PyObject *const *args, Py_ssize_t nargs,
+                                   PyObject *kwnames)
+{
+    static char *kw[] = {"path", "read_only", NULL};
+    static FastArgsParser parser = {kw, "s|p", "set_subvolume_read_only"};
+    const char *path;
+    int ro = 1;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &ro))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_set_subvolume_read_only_fd(fd, ro);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_get_default_subvolume(FilesystemObject *self,
+                                 PyObject *Py_UNUSED(a))
+{
+    uint64_t id;
+    enum btrfs_util_error err;
+
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = btrfs_util_get_default_subvolume_fd(base, &id);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    return PyLong_FromUnsignedLongLong(id);
+}
+
+static PyObject *
+Filesystem_set_default_subvolume(FilesystemObject *self, PyObject *const *args,
+                                 Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "|sK", "set_default_subvolume"};
+    const char *path = ".";
+    uint64_t id = 0;
+    enum btrfs_util_error err;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = fs_openat(base, path);
+    err = fd < 0 ? BTRFS_UTIL_ERROR_OPEN_FAILED
+                 : btrfs_util_set_default_subvolume_fd(fd, id);
+    fs_release(base, fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+/* -- create / snapshot / delete -------------------------------------- */
+
+static PyObject *
+Filesystem_create_subvolume(FilesystemObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "qgroup_inherit", NULL};
+    static FastArgsParser parser = {kw, "s|O!", "create_subvolume"};
+    const char *path;
+    QgroupInheritObject *qg_obj = NULL;
+    struct btrfs_util_qgroup_inherit *qg = NULL;
+    struct fs_child c;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path,
+                        self->state->QgroupInheritType, &qg_obj))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    if (qgroup_inherit_copy(self->state, qg_obj, &qg) < 0) {
+        fs_put(self);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (fs_open_parent(base, path, &c) < 0) {
+        err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+    }
+    else {
+        err = btrfs_util_create_subvolume_fd(c.parent_fd, c.name, 0,
+                                             NULL, qg);
+        fs_child_release(base, &c);
+    }
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+    qgroup_inherit_free(qg);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_create_snapshot(FilesystemObject *self, PyObject *const *args,
+                           Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"source", "path", "recursive", "read_only",
+                         "qgroup_inherit", NULL};
+    static FastArgsParser parser = {kw, "ss|ppO!", "create_snapshot"};
+    const char *source, *path;
+    int recursive = 0, read_only = 0, flags = 0;
+    QgroupInheritObject *qg_obj = NULL;
+    struct btrfs_util_qgroup_inherit *qg = NULL;
+    struct fs_child c;
+    enum btrfs_util_error err;
+    int src_fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &source, &path,
+                        &recursive, &read_only,
+                        self->state->QgroupInheritType, &qg_obj))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    if (recursive)
+        flags |= BTRFS_UTIL_CREATE_SNAPSHOT_RECURSIVE;
+    if (read_only)
+        flags |= BTRFS_UTIL_CREATE_SNAPSHOT_READ_ONLY;
+    if (qgroup_inherit_copy(self->state, qg_obj, &qg) < 0) {
+        fs_put(self);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    src_fd = fs_openat(base, source);
+    if (src_fd < 0) {
+        err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+    }
+    else if (fs_open_parent(base, path, &c) < 0) {
+        err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+    }
+    else {
+        err = btrfs_util_create_snapshot_fd2(src_fd, c.parent_fd, c.name,
+                                             flags, NULL, qg);
+        fs_child_release(base, &c);
+    }
+    fs_release(base, src_fd);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+    qgroup_inherit_free(qg);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_delete_subvolume(FilesystemObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "recursive", NULL};
+    static FastArgsParser parser = {kw, "s|p", "delete_subvolume"};
+    const char *path;
+    int recursive = 0, flags = 0;
+    struct fs_child c;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &recursive))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    if (recursive)
+        flags |= BTRFS_UTIL_DELETE_SUBVOLUME_RECURSIVE;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (fs_open_parent(base, path, &c) < 0) {
+        err = BTRFS_UTIL_ERROR_OPEN_FAILED;
+    }
+    else {
+        err = btrfs_util_delete_subvolume_fd(c.parent_fd, c.name, flags);
+        fs_child_release(base, &c);
+    }
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Filesystem_deleted_subvolumes(FilesystemObject *self, PyObject *Py_UNUSED(a))
+{
+    uint64_t *ids = NULL;
+    size_t n = 0;
+    enum btrfs_util_error err;
+
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = btrfs_util_deleted_subvolumes_fd(base, &ids, &n);
+    Py_END_ALLOW_THREADS
+    fs_put(self);
+
+    if (err)
+        return set_error(self->state, err);
+
+    PyObject *list = PyList_New((Py_ssize_t)n);
+    if (!list) { free(ids); return NULL; }
+
+    for (size_t i = 0; i < n; i++) {
+        PyObject *v = PyLong_FromUnsignedLongLong(ids[i]);
+        if (!v) { Py_DECREF(list); free(ids); return NULL; }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, v);
+    }
+    free(ids);
+    return list;
+}
+
+static PyObject *
+Filesystem_deleted_subvolumes_array(FilesystemObject *self,
+                                    PyObject *const *args, Py_ssize_t nargs,
+                                    PyObject *kwnames)
+{
+    static char *kw[] = {"count_only", NULL};
+    static FastArgsParser parser = {kw, "|p", "deleted_subvolumes_array"};
+    int count_only = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &count_only))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = deleted_array_fd(self->state, base, count_only);
+    fs_put(self);
+    return result;
+}
+
+static PyObject *
+Filesystem_wait_subvolumes_cleaned(FilesystemObject *self,
+                                   PyObject *const *args, Py_ssize_t nargs,
+                                   PyObject *kwnames)
+{
+    static char *kw[] = {"ids", "timeout", NULL};
+    static FastArgsParser parser = {kw, "|OO", "wait_subvolumes_cleaned"};
+    PyObject *ids = Py_None, *timeout = Py_None;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &ids, &timeout))
+        return NULL;
+    int base = fs_acquire(self);
+    if (base < 0)
+        return NULL;
+    PyObject *result = wait_cleaned_fd(self->state, base, ids, timeout);
+    fs_put(self);
+    return result;
+}
+
+/* -- type tables ----------------------------------------------------- */
+
+static PyMethodDef Filesystem_methods[] = {
+    {"fileno", (PyCFunction)Filesystem_fileno, METH_NOARGS,
+     "fileno() -> int\n\nReturn the file descriptor of the handle."},
+    {"_dup", (PyCFunction)Filesystem_dup, METH_NOARGS,
+     "_dup() -> int\n\n"
+     "Return a new descriptor for the handle; the caller must close it."},
+    {"close", (PyCFunction)Filesystem_close, METH_NOARGS,
+     "close() -> None\n\nClose the file descriptor."},
+    {"__enter__", (PyCFunction)Filesystem_enter, METH_NOARGS,
+     "__enter__() -> Filesystem\n\nEnter the context manager."},
+    {"__exit__", (PyCFunction)Filesystem_exit, METH_VARARGS,
+     "__exit__(*args) -> None\n\nExit the context manager and close the handle."},
+
+    {"sync", (PyCFunction)Filesystem_sync, METH_FASTCALL | METH_KEYWORDS,
+     "sync(coalesce: bool = False) -> None\n\n"
+     "Force a sync on the filesystem. With coalesce, share syncs with\n"
+     "concurrent callers as pybtrfs.sync(path, coalesce=True) does."},
+    {"start_sync", (PyCFunction)Filesystem_start_sync, METH_NOARGS,
+     "start_sync() -> int\n\nStart a sync and return the transaction ID."},
+    {"wait_sync", (PyCFunction)Filesystem_wait_sync,
+     METH_FASTCALL | METH_KEYWORDS,
+     "wait_sync(transid: int = 0, timeout: float | None = None) -> bool\n\n"
+     "Wait for a transaction to sync; see pybtrfs.wait_sync()."},
+
+    {"is_subvolume", (PyCFunction)Filesystem_is_subvolume,
+     METH_FASTCALL | METH_KEYWORDS,
+     "is_subvolume(path: str) -> bool\n\n"
+     "Return whether a path is a Btrfs subvolume."},
+    {"subvolume_id", (PyCFunction)Filesystem_subvolume_id,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_id(path: str = '.') -> int\n\n"
+     "Get the subvolume ID containing a path."},
+    {"subvolume_path", (PyCFunction)Filesystem_subvolume_path,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_path(path: str = '.', id: int = 0) -> str\n\n"
+     "Get the path of a subvolume relative to the filesystem root."},
+    {"subvolume_info", (PyCFunction)Filesystem_subvolume_info,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_info(path: str = '.', id: int = 0) -> SubvolumeInfo\n\n"
+     "Get information about a subvolume."},
+    {"subvolume_list", (PyCFunction)Filesystem_subvolume_list,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_list(top: int = 0, info: bool = False, "
+     "min_transid: int = 0) -> list[tuple[str, int | SubvolumeInfo]]\n\n"
+     "Same as the module-level subvolume_list(), on this handle."},
+    {"subvolume_columns", (PyCFunction)Filesystem_subvolume_columns,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_columns(top: int = 0, min_transid: int = 0) "
+     "-> dict[str, memoryview | bytes]\n\n"
+     "Same as the module-level subvolume_columns(), on this handle."},
+    {"find_subvolume_by_uuid",
+     (PyCFunction)Filesystem_find_subvolume_by_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolume_by_uuid(uuid: bytes) -> int | None\n\n"
+     "Look up a subvolume ID by UUID in the UUID tree."},
+    {"find_subvolume_by_received_uuid",
+     (PyCFunction)Filesystem_find_subvolume_by_received_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolume_by_received_uuid(uuid: bytes) -> int | None\n\n"
+     "Look up a subvolume ID by received UUID in the UUID tree."},
+    {"find_subvolumes_by_uuid",
+     (PyCFunction)Filesystem_find_subvolumes_by_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolumes_by_uuid(uuids: list[bytes], received: bool = False) "
+     "-> list[int | None]\n\n"
+     "Resolve many UUIDs in one call."},
+
+    {"get_subvolume_read_only",
+     (PyCFunction)Filesystem_get_subvolume_read_only,
+     METH_FASTCALL | METH_KEYWORDS,
+     "get_subvolume_read_only(path: str) -> bool\n\n"
+     "Get whether a subvolume is read-only."},
+    {"set_subvolume_read_only",
+     (PyCFunction)Filesystem_set_subvolume_read_only,
+     METH_FASTCALL | METH_KEYWORDS,
+     "set_subvolume_read_only(path: str, read_only: bool = True) -> None\n\n"
+     "Set whether a subvolume is read-only."},
+    {"get_default_subvolume",
+     (PyCFunction)Filesystem_get_default_subvolume, METH_NOARGS,
+     "get_default_subvolume() -> int\n\nGet the default subvolume ID."},
+    {"set_default_subvolume",
+     (PyCFunction)Filesystem_set_default_subvolume,
+     METH_FASTCALL | METH_KEYWORDS,
+     "set_default_subvolume(path: str = '.', id: int = 0) -> None\n\n"
+     "Set the default subvolume."},
+
+    {"create_subvolume", (PyCFunction)Filesystem_create_subvolume,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_subvolume(path: str, qgroup_inherit: QgroupInherit | None = None) -> None\n\n"
+     "Create a new subvolume."},
+    {"create_snapshot", (PyCFunction)Filesystem_create_snapshot,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_snapshot(source: str, path: str, recursive: bool = False, "
+     "read_only: bool = False, "
+     "qgroup_inherit: QgroupInherit | None = None) -> None\n\n"
+     "Create a snapshot of a subvolume."},
+    {"delete_subvolume", (PyCFunction)Filesystem_delete_subvolume,
+     METH_FASTCALL | METH_KEYWORDS,
+     "delete_subvolume(path: str, recursive: bool = False) -> None\n\n"
+     "Delete a subvolume."},
+    {"deleted_subvolumes", (PyCFunction)Filesystem_deleted_subvolumes,
+     METH_NOARGS,
+     "deleted_subvolumes() -> list[int]\n\n"
+     "Get IDs of deleted but not yet cleaned up subvolumes."},
+    {"deleted_subvolumes_array",
+     (PyCFunction)Filesystem_deleted_subvolumes_array,
+     METH_FASTCALL | METH_KEYWORDS,
+     "deleted_subvolumes_array(count_only: bool = False) "
+     "-> memoryview | int\n\n"
+     "Get IDs of deleted but not yet cleaned up subvolumes as a 'Q'\n"
+     "memoryview, or just their number with count_only."},
+    {"wait_subvolumes_cleaned",
+     (PyCFunction)Filesystem_wait_subvolumes_cleaned,
+     METH_FASTCALL | METH_KEYWORDS,
+     "wait_subvolumes_cleaned(ids: list[int] | None = None, "
+     "timeout: float | None = None) -> bool\n\n"
+     "Wait until deleted subvolumes are cleaned up; see\n"
+     "pybtrfs.wait_subvolumes_cleaned()."},
+    {NULL}
+};
+
+static PyMemberDef Filesystem_members[] = {
+    {"path",        T_OBJECT,    offsetof(FilesystemObject, path),        READONLY,
+     "Path the handle was opened with."},
+    {"fsid",        T_OBJECT,    offsetof(FilesystemObject, fsid),        READONLY,
+     "Filesystem UUID (16 bytes)."},
+    {"num_devices", T_ULONGLONG, offsetof(FilesystemObject, num_devices), READONLY,
+     "Number of devices in the filesystem."},
+    {"nodesize",    T_UINT,      offsetof(FilesystemObject, nodesize),    READONLY,
+     "Metadata node size in bytes."},
+    {"sectorsize",  T_UINT,      offsetof(FilesystemObject, sectorsize),  READONLY,
+     "Data sector size in bytes."},
+    {"csum_type",   T_USHORT,    offsetof(FilesystemObject, csum_type),   READONLY,
+     "Checksum algorithm (one of the CSUM_TYPE_* constants)."},
+    {NULL}
+};
+
+static PyGetSetDef Filesystem_getset[] = {
+    {"closed", (getter)Filesystem_get_closed, NULL,
+     "Whether the handle has been closed.", NULL},
+    {NULL}
+};
+
+static PyType_Slot Filesystem_slots[] = {
+    {Py_tp_dealloc, Filesystem_dealloc},
+    {Py_tp_repr,    Filesystem_repr},
+    {Py_tp_doc,     "Filesystem(path: str)\n\n"
+                    "Handle on a mounted Btrfs filesystem. Keeps a directory\n"
+                    "fd on path open and runs every operation against it;\n"
+                    "relative paths passed to methods are resolved from path."},
+    {Py_tp_methods, Filesystem_methods},
+    {Py_tp_members, Filesystem_members},
+    {Py_tp_getset,  Filesystem_getset},
+    {Py_tp_init,    Filesystem_init},
+    {Py_tp_new,     Filesystem_new},
+    {0, NULL}
+};
+
+PyType_Spec Filesystem_spec = {
+    .name      = "pybtrfs.btrfsutils.Filesystem",
+    .basicsize = sizeof(FilesystemObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE
+               | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = Filesystem_slots,
+};
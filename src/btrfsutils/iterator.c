@@ -1,18 +1,52 @@
 #include "module.h"
 #include <stdlib.h>
 
+/* entries fetched per GIL release when iterating with __next__ */
+#define ITER_BATCH 256
+
 typedef struct {
     PyObject_HEAD
     struct btrfs_util_subvolume_iterator *iter;
     int info_flag;
+    /* read-ahead buffer filled by iterator_fetch() */
+    struct iter_entry *buf;
+    size_t buf_pos;
+    size_t buf_len;
+    /* error hit after a partial batch, raised on the next call */
+    enum btrfs_util_error pending_err;
+    int pending_errno;
+    /* a call is using iter and buf; see SubvolumeIterator_acquire() */
+    int busy;
 } SubvolumeIteratorObject;
 
+void
+free_entries(struct iter_entry *e, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        free(e[i].path);
+}
+
+static void
+SubvolumeIterator_clear_buffer(SubvolumeIteratorObject *self)
+{
+    if (self->buf) {
+        free_entries(self->buf + self->buf_pos, self->buf_len - self->buf_pos);
+        PyMem_Free(self->buf);
+        self->buf = NULL;
+    }
+    self->buf_pos = self->buf_len = 0;
+}
+
 static void
 SubvolumeIterator_dealloc(SubvolumeIteratorObject *self)
 {
+    PyTypeObject *tp = Py_TYPE(self);
+
+    SubvolumeIterator_clear_buffer(self);
     if (self->iter)
         btrfs_util_destroy_subvolume_iterator(self->iter);
-    Py_TYPE(self)->tp_free((PyObject *)self);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
 }
 
 static int
@@ -22,7 +56,8 @@ SubvolumeIterator_init(SubvolumeIteratorObject *self,
     static char *kw[] = {"path", "top", "post_order", "info", NULL};
     const char *path;
     uint64_t top = 0;
-    int post_order = 0, info = 0, flags = 0;
+    int post_order = 0, info = 0, flags = 0, busy;
+    struct btrfs_util_subvolume_iterator *iter;
     enum btrfs_util_error err;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Kpp", kw,
@@ -32,90 +67,289 @@ SubvolumeIterator_init(SubvolumeIteratorObject *self,
     if (post_order)
         flags |= BTRFS_UTIL_SUBVOLUME_ITERATOR_POST_ORDER;
 
-    self->info_flag = info;
-
+    /* built aside, then swapped in only if no call is using the old one */
     Py_BEGIN_ALLOW_THREADS
-    err = btrfs_util_create_subvolume_iterator(path, top, flags, &self->iter);
+    err = btrfs_util_create_subvolume_iterator(path, top, flags, &iter);
     Py_END_ALLOW_THREADS
 
     if (err) {
-        set_error(err);
+        set_error(PyType_GetModuleState(Py_TYPE(self)), err);
+        return -1;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    if (!busy) {
+        SubvolumeIterator_clear_buffer(self);
+        if (self->iter)
+            btrfs_util_destroy_subvolume_iterator(self->iter);
+        self->iter = iter;
+        self->info_flag = info;
+        self->pending_err = BTRFS_UTIL_OK;
+        self->pending_errno = 0;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (busy) {
+        btrfs_util_destroy_subvolume_iterator(iter);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "SubvolumeIterator is in use by another thread");
         return -1;
     }
     return 0;
 }
 
-static PyObject *
-SubvolumeIterator_next(SubvolumeIteratorObject *self)
+/*
+ * Claim the iterator for one call.  The critical section taken here is
+ * suspended while a batch is fetched without the GIL, so the claim is
+ * kept in busy instead: a second thread calling in meanwhile gets an
+ * error rather than racing on the libbtrfsutil iterator and the
+ * read-ahead buffer.
+ */
+static int
+SubvolumeIterator_acquire(SubvolumeIteratorObject *self)
 {
-    enum btrfs_util_error err;
-    char *path = NULL;
+    int ret = -1;
 
-    if (!self->iter) {
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->busy)
+        PyErr_SetString(PyExc_RuntimeError,
+                        "SubvolumeIterator is in use by another thread");
+    else if (!self->iter)
         PyErr_SetString(PyExc_ValueError, "iterator is closed");
-        return NULL;
+    else {
+        self->busy = 1;
+        ret = 0;
     }
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
 
-    if (self->info_flag) {
-        struct btrfs_util_subvolume_info info;
-
-        Py_BEGIN_ALLOW_THREADS
-        err = btrfs_util_subvolume_iterator_next_info(
-            self->iter, &path, &info);
-        Py_END_ALLOW_THREADS
-
-        if (err == BTRFS_UTIL_ERROR_STOP_ITERATION)
-            return NULL;                 /* sets StopIteration */
-        if (err)
-            return set_error(err);
+static void
+SubvolumeIterator_release(SubvolumeIteratorObject *self)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->busy = 0;
+    Py_END_CRITICAL_SECTION();
+}
 
-        PyObject *p = PyUnicode_DecodeFSDefault(path);
-        free(path);
-        if (!p)
-            return NULL;
+enum btrfs_util_error
+iterator_fetch(struct btrfs_util_subvolume_iterator *iter, int info_flag,
+               struct iter_entry *out, size_t want, size_t *got)
+{
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+    size_t n = 0;
 
-        PyObject *i = SubvolumeInfo_from_struct(&info);
-        if (!i) { Py_DECREF(p); return NULL; }
+    while (n < want) {
+        struct iter_entry *e = &out[n];
 
-        PyObject *t = PyTuple_Pack(2, p, i);
-        Py_DECREF(p);
-        Py_DECREF(i);
-        return t;
+        e->path = NULL;
+        if (info_flag)
+            err = btrfs_util_subvolume_iterator_next_info(iter, &e->path,
+                                                          &e->info);
+        else
+            err = btrfs_util_subvolume_iterator_next(iter, &e->path,
+                                                     &e->info.id);
+        if (err)
+            break;
+        n++;
     }
+    *got = n;
+    return err;
+}
+
+/*
+ * Fetch up to *want* entries into *out* with a single GIL release and
+ * return how many were read.  Errors are not raised here: they are kept
+ * in pending_err so entries read before the failure are delivered first,
+ * and SubvolumeIterator_raise_pending() reports them once the caller has
+ * nothing else to return.
+ */
+static size_t
+SubvolumeIterator_fetch(SubvolumeIteratorObject *self,
+                        struct iter_entry *out, size_t want)
+{
+    enum btrfs_util_error err;
+    size_t got;
 
-    uint64_t id;
+    if (self->pending_err)
+        return 0;
 
     Py_BEGIN_ALLOW_THREADS
-    err = btrfs_util_subvolume_iterator_next(self->iter, &path, &id);
+    err = iterator_fetch(self->iter, self->info_flag, out, want, &got);
     Py_END_ALLOW_THREADS
 
-    if (err == BTRFS_UTIL_ERROR_STOP_ITERATION)
+    if (err && err != BTRFS_UTIL_ERROR_STOP_ITERATION) {
+        self->pending_err = err;
+        self->pending_errno = errno;
+    }
+    return got;
+}
+
+/* Raise a deferred error; with none pending this signals StopIteration. */
+static PyObject *
+SubvolumeIterator_raise_pending(SubvolumeIteratorObject *self)
+{
+    enum btrfs_util_error err = self->pending_err;
+
+    if (!err)
         return NULL;
-    if (err)
-        return set_error(err);
+    self->pending_err = BTRFS_UTIL_OK;
+    errno = self->pending_errno;
+    return set_error(PyType_GetModuleState(Py_TYPE(self)), err);
+}
 
-    PyObject *p = PyUnicode_DecodeFSDefault(path);
-    free(path);
+PyObject *
+iter_entry_tuple(module_state *st, struct iter_entry *e, int info_flag)
+{
+    PyObject *p = PyUnicode_DecodeFSDefault(e->path);
+    free(e->path);
+    e->path = NULL;
     if (!p)
         return NULL;
 
-    PyObject *id_obj = PyLong_FromUnsignedLongLong(id);
-    if (!id_obj) { Py_DECREF(p); return NULL; }
+    PyObject *v;
+    if (info_flag)
+        v = SubvolumeInfo_from_struct(st, &e->info);
+    else
+        v = PyLong_FromUnsignedLongLong(e->info.id);
+    if (!v) { Py_DECREF(p); return NULL; }
 
-    PyObject *t = PyTuple_Pack(2, p, id_obj);
+    PyObject *t = PyTuple_Pack(2, p, v);
     Py_DECREF(p);
-    Py_DECREF(id_obj);
+    Py_DECREF(v);
     return t;
 }
 
+static PyObject *
+SubvolumeIterator_entry(SubvolumeIteratorObject *self, struct iter_entry *e)
+{
+    return iter_entry_tuple(PyType_GetModuleState(Py_TYPE(self)), e,
+                            self->info_flag);
+}
+
+static PyObject *
+SubvolumeIterator_next_entry(SubvolumeIteratorObject *self)
+{
+    if (self->buf_pos == self->buf_len) {
+        if (!self->buf) {
+            self->buf = PyMem_Calloc(ITER_BATCH, sizeof(*self->buf));
+            if (!self->buf)
+                return PyErr_NoMemory();
+        }
+        self->buf_pos = 0;
+        self->buf_len = SubvolumeIterator_fetch(self, self->buf, ITER_BATCH);
+        if (!self->buf_len)
+            return SubvolumeIterator_raise_pending(self);
+    }
+
+    return SubvolumeIterator_entry(self, &self->buf[self->buf_pos++]);
+}
+
+static PyObject *
+SubvolumeIterator_next(SubvolumeIteratorObject *self)
+{
+    if (SubvolumeIterator_acquire(self) < 0)
+        return NULL;
+    PyObject *result = SubvolumeIterator_next_entry(self);
+    SubvolumeIterator_release(self);
+    return result;
+}
+
+static PyObject *
+SubvolumeIterator_take(SubvolumeIteratorObject *self, Py_ssize_t want)
+{
+    /* hand out read-ahead left by __next__ first, then fetch the rest */
+    size_t buffered = self->buf_len - self->buf_pos;
+    if (buffered > (size_t)want)
+        buffered = (size_t)want;
+    struct iter_entry *head = self->buf ? self->buf + self->buf_pos : NULL;
+    self->buf_pos += buffered;
+
+    struct iter_entry *fresh = NULL;
+    size_t rest = (size_t)want - buffered, got = 0;
+
+    if (rest) {
+        fresh = PyMem_Calloc(rest, sizeof(*fresh));
+        if (!fresh) {
+            free_entries(head, buffered);
+            return PyErr_NoMemory();
+        }
+        got = SubvolumeIterator_fetch(self, fresh, rest);
+    }
+
+    size_t total = buffered + got;
+    if (!total) {
+        PyMem_Free(fresh);
+        if (self->pending_err)
+            return SubvolumeIterator_raise_pending(self);
+        return PyList_New(0);
+    }
+
+    PyObject *list = PyList_New((Py_ssize_t)total);
+    for (size_t i = 0; list && i < total; i++) {
+        PyObject *t = SubvolumeIterator_entry(
+            self, i < buffered ? &head[i] : &fresh[i - buffered]);
+        if (!t) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, t);
+    }
+
+    if (!list) {
+        /* converted entries already had their path freed and cleared */
+        free_entries(head, buffered);
+        free_entries(fresh, got);
+    }
+    PyMem_Free(fresh);
+    return list;
+}
+
+static PyObject *
+SubvolumeIterator_next_batch(SubvolumeIteratorObject *self,
+                             PyObject *const *args, Py_ssize_t nargs,
+                             PyObject *kwnames)
+{
+    static char *kw[] = {"n", NULL};
+    static FastArgsParser parser = {kw, "|n", "next_batch"};
+    Py_ssize_t want = ITER_BATCH;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &want))
+        return NULL;
+    if (want <= 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be positive");
+        return NULL;
+    }
+    if (SubvolumeIterator_acquire(self) < 0)
+        return NULL;
+    PyObject *result = SubvolumeIterator_take(self, want);
+    SubvolumeIterator_release(self);
+    return result;
+}
+
 /* close / context-manager */
 
 static PyObject *
 SubvolumeIterator_close(SubvolumeIteratorObject *self, PyObject *Py_UNUSED(a))
 {
-    if (self->iter) {
-        btrfs_util_destroy_subvolume_iterator(self->iter);
-        self->iter = NULL;
+    int busy;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    if (!busy) {
+        SubvolumeIterator_clear_buffer(self);
+        if (self->iter) {
+            btrfs_util_destroy_subvolume_iterator(self->iter);
+            self->iter = NULL;
+        }
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "SubvolumeIterator is in use by another thread");
+        return NULL;
     }
     Py_RETURN_NONE;
 }
@@ -135,16 +369,25 @@ SubvolumeIterator_exit(SubvolumeIteratorObject *self, PyObject *args)
 static PyObject *
 SubvolumeIterator_get_fd(SubvolumeIteratorObject *self, void *closure)
 {
-    if (!self->iter) {
+    PyObject *fd = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->iter)
+        fd = PyLong_FromLong(btrfs_util_subvolume_iterator_fd(self->iter));
+    else
         PyErr_SetString(PyExc_ValueError, "iterator is closed");
-        return NULL;
-    }
-    return PyLong_FromLong(btrfs_util_subvolume_iterator_fd(self->iter));
+    Py_END_CRITICAL_SECTION();
+    return fd;
 }
 
 /* -- type tables ----------------------------------------------------- */
 
 static PyMethodDef SubvolumeIterator_methods[] = {
+    {"next_batch", (PyCFunction)SubvolumeIterator_next_batch,
+     METH_FASTCALL | METH_KEYWORDS,
+     "next_batch(n: int = 256) -> list[tuple[str, int | SubvolumeInfo]]\n\n"
+     "Return up to n entries, fetched with a single GIL release.\n"
+     "An empty list means the iterator is exhausted."},
     {"close",     (PyCFunction)SubvolumeIterator_close, METH_NOARGS,
      "close() -> None\n\nClose the iterator and release resources."},
     {"__enter__", (PyCFunction)SubvolumeIterator_enter, METH_NOARGS,
@@ -160,18 +403,22 @@ static PyGetSetDef SubvolumeIterator_getset[] = {
     {NULL}
 };
 
-PyTypeObject SubvolumeIteratorType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name      = "pybtrfs.SubvolumeIterator",
-    .tp_basicsize = sizeof(SubvolumeIteratorObject),
-    .tp_dealloc   = (destructor)SubvolumeIterator_dealloc,
-    .tp_flags     = Py_TPFLAGS_DEFAULT,
-    .tp_doc       = "SubvolumeIterator(path: str, top: int = 0, post_order: bool = False, info: bool = False)\n\n"
-                    "Iterator over Btrfs subvolumes.",
-    .tp_iter      = PyObject_SelfIter,
-    .tp_iternext  = (iternextfunc)SubvolumeIterator_next,
-    .tp_methods   = SubvolumeIterator_methods,
-    .tp_getset    = SubvolumeIterator_getset,
-    .tp_init      = (initproc)SubvolumeIterator_init,
-    .tp_new       = PyType_GenericNew,
+static PyType_Slot SubvolumeIterator_slots[] = {
+    {Py_tp_dealloc,  SubvolumeIterator_dealloc},
+    {Py_tp_doc,      "SubvolumeIterator(path: str, top: int = 0, post_order: bool = False, info: bool = False)\n\n"
+                     "Iterator over Btrfs subvolumes."},
+    {Py_tp_iter,     PyObject_SelfIter},
+    {Py_tp_iternext, SubvolumeIterator_next},
+    {Py_tp_methods,  SubvolumeIterator_methods},
+    {Py_tp_getset,   SubvolumeIterator_getset},
+    {Py_tp_init,     SubvolumeIterator_init},
+    {Py_tp_new,      PyType_GenericNew},
+    {0, NULL}
+};
+
+PyType_Spec SubvolumeIterator_spec = {
+    .name      = "pybtrfs.SubvolumeIterator",
+    .basicsize = sizeof(SubvolumeIteratorObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = SubvolumeIterator_slots,
 };
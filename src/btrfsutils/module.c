@@ -1,99 +1,117 @@
 #include "module.h"
 
-/* defined in error.c */
-extern PyObject *BtrfsUtilError_type_new(void);
+/* -- module state ---------------------------------------------------- */
 
-/* -- merge sentinel-terminated method tables ------------------------- */
+static struct PyModuleDef module_def;
+
+module_state *
+find_module_state(PyTypeObject *type)
+{
+#if PY_VERSION_HEX >= 0x030B0000
+    PyObject *m = PyType_GetModuleByDef(type, &module_def);
+    return m ? get_module_state(m) : NULL;
+#else
+    PyObject *mro = type->tp_mro;
+
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(mro); i++) {
+        PyTypeObject *base = (PyTypeObject *)PyTuple_GET_ITEM(mro, i);
+        if (!(base->tp_flags & Py_TPFLAGS_HEAPTYPE))
+            continue;
+        PyObject *m = ((PyHeapTypeObject *)base)->ht_module;
+        if (m && PyModule_GetDef(m) == &module_def)
+            return get_module_state(m);
+    }
+    PyErr_Format(PyExc_TypeError, "no superclass of '%s' is a pybtrfs type",
+                 type->tp_name);
+    return NULL;
+#endif
+}
 
 static int
-count_methods(PyMethodDef *m)
+module_traverse(PyObject *m, visitproc visit, void *arg)
 {
-    int n = 0;
-    while (m->ml_name) { n++; m++; }
-    return n;
+    module_state *st = get_module_state(m);
+
+    Py_VISIT(st->BtrfsUtilError);
+    Py_VISIT(st->SubvolumeInfoType);
+    Py_VISIT(st->ColumnType);
+    Py_VISIT(st->SubvolumeIteratorType);
+    Py_VISIT(st->QgroupInheritType);
+    Py_VISIT(st->FilesystemType);
+    Py_VISIT(st->AioQueueType);
+    Py_VISIT(st->AioCursorType);
+    return 0;
 }
 
-static PyMethodDef *
-merge_methods(void)
+static int
+module_clear(PyObject *m)
 {
-    int ns = count_methods(sync_methods);
-    int nv = count_methods(subvolume_methods);
-    int total = ns + nv;
-
-    PyMethodDef *all = PyMem_Calloc((size_t)(total + 1), sizeof(PyMethodDef));
-    if (!all)
-        return NULL;
-
-    memcpy(all, sync_methods, (size_t)ns * sizeof(PyMethodDef));
-    memcpy(all + ns, subvolume_methods, (size_t)nv * sizeof(PyMethodDef));
-    /* last entry is already zeroed by Calloc */
-    return all;
+    module_state *st = get_module_state(m);
+
+    Py_CLEAR(st->BtrfsUtilError);
+    Py_CLEAR(st->SubvolumeInfoType);
+    Py_CLEAR(st->ColumnType);
+    Py_CLEAR(st->SubvolumeIteratorType);
+    Py_CLEAR(st->QgroupInheritType);
+    Py_CLEAR(st->FilesystemType);
+    Py_CLEAR(st->AioQueueType);
+    Py_CLEAR(st->AioCursorType);
+    return 0;
 }
 
-/* -- module definition ----------------------------------------------- */
+static void
+module_free(void *m)
+{
+    module_clear((PyObject *)m);
+}
 
-static struct PyModuleDef module_def = {
-    PyModuleDef_HEAD_INIT,
-    .m_name    = "btrfsutils",
-    .m_doc     = "Python bindings for libbtrfsutil.",
-    .m_size    = -1,
-    .m_methods = NULL,  /* filled in PyInit */
-};
+/* Create the type for *spec* into *out*; public types also go on *m*. */
+static int
+add_type(PyObject *m, PyType_Spec *spec, PyTypeObject **out, int public)
+{
+    *out = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL);
+    if (!*out)
+        return -1;
+    return public ? PyModule_AddType(m, *out) : 0;
+}
 
-PyMODINIT_FUNC
-PyInit_btrfsutils(void)
+/* -- module definition ----------------------------------------------- */
+
+static int
+module_exec(PyObject *m)
 {
-    /* types */
-    if (PyType_Ready(&SubvolumeInfoType) < 0)
-        return NULL;
-    if (PyType_Ready(&SubvolumeIteratorType) < 0)
-        return NULL;
-    if (PyType_Ready(&QgroupInheritType) < 0)
-        return NULL;
-
-    /* merge method tables */
-    PyMethodDef *methods = merge_methods();
-    if (!methods)
-        return PyErr_NoMemory();
-    module_def.m_methods = methods;
-
-    PyObject *m = PyModule_Create(&module_def);
-    if (!m) {
-        PyMem_Free(methods);
-        return NULL;
-    }
+    module_state *st = get_module_state(m);
+
+    if (PyModule_AddFunctions(m, sync_methods) < 0 ||
+        PyModule_AddFunctions(m, subvolume_methods) < 0 ||
+        PyModule_AddFunctions(m, bulk_methods) < 0)
+        return -1;
 
     /* exception */
-    BtrfsUtilError = BtrfsUtilError_type_new();
-    if (!BtrfsUtilError) { Py_DECREF(m); return NULL; }
-    if (PyModule_AddObject(m, "BtrfsUtilError", BtrfsUtilError) < 0) {
-        Py_DECREF(BtrfsUtilError);
-        Py_DECREF(m);
-        return NULL;
-    }
+    st->BtrfsUtilError = BtrfsUtilError_type_new(m);
+    if (!st->BtrfsUtilError)
+        return -1;
+    if (PyModule_AddObjectRef(m, "BtrfsUtilError", st->BtrfsUtilError) < 0)
+        return -1;
 
     /* types */
-    Py_INCREF(&SubvolumeInfoType);
-    if (PyModule_AddObject(m, "SubvolumeInfo",
-                           (PyObject *)&SubvolumeInfoType) < 0)
-        goto fail;
-
-    Py_INCREF(&SubvolumeIteratorType);
-    if (PyModule_AddObject(m, "SubvolumeIterator",
-                           (PyObject *)&SubvolumeIteratorType) < 0)
-        goto fail;
-
-    Py_INCREF(&QgroupInheritType);
-    if (PyModule_AddObject(m, "QgroupInherit",
-                           (PyObject *)&QgroupInheritType) < 0)
-        goto fail;
+    if (add_type(m, &SubvolumeInfo_spec, &st->SubvolumeInfoType, 1) < 0 ||
+        add_type(m, &Column_spec, &st->ColumnType, 0) < 0 ||
+        add_type(m, &SubvolumeIterator_spec,
+                 &st->SubvolumeIteratorType, 1) < 0 ||
+        add_type(m, &QgroupInherit_spec, &st->QgroupInheritType, 1) < 0 ||
+        add_type(m, &Filesystem_spec, &st->FilesystemType, 1) < 0 ||
+        add_type(m, &AioQueue_spec, &st->AioQueueType, 1) < 0 ||
+        add_type(m, &AioCursor_spec, &st->AioCursorType, 1) < 0)
+        return -1;
 
     /* __annotations__ for BtrfsUtilError (heap type) */
     {
         PyObject *ann = PyDict_New();
-        if (!ann) goto fail;
+        if (!ann)
+            return -1;
         PyDict_SetItemString(ann, "btrfsutil_errno", (PyObject *)&PyLong_Type);
-        PyObject_SetAttrString(BtrfsUtilError, "__annotations__", ann);
+        PyObject_SetAttrString(st->BtrfsUtilError, "__annotations__", ann);
         Py_DECREF(ann);
     }
 
@@ -119,9 +137,34 @@ PyInit_btrfsutils(void)
     PyModule_AddIntMacro(m, BTRFS_UTIL_DELETE_SUBVOLUME_RECURSIVE);
     PyModule_AddIntMacro(m, BTRFS_UTIL_SUBVOLUME_ITERATOR_POST_ORDER);
 
-    return m;
+    return 0;
+}
 
-fail:
-    Py_DECREF(m);
-    return NULL;
+static PyModuleDef_Slot module_slots[] = {
+    {Py_mod_exec, module_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    /* objects with mutable state lock themselves; see iterator.c */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    .m_name     = "btrfsutils",
+    .m_doc      = "Python bindings for libbtrfsutil.",
+    .m_size     = sizeof(module_state),
+    .m_slots    = module_slots,
+    .m_traverse = module_traverse,
+    .m_clear    = module_clear,
+    .m_free     = module_free,
+};
+
+PyMODINIT_FUNC
+PyInit_btrfsutils(void)
+{
+    return PyModuleDef_Init(&module_def);
 }
@@ -5,17 +5,78 @@
 #include <Python.h>
 #include <structmember.h>
 #include "btrfsutil.h"
+#include "column.h"
+#include "deadline.h"
+#include "fastargs.h"
+
+/*
+ * Per-object locking for free-threaded builds.  With the GIL, and before
+ * 3.13, the critical section is a plain block.
+ */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+/*
+ * Per-module state.  Each interpreter that imports the module gets its
+ * own exception and types, so objects never cross interpreters.  Module
+ * functions reach it through their module argument, methods through the
+ * type of self.
+ */
+typedef struct {
+    PyObject *BtrfsUtilError;
+    PyTypeObject *SubvolumeInfoType;
+    PyTypeObject *ColumnType;
+    PyTypeObject *SubvolumeIteratorType;
+    PyTypeObject *QgroupInheritType;
+    PyTypeObject *FilesystemType;
+    PyTypeObject *AioQueueType;
+    PyTypeObject *AioCursorType;
+} module_state;
+
+static inline module_state *
+get_module_state(PyObject *module)
+{
+    return (module_state *)PyModule_GetState(module);
+}
+
+/* state of the module that defined *type* or one of its bases */
+module_state *find_module_state(PyTypeObject *type);
 
 /* BtrfsUtilError exception — defined in error.c */
-extern PyObject *BtrfsUtilError;
-PyObject *set_error(enum btrfs_util_error err);
+PyObject *BtrfsUtilError_type_new(PyObject *module);
+PyObject *set_error(module_state *st, enum btrfs_util_error err);
+/* new exception instance for a failure recorded without the GIL */
+PyObject *make_error(module_state *st, enum btrfs_util_error err,
+                     int errnum);
 
 /* SubvolumeInfo — defined in subvol_info.c */
-extern PyTypeObject SubvolumeInfoType;
-PyObject *SubvolumeInfo_from_struct(const struct btrfs_util_subvolume_info *info);
+extern PyType_Spec SubvolumeInfo_spec;
+PyObject *SubvolumeInfo_from_struct(
+    module_state *st, const struct btrfs_util_subvolume_info *info);
 
 /* SubvolumeIterator — defined in iterator.c */
-extern PyTypeObject SubvolumeIteratorType;
+extern PyType_Spec SubvolumeIterator_spec;
+
+/* one raw result from libbtrfsutil, converted to Python later */
+struct iter_entry {
+    char *path;
+    struct btrfs_util_subvolume_info info;  /* only .id is set without info */
+};
+
+/*
+ * Pull up to *want* entries into *out*.  Runs without the GIL.  Returns
+ * BTRFS_UTIL_OK when the batch is full, BTRFS_UTIL_ERROR_STOP_ITERATION
+ * when the iterator ran dry, or the first error; *got* is always set.
+ */
+enum btrfs_util_error iterator_fetch(
+    struct btrfs_util_subvolume_iterator *iter, int info_flag,
+    struct iter_entry *out, size_t want, size_t *got);
+void free_entries(struct iter_entry *e, size_t n);
+/* (path, id) or (path, SubvolumeInfo) tuple; frees and clears e->path */
+PyObject *iter_entry_tuple(module_state *st, struct iter_entry *e,
+                           int info_flag);
 
 /* QgroupInherit — defined in qgroup.c */
 typedef struct {
@@ -23,10 +84,54 @@ typedef struct {
     struct btrfs_util_qgroup_inherit *inherit;
 } QgroupInheritObject;
 
-extern PyTypeObject QgroupInheritType;
+extern PyType_Spec QgroupInherit_spec;
+
+/*
+ * add_group() reallocates obj->inherit, so calls that release the GIL work
+ * on a private copy instead.  *out is NULL for a NULL obj; free the copy
+ * with qgroup_inherit_free(), which preserves errno.
+ */
+int qgroup_inherit_copy(module_state *st, QgroupInheritObject *obj,
+                        struct btrfs_util_qgroup_inherit **out);
+void qgroup_inherit_free(struct btrfs_util_qgroup_inherit *qg);
+
+/*
+ * fd-based listing and UUID lookups — defined in subvolume.c, shared by
+ * the module functions and Filesystem methods.
+ */
+PyObject *subvolume_list_fd(module_state *st, int fd, uint64_t top, int info,
+                            uint64_t min_transid);
+PyObject *subvolume_columns_fd(module_state *st, int fd, uint64_t top,
+                               uint64_t min_transid);
+PyObject *find_subvolume_fd(module_state *st, int fd, const char *uuid,
+                            Py_ssize_t uuid_len, int received);
+PyObject *find_subvolumes_fd(module_state *st, int fd, PyObject *uuids,
+                             int received);
+PyObject *deleted_array_fd(module_state *st, int fd, int count_only);
+PyObject *wait_cleaned_fd(module_state *st, int fd, PyObject *ids,
+                          PyObject *timeout);
+
+/*
+ * Group-committed BTRFS_IOC_SYNC shared by concurrent callers on the same
+ * filesystem — defined in sync.c.  Call without the GIL.
+ */
+enum btrfs_util_error sync_coalesced_fd(int fd);
+enum btrfs_util_error sync_coalesced(const char *path);
+
+/* wait_sync() with an optional timeout — defined in sync.c */
+PyObject *wait_sync_fd(module_state *st, int fd, uint64_t transid,
+                       PyObject *timeout);
+
+/* Filesystem — defined in filesystem.c */
+extern PyType_Spec Filesystem_spec;
+
+/* completion queue behind pybtrfs.aio — defined in aio.c */
+extern PyType_Spec AioQueue_spec;
+extern PyType_Spec AioCursor_spec;
 
 /* Method tables exported by each translation unit */
 extern PyMethodDef sync_methods[];
 extern PyMethodDef subvolume_methods[];
+extern PyMethodDef bulk_methods[];
 
 #endif /* PYBTRFS_MODULE_H */
@@ -0,0 +1,89 @@
+#include "pool.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct pool_job {
+    atomic_size_t next;
+    size_t n;
+    void (*fn)(void *ctx, size_t i);
+    void *ctx;
+};
+
+static void *
+pool_worker(void *arg)
+{
+    struct pool_job *job = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n)
+        job->fn(job->ctx, i);
+    return NULL;
+}
+
+unsigned int
+pool_default_workers(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+
+void
+pool_run(size_t n, unsigned int workers,
+         void (*fn)(void *ctx, size_t i), void *ctx)
+{
+    struct pool_job job = {.n = n, .fn = fn, .ctx = ctx};
+    pthread_t *threads = NULL;
+    unsigned int started = 0;
+
+    atomic_init(&job.next, 0);
+
+    if (!workers)
+        workers = pool_default_workers();
+    if (workers > n)
+        workers = (unsigned int)n;
+
+    /* the calling thread is one of the workers */
+    if (workers > 1)
+        threads = malloc((workers - 1) * sizeof(*threads));
+    if (threads) {
+        while (started < workers - 1 &&
+               pthread_create(&threads[started], NULL, pool_worker,
+                              &job) == 0)
+            started++;
+    }
+
+    pool_worker(&job);
+
+    for (unsigned int t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    free(threads);
+}
+
+unsigned int
+pool_start(struct pool_threads *p, unsigned int workers,
+           void *(*fn)(void *arg), void *arg)
+{
+    p->started = 0;
+    if (!workers)
+        workers = pool_default_workers();
+
+    p->threads = malloc(workers * sizeof(*p->threads));
+    if (!p->threads)
+        return 0;
+    while (p->started < workers &&
+           pthread_create(&p->threads[p->started], NULL, fn, arg) == 0)
+        p->started++;
+    return p->started;
+}
+
+void
+pool_join(struct pool_threads *p)
+{
+    for (unsigned int t = 0; t < p->started; t++)
+        pthread_join(p->threads[t], NULL);
+    free(p->threads);
+    p->threads = NULL;
+    p->started = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef PYBTRFS_POOL_H
+#define PYBTRFS_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Minimal fork/join worker pool for bulk operations.  Plain C with no
+ * Python dependency: callers release the GIL around pool_run().
+ */
+
+/* Number of workers to use when the caller passes 0: online CPUs. */
+unsigned int pool_default_workers(void);
+
+/*
+ * Call fn(ctx, i) once for every i in [0, n), spread over up to *workers*
+ * threads including the calling one.  Returns when all calls are done.
+ * If threads cannot be created, the caller runs the remaining work.
+ */
+void pool_run(size_t n, unsigned int workers,
+              void (*fn)(void *ctx, size_t i), void *ctx);
+
+/*
+ * Background workers for jobs that schedule their own work, leaving the
+ * calling thread free (e.g. to report progress).  pool_start() runs
+ * fn(arg) on up to *workers* threads (0: one per CPU) and returns how
+ * many were started; if that is 0 the caller must run fn(arg) itself.
+ */
+struct pool_threads {
+    pthread_t *threads;
+    unsigned int started;
+};
+
+unsigned int pool_start(struct pool_threads *p, unsigned int workers,
+                        void *(*fn)(void *arg), void *arg);
+void pool_join(struct pool_threads *p);
+
+#endif /* PYBTRFS_POOL_H */
@@ -1,11 +1,15 @@
 #include "module.h"
+#include <errno.h>
 
 static void
 QgroupInherit_dealloc(QgroupInheritObject *self)
 {
+    PyTypeObject *tp = Py_TYPE(self);
+
     if (self->inherit)
         btrfs_util_destroy_qgroup_inherit(self->inherit);
-    Py_TYPE(self)->tp_free((PyObject *)self);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
 }
 
 static int
@@ -18,24 +22,28 @@ QgroupInherit_init(QgroupInheritObject *self, PyObject *args, PyObject *kwds)
 
     err = btrfs_util_create_qgroup_inherit(0, &self->inherit);
     if (err) {
-        set_error(err);
+        set_error(PyType_GetModuleState(Py_TYPE(self)), err);
         return -1;
     }
     return 0;
 }
 
 static PyObject *
-QgroupInherit_add_group(QgroupInheritObject *self, PyObject *args)
+QgroupInherit_add_group(QgroupInheritObject *self, PyObject *const *args,
+                        Py_ssize_t nargs)
 {
+    static FastArgsParser parser = {NULL, "K", "add_group"};
     uint64_t qgroupid;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTuple(args, "K", &qgroupid))
+    if (!fastargs_parse(&parser, args, nargs, NULL, &qgroupid))
         return NULL;
 
+    Py_BEGIN_CRITICAL_SECTION(self);
     err = btrfs_util_qgroup_inherit_add_group(&self->inherit, qgroupid);
+    Py_END_CRITICAL_SECTION();
     if (err)
-        return set_error(err);
+        return set_error(PyType_GetModuleState(Py_TYPE(self)), err);
 
     Py_RETURN_NONE;
 }
@@ -45,37 +53,80 @@ QgroupInherit_get_groups(QgroupInheritObject *self, PyObject *Py_UNUSED(a))
 {
     const uint64_t *groups;
     size_t n;
+    PyObject *list;
 
+    Py_BEGIN_CRITICAL_SECTION(self);
     btrfs_util_qgroup_inherit_get_groups(self->inherit, &groups, &n);
 
-    PyObject *list = PyList_New((Py_ssize_t)n);
-    if (!list)
-        return NULL;
-
-    for (size_t i = 0; i < n; i++) {
+    list = PyList_New((Py_ssize_t)n);
+    for (size_t i = 0; list && i < n; i++) {
         PyObject *v = PyLong_FromUnsignedLongLong(groups[i]);
-        if (!v) { Py_DECREF(list); return NULL; }
+        if (!v) { Py_CLEAR(list); break; }
         PyList_SET_ITEM(list, (Py_ssize_t)i, v);
     }
+    Py_END_CRITICAL_SECTION();
     return list;
 }
 
+int
+qgroup_inherit_copy(module_state *st, QgroupInheritObject *obj,
+                    struct btrfs_util_qgroup_inherit **out)
+{
+    struct btrfs_util_qgroup_inherit *copy = NULL;
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+    const uint64_t *groups;
+    size_t n;
+
+    *out = NULL;
+    if (!obj)
+        return 0;
+
+    Py_BEGIN_CRITICAL_SECTION(obj);
+    btrfs_util_qgroup_inherit_get_groups(obj->inherit, &groups, &n);
+    err = btrfs_util_create_qgroup_inherit(0, &copy);
+    for (size_t i = 0; !err && i < n; i++)
+        err = btrfs_util_qgroup_inherit_add_group(&copy, groups[i]);
+    Py_END_CRITICAL_SECTION();
+
+    if (err) {
+        qgroup_inherit_free(copy);
+        set_error(st, err);
+        return -1;
+    }
+    *out = copy;
+    return 0;
+}
+
+void
+qgroup_inherit_free(struct btrfs_util_qgroup_inherit *qg)
+{
+    int saved_errno = errno;
+
+    if (qg)
+        btrfs_util_destroy_qgroup_inherit(qg);
+    errno = saved_errno;
+}
+
 static PyMethodDef QgroupInherit_methods[] = {
-    {"add_group",  (PyCFunction)QgroupInherit_add_group,  METH_VARARGS,
+    {"add_group",  (PyCFunction)QgroupInherit_add_group,  METH_FASTCALL,
      "add_group(qgroupid: int) -> None\n\nAdd a qgroup to inherit from."},
     {"get_groups", (PyCFunction)QgroupInherit_get_groups, METH_NOARGS,
      "get_groups() -> list[int]\n\nGet the list of qgroup IDs to inherit from."},
     {NULL}
 };
 
-PyTypeObject QgroupInheritType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name      = "pybtrfs.QgroupInherit",
-    .tp_basicsize = sizeof(QgroupInheritObject),
-    .tp_dealloc   = (destructor)QgroupInherit_dealloc,
-    .tp_flags     = Py_TPFLAGS_DEFAULT,
-    .tp_doc       = "QgroupInherit()\n\nQgroup inheritance specifier.",
-    .tp_methods   = QgroupInherit_methods,
-    .tp_init      = (initproc)QgroupInherit_init,
-    .tp_new       = PyType_GenericNew,
+static PyType_Slot QgroupInherit_slots[] = {
+    {Py_tp_dealloc, QgroupInherit_dealloc},
+    {Py_tp_doc,     "QgroupInherit()\n\nQgroup inheritance specifier."},
+    {Py_tp_methods, QgroupInherit_methods},
+    {Py_tp_init,    QgroupInherit_init},
+    {Py_tp_new,     PyType_GenericNew},
+    {0, NULL}
+};
+
+PyType_Spec QgroupInherit_spec = {
+    .name      = "pybtrfs.QgroupInherit",
+    .basicsize = sizeof(QgroupInheritObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = QgroupInherit_slots,
 };
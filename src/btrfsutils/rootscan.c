@@ -0,0 +1,532 @@
+#include "rootscan.h"
+#include "search.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+enum { PATH_UNKNOWN, PATH_INSIDE, PATH_OUTSIDE };
+
+/* one root-tree subvolume while the scan is being assembled */
+struct scan_root {
+    struct subvol_entry e;
+    int has_ref;          /* saw its ROOT_BACKREF (not deleted) */
+    int ref_looked_up;    /* targeted backref search already done */
+    int report;           /* part of the result, not only a path hop */
+    int state;
+    const char *dirpath;  /* directory inside the parent: "" or "a/b/" */
+};
+
+struct scan_ctx {
+    int fd;
+    uint64_t top;
+    uint64_t min_transid;
+    struct scan_root *roots;  /* ascending id, as laid out in the tree */
+    size_t n, cap;
+    char **dirs;              /* INO_LOOKUP results, owned */
+    size_t ndirs;
+    size_t *chain;            /* scratch for walking parent links */
+};
+
+/* -- root tree sweep ------------------------------------------------- */
+
+static void
+root_item_to_info(uint64_t id, const void *item, uint32_t len,
+                  struct btrfs_util_subvolume_info *info)
+{
+    struct btrfs_root_item ri;
+
+    /* items written before the v2 fields existed are shorter */
+    memset(&ri, 0, sizeof(ri));
+    memcpy(&ri, item, len < sizeof(ri) ? len : sizeof(ri));
+
+    memset(info, 0, sizeof(*info));
+    info->id         = id;
+    info->flags      = le64toh(ri.flags);
+    info->generation = le64toh(ri.generation);
+    info->ctransid   = le64toh(ri.ctransid);
+    info->otransid   = le64toh(ri.otransid);
+    info->stransid   = le64toh(ri.stransid);
+    info->rtransid   = le64toh(ri.rtransid);
+    memcpy(info->uuid, ri.uuid, sizeof(info->uuid));
+    memcpy(info->parent_uuid, ri.parent_uuid, sizeof(info->parent_uuid));
+    memcpy(info->received_uuid, ri.received_uuid,
+           sizeof(info->received_uuid));
+
+#define TS(f)                                               \
+    info->f.tv_sec  = (time_t)le64toh(ri.f.sec);            \
+    info->f.tv_nsec = (long)le32toh(ri.f.nsec)
+    TS(ctime);
+    TS(otime);
+    TS(stime);
+    TS(rtime);
+#undef TS
+}
+
+static struct scan_root *
+add_root(struct scan_ctx *c)
+{
+    if (c->n == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 256;
+        struct scan_root *r = realloc(c->roots, cap * sizeof(*r));
+        if (!r)
+            return NULL;
+        c->roots = r;
+        c->cap = cap;
+    }
+    struct scan_root *r = &c->roots[c->n++];
+    memset(r, 0, sizeof(*r));
+    return r;
+}
+
+/* Attach a ROOT_BACKREF item; returns -1 only when out of memory. */
+static int
+parse_backref(struct scan_root *r,
+              const struct btrfs_ioctl_search_header *h, const void *item)
+{
+    const struct btrfs_root_ref *ref = item;
+    size_t len;
+
+    if (r->has_ref || h->len < sizeof(*ref))
+        return 0;
+    len = le16toh(ref->name_len);
+    if (sizeof(*ref) + len > h->len)
+        return 0;
+
+    r->e.name = malloc(len + 1);
+    if (!r->e.name)
+        return -1;
+    memcpy(r->e.name, (const char *)(ref + 1), len);
+    r->e.name[len] = '\0';
+    r->e.info.parent_id = h->offset;
+    r->e.info.dir_id = le64toh(ref->dirid);
+    r->has_ref = 1;
+    return 0;
+}
+
+/*
+ * One pass over ROOT_ITEM/ROOT_BACKREF keys.  With min_transid set the
+ * kernel skips leaves older than it; root items that share a newer leaf
+ * are filtered on their own generation here.
+ */
+static enum btrfs_util_error
+sweep_root_tree(struct scan_ctx *c)
+{
+    struct btrfs_ioctl_search_key key = {
+        .tree_id      = BTRFS_ROOT_TREE_OBJECTID,
+        .min_objectid = BTRFS_FIRST_FREE_OBJECTID,
+        .max_objectid = BTRFS_LAST_FREE_OBJECTID,
+        .min_type     = BTRFS_ROOT_ITEM_KEY,
+        .max_type     = BTRFS_ROOT_BACKREF_KEY,
+        .min_offset   = 0,
+        .max_offset   = (uint64_t)-1,
+        .min_transid  = c->min_transid,
+        .max_transid  = (uint64_t)-1,
+    };
+    struct tree_search s;
+    const struct btrfs_ioctl_search_header *h;
+    const void *item;
+    int ret;
+
+    if (tree_search_init(&s, c->fd, &key, TREE_SEARCH_BUF_SIZE) < 0)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+
+    while ((ret = tree_search_next(&s, &h, &item)) > 0) {
+        /* the range also spans other key types of lower objectids */
+        if (h->type == BTRFS_ROOT_ITEM_KEY) {
+            struct btrfs_util_subvolume_info info;
+
+            root_item_to_info(h->objectid, item, h->len, &info);
+            if (info.generation < c->min_transid)
+                continue;
+            struct scan_root *r = add_root(c);
+            if (!r)
+                goto nomem;
+            r->e.info = info;
+            r->report = 1;
+        }
+        else if (h->type == BTRFS_ROOT_BACKREF_KEY) {
+            /* ROOT_ITEM sorts first, so the backref belongs to the tail */
+            if (!c->n || c->roots[c->n - 1].e.info.id != h->objectid)
+                continue;
+            if (parse_backref(&c->roots[c->n - 1], h, item) < 0)
+                goto nomem;
+        }
+    }
+
+    tree_search_release(&s);
+    return ret < 0 ? BTRFS_UTIL_ERROR_SEARCH_FAILED : BTRFS_UTIL_OK;
+
+nomem:
+    tree_search_release(&s);
+    errno = ENOMEM;
+    return BTRFS_UTIL_ERROR_NO_MEMORY;
+}
+
+/* Look up the ROOT_BACKREF of a single root, ignoring min_transid. */
+static enum btrfs_util_error
+fetch_backref(struct scan_ctx *c, struct scan_root *r)
+{
+    struct btrfs_ioctl_search_key key = {
+        .tree_id      = BTRFS_ROOT_TREE_OBJECTID,
+        .min_objectid = r->e.info.id,
+        .max_objectid = r->e.info.id,
+        .min_type     = BTRFS_ROOT_BACKREF_KEY,
+        .max_type     = BTRFS_ROOT_BACKREF_KEY,
+        .min_offset   = 0,
+        .max_offset   = (uint64_t)-1,
+        .min_transid  = 0,
+        .max_transid  = (uint64_t)-1,
+    };
+    struct tree_search s;
+    const struct btrfs_ioctl_search_header *h;
+    const void *item;
+    int ret;
+
+    r->ref_looked_up = 1;
+    if (tree_search_init(&s, c->fd, &key, 4096) < 0)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+
+    ret = tree_search_next(&s, &h, &item);
+    if (ret > 0 && parse_backref(r, h, item) < 0) {
+        errno = ENOMEM;
+        ret = -2;
+    }
+    tree_search_release(&s);
+
+    if (ret == -2)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+    return ret < 0 ? BTRFS_UTIL_ERROR_SEARCH_FAILED : BTRFS_UTIL_OK;
+}
+
+/* -- path reconstruction --------------------------------------------- */
+
+/* Binary search among the first *n* roots, which must be sorted. */
+static struct scan_root *
+find_root_n(struct scan_ctx *c, uint64_t id, size_t n)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t v = c->roots[mid].e.info.id;
+        if (v == id)
+            return &c->roots[mid];
+        if (v < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static struct scan_root *
+find_root(struct scan_ctx *c, uint64_t id)
+{
+    return find_root_n(c, id, c->n);
+}
+
+static int
+cmp_id(const void *a, const void *b)
+{
+    uint64_t x = ((const struct scan_root *)a)->e.info.id;
+    uint64_t y = ((const struct scan_root *)b)->e.info.id;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * A min_transid sweep only sees changed roots, and their backrefs or
+ * ancestors may sit in older leaves.  Fetch the missing backrefs one by
+ * one and add the ancestors as path-only hops, so the cost stays
+ * proportional to the changes rather than to the whole tree.
+ */
+static enum btrfs_util_error
+complete_ancestry(struct scan_ctx *c)
+{
+    enum btrfs_util_error err;
+
+    for (;;) {
+        size_t sorted = c->n;
+
+        for (size_t i = 0; i < sorted; i++) {
+            if (!c->roots[i].has_ref && !c->roots[i].ref_looked_up &&
+                (err = fetch_backref(c, &c->roots[i])))
+                return err;
+        }
+
+        /* queue parents that are neither the top nor known yet */
+        for (size_t i = 0; i < sorted; i++) {
+            uint64_t parent = c->roots[i].e.info.parent_id;
+
+            if (!c->roots[i].has_ref || parent == c->top ||
+                parent < BTRFS_FIRST_FREE_OBJECTID ||
+                find_root_n(c, parent, sorted))
+                continue;
+            struct scan_root *r = add_root(c);
+            if (!r) {
+                errno = ENOMEM;
+                return BTRFS_UTIL_ERROR_NO_MEMORY;
+            }
+            r->e.info.id = parent;
+        }
+        if (c->n == sorted)
+            return BTRFS_UTIL_OK;
+
+        /* merge the new hops in, dropping parents queued twice */
+        qsort(c->roots, c->n, sizeof(*c->roots), cmp_id);
+        size_t k = 0;
+        for (size_t i = 0; i < c->n; i++) {
+            if (k && c->roots[k - 1].e.info.id == c->roots[i].e.info.id)
+                continue;
+            c->roots[k++] = c->roots[i];
+        }
+        c->n = k;
+    }
+}
+
+/* Mark every root as below the scan top or not. */
+static void
+classify(struct scan_ctx *c)
+{
+    for (size_t i = 0; i < c->n; i++) {
+        size_t depth = 0;
+        int state = PATH_OUTSIDE;
+        struct scan_root *r = &c->roots[i];
+
+        /* walk up until the answer is known; depth bounds bad links */
+        while (r->state == PATH_UNKNOWN && depth < c->n) {
+            c->chain[depth++] = (size_t)(r - c->roots);
+            if (!r->has_ref)
+                break;
+            if (r->e.info.parent_id == c->top) {
+                state = PATH_INSIDE;
+                break;
+            }
+            struct scan_root *p = find_root(c, r->e.info.parent_id);
+            if (!p)
+                break;
+            r = p;
+        }
+        if (r->state != PATH_UNKNOWN)
+            state = r->state;
+        while (depth)
+            c->roots[c->chain[--depth]].state = state;
+    }
+}
+
+static int
+cmp_dir(const void *a, const void *b, void *arg)
+{
+    const struct scan_root *roots = arg;
+    const struct btrfs_util_subvolume_info *x = &roots[*(const size_t *)a].e.info;
+    const struct btrfs_util_subvolume_info *y = &roots[*(const size_t *)b].e.info;
+
+    if (x->parent_id != y->parent_id)
+        return x->parent_id < y->parent_id ? -1 : 1;
+    if (x->dir_id != y->dir_id)
+        return x->dir_id < y->dir_id ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Resolve the directory each subvolume sits in with one INO_LOOKUP per
+ * distinct (parent, dir) pair; subvolumes directly in the root directory
+ * of their parent, the common case, need none.
+ */
+static enum btrfs_util_error
+lookup_dirs(struct scan_ctx *c)
+{
+    size_t *idx = c->chain, m = 0;
+
+    for (size_t i = 0; i < c->n; i++) {
+        struct scan_root *r = &c->roots[i];
+        r->dirpath = "";
+        if (r->state == PATH_INSIDE &&
+            r->e.info.dir_id != BTRFS_FIRST_FREE_OBJECTID)
+            idx[m++] = i;
+    }
+    if (!m)
+        return BTRFS_UTIL_OK;
+
+    qsort_r(idx, m, sizeof(*idx), cmp_dir, c->roots);
+
+    c->dirs = calloc(m, sizeof(*c->dirs));
+    if (!c->dirs) {
+        errno = ENOMEM;
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+    }
+
+    const char *last = NULL;
+    for (size_t k = 0; k < m; k++) {
+        struct scan_root *r = &c->roots[idx[k]];
+
+        if (!k || cmp_dir(&idx[k - 1], &idx[k], c->roots)) {
+            struct btrfs_ioctl_ino_lookup_args args = {
+                .treeid   = r->e.info.parent_id,
+                .objectid = r->e.info.dir_id,
+            };
+            if (ioctl(c->fd, BTRFS_IOC_INO_LOOKUP, &args) < 0)
+                return BTRFS_UTIL_ERROR_INO_LOOKUP_FAILED;
+            args.name[sizeof(args.name) - 1] = '\0';
+            last = c->dirs[c->ndirs++] = strdup(args.name);
+            if (!last) {
+                errno = ENOMEM;
+                return BTRFS_UTIL_ERROR_NO_MEMORY;
+            }
+        }
+        r->dirpath = last;
+    }
+    return BTRFS_UTIL_OK;
+}
+
+static char *
+join_path(const char *parent, const char *dir, const char *name)
+{
+    size_t pl = strlen(parent), dl = strlen(dir), nl = strlen(name);
+    char *p = malloc(pl + 1 + dl + nl + 1), *q = p;
+
+    if (!p)
+        return NULL;
+    if (pl) {
+        memcpy(q, parent, pl);
+        q += pl;
+        *q++ = '/';
+    }
+    memcpy(q, dir, dl);
+    memcpy(q + dl, name, nl + 1);
+    return p;
+}
+
+static enum btrfs_util_error
+build_paths(struct scan_ctx *c)
+{
+    for (size_t i = 0; i < c->n; i++) {
+        struct scan_root *r = &c->roots[i];
+        size_t depth = 0;
+
+        /* collect ancestors whose path is still unknown */
+        while (r->state == PATH_INSIDE && !r->e.path) {
+            c->chain[depth++] = (size_t)(r - c->roots);
+            if (r->e.info.parent_id == c->top)
+                break;
+            r = find_root(c, r->e.info.parent_id);
+        }
+        while (depth) {
+            r = &c->roots[c->chain[--depth]];
+            struct scan_root *p = r->e.info.parent_id == c->top
+                ? NULL : find_root(c, r->e.info.parent_id);
+            r->e.path = join_path(p ? p->e.path : "", r->dirpath, r->e.name);
+            if (!r->e.path) {
+                errno = ENOMEM;
+                return BTRFS_UTIL_ERROR_NO_MEMORY;
+            }
+        }
+    }
+    return BTRFS_UTIL_OK;
+}
+
+/* -- public entry points --------------------------------------------- */
+
+static enum btrfs_util_error
+lookup_top(int fd, uint64_t *top)
+{
+    struct btrfs_ioctl_ino_lookup_args args = {
+        .treeid   = 0,
+        .objectid = BTRFS_FIRST_FREE_OBJECTID,
+    };
+
+    if (ioctl(fd, BTRFS_IOC_INO_LOOKUP, &args) < 0)
+        return BTRFS_UTIL_ERROR_INO_LOOKUP_FAILED;
+    *top = args.treeid;
+    return BTRFS_UTIL_OK;
+}
+
+static int
+cmp_path(const void *a, const void *b)
+{
+    return strcmp(((const struct subvol_entry *)a)->path,
+                  ((const struct subvol_entry *)b)->path);
+}
+
+static void
+scan_ctx_free(struct scan_ctx *c)
+{
+    for (size_t i = 0; i < c->n; i++) {
+        free(c->roots[i].e.name);
+        free(c->roots[i].e.path);
+    }
+    for (size_t i = 0; i < c->ndirs; i++)
+        free(c->dirs[i]);
+    free(c->dirs);
+    free(c->roots);
+    free(c->chain);
+}
+
+enum btrfs_util_error
+subvol_scan(int fd, uint64_t top, uint64_t min_transid,
+            struct subvol_scan *scan)
+{
+    struct scan_ctx c = { .fd = fd, .top = top, .min_transid = min_transid };
+    enum btrfs_util_error err;
+
+    scan->entries = NULL;
+    scan->n = 0;
+
+    if (!c.top && (err = lookup_top(fd, &c.top)))
+        return err;
+    if ((err = sweep_root_tree(&c)))
+        goto out;
+    if (c.min_transid && (err = complete_ancestry(&c)))
+        goto out;
+
+    c.chain = malloc((c.n ? c.n : 1) * sizeof(*c.chain));
+    if (!c.chain) {
+        errno = ENOMEM;
+        err = BTRFS_UTIL_ERROR_NO_MEMORY;
+        goto out;
+    }
+
+    classify(&c);
+    if ((err = lookup_dirs(&c)) || (err = build_paths(&c)))
+        goto out;
+
+    size_t n = 0;
+    for (size_t i = 0; i < c.n; i++)
+        n += c.roots[i].state == PATH_INSIDE && c.roots[i].report;
+
+    scan->entries = malloc((n ? n : 1) * sizeof(*scan->entries));
+    if (!scan->entries) {
+        errno = ENOMEM;
+        err = BTRFS_UTIL_ERROR_NO_MEMORY;
+        goto out;
+    }
+
+    /* move the results out; ownership of name/path goes with them */
+    for (size_t i = 0; i < c.n; i++) {
+        struct scan_root *r = &c.roots[i];
+        if (r->state != PATH_INSIDE || !r->report)
+            continue;
+        scan->entries[scan->n++] = r->e;
+        r->e.name = r->e.path = NULL;
+    }
+    qsort(scan->entries, scan->n, sizeof(*scan->entries), cmp_path);
+
+out:
+    scan_ctx_free(&c);
+    return err;
+}
+
+void
+subvol_scan_free(struct subvol_scan *scan)
+{
+    for (size_t i = 0; i < scan->n; i++) {
+        free(scan->entries[i].name);
+        free(scan->entries[i].path);
+    }
+    free(scan->entries);
+    scan->entries = NULL;
+    scan->n = 0;
+}
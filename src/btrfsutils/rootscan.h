@@ -0,0 +1,37 @@
+#ifndef PYBTRFS_ROOTSCAN_H
+#define PYBTRFS_ROOTSCAN_H
+
+#include "btrfsutil.h"
+
+/*
+ * Subvolume listing from one sweep over the root tree (ROOT_ITEM and
+ * ROOT_BACKREF items) instead of per-subvolume lookups.  Needs
+ * CAP_SYS_ADMIN, like the privileged paths of libbtrfsutil.  Runs
+ * without touching Python, so callers release the GIL around it.
+ */
+
+struct subvol_entry {
+    struct btrfs_util_subvolume_info info;
+    char *name;     /* name in the parent directory */
+    char *path;     /* relative to the scan top */
+};
+
+struct subvol_scan {
+    struct subvol_entry *entries;  /* sorted by path */
+    size_t n;
+};
+
+/*
+ * List every subvolume below *top* (0: the subvolume containing *fd*),
+ * with paths relative to it.  A nonzero *min_transid* keeps only
+ * subvolumes whose generation is at least that transaction and lets the
+ * kernel skip unchanged parts of the root tree.  On failure errno is
+ * preserved for set_error().
+ */
+enum btrfs_util_error subvol_scan(int fd, uint64_t top,
+                                  uint64_t min_transid,
+                                  struct subvol_scan *scan);
+
+void subvol_scan_free(struct subvol_scan *scan);
+
+#endif /* PYBTRFS_ROOTSCAN_H */
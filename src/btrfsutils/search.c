@@ -0,0 +1,122 @@
+#include "search.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+int
+tree_search_init(struct tree_search *s, int fd,
+                 const struct btrfs_ioctl_search_key *key, size_t buf_size)
+{
+    memset(s, 0, sizeof(*s));
+    s->args = malloc(sizeof(*s->args) + buf_size);
+    if (!s->args) {
+        errno = ENOMEM;
+        return -1;
+    }
+    s->fd = fd;
+    s->buf_size = buf_size;
+    tree_search_reset(s, key);
+    return 0;
+}
+
+void
+tree_search_reset(struct tree_search *s,
+                  const struct btrfs_ioctl_search_key *key)
+{
+    s->args->key = *key;
+    s->args->key.nr_items = 0;
+    s->pos = 0;
+    s->remaining = 0;
+    s->done = 0;
+}
+
+/* Move the minimum key just past *h* in (objectid, type, offset) order. */
+static int
+advance_key(struct btrfs_ioctl_search_key *sk,
+            const struct btrfs_ioctl_search_header *h)
+{
+    sk->min_objectid = h->objectid;
+    sk->min_type = h->type;
+    sk->min_offset = h->offset;
+
+    if (sk->min_offset < (uint64_t)-1) {
+        sk->min_offset++;
+    }
+    else if (sk->min_type < (uint8_t)-1) {
+        sk->min_type++;
+        sk->min_offset = 0;
+    }
+    else if (sk->min_objectid < (uint64_t)-1) {
+        sk->min_objectid++;
+        sk->min_type = 0;
+        sk->min_offset = 0;
+    }
+    else {
+        return 0;
+    }
+
+    if (sk->min_objectid != sk->max_objectid)
+        return sk->min_objectid < sk->max_objectid;
+    if (sk->min_type != sk->max_type)
+        return sk->min_type < sk->max_type;
+    return sk->min_offset <= sk->max_offset;
+}
+
+int
+tree_search_next(struct tree_search *s,
+                 const struct btrfs_ioctl_search_header **hdr,
+                 const void **item)
+{
+    struct btrfs_ioctl_search_key *sk = &s->args->key;
+
+    if (!s->remaining) {
+        if (s->done)
+            return 0;
+
+        sk->nr_items = (uint32_t)-1;
+        s->args->buf_size = s->buf_size;
+        if (ioctl(s->fd, BTRFS_IOC_TREE_SEARCH_V2, s->args) < 0)
+            return -1;
+        if (!sk->nr_items) {
+            s->done = 1;
+            return 0;
+        }
+        s->remaining = sk->nr_items;
+        s->pos = 0;
+    }
+
+    const char *buf = (const char *)s->args->buf + s->pos;
+    const struct btrfs_ioctl_search_header *h = &s->hdr;
+
+    memcpy(&s->hdr, buf, sizeof(s->hdr));
+    *hdr = h;
+    *item = buf + sizeof(*h);
+    s->pos += sizeof(*h) + h->len;
+
+    /* last item in the buffer: set up the key for the next ioctl */
+    if (!--s->remaining && !advance_key(sk, h))
+        s->done = 1;
+    return 1;
+}
+
+void
+tree_search_seek(struct tree_search *s, uint64_t offset)
+{
+    struct btrfs_ioctl_search_key *sk = &s->args->key;
+
+    if (s->remaining || s->done || sk->min_offset >= offset)
+        return;
+    if (offset > sk->max_offset)
+        s->done = 1;
+    else
+        sk->min_offset = offset;
+}
+
+void
+tree_search_release(struct tree_search *s)
+{
+    free(s->args);
+    s->args = NULL;
+}
@@ -0,0 +1,57 @@
+#ifndef PYBTRFS_SEARCH_H
+#define PYBTRFS_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel-shared/uapi/btrfs.h"
+#include "kernel-shared/uapi/btrfs_tree.h"
+
+/*
+ * Cursor over BTRFS_IOC_TREE_SEARCH_V2 results.  Plain C with no Python
+ * dependency so it can run with the GIL released and be shared between
+ * extension modules.  Functions return -1 and set errno on failure.
+ */
+
+/* result buffer handed to the kernel on every search call */
+#define TREE_SEARCH_BUF_SIZE (512 * 1024)
+
+struct tree_search {
+    int fd;
+    struct btrfs_ioctl_search_args_v2 *args;
+    size_t buf_size;
+    size_t pos;          /* offset of the next header in args->buf */
+    uint32_t remaining;  /* unread items in the current buffer */
+    int done;
+    /* aligned copy of the current header; the buffer packs them */
+    struct btrfs_ioctl_search_header hdr;
+};
+
+/* Prepare a search over *key*; nr_items is managed by the cursor. */
+int tree_search_init(struct tree_search *s, int fd,
+                     const struct btrfs_ioctl_search_key *key,
+                     size_t buf_size);
+
+/* Restart the cursor on a new key, reusing its buffer. */
+void tree_search_reset(struct tree_search *s,
+                       const struct btrfs_ioctl_search_key *key);
+
+/*
+ * Fetch the next item: returns 1 and points *hdr / *item into the
+ * cursor's buffer (valid until the following call), 0 at the end of the
+ * range, or -1 on error.
+ */
+int tree_search_next(struct tree_search *s,
+                     const struct btrfs_ioctl_search_header **hdr,
+                     const void **item);
+
+/*
+ * Skip ahead to *offset* when the key range covers a single (objectid,
+ * type).  Items already buffered are still returned; the next ioctl
+ * starts no lower than *offset*.
+ */
+void tree_search_seek(struct tree_search *s, uint64_t offset);
+
+void tree_search_release(struct tree_search *s);
+
+#endif /* PYBTRFS_SEARCH_H */
@@ -17,37 +17,38 @@ timespec_to_float(const struct timespec *ts)
 
 /* -- SubvolumeInfo type ---------------------------------------------- */
 
+/*
+ * The raw struct is kept inline so that building an info costs a single
+ * allocation.  Integer fields are read straight out of it; the uuid and
+ * timestamp objects are created on first access and cached, under a
+ * critical section so concurrent first reads agree on one object.
+ */
+enum {
+    CACHE_UUID,
+    CACHE_PARENT_UUID,
+    CACHE_RECEIVED_UUID,
+    CACHE_CTIME,
+    CACHE_OTIME,
+    CACHE_STIME,
+    CACHE_RTIME,
+    CACHE_COUNT
+};
+
 typedef struct {
     PyObject_HEAD
-    uint64_t id;
-    uint64_t parent_id;
-    uint64_t dir_id;
-    uint64_t flags;
-    PyObject *uuid;
-    PyObject *parent_uuid;
-    PyObject *received_uuid;
-    uint64_t generation;
-    uint64_t ctransid;
-    uint64_t otransid;
-    uint64_t stransid;
-    uint64_t rtransid;
-    PyObject *ctime;
-    PyObject *otime;
-    PyObject *stime;
-    PyObject *rtime;
+    struct btrfs_util_subvolume_info info;
+    PyObject *cache[CACHE_COUNT];
 } SubvolumeInfoObject;
 
 static void
 SubvolumeInfo_dealloc(SubvolumeInfoObject *self)
 {
-    Py_XDECREF(self->uuid);
-    Py_XDECREF(self->parent_uuid);
-    Py_XDECREF(self->received_uuid);
-    Py_XDECREF(self->ctime);
-    Py_XDECREF(self->otime);
-    Py_XDECREF(self->stime);
-    Py_XDECREF(self->rtime);
-    Py_TYPE(self)->tp_free((PyObject *)self);
+    PyTypeObject *tp = Py_TYPE(self);
+
+    for (int i = 0; i < CACHE_COUNT; i++)
+        Py_XDECREF(self->cache[i]);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
 }
 
 static PyObject *
@@ -55,74 +56,101 @@ SubvolumeInfo_repr(SubvolumeInfoObject *self)
 {
     return PyUnicode_FromFormat(
         "SubvolumeInfo(id=%llu, parent_id=%llu, generation=%llu)",
-        (unsigned long long)self->id,
-        (unsigned long long)self->parent_id,
-        (unsigned long long)self->generation);
+        (unsigned long long)self->info.id,
+        (unsigned long long)self->info.parent_id,
+        (unsigned long long)self->info.generation);
+}
+
+static PyObject *
+SubvolumeInfo_get_cached(SubvolumeInfoObject *self, void *closure)
+{
+    int slot = (int)(intptr_t)closure;
+    const struct btrfs_util_subvolume_info *s = &self->info;
+    PyObject *v;
+
+    if ((unsigned)slot >= CACHE_COUNT) {
+        PyErr_SetString(PyExc_SystemError, "bad SubvolumeInfo cache slot");
+        return NULL;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    v = self->cache[slot];
+    if (!v) {
+        switch (slot) {
+        case CACHE_UUID:          v = uuid_to_bytes(s->uuid); break;
+        case CACHE_PARENT_UUID:   v = uuid_to_bytes(s->parent_uuid); break;
+        case CACHE_RECEIVED_UUID: v = uuid_to_bytes(s->received_uuid); break;
+        case CACHE_CTIME:         v = timespec_to_float(&s->ctime); break;
+        case CACHE_OTIME:         v = timespec_to_float(&s->otime); break;
+        case CACHE_STIME:         v = timespec_to_float(&s->stime); break;
+        case CACHE_RTIME:         v = timespec_to_float(&s->rtime); break;
+        }
+        if (v)
+            self->cache[slot] = v;
+    }
+    Py_XINCREF(v);
+    Py_END_CRITICAL_SECTION();
+    return v;
 }
 
+#define INFO_MEMBER(name) \
+    {#name, T_ULONGLONG, offsetof(SubvolumeInfoObject, info.name), READONLY, NULL}
+
 static PyMemberDef SubvolumeInfo_members[] = {
-    {"id",            T_ULONGLONG, offsetof(SubvolumeInfoObject, id),            READONLY, NULL},
-    {"parent_id",     T_ULONGLONG, offsetof(SubvolumeInfoObject, parent_id),     READONLY, NULL},
-    {"dir_id",        T_ULONGLONG, offsetof(SubvolumeInfoObject, dir_id),        READONLY, NULL},
-    {"flags",         T_ULONGLONG, offsetof(SubvolumeInfoObject, flags),         READONLY, NULL},
-    {"uuid",          T_OBJECT_EX, offsetof(SubvolumeInfoObject, uuid),          READONLY, NULL},
-    {"parent_uuid",   T_OBJECT_EX, offsetof(SubvolumeInfoObject, parent_uuid),   READONLY, NULL},
-    {"received_uuid", T_OBJECT_EX, offsetof(SubvolumeInfoObject, received_uuid), READONLY, NULL},
-    {"generation",    T_ULONGLONG, offsetof(SubvolumeInfoObject, generation),    READONLY, NULL},
-    {"ctransid",      T_ULONGLONG, offsetof(SubvolumeInfoObject, ctransid),      READONLY, NULL},
-    {"otransid",      T_ULONGLONG, offsetof(SubvolumeInfoObject, otransid),      READONLY, NULL},
-    {"stransid",      T_ULONGLONG, offsetof(SubvolumeInfoObject, stransid),      READONLY, NULL},
-    {"rtransid",      T_ULONGLONG, offsetof(SubvolumeInfoObject, rtransid),      READONLY, NULL},
-    {"ctime",         T_OBJECT_EX, offsetof(SubvolumeInfoObject, ctime),         READONLY, NULL},
-    {"otime",         T_OBJECT_EX, offsetof(SubvolumeInfoObject, otime),         READONLY, NULL},
-    {"stime",         T_OBJECT_EX, offsetof(SubvolumeInfoObject, stime),         READONLY, NULL},
-    {"rtime",         T_OBJECT_EX, offsetof(SubvolumeInfoObject, rtime),         READONLY, NULL},
+    INFO_MEMBER(id),
+    INFO_MEMBER(parent_id),
+    INFO_MEMBER(dir_id),
+    INFO_MEMBER(flags),
+    INFO_MEMBER(generation),
+    INFO_MEMBER(ctransid),
+    INFO_MEMBER(otransid),
+    INFO_MEMBER(stransid),
+    INFO_MEMBER(rtransid),
+    {NULL}
+};
+
+#define INFO_CACHED(name, slot) \
+    {#name, (getter)SubvolumeInfo_get_cached, NULL, NULL, \
+     (void *)(intptr_t)(slot)}
+
+static PyGetSetDef SubvolumeInfo_getset[] = {
+    INFO_CACHED(uuid,          CACHE_UUID),
+    INFO_CACHED(parent_uuid,   CACHE_PARENT_UUID),
+    INFO_CACHED(received_uuid, CACHE_RECEIVED_UUID),
+    INFO_CACHED(ctime,         CACHE_CTIME),
+    INFO_CACHED(otime,         CACHE_OTIME),
+    INFO_CACHED(stime,         CACHE_STIME),
+    INFO_CACHED(rtime,         CACHE_RTIME),
     {NULL}
 };
 
-PyTypeObject SubvolumeInfoType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name      = "pybtrfs.SubvolumeInfo",
-    .tp_basicsize = sizeof(SubvolumeInfoObject),
-    .tp_dealloc   = (destructor)SubvolumeInfo_dealloc,
-    .tp_repr      = (reprfunc)SubvolumeInfo_repr,
-    .tp_flags     = Py_TPFLAGS_DEFAULT,
-    .tp_doc       = "Btrfs subvolume information.",
-    .tp_members   = SubvolumeInfo_members,
-    .tp_new       = PyType_GenericNew,
+static PyType_Slot SubvolumeInfo_slots[] = {
+    {Py_tp_dealloc, SubvolumeInfo_dealloc},
+    {Py_tp_repr,    SubvolumeInfo_repr},
+    {Py_tp_doc,     "Btrfs subvolume information."},
+    {Py_tp_members, SubvolumeInfo_members},
+    {Py_tp_getset,  SubvolumeInfo_getset},
+    {Py_tp_new,     PyType_GenericNew},
+    {0, NULL}
+};
+
+PyType_Spec SubvolumeInfo_spec = {
+    .name      = "pybtrfs.SubvolumeInfo",
+    .basicsize = sizeof(SubvolumeInfoObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = SubvolumeInfo_slots,
 };
 
 PyObject *
-SubvolumeInfo_from_struct(const struct btrfs_util_subvolume_info *s)
+SubvolumeInfo_from_struct(module_state *st,
+                          const struct btrfs_util_subvolume_info *s)
 {
+    PyTypeObject *type = st->SubvolumeInfoType;
     SubvolumeInfoObject *self = (SubvolumeInfoObject *)
-        SubvolumeInfoType.tp_alloc(&SubvolumeInfoType, 0);
+        type->tp_alloc(type, 0);
     if (!self)
         return NULL;
 
-    self->id         = s->id;
-    self->parent_id  = s->parent_id;
-    self->dir_id     = s->dir_id;
-    self->flags      = s->flags;
-    self->generation = s->generation;
-    self->ctransid   = s->ctransid;
-    self->otransid   = s->otransid;
-    self->stransid   = s->stransid;
-    self->rtransid   = s->rtransid;
-
-    self->uuid          = uuid_to_bytes(s->uuid);
-    self->parent_uuid   = uuid_to_bytes(s->parent_uuid);
-    self->received_uuid = uuid_to_bytes(s->received_uuid);
-    self->ctime         = timespec_to_float(&s->ctime);
-    self->otime         = timespec_to_float(&s->otime);
-    self->stime         = timespec_to_float(&s->stime);
-    self->rtime         = timespec_to_float(&s->rtime);
-
-    if (!self->uuid || !self->parent_uuid || !self->received_uuid ||
-        !self->ctime || !self->otime || !self->stime || !self->rtime) {
-        Py_DECREF(self);
-        return NULL;
-    }
-
+    self->info = *s;
     return (PyObject *)self;
 }
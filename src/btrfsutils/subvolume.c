@@ -1,16 +1,45 @@
 #include "module.h"
+#include "rootscan.h"
+#include "search.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- helpers --------------------------------------------------------- */
+
+/* Open *path* for the *_fd helpers; sets BtrfsUtilError on failure. */
+static int
+open_path(module_state *st, const char *path)
+{
+    int fd;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    Py_END_ALLOW_THREADS
+
+    if (fd < 0)
+        set_error(st, BTRFS_UTIL_ERROR_OPEN_FAILED);
+    return fd;
+}
 
 /* -- queries --------------------------------------------------------- */
 
 static PyObject *
-mod_is_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
+mod_is_subvolume(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                 PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "is_subvolume"};
+    module_state *st = get_module_state(self);
     const char *path;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -22,18 +51,21 @@ mod_is_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
     if (err == BTRFS_UTIL_ERROR_NOT_BTRFS ||
         err == BTRFS_UTIL_ERROR_NOT_SUBVOLUME)
         Py_RETURN_FALSE;
-    return set_error(err);
+    return set_error(st, err);
 }
 
 static PyObject *
-mod_subvolume_id(PyObject *self, PyObject *args, PyObject *kwds)
+mod_subvolume_id(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                 PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "subvolume_id"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t id;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -41,20 +73,23 @@ mod_subvolume_id(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     return PyLong_FromUnsignedLongLong(id);
 }
 
 static PyObject *
-mod_subvolume_path(PyObject *self, PyObject *args, PyObject *kwds)
+mod_subvolume_path(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                   PyObject *kwnames)
 {
     static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "s|K", "subvolume_path"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t id = 0;
     char *subvol_path = NULL;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|K", kw, &path, &id))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -62,7 +97,7 @@ mod_subvolume_path(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
 
     PyObject *result = PyUnicode_DecodeFSDefault(subvol_path);
     free(subvol_path);
@@ -70,15 +105,18 @@ mod_subvolume_path(PyObject *self, PyObject *args, PyObject *kwds)
 }
 
 static PyObject *
-mod_subvolume_info(PyObject *self, PyObject *args, PyObject *kwds)
+mod_subvolume_info(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                   PyObject *kwnames)
 {
     static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "s|K", "subvolume_info"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t id = 0;
     struct btrfs_util_subvolume_info info;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|K", kw, &path, &id))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -86,21 +124,474 @@ mod_subvolume_info(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
-    return SubvolumeInfo_from_struct(&info);
+        return set_error(st, err);
+    return SubvolumeInfo_from_struct(st, &info);
+}
+
+/* -- UUID tree lookups ----------------------------------------------- */
+
+#define UUID_SIZE 16
+
+/*
+ * The UUID tree keys subvolumes by (uuid[0:8], type, uuid[8:16]), both
+ * halves read as little-endian; the item is an array of __le64 subvolume
+ * ids.  Looks up each of the *n* uuids and stores the first id found, or
+ * 0 if there is none.
+ */
+static enum btrfs_util_error
+uuid_tree_lookup(int fd, uint8_t type, const uint8_t *uuids, size_t n,
+                 uint64_t *ids)
+{
+    struct btrfs_ioctl_search_key sk = {
+        .tree_id = BTRFS_UUID_TREE_OBJECTID,
+        .min_type = type,
+        .max_type = type,
+        .max_transid = (uint64_t)-1,
+    };
+    struct tree_search s;
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+
+    /* one key per lookup, and the item is small */
+    if (tree_search_init(&s, fd, &sk, 4096) < 0)
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+
+    for (size_t i = 0; i < n; i++) {
+        const struct btrfs_ioctl_search_header *h;
+        const void *item;
+        uint64_t le;
+        int r;
+
+        memcpy(&le, uuids + i * UUID_SIZE, sizeof(le));
+        sk.min_objectid = sk.max_objectid = le64toh(le);
+        memcpy(&le, uuids + i * UUID_SIZE + sizeof(le), sizeof(le));
+        sk.min_offset = sk.max_offset = le64toh(le);
+        tree_search_reset(&s, &sk);
+
+        ids[i] = 0;
+        while ((r = tree_search_next(&s, &h, &item)) > 0) {
+            if (h->type == type && h->len >= sizeof(le)) {
+                memcpy(&le, item, sizeof(le));
+                ids[i] = le64toh(le);
+                break;
+            }
+        }
+        if (r < 0) {
+            err = BTRFS_UTIL_ERROR_SEARCH_FAILED;
+            break;
+        }
+    }
+
+    tree_search_release(&s);
+    return err;
+}
+
+PyObject *
+find_subvolume_fd(module_state *st, int fd, const char *uuid,
+                  Py_ssize_t uuid_len, int received)
+{
+    uint8_t type = received ? BTRFS_UUID_KEY_RECEIVED_SUBVOL
+                            : BTRFS_UUID_KEY_SUBVOL;
+    uint64_t id;
+    enum btrfs_util_error err;
+
+    if (uuid_len != UUID_SIZE) {
+        PyErr_Format(PyExc_ValueError,
+                     "uuid must be %d bytes, got %zd", UUID_SIZE, uuid_len);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = uuid_tree_lookup(fd, type, (const uint8_t *)uuid, 1, &id);
+    Py_END_ALLOW_THREADS
+
+    if (err)
+        return set_error(st, err);
+    if (!id)
+        Py_RETURN_NONE;
+    return PyLong_FromUnsignedLongLong(id);
+}
+
+PyObject *
+find_subvolumes_fd(module_state *st, int fd, PyObject *uuids_arg, int received)
+{
+    PyObject *seq, *list = NULL;
+    uint8_t *uuids = NULL;
+    uint64_t *ids = NULL;
+    enum btrfs_util_error err;
+
+    seq = PySequence_Fast(uuids_arg, "uuids must be an iterable of bytes");
+    if (!seq)
+        return NULL;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    uuids = PyMem_Malloc(n * UUID_SIZE + 1);
+    ids = PyMem_Malloc(n * sizeof(*ids) + 1);
+    if (!uuids || !ids) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *u = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyBytes_Check(u) || PyBytes_GET_SIZE(u) != UUID_SIZE) {
+            PyErr_Format(PyExc_ValueError,
+                         "uuids[%zd] must be %d bytes", i, UUID_SIZE);
+            goto out;
+        }
+        memcpy(uuids + i * UUID_SIZE, PyBytes_AS_STRING(u), UUID_SIZE);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = uuid_tree_lookup(fd,
+                           received ? BTRFS_UUID_KEY_RECEIVED_SUBVOL
+                                    : BTRFS_UUID_KEY_SUBVOL,
+                           uuids, (size_t)n, ids);
+    Py_END_ALLOW_THREADS
+
+    if (err) {
+        set_error(st, err);
+        goto out;
+    }
+
+    list = PyList_New(n);
+    if (!list)
+        goto out;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *v;
+        if (ids[i]) {
+            v = PyLong_FromUnsignedLongLong(ids[i]);
+            if (!v) { Py_CLEAR(list); goto out; }
+        }
+        else {
+            v = Py_NewRef(Py_None);
+        }
+        PyList_SET_ITEM(list, i, v);
+    }
+
+out:
+    PyMem_Free(uuids);
+    PyMem_Free(ids);
+    Py_DECREF(seq);
+    return list;
+}
+
+static char *find_one_kw[] = {"path", "uuid", NULL};
+
+static PyObject *
+find_one(module_state *st, FastArgsParser *parser, PyObject *const *args,
+         Py_ssize_t nargs, PyObject *kwnames, int received)
+{
+    const char *path;
+    const char *uuid;
+    Py_ssize_t uuid_len;
+
+    if (!fastargs_parse(parser, args, nargs, kwnames,
+                        &path, &uuid, &uuid_len))
+        return NULL;
+
+    int fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = find_subvolume_fd(st, fd, uuid, uuid_len, received);
+    close(fd);
+    return result;
+}
+
+static PyObject *
+mod_find_subvolume_by_uuid(PyObject *self, PyObject *const *args,
+                           Py_ssize_t nargs, PyObject *kwnames)
+{
+    static FastArgsParser parser = {find_one_kw, "sy#",
+                                    "find_subvolume_by_uuid"};
+    module_state *st = get_module_state(self);
+    return find_one(st, &parser, args, nargs, kwnames, 0);
+}
+
+static PyObject *
+mod_find_subvolume_by_received_uuid(PyObject *self, PyObject *const *args,
+                                    Py_ssize_t nargs, PyObject *kwnames)
+{
+    static FastArgsParser parser = {find_one_kw, "sy#",
+                                    "find_subvolume_by_received_uuid"};
+    module_state *st = get_module_state(self);
+    return find_one(st, &parser, args, nargs, kwnames, 1);
+}
+
+static PyObject *
+mod_find_subvolumes_by_uuid(PyObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "uuids", "received", NULL};
+    static FastArgsParser parser = {kw, "sO|p", "find_subvolumes_by_uuid"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    PyObject *uuids;
+    int received = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &uuids,
+                        &received))
+        return NULL;
+
+    int fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = find_subvolumes_fd(st, fd, uuids, received);
+    close(fd);
+    return result;
+}
+
+/* -- root tree scan -------------------------------------------------- */
+
+PyObject *
+subvolume_list_fd(module_state *st, int fd, uint64_t top, int info,
+                  uint64_t min_transid)
+{
+    struct subvol_scan scan;
+    enum btrfs_util_error err;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = subvol_scan(fd, top, min_transid, &scan);
+    Py_END_ALLOW_THREADS
+
+    if (err)
+        return set_error(st, err);
+
+    PyObject *list = PyList_New((Py_ssize_t)scan.n);
+    if (!list)
+        goto out;
+
+    for (size_t i = 0; i < scan.n; i++) {
+        struct subvol_entry *e = &scan.entries[i];
+        PyObject *v = info
+            ? SubvolumeInfo_from_struct(st, &e->info)
+            : PyLong_FromUnsignedLongLong(e->info.id);
+        if (!v) { Py_CLEAR(list); goto out; }
+
+        PyObject *p = PyUnicode_DecodeFSDefault(e->path);
+        if (!p) { Py_DECREF(v); Py_CLEAR(list); goto out; }
+
+        PyObject *t = PyTuple_Pack(2, p, v);
+        Py_DECREF(p);
+        Py_DECREF(v);
+        if (!t) { Py_CLEAR(list); goto out; }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, t);
+    }
+
+out:
+    subvol_scan_free(&scan);
+    return list;
+}
+
+static PyObject *
+mod_subvolume_list(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                   PyObject *kwnames)
+{
+    static char *kw[] = {"path", "top", "info", "min_transid", NULL};
+    static FastArgsParser parser = {kw, "s|KpK", "subvolume_list"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    uint64_t top = 0, min_transid = 0;
+    int info = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &top, &info,
+                        &min_transid))
+        return NULL;
+
+    int fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = subvolume_list_fd(st, fd, top, info, min_transid);
+    close(fd);
+    return result;
+}
+
+/* -- columnar listing ------------------------------------------------ */
+
+#define INFO_FIELD(name) \
+    {#name, offsetof(struct btrfs_util_subvolume_info, name)}
+
+/* uint64 fields of btrfs_util_subvolume_info exported as 'Q' columns */
+static const struct {
+    const char *name;
+    size_t offset;
+} u64_columns[] = {
+    INFO_FIELD(id),
+    INFO_FIELD(parent_id),
+    INFO_FIELD(generation),
+    INFO_FIELD(ctransid),
+    INFO_FIELD(otransid),
+    INFO_FIELD(flags),
+};
+
+#define N_U64_COLUMNS (sizeof(u64_columns) / sizeof(u64_columns[0]))
+
+struct columns {
+    size_t n;
+    uint64_t *u64[N_U64_COLUMNS];
+    int64_t *otime;
+    uint8_t *uuid;
+    uint64_t *path_offsets;  /* n + 1 entries into path_data */
+    char *path_data;
+};
+
+static void
+columns_free(struct columns *c)
+{
+    for (size_t k = 0; k < N_U64_COLUMNS; k++)
+        free(c->u64[k]);
+    free(c->otime);
+    free(c->uuid);
+    free(c->path_offsets);
+    free(c->path_data);
+}
+
+/* Transpose a scan into packed arrays; runs without the GIL. */
+static enum btrfs_util_error
+columns_fill(const struct subvol_scan *scan, struct columns *c)
+{
+    size_t n = scan->n, total = 0;
+
+    memset(c, 0, sizeof(*c));
+    c->n = n;
+    for (size_t i = 0; i < n; i++)
+        total += strlen(scan->entries[i].path);
+
+    /* +1 so that empty listings still get non-NULL arrays */
+    for (size_t k = 0; k < N_U64_COLUMNS; k++)
+        if (!(c->u64[k] = malloc(n * sizeof(uint64_t) + 1)))
+            goto nomem;
+    c->otime = malloc(n * sizeof(int64_t) + 1);
+    c->uuid = malloc(n * 16 + 1);
+    c->path_offsets = malloc((n + 1) * sizeof(uint64_t));
+    c->path_data = malloc(total + 1);
+    if (!c->otime || !c->uuid || !c->path_offsets || !c->path_data)
+        goto nomem;
+
+    uint64_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct btrfs_util_subvolume_info *info = &scan->entries[i].info;
+        const char *path = scan->entries[i].path;
+        size_t len = strlen(path);
+
+        for (size_t k = 0; k < N_U64_COLUMNS; k++)
+            memcpy(&c->u64[k][i], (const char *)info + u64_columns[k].offset,
+                   sizeof(uint64_t));
+        c->otime[i] = info->otime.tv_sec;
+        memcpy(c->uuid + i * 16, info->uuid, 16);
+        c->path_offsets[i] = off;
+        memcpy(c->path_data + off, path, len);
+        off += len;
+    }
+    c->path_offsets[n] = off;
+    return BTRFS_UTIL_OK;
+
+nomem:
+    columns_free(c);
+    errno = ENOMEM;
+    return BTRFS_UTIL_ERROR_NO_MEMORY;
+}
+
+/*
+ * Hand *data* over to a new column in *dict*.  The array is always
+ * consumed: with dict NULL (an earlier column failed) it is just freed.
+ */
+static int
+add_column(module_state *st, PyObject *dict, const char *name, void *data,
+           size_t n, Py_ssize_t width, char format, Py_ssize_t itemsize)
+{
+    if (!dict) {
+        free(data);
+        return -1;
+    }
+
+    PyObject *view = column_view(st->ColumnType, data, (Py_ssize_t)n, width,
+                                 format, itemsize);
+    if (!view)
+        return -1;
+    int ret = PyDict_SetItemString(dict, name, view);
+    Py_DECREF(view);
+    return ret;
+}
+
+PyObject *
+subvolume_columns_fd(module_state *st, int fd, uint64_t top,
+                     uint64_t min_transid)
+{
+    struct subvol_scan scan;
+    struct columns c;
+    enum btrfs_util_error err;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = subvol_scan(fd, top, min_transid, &scan);
+    if (!err) {
+        err = columns_fill(&scan, &c);
+        subvol_scan_free(&scan);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (err)
+        return set_error(st, err);
+
+    PyObject *dict = PyDict_New();
+    PyObject *blob = PyBytes_FromStringAndSize(
+        c.path_data, (Py_ssize_t)c.path_offsets[c.n]);
+    free(c.path_data);
+    if (dict && (!blob || PyDict_SetItemString(dict, "path_data", blob) < 0))
+        Py_CLEAR(dict);
+    Py_XDECREF(blob);
+
+    for (size_t k = 0; k < N_U64_COLUMNS; k++)
+        if (add_column(st, dict, u64_columns[k].name, c.u64[k], c.n, 0,
+                       'Q', sizeof(uint64_t)) < 0)
+            Py_CLEAR(dict);
+    if (add_column(st, dict, "otime", c.otime, c.n, 0,
+                   'q', sizeof(int64_t)) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "uuid", c.uuid, c.n, 16, 'B', 1) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "path_offsets", c.path_offsets, c.n + 1, 0,
+                   'Q', sizeof(uint64_t)) < 0)
+        Py_CLEAR(dict);
+
+    return dict;
+}
+
+static PyObject *
+mod_subvolume_columns(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                      PyObject *kwnames)
+{
+    static char *kw[] = {"path", "top", "min_transid", NULL};
+    static FastArgsParser parser = {kw, "s|KK", "subvolume_columns"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    uint64_t top = 0, min_transid = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &top,
+                        &min_transid))
+        return NULL;
+
+    int fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = subvolume_columns_fd(st, fd, top, min_transid);
+    close(fd);
+    return result;
 }
 
 /* -- read-only flag -------------------------------------------------- */
 
 static PyObject *
-mod_get_subvolume_read_only(PyObject *self, PyObject *args, PyObject *kwds)
+mod_get_subvolume_read_only(PyObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "get_subvolume_read_only"};
+    module_state *st = get_module_state(self);
     const char *path;
     bool ro;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -108,19 +599,22 @@ mod_get_subvolume_read_only(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     return PyBool_FromLong(ro);
 }
 
 static PyObject *
-mod_set_subvolume_read_only(PyObject *self, PyObject *args, PyObject *kwds)
+mod_set_subvolume_read_only(PyObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
 {
     static char *kw[] = {"path", "read_only", NULL};
+    static FastArgsParser parser = {kw, "s|p", "set_subvolume_read_only"};
+    module_state *st = get_module_state(self);
     const char *path;
     int ro = 1;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|p", kw, &path, &ro))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &ro))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -128,21 +622,24 @@ mod_set_subvolume_read_only(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
 /* -- default subvolume ----------------------------------------------- */
 
 static PyObject *
-mod_get_default_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
+mod_get_default_subvolume(PyObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "get_default_subvolume"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t id;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -150,19 +647,22 @@ mod_get_default_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     return PyLong_FromUnsignedLongLong(id);
 }
 
 static PyObject *
-mod_set_default_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
+mod_set_default_subvolume(PyObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
 {
     static char *kw[] = {"path", "id", NULL};
+    static FastArgsParser parser = {kw, "s|K", "set_default_subvolume"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t id = 0;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|K", kw, &path, &id))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -170,79 +670,154 @@ mod_set_default_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
 /* -- create / snapshot / delete -------------------------------------- */
 
 static PyObject *
-mod_create_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
+mod_create_subvolume(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     PyObject *kwnames)
 {
     static char *kw[] = {"path", "qgroup_inherit", NULL};
+    static FastArgsParser parser = {kw, "s|O!", "create_subvolume"};
+    module_state *st = get_module_state(self);
     const char *path;
     QgroupInheritObject *qg_obj = NULL;
     struct btrfs_util_qgroup_inherit *qg = NULL;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|O!", kw,
-                                     &path, &QgroupInheritType, &qg_obj))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path,
+                        st->QgroupInheritType, &qg_obj))
+        return NULL;
+    if (qgroup_inherit_copy(st, qg_obj, &qg) < 0)
         return NULL;
-    if (qg_obj)
-        qg = qg_obj->inherit;
 
     Py_BEGIN_ALLOW_THREADS
     err = btrfs_util_create_subvolume(path, 0, NULL, qg);
     Py_END_ALLOW_THREADS
+    qgroup_inherit_free(qg);
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
 static PyObject *
-mod_create_snapshot(PyObject *self, PyObject *args, PyObject *kwds)
+mod_create_snapshot(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                    PyObject *kwnames)
 {
     static char *kw[] = {"source", "path", "recursive", "read_only",
                          "qgroup_inherit", NULL};
+    static FastArgsParser parser = {kw, "ss|ppO!", "create_snapshot"};
+    module_state *st = get_module_state(self);
     const char *source, *path;
     int recursive = 0, read_only = 0, flags = 0;
     QgroupInheritObject *qg_obj = NULL;
     struct btrfs_util_qgroup_inherit *qg = NULL;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|ppO!", kw,
-                                     &source, &path,
-                                     &recursive, &read_only,
-                                     &QgroupInheritType, &qg_obj))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &source, &path,
+                        &recursive, &read_only, st->QgroupInheritType,
+                        &qg_obj))
         return NULL;
 
     if (recursive)
         flags |= BTRFS_UTIL_CREATE_SNAPSHOT_RECURSIVE;
     if (read_only)
         flags |= BTRFS_UTIL_CREATE_SNAPSHOT_READ_ONLY;
-    if (qg_obj)
-        qg = qg_obj->inherit;
+    if (qgroup_inherit_copy(st, qg_obj, &qg) < 0)
+        return NULL;
 
     Py_BEGIN_ALLOW_THREADS
     err = btrfs_util_create_snapshot(source, path, flags, NULL, qg);
     Py_END_ALLOW_THREADS
+    qgroup_inherit_free(qg);
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
+/*
+ * Linux 5.7 dropped BTRFS_SUBVOL_CREATE_ASYNC and rejects it with
+ * EOPNOTSUPP.  Remember that and create synchronously from then on; the
+ * snapshot's otransid is then already committed.
+ */
+static atomic_int snapshot_async_unsupported;
+
+static enum btrfs_util_error
+create_snapshot_transid(const char *source, const char *path, int flags,
+                        struct btrfs_util_qgroup_inherit *qg,
+                        uint64_t *transid)
+{
+    struct btrfs_util_subvolume_info info;
+    enum btrfs_util_error err;
+
+    if (!atomic_load(&snapshot_async_unsupported)) {
+        err = btrfs_util_create_snapshot(source, path, flags, transid, qg);
+        if (err != BTRFS_UTIL_ERROR_SNAP_CREATE_FAILED ||
+            errno != EOPNOTSUPP)
+            return err;
+        atomic_store(&snapshot_async_unsupported, 1);
+    }
+
+    err = btrfs_util_create_snapshot(source, path, flags, NULL, qg);
+    if (err)
+        return err;
+    err = btrfs_util_subvolume_info(path, 0, &info);
+    if (!err)
+        *transid = info.otransid;
+    return err;
+}
+
+static PyObject *
+mod_create_snapshot_async(PyObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"source", "path", "read_only", "qgroup_inherit",
+                         NULL};
+    static FastArgsParser parser = {kw, "ss|pO!", "create_snapshot_async"};
+    module_state *st = get_module_state(self);
+    const char *source, *path;
+    int read_only = 0, flags = 0;
+    QgroupInheritObject *qg_obj = NULL;
+    struct btrfs_util_qgroup_inherit *qg = NULL;
+    uint64_t transid = 0;
+    enum btrfs_util_error err;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &source, &path,
+                        &read_only, st->QgroupInheritType, &qg_obj))
+        return NULL;
+
+    if (read_only)
+        flags |= BTRFS_UTIL_CREATE_SNAPSHOT_READ_ONLY;
+    if (qgroup_inherit_copy(st, qg_obj, &qg) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = create_snapshot_transid(source, path, flags, qg, &transid);
+    Py_END_ALLOW_THREADS
+    qgroup_inherit_free(qg);
+
+    if (err)
+        return set_error(st, err);
+    return PyLong_FromUnsignedLongLong(transid);
+}
+
 static PyObject *
-mod_delete_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
+mod_delete_subvolume(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     PyObject *kwnames)
 {
     static char *kw[] = {"path", "recursive", NULL};
+    static FastArgsParser parser = {kw, "s|p", "delete_subvolume"};
+    module_state *st = get_module_state(self);
     const char *path;
     int recursive = 0, flags = 0;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|p", kw,
-                                     &path, &recursive))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &recursive))
         return NULL;
 
     if (recursive)
@@ -253,20 +828,23 @@ mod_delete_subvolume(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
 static PyObject *
-mod_deleted_subvolumes(PyObject *self, PyObject *args, PyObject *kwds)
+mod_deleted_subvolumes(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                       PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "deleted_subvolumes"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t *ids = NULL;
     size_t n = 0;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -274,7 +852,7 @@ mod_deleted_subvolumes(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
 
     PyObject *list = PyList_New((Py_ssize_t)n);
     if (!list) { free(ids); return NULL; }
@@ -288,67 +866,399 @@ mod_deleted_subvolumes(PyObject *self, PyObject *args, PyObject *kwds)
     return list;
 }
 
+/*
+ * The ID array libbtrfsutil returns is handed to a memoryview as is,
+ * without a PyLong per ID.
+ */
+PyObject *
+deleted_array_fd(module_state *st, int fd, int count_only)
+{
+    uint64_t *ids = NULL;
+    size_t n = 0;
+    enum btrfs_util_error err;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = btrfs_util_deleted_subvolumes_fd(fd, &ids, &n);
+    Py_END_ALLOW_THREADS
+
+    if (err)
+        return set_error(st, err);
+    if (count_only) {
+        free(ids);
+        return PyLong_FromSize_t(n);
+    }
+    return column_view(st->ColumnType, ids, (Py_ssize_t)n, 0, 'Q',
+                       sizeof(*ids));
+}
+
+static PyObject *
+mod_deleted_subvolumes_array(PyObject *self, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "count_only", NULL};
+    static FastArgsParser parser = {kw, "s|p", "deleted_subvolumes_array"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    int count_only = 0;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &count_only))
+        return NULL;
+
+    fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = deleted_array_fd(st, fd, count_only);
+    close(fd);
+    return result;
+}
+
+/* -- deleted subvolume cleanup --------------------------------------- */
+
+#ifndef BTRFS_IOC_SUBVOL_SYNC_WAIT
+/* Linux 6.8 */
+struct btrfs_ioctl_subvol_wait {
+    __u64 subvolid;
+    __u32 mode;
+    __u32 count;
+};
+#define BTRFS_SUBVOL_SYNC_WAIT_FOR_ONE     0
+#define BTRFS_SUBVOL_SYNC_WAIT_FOR_QUEUED  1
+#define BTRFS_IOC_SUBVOL_SYNC_WAIT _IOW(BTRFS_IOCTL_MAGIC, 65, \
+                                        struct btrfs_ioctl_subvol_wait)
+#endif
+
+/* longest sleep between polls of the deleted subvolume list */
+#define CLEANUP_POLL_MAX_MS 1000
+
+/*
+ * Wait in the kernel for *id* to be cleaned (0: everything queued now).
+ * Returns 0 when done, -1 with errno set otherwise (EINTR if a signal
+ * arrived, ENOTTY on kernels without the ioctl).
+ */
+static int
+subvol_sync_wait(int fd, uint64_t id)
+{
+    struct btrfs_ioctl_subvol_wait args = {
+        .subvolid = id,
+        .mode = id ? BTRFS_SUBVOL_SYNC_WAIT_FOR_ONE
+                   : BTRFS_SUBVOL_SYNC_WAIT_FOR_QUEUED,
+    };
+
+    if (ioctl(fd, BTRFS_IOC_SUBVOL_SYNC_WAIT, &args) >= 0)
+        return 0;
+    /* not queued: already cleaned, or never deleted */
+    if (errno == ENOENT || errno == EEXIST)
+        return 0;
+    return -1;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Count the sorted *ids* still queued for cleaning. */
+static enum btrfs_util_error
+count_pending(int fd, const uint64_t *ids, size_t n, size_t *pending)
+{
+    uint64_t *dead;
+    size_t ndead;
+    enum btrfs_util_error err;
+
+    err = btrfs_util_deleted_subvolumes_fd(fd, &dead, &ndead);
+    if (err)
+        return err;
+
+    *pending = 0;
+    for (size_t i = 0; i < ndead; i++)
+        if (bsearch(&dead[i], ids, n, sizeof(*ids), cmp_u64))
+            (*pending)++;
+    free(dead);
+    return BTRFS_UTIL_OK;
+}
+
+/* Copy an iterable of ints into a malloc'd array. */
+static int
+load_ids(PyObject *ids_arg, uint64_t **ids, size_t *n)
+{
+    PyObject *seq = PySequence_Fast(ids_arg, "ids must be an iterable");
+    if (!seq)
+        return -1;
+
+    *n = (size_t)PySequence_Fast_GET_SIZE(seq);
+    *ids = malloc(*n * sizeof(**ids) + 1);
+    if (!*ids) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t i = 0; i < *n; i++) {
+        (*ids)[i] = PyLong_AsUnsignedLongLong(
+            PySequence_Fast_GET_ITEM(seq, (Py_ssize_t)i));
+        if ((*ids)[i] == (uint64_t)-1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            free(*ids);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+/*
+ * BTRFS_IOC_SUBVOL_SYNC_WAIT cannot time out, so it is only used without
+ * a timeout; it returns EINTR on signals, which lets handlers run between
+ * ids.  Otherwise, and on kernels before 6.8, the deleted subvolume list
+ * is polled with a backoff, checking for signals between polls.
+ */
+PyObject *
+wait_cleaned_fd(module_state *st, int fd, PyObject *ids_arg,
+                PyObject *timeout_arg)
+{
+    uint64_t *ids = NULL;
+    size_t n = 0;
+    int all = ids_arg == Py_None;
+    double deadline;
+    enum btrfs_util_error err;
+    PyObject *result = NULL;
+
+    if (deadline_init(timeout_arg, &deadline) < 0)
+        return NULL;
+    if (!all && load_ids(ids_arg, &ids, &n) < 0)
+        return NULL;
+
+    if (timeout_arg == Py_None) {
+        size_t count = all ? 1 : n, i = 0;
+        int r = 0;
+
+        for (;;) {
+            Py_BEGIN_ALLOW_THREADS
+            for (; i < count; i++) {
+                r = subvol_sync_wait(fd, all ? 0 : ids[i]);
+                if (r < 0)
+                    break;
+            }
+            Py_END_ALLOW_THREADS
+
+            if (r == 0) {
+                result = Py_NewRef(Py_True);
+                goto out;
+            }
+            if (errno != EINTR)
+                break;          /* fall back to polling */
+            if (PyErr_CheckSignals() < 0)
+                goto out;
+        }
+    }
+
+    if (all) {
+        Py_BEGIN_ALLOW_THREADS
+        err = btrfs_util_deleted_subvolumes_fd(fd, &ids, &n);
+        Py_END_ALLOW_THREADS
+        if (err) {
+            set_error(st, err);
+            goto out;
+        }
+    }
+    qsort(ids, n, sizeof(*ids), cmp_u64);
+
+    for (long delay_ms = 10;; ) {
+        size_t pending;
+
+        Py_BEGIN_ALLOW_THREADS
+        err = count_pending(fd, ids, n, &pending);
+        Py_END_ALLOW_THREADS
+
+        if (err) {
+            set_error(st, err);
+            goto out;
+        }
+        if (!pending) {
+            result = Py_NewRef(Py_True);
+            goto out;
+        }
+        int r = deadline_sleep(deadline, delay_ms);
+        if (r) {
+            if (r > 0)
+                result = Py_NewRef(Py_False);
+            goto out;
+        }
+        delay_ms = delay_ms * 2 > CLEANUP_POLL_MAX_MS ? CLEANUP_POLL_MAX_MS
+                                                       : delay_ms * 2;
+    }
+
+out:
+    free(ids);
+    return result;
+}
+
+static PyObject *
+mod_wait_subvolumes_cleaned(PyObject *self, PyObject *const *args,
+                            Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "ids", "timeout", NULL};
+    static FastArgsParser parser = {kw, "s|OO", "wait_subvolumes_cleaned"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    PyObject *ids = Py_None, *timeout = Py_None;
+    int fd;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &ids, &timeout))
+        return NULL;
+
+    fd = open_path(st, path);
+    if (fd < 0)
+        return NULL;
+    PyObject *result = wait_cleaned_fd(st, fd, ids, timeout);
+    close(fd);
+    return result;
+}
+
 /* -- exported method table ------------------------------------------- */
 
 PyMethodDef subvolume_methods[] = {
     {"is_subvolume", (PyCFunction)mod_is_subvolume,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "is_subvolume(path: str) -> bool\n\n"
      "Return whether a path is a Btrfs subvolume."},
 
     {"subvolume_id", (PyCFunction)mod_subvolume_id,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "subvolume_id(path: str) -> int\n\n"
      "Get the subvolume ID containing a path."},
 
     {"subvolume_path", (PyCFunction)mod_subvolume_path,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "subvolume_path(path: str, id: int = 0) -> str\n\n"
      "Get the path of a subvolume relative to the filesystem root."},
 
     {"subvolume_info", (PyCFunction)mod_subvolume_info,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "subvolume_info(path: str, id: int = 0) -> SubvolumeInfo\n\n"
      "Get information about a subvolume."},
 
+    {"find_subvolume_by_uuid", (PyCFunction)mod_find_subvolume_by_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolume_by_uuid(path: str, uuid: bytes) -> int | None\n\n"
+     "Look up the ID of the subvolume with the given 16-byte UUID in the\n"
+     "UUID tree of the filesystem containing path. Returns None if no\n"
+     "subvolume has that UUID. Requires CAP_SYS_ADMIN."},
+
+    {"find_subvolume_by_received_uuid",
+     (PyCFunction)mod_find_subvolume_by_received_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolume_by_received_uuid(path: str, uuid: bytes) -> int | None\n\n"
+     "Look up the ID of a subvolume whose received UUID is uuid. If\n"
+     "several subvolumes were received from the same source, the first\n"
+     "one recorded is returned. Returns None if there is none.\n"
+     "Requires CAP_SYS_ADMIN."},
+
+    {"find_subvolumes_by_uuid", (PyCFunction)mod_find_subvolumes_by_uuid,
+     METH_FASTCALL | METH_KEYWORDS,
+     "find_subvolumes_by_uuid(path: str, uuids: list[bytes], "
+     "received: bool = False) -> list[int | None]\n\n"
+     "Batch form of find_subvolume_by_uuid() (or of\n"
+     "find_subvolume_by_received_uuid() with received=True): resolve\n"
+     "every UUID in one call on a single file descriptor. Returns the IDs\n"
+     "in the same order, with None for UUIDs that were not found."},
+
+    {"subvolume_list", (PyCFunction)mod_subvolume_list,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_list(path: str, top: int = 0, info: bool = False, "
+     "min_transid: int = 0) -> list[tuple[str, int | SubvolumeInfo]]\n\n"
+     "List all subvolumes below top (0: the subvolume containing path)\n"
+     "from a single sweep of the root tree, sorted by path. Returns the\n"
+     "same (path, id) or (path, SubvolumeInfo) pairs as SubvolumeIterator\n"
+     "in one call. With min_transid, only subvolumes whose generation is\n"
+     "at least min_transid are returned, and unchanged parts of the root\n"
+     "tree are skipped by the kernel. Requires CAP_SYS_ADMIN."},
+
+    {"subvolume_columns", (PyCFunction)mod_subvolume_columns,
+     METH_FASTCALL | METH_KEYWORDS,
+     "subvolume_columns(path: str, top: int = 0, "
+     "min_transid: int = 0) -> dict[str, memoryview | bytes]\n\n"
+     "Columnar form of subvolume_list(info=True): the same subvolumes in\n"
+     "the same order, as read-only memoryviews over packed C arrays that\n"
+     "numpy.asarray() and friends can wrap without copying. Keys 'id',\n"
+     "'parent_id', 'generation', 'ctransid', 'otransid' and 'flags' are\n"
+     "uint64 ('Q'), 'otime' is int64 seconds ('q') and 'uuid' has shape\n"
+     "(n, 16). Path i is path_data[path_offsets[i]:path_offsets[i + 1]],\n"
+     "with 'path_offsets' holding n + 1 uint64 values and 'path_data'\n"
+     "the bytes of all paths concatenated. Requires CAP_SYS_ADMIN."},
+
     {"get_subvolume_read_only", (PyCFunction)mod_get_subvolume_read_only,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "get_subvolume_read_only(path: str) -> bool\n\n"
      "Get whether a subvolume is read-only."},
 
     {"set_subvolume_read_only", (PyCFunction)mod_set_subvolume_read_only,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "set_subvolume_read_only(path: str, read_only: bool = True) -> None\n\n"
      "Set whether a subvolume is read-only."},
 
     {"get_default_subvolume", (PyCFunction)mod_get_default_subvolume,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "get_default_subvolume(path: str) -> int\n\n"
      "Get the default subvolume ID."},
 
     {"set_default_subvolume", (PyCFunction)mod_set_default_subvolume,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "set_default_subvolume(path: str, id: int = 0) -> None\n\n"
      "Set the default subvolume."},
 
     {"create_subvolume", (PyCFunction)mod_create_subvolume,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "create_subvolume(path: str, qgroup_inherit: QgroupInherit | None = None) -> None\n\n"
      "Create a new subvolume."},
 
     {"create_snapshot", (PyCFunction)mod_create_snapshot,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "create_snapshot(source: str, path: str, recursive: bool = False, "
      "read_only: bool = False, qgroup_inherit: QgroupInherit | None = None) -> None\n\n"
      "Create a snapshot of a subvolume."},
 
+    {"create_snapshot_async", (PyCFunction)mod_create_snapshot_async,
+     METH_FASTCALL | METH_KEYWORDS,
+     "create_snapshot_async(source: str, path: str, "
+     "read_only: bool = False, "
+     "qgroup_inherit: QgroupInherit | None = None) -> int\n\n"
+     "Create a snapshot without waiting for its transaction to commit and\n"
+     "return the transaction ID; pass it (or the largest of several) to\n"
+     "wait_sync() or commit_group() to make the snapshots durable.\n"
+     "Kernels since 5.7 always commit snapshot creation; there the\n"
+     "snapshot is created synchronously and its otransid is returned."},
+
     {"delete_subvolume", (PyCFunction)mod_delete_subvolume,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "delete_subvolume(path: str, recursive: bool = False) -> None\n\n"
      "Delete a subvolume or snapshot."},
 
+    {"deleted_subvolumes_array", (PyCFunction)mod_deleted_subvolumes_array,
+     METH_FASTCALL | METH_KEYWORDS,
+     "deleted_subvolumes_array(path: str, count_only: bool = False) "
+     "-> memoryview | int\n\n"
+     "Like deleted_subvolumes(), but return the IDs as a read-only 'Q'\n"
+     "memoryview over the array built in C, without creating an int\n"
+     "object per ID. With count_only, return just the number of deleted\n"
+     "but not yet cleaned up subvolumes."},
+
+    {"wait_subvolumes_cleaned", (PyCFunction)mod_wait_subvolumes_cleaned,
+     METH_FASTCALL | METH_KEYWORDS,
+     "wait_subvolumes_cleaned(path: str, ids: list[int] | None = None, "
+     "timeout: float | None = None) -> bool\n\n"
+     "Wait until the deleted subvolumes ids (None: all deleted now) have\n"
+     "been cleaned up and their space reclaimed. IDs that are not queued\n"
+     "for cleaning count as cleaned. Uses BTRFS_IOC_SUBVOL_SYNC_WAIT on\n"
+     "Linux 6.8+ when there is no timeout, else polls the deleted list\n"
+     "from C. The GIL is released while waiting and signal handlers run\n"
+     "as usual. Returns False if timeout seconds pass first. Requires\n"
+     "CAP_SYS_ADMIN."},
+
     {"deleted_subvolumes", (PyCFunction)mod_deleted_subvolumes,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "deleted_subvolumes(path: str) -> list[int]\n\n"
      "Get IDs of deleted but not yet cleaned up subvolumes."},
 
@@ -1,33 +1,265 @@
 #include "module.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "kernel-shared/uapi/btrfs.h"
+
+/* -- coalesced sync -------------------------------------------------- */
+
+/*
+ * Process-wide group commit.  Every filesystem (keyed by fsid, since each
+ * subvolume has its own st_dev) counts the syncs started and finished.
+ * A caller needs a sync that starts after it arrives, i.e. generation
+ * started + 1: it leads that sync if none is running, else waits for the
+ * running one to finish and leads or joins the next.  Any number of
+ * concurrent callers thus share at most two BTRFS_IOC_SYNC calls, and no
+ * caller waits for more than the sync in flight plus one.
+ */
+struct sync_group {
+    struct sync_group *next;
+    uint8_t fsid[BTRFS_FSID_SIZE];
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int running;
+    uint64_t started;
+    uint64_t finished;
+    uint64_t succeeded;         /* newest generation that succeeded */
+    enum btrfs_util_error err;  /* result of the newest failed one */
+    int err_no;
+};
+
+static pthread_mutex_t sync_groups_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sync_group *sync_groups;
+
+/* Groups live for the whole process; there is one per filesystem. */
+static struct sync_group *
+sync_group_get(const uint8_t *fsid)
+{
+    struct sync_group *g;
+
+    pthread_mutex_lock(&sync_groups_lock);
+    for (g = sync_groups; g; g = g->next)
+        if (memcmp(g->fsid, fsid, BTRFS_FSID_SIZE) == 0)
+            goto out;
+
+    g = calloc(1, sizeof(*g));
+    if (g) {
+        memcpy(g->fsid, fsid, BTRFS_FSID_SIZE);
+        pthread_mutex_init(&g->lock, NULL);
+        pthread_cond_init(&g->done, NULL);
+        g->next = sync_groups;
+        sync_groups = g;
+    }
+out:
+    pthread_mutex_unlock(&sync_groups_lock);
+    return g;
+}
+
+enum btrfs_util_error
+sync_coalesced_fd(int fd)
+{
+    struct btrfs_ioctl_fs_info_args fi;
+    struct sync_group *g;
+    enum btrfs_util_error err;
+    uint64_t target;
+    int err_no = 0;
+
+    memset(&fi, 0, sizeof(fi));
+    if (ioctl(fd, BTRFS_IOC_FS_INFO, &fi) < 0)
+        return errno == ENOTTY ? BTRFS_UTIL_ERROR_NOT_BTRFS
+                               : BTRFS_UTIL_ERROR_FS_INFO_FAILED;
+    g = sync_group_get(fi.fsid);
+    if (!g) {
+        errno = ENOMEM;
+        return BTRFS_UTIL_ERROR_NO_MEMORY;
+    }
+
+    pthread_mutex_lock(&g->lock);
+    target = g->started + 1;
+    while (g->finished < target) {
+        if (g->running) {
+            pthread_cond_wait(&g->done, &g->lock);
+            continue;
+        }
+
+        uint64_t gen = ++g->started;
+        g->running = 1;
+        pthread_mutex_unlock(&g->lock);
+        err = btrfs_util_sync_fd(fd);
+        err_no = errno;
+        pthread_mutex_lock(&g->lock);
+
+        g->running = 0;
+        g->finished = gen;
+        if (err) {
+            g->err = err;
+            g->err_no = err_no;
+        }
+        else {
+            g->succeeded = gen;
+        }
+        pthread_cond_broadcast(&g->done);
+    }
+
+    /* any sync that started after we arrived covers us */
+    err = BTRFS_UTIL_OK;
+    if (g->succeeded < target) {
+        err = g->err;
+        err_no = g->err_no;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    errno = err_no;
+    return err;
+}
+
+enum btrfs_util_error
+sync_coalesced(const char *path)
+{
+    enum btrfs_util_error err;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return BTRFS_UTIL_ERROR_OPEN_FAILED;
+    err = sync_coalesced_fd(fd);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return err;
+}
+
+/* -- wait_sync with a timeout --------------------------------------- */
+
+/*
+ * BTRFS_IOC_WAIT_SYNC blocks until the commit and there is no way to ask
+ * for the last committed transaction without blocking, so a wait with a
+ * timeout runs the ioctl on a helper thread (see deadline.h) with its own
+ * copy of the fd.  If the caller gives up the helper keeps waiting; the
+ * commit finishes regardless and the helper exits with it.
+ */
+struct sync_wait {
+    struct bgcall call;
+    int fd;
+    uint64_t transid;
+    enum btrfs_util_error err;
+    int err_no;
+};
+
+static void
+sync_wait_run(struct bgcall *c)
+{
+    struct sync_wait *w = (struct sync_wait *)c;
+
+    w->err = btrfs_util_wait_sync_fd(w->fd, w->transid);
+    w->err_no = errno;
+}
+
+static void
+sync_wait_release(struct bgcall *c)
+{
+    struct sync_wait *w = (struct sync_wait *)c;
+
+    close(w->fd);
+    free(w);
+}
+
+PyObject *
+wait_sync_fd(module_state *st, int fd, uint64_t transid, PyObject *timeout)
+{
+    enum btrfs_util_error err;
+    double deadline;
+
+    if (deadline_init(timeout, &deadline) < 0)
+        return NULL;
+    if (timeout == Py_None) {
+        Py_BEGIN_ALLOW_THREADS
+        err = btrfs_util_wait_sync_fd(fd, transid);
+        Py_END_ALLOW_THREADS
+
+        if (err)
+            return set_error(st, err);
+        Py_RETURN_TRUE;
+    }
+
+    struct sync_wait *w = calloc(1, sizeof(*w));
+    if (!w)
+        return PyErr_NoMemory();
+    w->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (w->fd < 0) {
+        free(w);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    w->transid = transid;
+    bgcall_init(&w->call, sync_wait_run, sync_wait_release);
+    if (bgcall_start(&w->call) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        bgcall_put(&w->call);
+        return NULL;
+    }
+
+    int r = bgcall_wait(&w->call, deadline);
+    PyObject *result = NULL;
+    if (r > 0) {
+        result = Py_NewRef(Py_False);
+    }
+    else if (r == 0) {
+        if (w->err) {
+            errno = w->err_no;
+            set_error(st, w->err);
+        }
+        else {
+            result = Py_NewRef(Py_True);
+        }
+    }
+    bgcall_put(&w->call);
+    return result;
+}
+
+/* -- module functions ------------------------------------------------ */
 
 static PyObject *
-mod_sync(PyObject *self, PyObject *args, PyObject *kwds)
+mod_sync(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+         PyObject *kwnames)
 {
-    static char *kw[] = {"path", NULL};
+    static char *kw[] = {"path", "coalesce", NULL};
+    static FastArgsParser parser = {kw, "s|p", "sync"};
+    module_state *st = get_module_state(self);
     const char *path;
+    int coalesce = 0;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &coalesce))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
-    err = btrfs_util_sync(path);
+    if (coalesce)
+        err = sync_coalesced(path);
+    else
+        err = btrfs_util_sync(path);
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     Py_RETURN_NONE;
 }
 
 static PyObject *
-mod_start_sync(PyObject *self, PyObject *args, PyObject *kwds)
+mod_start_sync(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+               PyObject *kwnames)
 {
     static char *kw[] = {"path", NULL};
+    static FastArgsParser parser = {kw, "s", "start_sync"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t transid;
     enum btrfs_util_error err;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kw, &path))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
@@ -35,45 +267,109 @@ mod_start_sync(PyObject *self, PyObject *args, PyObject *kwds)
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
+        return set_error(st, err);
     return PyLong_FromUnsignedLongLong(transid);
 }
 
 static PyObject *
-mod_wait_sync(PyObject *self, PyObject *args, PyObject *kwds)
+mod_wait_sync(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+              PyObject *kwnames)
 {
-    static char *kw[] = {"path", "transid", NULL};
+    static char *kw[] = {"path", "transid", "timeout", NULL};
+    static FastArgsParser parser = {kw, "s|KO", "wait_sync"};
+    module_state *st = get_module_state(self);
     const char *path;
     uint64_t transid = 0;
-    enum btrfs_util_error err;
+    PyObject *timeout = Py_None, *result;
+    int fd;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|K", kw,
-                                     &path, &transid))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &transid,
+                        &timeout))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS
-    err = btrfs_util_wait_sync(path, transid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    Py_END_ALLOW_THREADS
+
+    if (fd < 0)
+        return set_error(st, BTRFS_UTIL_ERROR_OPEN_FAILED);
+    result = wait_sync_fd(st, fd, transid, timeout);
+    close(fd);
+    return result;
+}
+
+static PyObject *
+mod_commit_group(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                 PyObject *kwnames)
+{
+    static char *kw[] = {"path", "transids", NULL};
+    static FastArgsParser parser = {kw, "sO", "commit_group"};
+    module_state *st = get_module_state(self);
+    const char *path;
+    PyObject *transids, *seq;
+    uint64_t transid = 0;
+    enum btrfs_util_error err = BTRFS_UTIL_OK;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &transids))
+        return NULL;
+
+    seq = PySequence_Fast(transids, "transids must be an iterable");
+    if (!seq)
+        return NULL;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        unsigned long long t =
+            PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (t == (unsigned long long)-1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+        if (t > transid)
+            transid = t;
+    }
+    Py_DECREF(seq);
+
+    /* transactions commit in order: waiting for the newest covers all */
+    Py_BEGIN_ALLOW_THREADS
+    if (!transid)
+        err = btrfs_util_start_sync(path, &transid);
+    if (!err)
+        err = btrfs_util_wait_sync(path, transid);
     Py_END_ALLOW_THREADS
 
     if (err)
-        return set_error(err);
-    Py_RETURN_NONE;
+        return set_error(st, err);
+    return PyLong_FromUnsignedLongLong(transid);
 }
 
 PyMethodDef sync_methods[] = {
     {"sync", (PyCFunction)mod_sync,
-     METH_VARARGS | METH_KEYWORDS,
-     "sync(path: str) -> None\n\nForce a sync on a Btrfs filesystem."},
+     METH_FASTCALL | METH_KEYWORDS,
+     "sync(path: str, coalesce: bool = False) -> None\n\n"
+     "Force a sync on a Btrfs filesystem. With coalesce, concurrent\n"
+     "callers in this process share syncs: a caller joins the next sync\n"
+     "to start on the filesystem (waiting for one in flight to finish\n"
+     "first) instead of issuing its own."},
 
     {"start_sync", (PyCFunction)mod_start_sync,
-     METH_VARARGS | METH_KEYWORDS,
+     METH_FASTCALL | METH_KEYWORDS,
      "start_sync(path: str) -> int\n\n"
      "Start a sync and return the transaction ID."},
 
     {"wait_sync", (PyCFunction)mod_wait_sync,
-     METH_VARARGS | METH_KEYWORDS,
-     "wait_sync(path: str, transid: int = 0) -> None\n\n"
-     "Wait for a transaction to sync."},
+     METH_FASTCALL | METH_KEYWORDS,
+     "wait_sync(path: str, transid: int = 0, timeout: float | None = None)"
+     " -> bool\n\n"
+     "Wait for a transaction to sync. Returns True once it has committed,\n"
+     "or False if timeout seconds pass first. KeyboardInterrupt and other\n"
+     "signal exceptions are raised while waiting."},
+
+    {"commit_group", (PyCFunction)mod_commit_group,
+     METH_FASTCALL | METH_KEYWORDS,
+     "commit_group(path: str, transids: list[int]) -> int\n\n"
+     "Wait once for every transaction in transids to commit, e.g. the IDs\n"
+     "returned by create_snapshot_async(). Transactions commit in order,\n"
+     "so this is a single wait_sync() on the largest ID; with no IDs it\n"
+     "commits the current transaction. Returns the ID waited for."},
 
     {NULL}
 };
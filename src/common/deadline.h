@@ -0,0 +1,258 @@
+#ifndef PYBTRFS_DEADLINE_H
+#define PYBTRFS_DEADLINE_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Timeouts and interruption for calls that can block for a long time.
+ *
+ * A timeout argument is None (no limit) or a number of seconds >= 0,
+ * which deadline_init() turns into a point on CLOCK_MONOTONIC (0 for no
+ * limit).  Waits run signal handlers as they go, so KeyboardInterrupt
+ * gets through within a poll interval or DEADLINE_SLICE_MS.
+ *
+ *     double deadline;
+ *
+ *     if (deadline_init(timeout, &deadline) < 0)
+ *         return NULL;
+ *     for (long ms = 1;; ms = ms * 2 > MAX_MS ? MAX_MS : ms * 2) {
+ *         ... poll without the GIL, return when done ...
+ *         int r = deadline_sleep(deadline, ms);
+ *         if (r)
+ *             return r < 0 ? NULL : Py_NewRef(Py_False);
+ *     }
+ */
+
+#define DEADLINE_SLICE_MS 100
+
+static inline double
+deadline_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int
+deadline_init(PyObject *timeout, double *deadline)
+{
+    *deadline = 0;
+    if (timeout == Py_None)
+        return 0;
+
+    double t = PyFloat_AsDouble(timeout);
+    if (t == -1 && PyErr_Occurred())
+        return -1;
+    if (t < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be >= 0");
+        return -1;
+    }
+    *deadline = deadline_clock() + t;
+    return 0;
+}
+
+/*
+ * Sleep for *ms* milliseconds, or until the deadline if that is sooner,
+ * with the GIL released.  Returns 0 after sleeping, 1 if the deadline
+ * has already passed, or -1 with an exception set if a signal handler
+ * raised.  Signals cut the sleep short, so handlers run promptly.
+ */
+static inline int
+deadline_sleep(double deadline, long ms)
+{
+    if (deadline) {
+        double left = deadline - deadline_clock();
+        if (left <= 0)
+            return 1;
+        if (left * 1000 < ms)
+            ms = (long)(left * 1000) + 1;
+    }
+
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000L,
+    };
+    Py_BEGIN_ALLOW_THREADS
+    nanosleep(&ts, NULL);
+    Py_END_ALLOW_THREADS
+
+    return PyErr_CheckSignals() < 0 ? -1 : 0;
+}
+
+/*
+ * A blocking call run on a thread of its own, so that its caller can
+ * stop waiting for it.  Embed struct bgcall as the first member of the
+ * call's state: run() does the work without the GIL and release() frees
+ * the state once both the thread and the caller are done with it.
+ *
+ * An abandoned call keeps running in the background.  run() may poll
+ * bgcall_cancelled() to stop early, and calls bgcall_commit() before a
+ * step that must not be left half done; after that the caller waits for
+ * the call to finish whatever the timeout or signals say.
+ */
+struct bgcall {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int done;
+    int cancelled;
+    int committed;
+    int refs;
+    void (*run)(struct bgcall *c);
+    void (*release)(struct bgcall *c);
+};
+
+static inline void
+bgcall_init(struct bgcall *c, void (*run)(struct bgcall *),
+            void (*release)(struct bgcall *))
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&c->finished, &attr);
+    pthread_condattr_destroy(&attr);
+    c->done = c->cancelled = c->committed = 0;
+    c->refs = 1;
+    c->run = run;
+    c->release = release;
+}
+
+/* Drop a reference; the last one destroys *c* and calls release(). */
+static inline void
+bgcall_put(struct bgcall *c)
+{
+    if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    pthread_cond_destroy(&c->finished);
+    pthread_mutex_destroy(&c->lock);
+    c->release(c);
+}
+
+static inline void *
+bgcall_main(void *arg)
+{
+    struct bgcall *c = arg;
+
+    c->run(c);
+    pthread_mutex_lock(&c->lock);
+    c->done = 1;
+    pthread_cond_broadcast(&c->finished);
+    pthread_mutex_unlock(&c->lock);
+    bgcall_put(c);
+    return NULL;
+}
+
+/*
+ * Start run() on a detached thread.  Returns 0, or -1 with errno set if
+ * no thread could be started, in which case the caller may still call
+ * run() itself.
+ */
+static inline int
+bgcall_start(struct bgcall *c)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err;
+
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    err = pthread_create(&thread, &attr, bgcall_main, c);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        __atomic_sub_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* For run(): whether the caller has given up on the call. */
+static inline int
+bgcall_cancelled(struct bgcall *c)
+{
+    pthread_mutex_lock(&c->lock);
+    int cancelled = c->cancelled;
+    pthread_mutex_unlock(&c->lock);
+    return cancelled;
+}
+
+/*
+ * For run(): commit to finishing.  Returns -1 if the caller has already
+ * given up, in which case run() should stop instead.
+ */
+static inline int
+bgcall_commit(struct bgcall *c)
+{
+    pthread_mutex_lock(&c->lock);
+    int cancelled = c->cancelled;
+    if (!cancelled)
+        c->committed = 1;
+    pthread_mutex_unlock(&c->lock);
+    return cancelled ? -1 : 0;
+}
+
+/*
+ * Wait for a started call, with the GIL held.  Returns 0 once it has
+ * finished, 1 if the deadline passed first, or -1 with an exception set
+ * if a signal handler raised.  On 1 or -1 the call is cancelled, unless
+ * it had committed: then this waits for it to finish, and returns 0 for
+ * a passed deadline or -1 for the exception.
+ */
+static inline int
+bgcall_wait(struct bgcall *c, double deadline)
+{
+    int ret = 0;
+
+    for (;;) {
+        int done, committed;
+
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&c->lock);
+        if (c->committed) {
+            while (!c->done)
+                pthread_cond_wait(&c->finished, &c->lock);
+        }
+        else if (!c->done) {
+            double until = deadline_clock() + DEADLINE_SLICE_MS / 1000.0;
+            if (deadline && deadline < until)
+                until = deadline;
+            struct timespec ts = {
+                .tv_sec = (time_t)until,
+                .tv_nsec = (long)((until - (time_t)until) * 1e9),
+            };
+            pthread_cond_timedwait(&c->finished, &c->lock, &ts);
+        }
+        done = c->done;
+        pthread_mutex_unlock(&c->lock);
+        Py_END_ALLOW_THREADS
+
+        if (done)
+            return ret;
+        if (PyErr_CheckSignals() < 0)
+            ret = -1;
+        else if (deadline && deadline_clock() >= deadline)
+            ret = 1;
+        else
+            continue;
+
+        pthread_mutex_lock(&c->lock);
+        committed = c->committed;
+        if (!committed)
+            c->cancelled = 1;
+        pthread_mutex_unlock(&c->lock);
+        if (!committed)
+            return ret;
+        /* too late to give up: wait, then report the real result */
+        if (ret > 0)
+            ret = 0;
+    }
+}
+
+#endif /* PYBTRFS_DEADLINE_H */
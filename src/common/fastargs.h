@@ -0,0 +1,357 @@
+#ifndef PYBTRFS_FASTARGS_H
+#define PYBTRFS_FASTARGS_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
+
+/*
+ * Argument parsing for METH_FASTCALL functions.
+ *
+ * CPython's own cached keyword parser (_PyArg_Parser) is private API, so
+ * this is a small stand-in that understands the subset of
+ * PyArg_ParseTupleAndKeywords format units the extensions use:
+ *
+ *   s    str -> const char * (no embedded NUL)
+ *   p    truth value -> int
+ *   i    int -> int (range checked)
+ *   I    int -> unsigned int (masked)
+ *   n    int -> Py_ssize_t
+ *   k    int -> unsigned long (masked)
+ *   K    int -> unsigned long long (masked)
+ *   L    int -> long long
+ *   O    object -> PyObject * (borrowed)
+ *   O!   object of a type -> PyTypeObject *, PyObject **
+ *   y#   bytes -> const char **, Py_ssize_t *
+ *   |    remaining arguments are optional
+ *   $    remaining arguments are keyword-only
+ *
+ * The format is scanned once, on the first call; after that a call is a
+ * vector walk that never allocates.  Keyword names are compared against
+ * the C strings, so a parser holds no Python objects and one static
+ * parser serves every interpreter that imports the module.  A parser
+ * without keywords accepts positional arguments only.
+ *
+ *     static char *kw[] = {"path", "id", NULL};
+ *     static FastArgsParser parser = {kw, "s|K", "subvolume_info"};
+ *
+ *     if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &id))
+ *         return NULL;
+ */
+
+#define FASTARGS_MAX 16
+
+typedef struct {
+    char **keywords;        /* NULL-terminated, or NULL for positional only */
+    const char *format;
+    const char *fname;      /* for error messages */
+
+    /*
+     * Argument counts, filled in on first use: 0 until then, else
+     * FASTARGS_READY | nargs << 16 | min << 8 | maxpos.  One word, so
+     * threads in any interpreter may race to compute it.
+     */
+    unsigned int layout;
+} FastArgsParser;
+
+#define FASTARGS_READY (1u << 24)
+
+typedef struct {
+    int nargs;              /* format units */
+    int min;                /* required arguments */
+    int maxpos;             /* arguments accepted by position */
+} FastArgsLayout;
+
+static inline int
+fastargs_layout(FastArgsParser *p, FastArgsLayout *l)
+{
+    unsigned int word = __atomic_load_n(&p->layout, __ATOMIC_RELAXED);
+
+    if (!word) {
+        int n = 0;
+        int min = -1;
+        int maxpos = -1;
+
+        for (const char *f = p->format; *f; f++) {
+            if (*f == '|')
+                min = n;
+            else if (*f == '$')
+                maxpos = n;
+            else if (*f != '!' && *f != '#')
+                n++;
+        }
+        if (n > FASTARGS_MAX) {
+            PyErr_Format(PyExc_SystemError,
+                         "%s(): too many arguments in format", p->fname);
+            return -1;
+        }
+        word = FASTARGS_READY | (unsigned int)n << 16
+            | (unsigned int)(min < 0 ? n : min) << 8
+            | (unsigned int)(maxpos < 0 ? n : maxpos);
+        __atomic_store_n(&p->layout, word, __ATOMIC_RELAXED);
+    }
+
+    l->nargs = (word >> 16) & 0xff;
+    l->min = (word >> 8) & 0xff;
+    l->maxpos = word & 0xff;
+    return 0;
+}
+
+/* index of keyword *key* among the first *n*, or -1 */
+static inline int
+fastargs_find(const FastArgsParser *p, int n, PyObject *key)
+{
+    for (int i = 0; i < n; i++)
+        if (PyUnicode_CompareWithASCIIString(key, p->keywords[i]) == 0)
+            return i;
+    return -1;
+}
+
+static inline int
+fastargs_type_error(const FastArgsParser *p, int i, const char *expected,
+                    PyObject *arg)
+{
+    if (p->keywords)
+        PyErr_Format(PyExc_TypeError, "%s() argument '%s' must be %s, not %.50s",
+                     p->fname, p->keywords[i], expected,
+                     Py_TYPE(arg)->tp_name);
+    else
+        PyErr_Format(PyExc_TypeError, "%s() argument %d must be %s, not %.50s",
+                     p->fname, i + 1, expected, Py_TYPE(arg)->tp_name);
+    return 0;
+}
+
+/*
+ * Convert argument *i* for the format unit at **f, advancing *f past
+ * any '!' or '#' modifier.  The destination pointers are consumed from
+ * *va even when the argument was not given (arg == NULL), in which case
+ * the destination keeps its default.
+ */
+static inline int
+fastargs_convert(const FastArgsParser *p, int i, const char **f,
+                 PyObject *arg, va_list *va)
+{
+    switch (**f) {
+    case 's': {
+        const char **out = va_arg(*va, const char **);
+        Py_ssize_t len;
+
+        if (!arg)
+            return 1;
+        if (!PyUnicode_Check(arg))
+            return fastargs_type_error(p, i, "str", arg);
+        const char *s = PyUnicode_AsUTF8AndSize(arg, &len);
+        if (!s)
+            return 0;
+        if (strlen(s) != (size_t)len) {
+            PyErr_SetString(PyExc_ValueError, "embedded null character");
+            return 0;
+        }
+        *out = s;
+        return 1;
+    }
+    case 'p': {
+        int *out = va_arg(*va, int *);
+
+        if (!arg)
+            return 1;
+        int v = PyObject_IsTrue(arg);
+        if (v < 0)
+            return 0;
+        *out = v;
+        return 1;
+    }
+    case 'i': {
+        int *out = va_arg(*va, int *);
+
+        if (!arg)
+            return 1;
+        long v = PyLong_AsLong(arg);
+        if (v == -1 && PyErr_Occurred())
+            return 0;
+        if (v > INT_MAX) {
+            PyErr_SetString(PyExc_OverflowError,
+                            "signed integer is greater than maximum");
+            return 0;
+        }
+        if (v < INT_MIN) {
+            PyErr_SetString(PyExc_OverflowError,
+                            "signed integer is less than minimum");
+            return 0;
+        }
+        *out = (int)v;
+        return 1;
+    }
+    case 'I': {
+        unsigned int *out = va_arg(*va, unsigned int *);
+
+        if (!arg)
+            return 1;
+        if (!PyLong_Check(arg))
+            return fastargs_type_error(p, i, "int", arg);
+        *out = (unsigned int)PyLong_AsUnsignedLongMask(arg);
+        return 1;
+    }
+    case 'n': {
+        Py_ssize_t *out = va_arg(*va, Py_ssize_t *);
+
+        if (!arg)
+            return 1;
+        Py_ssize_t v = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+        if (v == -1 && PyErr_Occurred())
+            return 0;
+        *out = v;
+        return 1;
+    }
+    case 'k': {
+        unsigned long *out = va_arg(*va, unsigned long *);
+
+        if (!arg)
+            return 1;
+        if (!PyLong_Check(arg))
+            return fastargs_type_error(p, i, "int", arg);
+        *out = PyLong_AsUnsignedLongMask(arg);
+        return 1;
+    }
+    case 'K': {
+        unsigned long long *out = va_arg(*va, unsigned long long *);
+
+        if (!arg)
+            return 1;
+        if (!PyLong_Check(arg))
+            return fastargs_type_error(p, i, "int", arg);
+        *out = PyLong_AsUnsignedLongLongMask(arg);
+        return 1;
+    }
+    case 'L': {
+        long long *out = va_arg(*va, long long *);
+
+        if (!arg)
+            return 1;
+        long long v = PyLong_AsLongLong(arg);
+        if (v == -1 && PyErr_Occurred())
+            return 0;
+        *out = v;
+        return 1;
+    }
+    case 'O': {
+        PyTypeObject *type = NULL;
+
+        if ((*f)[1] == '!') {
+            (*f)++;
+            type = va_arg(*va, PyTypeObject *);
+        }
+        PyObject **out = va_arg(*va, PyObject **);
+
+        if (!arg)
+            return 1;
+        if (type && !PyObject_TypeCheck(arg, type))
+            return fastargs_type_error(p, i, type->tp_name, arg);
+        *out = arg;
+        return 1;
+    }
+    case 'y': {
+        if ((*f)[1] != '#')
+            break;
+        (*f)++;
+        const char **out = va_arg(*va, const char **);
+        Py_ssize_t *len = va_arg(*va, Py_ssize_t *);
+
+        if (!arg)
+            return 1;
+        if (!PyBytes_Check(arg))
+            return fastargs_type_error(p, i, "bytes", arg);
+        *out = PyBytes_AS_STRING(arg);
+        *len = PyBytes_GET_SIZE(arg);
+        return 1;
+    }
+    }
+
+    PyErr_Format(PyExc_SystemError, "%s(): bad format unit '%c'",
+                 p->fname, **f);
+    return 0;
+}
+
+/*
+ * Parse a METH_FASTCALL argument vector against *p*, storing into the
+ * trailing pointers as PyArg_ParseTupleAndKeywords would.  Returns 1 on
+ * success, 0 with an exception set on failure.
+ */
+static inline int
+fastargs_parse(FastArgsParser *p, PyObject *const *args, Py_ssize_t nargs,
+               PyObject *kwnames, ...)
+{
+    PyObject *slots[FASTARGS_MAX];
+    Py_ssize_t nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    FastArgsLayout l;
+
+    if (fastargs_layout(p, &l) < 0)
+        return 0;
+
+    if (nargs > l.maxpos || (!p->keywords && nargs < l.min)) {
+        int limit = nargs > l.maxpos ? l.maxpos : l.min;
+
+        PyErr_Format(PyExc_TypeError,
+                     "%s() takes %s %d positional argument%s (%zd given)",
+                     p->fname,
+                     l.min == l.maxpos ? "exactly"
+                         : nargs > l.maxpos ? "at most" : "at least",
+                     limit, limit == 1 ? "" : "s", nargs);
+        return 0;
+    }
+    if (nkw && !p->keywords) {
+        PyErr_Format(PyExc_TypeError, "%s() takes no keyword arguments",
+                     p->fname);
+        return 0;
+    }
+
+    for (int i = 0; i < l.nargs; i++)
+        slots[i] = i < nargs ? args[i] : NULL;
+
+    for (Py_ssize_t k = 0; k < nkw; k++) {
+        PyObject *key = PyTuple_GET_ITEM(kwnames, k);
+        int i = fastargs_find(p, l.nargs, key);
+
+        if (i < 0) {
+            PyErr_Format(PyExc_TypeError,
+                         "'%U' is an invalid keyword argument for %s()",
+                         key, p->fname);
+            return 0;
+        }
+        if (slots[i]) {
+            PyErr_Format(PyExc_TypeError,
+                         "argument for %s() given by name ('%s') "
+                         "and position (%d)",
+                         p->fname, p->keywords[i], i + 1);
+            return 0;
+        }
+        slots[i] = args[nargs + k];
+    }
+
+    for (int i = 0; i < l.min; i++) {
+        if (!slots[i]) {
+            PyErr_Format(PyExc_TypeError,
+                         "%s() missing required argument '%s' (pos %d)",
+                         p->fname, p->keywords[i], i + 1);
+            return 0;
+        }
+    }
+
+    va_list va;
+    const char *f = p->format;
+    int ok = 1;
+
+    va_start(va, kwnames);
+    for (int i = 0; *f && ok; f++) {
+        if (*f == '|' || *f == '$')
+            continue;
+        ok = fastargs_convert(p, i, &f, slots[i], &va);
+        i++;
+    }
+    va_end(va);
+    return ok;
+}
+
+#endif /* PYBTRFS_FASTARGS_H */
@@ -47,6 +47,9 @@
 #include "check/qgroup-verify.h"
 #include "mkfs/common.h"
 
+#include "deadline.h"
+#include "fastargs.h"
+
 /* -- structs from mkfs/main.c ----------------------------------- */
 
 struct mkfs_allocation {
@@ -718,156 +721,88 @@ PyDoc_STRVAR(pybtrfs_mkfs_doc,
 "mkfs(*devices: str, label: str = \"\", nodesize: int = 16384, sectorsize: int = 4096,\n"
 "     byte_count: int = 0, metadata_profile: int = -1, data_profile: int = 0,\n"
 "     mixed: bool = False, features: int = 0, csum_type: int = 0, uuid: str = \"\",\n"
-"     force: bool = False, no_discard: bool = False) -> dict\n\n"
+"     force: bool = False, no_discard: bool = False,\n"
+"     timeout: float | None = None) -> dict\n\n"
 "Create a btrfs filesystem on one or more block devices.\n\n"
 "Returns a dict with keys 'uuid' (str) and 'num_bytes' (int).\n"
-"Raises OSError on failure.");
-
-static PyObject *
-pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
-{
-	static char *kwlist[] = {
-		"label", "nodesize", "sectorsize",
-		"byte_count", "metadata_profile", "data_profile",
-		"mixed", "features", "csum_type", "uuid",
-		"force", "no_discard", NULL
-	};
-
-	const char *label = "";
-	unsigned int nodesize = 16384;
-	unsigned int sectorsize = 4096;
-	unsigned long long byte_count = 0;
-	long long metadata_profile = -1;  /* -1 = auto */
-	unsigned long long data_profile = 0;
-	int mixed = 0;
-	unsigned long long features_arg = 0;
-	int csum_type = 0;
-	const char *fs_uuid_str = "";
-	int force = 0;
-	int no_discard = 0;
-
-	/*
-	 * All positional args are device paths — they arrive in 'args'.
-	 * Only keyword args are parsed via PyArg_ParseTupleAndKeywords
-	 * using an empty positional tuple.
-	 */
-	PyObject *empty_tuple = PyTuple_New(0);
-	if (!empty_tuple)
-		return NULL;
-
-	int parse_ok = PyArg_ParseTupleAndKeywords(
-		empty_tuple, kwargs, "|sIIKLKpKis$pp:mkfs",
-		kwlist,
-		&label, &nodesize, &sectorsize,
-		&byte_count,
-		&metadata_profile, &data_profile,
-		&mixed, &features_arg,
-		&csum_type, &fs_uuid_str,
-		&force, &no_discard);
-	Py_DECREF(empty_tuple);
-	if (!parse_ok)
-		return NULL;
+"Raises OSError on failure. Only one mkfs runs at a time; if timeout\n"
+"seconds pass, or KeyboardInterrupt arrives, before this one starts\n"
+"writing to the devices, it is abandoned (TimeoutError for the\n"
+"timeout). Once writing has started it always runs to completion.");
 
-	/* args itself is the devices tuple */
-	Py_ssize_t device_count = PyTuple_GET_SIZE(args);
-	if (device_count < 1) {
-		PyErr_SetString(PyExc_ValueError,
-				"at least one device is required");
-		return NULL;
-	}
-
-	/* Extract device paths */
-	const char **device_paths = calloc(device_count, sizeof(char *));
-	if (!device_paths)
-		return PyErr_NoMemory();
-
-	for (Py_ssize_t i = 0; i < device_count; i++) {
-		PyObject *item = PyTuple_GET_ITEM(args, i);
-		if (!PyUnicode_Check(item)) {
-			free(device_paths);
-			PyErr_SetString(PyExc_TypeError,
-					"device paths must be strings");
-			return NULL;
-		}
-		device_paths[i] = PyUnicode_AsUTF8(item);
-		if (!device_paths[i]) {
-			free(device_paths);
-			return NULL;
-		}
-	}
-
-	/* Validate label length */
-	if (strlen(label) >= BTRFS_LABEL_SIZE) {
-		free(device_paths);
-		PyErr_Format(PyExc_ValueError,
-			     "label too long (max %d)", BTRFS_LABEL_SIZE - 1);
-		return NULL;
-	}
-
-	/* Validate UUID if provided */
-	char fs_uuid[BTRFS_UUID_UNPARSED_SIZE] = { 0 };
-	if (fs_uuid_str[0]) {
-		uuid_t dummy;
-		if (uuid_parse(fs_uuid_str, dummy) != 0) {
-			free(device_paths);
-			PyErr_Format(PyExc_ValueError,
-				     "invalid UUID: %s", fs_uuid_str);
-			return NULL;
-		}
-		strncpy(fs_uuid, fs_uuid_str, BTRFS_UUID_UNPARSED_SIZE - 1);
-	}
+/*
+ * btrfs-progs keeps process-wide state (the device list closed by
+ * btrfs_close_all_devices(), config, hash setup), so only one mkfs runs
+ * at a time.  Taken without the GIL.
+ */
+static pthread_mutex_t mkfs_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	/* Auto-select metadata profile based on device count */
+/*
+ * One mkfs call.  The inputs are copied out of the Python arguments, since
+ * the call runs on a thread of its own and may outlive its caller.
+ */
+struct mkfs_job {
+	struct bgcall call;
+	char **devices;
+	Py_ssize_t device_count;
+	char *label;
+	char fs_uuid[BTRFS_UUID_UNPARSED_SIZE];
+	unsigned int nodesize;
+	unsigned int sectorsize;
+	u64 byte_count;
 	u64 meta_profile;
-	if (metadata_profile < 0) {
-		if (!mixed) {
-			meta_profile = (device_count > 1)
-				? BTRFS_MKFS_DEFAULT_META_MULTI_DEVICE
-				: BTRFS_MKFS_DEFAULT_META_ONE_DEVICE;
-		} else {
-			meta_profile = 0;
-		}
-	} else {
-		meta_profile = (u64)metadata_profile;
-	}
+	u64 data_prof;
+	int mixed;
+	struct btrfs_mkfs_features features;
+	int csum_type;
+	int force;
+	int no_discard;
 
-	u64 data_prof = data_profile;
-	if (!mixed && data_prof == 0 && device_count > 1) {
-		data_prof = BTRFS_MKFS_DEFAULT_DATA_MULTI_DEVICE;
-	}
-
-	/* Build feature flags */
-	struct btrfs_mkfs_features mkfs_features = btrfs_mkfs_default_features;
-	mkfs_features.incompat_flags |= features_arg;
-
-	if (mixed)
-		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_MIXED_GROUPS;
-
-	if ((data_prof | meta_profile) & BTRFS_BLOCK_GROUP_RAID56_MASK)
-		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_RAID56;
-
-	if ((data_prof | meta_profile) &
-	    (BTRFS_BLOCK_GROUP_RAID1C3 | BTRFS_BLOCK_GROUP_RAID1C4))
-		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_RAID1C34;
+	int ret;
+	char result_uuid[BTRFS_UUID_UNPARSED_SIZE];
+	u64 result_num_bytes;
+};
 
-	if (nodesize > sysconf(_SC_PAGE_SIZE))
-		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_BIG_METADATA;
+static void mkfs_job_release(struct bgcall *c)
+{
+	struct mkfs_job *job = (struct mkfs_job *)c;
 
-	if (mixed && nodesize != sectorsize)
-		nodesize = sectorsize;
+	for (Py_ssize_t i = 0; i < job->device_count; i++)
+		free(job->devices[i]);
+	free(job->devices);
+	free(job->label);
+	free(job);
+}
 
-	/* Do the work with GIL released */
+/* Runs without the GIL */
+static void mkfs_job_run(struct bgcall *c)
+{
+	struct mkfs_job *job = (struct mkfs_job *)c;
+	char **device_paths = job->devices;
+	Py_ssize_t device_count = job->device_count;
+	unsigned int nodesize = job->nodesize;
+	unsigned int sectorsize = job->sectorsize;
+	u64 byte_count = job->byte_count;
+	u64 meta_profile = job->meta_profile;
+	u64 data_prof = job->data_prof;
+	int mixed = job->mixed;
+	int csum_type = job->csum_type;
+	int force = job->force;
 	int ret = 0;
 	int close_ret = 0;
-	char result_uuid[BTRFS_UUID_UNPARSED_SIZE] = { 0 };
-	u64 result_num_bytes = 0;
 
-	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&mkfs_lock);
 
 	cpu_detect_flags();
 	hash_init_accel();
 	btrfs_config_init();
 
+	/* The caller may have given up while another mkfs held the lock */
+	if (bgcall_cancelled(c)) {
+		ret = -ECANCELED;
+		goto out_free;
+	}
+
 	/* Validate devices */
 	if (!force) {
 		for (Py_ssize_t i = 0; i < device_count; i++) {
@@ -878,6 +813,12 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 		}
 	}
 
+	/* Past this point devices are written, so finish whatever happens */
+	if (bgcall_commit(c) < 0) {
+		ret = -ECANCELED;
+		goto out_free;
+	}
+
 	/* Prepare all devices in parallel */
 	pthread_t *t_prepare = calloc(device_count, sizeof(pthread_t));
 	struct prepare_device_progress *prepare_ctx =
@@ -891,10 +832,10 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 	}
 
 	int oflags = O_RDWR;
-	int do_discard = !no_discard;
+	int do_discard = !job->no_discard;
 
 	for (Py_ssize_t i = 0; i < device_count; i++) {
-		prepare_ctx[i].file = (char *)device_paths[i];
+		prepare_ctx[i].file = device_paths[i];
 		prepare_ctx[i].byte_count = byte_count;
 		prepare_ctx[i].dev_byte_count = byte_count;
 		prepare_ctx[i].oflags = oflags;
@@ -934,13 +875,13 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 	/* Fill mkfs config */
 	struct btrfs_mkfs_config mkfs_cfg;
 	memset(&mkfs_cfg, 0, sizeof(mkfs_cfg));
-	mkfs_cfg.label = label[0] ? label : NULL;
-	memcpy(mkfs_cfg.fs_uuid, fs_uuid, sizeof(mkfs_cfg.fs_uuid));
+	mkfs_cfg.label = job->label[0] ? job->label : NULL;
+	memcpy(mkfs_cfg.fs_uuid, job->fs_uuid, sizeof(mkfs_cfg.fs_uuid));
 	mkfs_cfg.num_bytes = dev_byte_count;
 	mkfs_cfg.nodesize = nodesize;
 	mkfs_cfg.sectorsize = sectorsize;
 	mkfs_cfg.stripesize = sectorsize;
-	mkfs_cfg.features = mkfs_features;
+	mkfs_cfg.features = job->features;
 	mkfs_cfg.csum_type = csum_type;
 	mkfs_cfg.leaf_data_size = __BTRFS_LEAF_DATA_SIZE(nodesize);
 	mkfs_cfg.zone_size = 0;
@@ -967,20 +908,20 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 	/* Create metadata block groups */
 	struct mkfs_allocation allocation = { 0 };
 	ret = create_metadata_block_groups(root,
-					   mkfs_features.incompat_flags,
+					   job->features.incompat_flags,
 					   &allocation, meta_profile);
 	if (ret)
 		goto out_ctree;
 
 	/* Optional tree roots */
-	if (mkfs_features.incompat_flags &
+	if (job->features.incompat_flags &
 	    BTRFS_FEATURE_INCOMPAT_RAID_STRIPE_TREE) {
 		ret = setup_raid_stripe_tree_root(fs_info);
 		if (ret)
 			goto out_ctree;
 	}
 
-	if (mkfs_features.incompat_flags &
+	if (job->features.incompat_flags &
 	    BTRFS_FEATURE_INCOMPAT_REMAP_TREE) {
 		ret = setup_remap_tree_root(fs_info);
 		if (ret)
@@ -999,7 +940,7 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 	if (ret)
 		goto out_ctree;
 
-	if (mkfs_features.incompat_flags &
+	if (job->features.incompat_flags &
 	    BTRFS_FEATURE_INCOMPAT_EXTENT_TREE_V2) {
 		int nr_global_roots = sysconf(_SC_NPROCESSORS_ONLN);
 		ret = create_global_roots(trans, nr_global_roots);
@@ -1065,7 +1006,7 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 		goto out_ctree;
 
 	/* Create data reloc tree */
-	if (!(mkfs_features.incompat_flags &
+	if (!(job->features.incompat_flags &
 	      BTRFS_FEATURE_INCOMPAT_REMAP_TREE)) {
 		ret = btrfs_make_subvolume(trans,
 					   BTRFS_DATA_RELOC_TREE_OBJECTID,
@@ -1090,8 +1031,9 @@ pybtrfs_mkfs(PyObject *self, PyObject *args, PyObject *kwargs)
 		goto out_ctree;
 
 	/* Capture results before closing */
-	strncpy(result_uuid, mkfs_cfg.fs_uuid, BTRFS_UUID_UNPARSED_SIZE - 1);
-	result_num_bytes = btrfs_super_total_bytes(fs_info->super_copy);
+	strncpy(job->result_uuid, mkfs_cfg.fs_uuid,
+		BTRFS_UUID_UNPARSED_SIZE - 1);
+	job->result_num_bytes = btrfs_super_total_bytes(fs_info->super_copy);
 
 	fs_info->finalize_on_close = 1;
 
@@ -1111,44 +1053,210 @@ out_close:
 out_free:
 	btrfs_close_all_devices();
 
-	Py_END_ALLOW_THREADS
+	pthread_mutex_unlock(&mkfs_lock);
+	job->ret = ret;
+}
 
-	free(device_paths);
+static PyObject *
+pybtrfs_mkfs(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+	     PyObject *kwnames)
+{
+	static char *kwlist[] = {
+		"label", "nodesize", "sectorsize",
+		"byte_count", "metadata_profile", "data_profile",
+		"mixed", "features", "csum_type", "uuid",
+		"force", "no_discard", "timeout", NULL
+	};
+	static FastArgsParser parser = {kwlist, "|$sIIKLKpKisppO", "mkfs"};
 
-	if (ret) {
-		errno = -ret;
-		return PyErr_SetFromErrno(PyExc_OSError);
+	const char *label = "";
+	unsigned int nodesize = 16384;
+	unsigned int sectorsize = 4096;
+	unsigned long long byte_count = 0;
+	long long metadata_profile = -1;  /* -1 = auto */
+	unsigned long long data_profile = 0;
+	int mixed = 0;
+	unsigned long long features_arg = 0;
+	int csum_type = 0;
+	const char *fs_uuid_str = "";
+	int force = 0;
+	int no_discard = 0;
+	PyObject *timeout = Py_None;
+	double deadline;
+
+	/*
+	 * All positional args are device paths.  The keyword values follow
+	 * them in the vector, so only that tail is handed to the parser.
+	 */
+	if (!fastargs_parse(&parser, args + nargs, 0, kwnames,
+			    &label, &nodesize, &sectorsize,
+			    &byte_count,
+			    &metadata_profile, &data_profile,
+			    &mixed, &features_arg,
+			    &csum_type, &fs_uuid_str,
+			    &force, &no_discard, &timeout))
+		return NULL;
+	if (deadline_init(timeout, &deadline) < 0)
+		return NULL;
+
+	Py_ssize_t device_count = nargs;
+	if (device_count < 1) {
+		PyErr_SetString(PyExc_ValueError,
+				"at least one device is required");
+		return NULL;
+	}
+
+	struct mkfs_job *job = calloc(1, sizeof(*job));
+	if (!job)
+		return PyErr_NoMemory();
+
+	/* Copy device paths */
+	job->devices = calloc(device_count, sizeof(char *));
+	if (!job->devices) {
+		free(job);
+		return PyErr_NoMemory();
 	}
+	job->device_count = device_count;
 
-	return Py_BuildValue("{s:s,s:K}", "uuid", result_uuid,
-			     "num_bytes", result_num_bytes);
+	for (Py_ssize_t i = 0; i < device_count; i++) {
+		PyObject *item = args[i];
+		if (!PyUnicode_Check(item)) {
+			mkfs_job_release(&job->call);
+			PyErr_SetString(PyExc_TypeError,
+					"device paths must be strings");
+			return NULL;
+		}
+		const char *path = PyUnicode_AsUTF8(item);
+		if (!path) {
+			mkfs_job_release(&job->call);
+			return NULL;
+		}
+		job->devices[i] = strdup(path);
+		if (!job->devices[i]) {
+			mkfs_job_release(&job->call);
+			return PyErr_NoMemory();
+		}
+	}
+
+	/* Validate label length */
+	if (strlen(label) >= BTRFS_LABEL_SIZE) {
+		mkfs_job_release(&job->call);
+		PyErr_Format(PyExc_ValueError,
+			     "label too long (max %d)", BTRFS_LABEL_SIZE - 1);
+		return NULL;
+	}
+	job->label = strdup(label);
+	if (!job->label) {
+		mkfs_job_release(&job->call);
+		return PyErr_NoMemory();
+	}
+
+	/* Validate UUID if provided */
+	if (fs_uuid_str[0]) {
+		uuid_t dummy;
+		if (uuid_parse(fs_uuid_str, dummy) != 0) {
+			mkfs_job_release(&job->call);
+			PyErr_Format(PyExc_ValueError,
+				     "invalid UUID: %s", fs_uuid_str);
+			return NULL;
+		}
+		strncpy(job->fs_uuid, fs_uuid_str,
+			BTRFS_UUID_UNPARSED_SIZE - 1);
+	}
+
+	/* Auto-select metadata profile based on device count */
+	u64 meta_profile;
+	if (metadata_profile < 0) {
+		if (!mixed) {
+			meta_profile = (device_count > 1)
+				? BTRFS_MKFS_DEFAULT_META_MULTI_DEVICE
+				: BTRFS_MKFS_DEFAULT_META_ONE_DEVICE;
+		} else {
+			meta_profile = 0;
+		}
+	} else {
+		meta_profile = (u64)metadata_profile;
+	}
+
+	u64 data_prof = data_profile;
+	if (!mixed && data_prof == 0 && device_count > 1) {
+		data_prof = BTRFS_MKFS_DEFAULT_DATA_MULTI_DEVICE;
+	}
+
+	/* Build feature flags */
+	struct btrfs_mkfs_features mkfs_features = btrfs_mkfs_default_features;
+	mkfs_features.incompat_flags |= features_arg;
+
+	if (mixed)
+		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_MIXED_GROUPS;
+
+	if ((data_prof | meta_profile) & BTRFS_BLOCK_GROUP_RAID56_MASK)
+		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_RAID56;
+
+	if ((data_prof | meta_profile) &
+	    (BTRFS_BLOCK_GROUP_RAID1C3 | BTRFS_BLOCK_GROUP_RAID1C4))
+		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_RAID1C34;
+
+	if (nodesize > sysconf(_SC_PAGE_SIZE))
+		mkfs_features.incompat_flags |= BTRFS_FEATURE_INCOMPAT_BIG_METADATA;
+
+	if (mixed && nodesize != sectorsize)
+		nodesize = sectorsize;
+
+	job->nodesize = nodesize;
+	job->sectorsize = sectorsize;
+	job->byte_count = byte_count;
+	job->meta_profile = meta_profile;
+	job->data_prof = data_prof;
+	job->mixed = mixed;
+	job->features = mkfs_features;
+	job->csum_type = csum_type;
+	job->force = force;
+	job->no_discard = no_discard;
+
+	/*
+	 * Do the work on a thread of its own with the GIL released, so that
+	 * signals and the timeout are noticed while waiting.  Without a
+	 * thread, run it here instead.
+	 */
+	int r = 0;
+	bgcall_init(&job->call, mkfs_job_run, mkfs_job_release);
+	if (bgcall_start(&job->call) < 0) {
+		Py_BEGIN_ALLOW_THREADS
+		mkfs_job_run(&job->call);
+		Py_END_ALLOW_THREADS
+	} else {
+		r = bgcall_wait(&job->call, deadline);
+	}
+
+	PyObject *result = NULL;
+	if (r > 0) {
+		PyErr_SetString(PyExc_TimeoutError,
+				"mkfs did not start before the timeout");
+	} else if (r == 0 && job->ret) {
+		errno = -job->ret;
+		PyErr_SetFromErrno(PyExc_OSError);
+	} else if (r == 0) {
+		result = Py_BuildValue("{s:s,s:K}", "uuid", job->result_uuid,
+				       "num_bytes", job->result_num_bytes);
+	}
+	bgcall_put(&job->call);
+	return result;
 }
 
 /* -- method table ---------------------------------------------- */
 
 static PyMethodDef mkfs_methods[] = {
-	{"mkfs", (PyCFunction)pybtrfs_mkfs, METH_VARARGS | METH_KEYWORDS,
+	{"mkfs", (PyCFunction)pybtrfs_mkfs, METH_FASTCALL | METH_KEYWORDS,
 	 pybtrfs_mkfs_doc},
 	{NULL, NULL, 0, NULL},
 };
 
 /* -- module definition ----------------------------------------- */
 
-static struct PyModuleDef mkfs_module = {
-	PyModuleDef_HEAD_INIT,
-	.m_name    = "pybtrfs.mkfs",
-	.m_doc     = "Create btrfs filesystems (wraps btrfs-progs mkfs).",
-	.m_size    = -1,
-	.m_methods = mkfs_methods,
-};
-
-PyMODINIT_FUNC
-PyInit_mkfs(void)
+static int
+mkfs_exec(PyObject *m)
 {
-	PyObject *m = PyModule_Create(&mkfs_module);
-	if (!m)
-		return NULL;
-
 	/* Checksum type constants */
 	PyModule_AddIntConstant(m, "CSUM_TYPE_CRC32",   BTRFS_CSUM_TYPE_CRC32);
 	PyModule_AddIntConstant(m, "CSUM_TYPE_XXHASH",  BTRFS_CSUM_TYPE_XXHASH);
@@ -1186,5 +1294,32 @@ PyInit_mkfs(void)
 	PyModule_AddIntConstant(m, "FEATURE_NO_HOLES",
 				BTRFS_FEATURE_INCOMPAT_NO_HOLES);
 
-	return m;
+	return 0;
+}
+
+static PyModuleDef_Slot mkfs_slots[] = {
+	{Py_mod_exec, mkfs_exec},
+#ifdef Py_mod_multiple_interpreters
+	/* mkfs_lock is process-wide, so it also holds across interpreters */
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL}
+};
+
+static struct PyModuleDef mkfs_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name    = "pybtrfs.mkfs",
+	.m_doc     = "Create btrfs filesystems (wraps btrfs-progs mkfs).",
+	.m_size    = 0,
+	.m_methods = mkfs_methods,
+	.m_slots   = mkfs_slots,
+};
+
+PyMODINIT_FUNC
+PyInit_mkfs(void)
+{
+	return PyModuleDef_Init(&mkfs_module);
 }
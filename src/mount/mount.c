@@ -2,6 +2,8 @@
 #include <Python.h>
 #include <sys/mount.h>
 
+#include "fastargs.h"
+
 /* -- mount(source, target, flags=0, data="") ----------------------- */
 
 PyDoc_STRVAR(pybtrfs_mount_doc,
@@ -10,7 +12,8 @@ PyDoc_STRVAR(pybtrfs_mount_doc,
 "Calls mount(2). Raises OSError on failure.");
 
 static PyObject *
-pybtrfs_mount(PyObject *self, PyObject *args, PyObject *kwargs)
+pybtrfs_mount(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+              PyObject *kwnames)
 {
     const char *source;
     const char *target;
@@ -19,9 +22,10 @@ pybtrfs_mount(PyObject *self, PyObject *args, PyObject *kwargs)
     const char *data = "";
 
     static char *kwlist[] = {"source", "target", "fstype", "flags", "data", NULL};
+    static FastArgsParser parser = {kwlist, "ss|sks", "mount"};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|sks:mount",
-                                     kwlist, &source, &target, &fstype, &flags, &data))
+    if (!fastargs_parse(&parser, args, nargs, kwnames,
+                        &source, &target, &fstype, &flags, &data))
         return NULL;
 
     int ret;
@@ -43,15 +47,16 @@ PyDoc_STRVAR(pybtrfs_umount_doc,
 "Calls umount2(2). Raises OSError on failure.");
 
 static PyObject *
-pybtrfs_umount(PyObject *self, PyObject *args, PyObject *kwargs)
+pybtrfs_umount(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+               PyObject *kwnames)
 {
     const char *target;
     int flags = 0;
 
     static char *kwlist[] = {"target", "flags", NULL};
+    static FastArgsParser parser = {kwlist, "s|i", "umount"};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i:umount",
-                                     kwlist, &target, &flags))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &target, &flags))
         return NULL;
 
     int ret;
@@ -68,28 +73,16 @@ pybtrfs_umount(PyObject *self, PyObject *args, PyObject *kwargs)
 /* -- method table -------------------------------------------------- */
 
 static PyMethodDef mount_methods[] = {
-    {"mount",  (PyCFunction)pybtrfs_mount,  METH_VARARGS | METH_KEYWORDS, pybtrfs_mount_doc},
-    {"umount", (PyCFunction)pybtrfs_umount, METH_VARARGS | METH_KEYWORDS, pybtrfs_umount_doc},
+    {"mount",  (PyCFunction)pybtrfs_mount,  METH_FASTCALL | METH_KEYWORDS, pybtrfs_mount_doc},
+    {"umount", (PyCFunction)pybtrfs_umount, METH_FASTCALL | METH_KEYWORDS, pybtrfs_umount_doc},
     {NULL, NULL, 0, NULL},
 };
 
 /* -- module definition --------------------------------------------- */
 
-static struct PyModuleDef mount_module = {
-    PyModuleDef_HEAD_INIT,
-    .m_name    = "pybtrfs.mount",
-    .m_doc     = "Low-level mount/umount helpers.",
-    .m_size    = -1,
-    .m_methods = mount_methods,
-};
-
-PyMODINIT_FUNC
-PyInit_mount(void)
+static int
+mount_exec(PyObject *m)
 {
-    PyObject *m = PyModule_Create(&mount_module);
-    if (!m)
-        return NULL;
-
     /* MS_* flags */
     PyModule_AddIntMacro(m, MS_RDONLY);
     PyModule_AddIntMacro(m, MS_NOSUID);
@@ -104,5 +97,31 @@ PyInit_mount(void)
     PyModule_AddIntMacro(m, MNT_DETACH);
     PyModule_AddIntMacro(m, MNT_EXPIRE);
 
-    return m;
+    return 0;
+}
+
+static PyModuleDef_Slot mount_slots[] = {
+    {Py_mod_exec, mount_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef mount_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name    = "pybtrfs.mount",
+    .m_doc     = "Low-level mount/umount helpers.",
+    .m_size    = 0,
+    .m_methods = mount_methods,
+    .m_slots   = mount_slots,
+};
+
+PyMODINIT_FUNC
+PyInit_mount(void)
+{
+    return PyModuleDef_Init(&mount_module);
 }
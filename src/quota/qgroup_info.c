@@ -0,0 +1,514 @@
+#include "quota.h"
+#include "search.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* -- reading the quota tree ---------------------------------------- */
+
+static struct qgroup_record *
+record_push(struct qgroup_record **recs, size_t *n, size_t *cap,
+            uint64_t qgroupid)
+{
+    if (*n == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        struct qgroup_record *p = realloc(*recs, new_cap * sizeof(*p));
+        if (!p) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        *recs = p;
+        *cap = new_cap;
+    }
+    struct qgroup_record *r = &(*recs)[(*n)++];
+    memset(r, 0, sizeof(*r));
+    r->qgroupid = qgroupid;
+    return r;
+}
+
+static int
+record_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const struct qgroup_record *)a)->qgroupid;
+    uint64_t y = ((const struct qgroup_record *)b)->qgroupid;
+
+    return x < y ? -1 : x > y;
+}
+
+static struct qgroup_relation *
+relation_push(struct qgroup_relation **rels, size_t *n, size_t *cap)
+{
+    if (*n == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        struct qgroup_relation *p = realloc(*rels, new_cap * sizeof(*p));
+        if (!p) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        *rels = p;
+        *cap = new_cap;
+    }
+    return &(*rels)[(*n)++];
+}
+
+/*
+ * INFO and LIMIT items both live at objectid 0 keyed by qgroupid, so the
+ * search returns every INFO item in qgroupid order and then every LIMIT
+ * item in the same order: one pass over the results merges them.  A
+ * LIMIT item without an INFO item gets a record of its own, sorted in
+ * afterwards.  RELATION items are keyed (qgroupid, type, other qgroupid)
+ * and so come after all of them, sorted by qgroupid too; with *rels* set
+ * the range is widened to take them in the same pass.
+ */
+static int
+scan_quota_tree(int fd, struct qgroup_record **out, size_t *n,
+                struct qgroup_relation **rels, size_t *nrels)
+{
+    struct btrfs_ioctl_search_key key = {
+        .tree_id = BTRFS_QUOTA_TREE_OBJECTID,
+        .min_objectid = 0,
+        .max_objectid = rels ? (uint64_t)-1 : 0,
+        .min_type = BTRFS_QGROUP_INFO_KEY,
+        .max_type = rels ? BTRFS_QGROUP_RELATION_KEY : BTRFS_QGROUP_LIMIT_KEY,
+        .min_offset = 0,
+        .max_offset = (uint64_t)-1,
+        .min_transid = 0,
+        .max_transid = (uint64_t)-1,
+    };
+    const struct btrfs_ioctl_search_header *sh;
+    const void *item;
+    struct tree_search s;
+    struct qgroup_record *recs = NULL;
+    struct qgroup_relation *rel = NULL;
+    size_t count = 0, cap = 0, ninfo = 0, j = 0, nrel = 0, rel_cap = 0;
+    int ret;
+
+    if (tree_search_init(&s, fd, &key, TREE_SEARCH_BUF_SIZE) < 0)
+        return -1;
+
+    while ((ret = tree_search_next(&s, &sh, &item)) > 0) {
+        struct qgroup_record *r;
+
+        if (sh->objectid == 0 && sh->type == BTRFS_QGROUP_INFO_KEY) {
+            const struct btrfs_qgroup_info_item *info = item;
+
+            if (sh->len < sizeof(*info))
+                continue;
+            r = record_push(&recs, &count, &cap, sh->offset);
+            if (!r)
+                goto error;
+            r->rfer = le64toh(info->rfer);
+            r->excl = le64toh(info->excl);
+            r->rfer_cmpr = le64toh(info->rfer_cmpr);
+            r->excl_cmpr = le64toh(info->excl_cmpr);
+            ninfo = count;
+        }
+        else if (sh->objectid == 0 && sh->type == BTRFS_QGROUP_LIMIT_KEY) {
+            const struct btrfs_qgroup_limit_item *lim = item;
+
+            if (sh->len < sizeof(*lim))
+                continue;
+            while (j < ninfo && recs[j].qgroupid < sh->offset)
+                j++;
+            if (j < ninfo && recs[j].qgroupid == sh->offset) {
+                r = &recs[j];
+            }
+            else {
+                r = record_push(&recs, &count, &cap, sh->offset);
+                if (!r)
+                    goto error;
+            }
+            r->max_rfer = le64toh(lim->max_rfer);
+            r->max_excl = le64toh(lim->max_excl);
+        }
+        else if (rels && sh->type == BTRFS_QGROUP_RELATION_KEY) {
+            struct qgroup_relation *e = relation_push(&rel, &nrel, &rel_cap);
+            if (!e)
+                goto error;
+            e->src = sh->objectid;
+            e->dst = sh->offset;
+        }
+    }
+    if (ret < 0)
+        goto error;
+    if (count > ninfo)
+        qsort(recs, count, sizeof(*recs), record_cmp);
+
+    tree_search_release(&s);
+    *out = recs;
+    *n = count;
+    if (rels) {
+        *rels = rel;
+        *nrels = nrel;
+    }
+    return 0;
+
+error:
+    ret = errno;
+    tree_search_release(&s);
+    free(recs);
+    free(rel);
+    errno = ret;
+    return -1;
+}
+
+int
+qgroup_collect(int fd, struct qgroup_record **out, size_t *n)
+{
+    return scan_quota_tree(fd, out, n, NULL, NULL);
+}
+
+/* the higher level of a relation is the parent */
+#define QGROUP_LEVEL(id) ((id) >> QGROUP_LEVEL_SHIFT)
+
+/*
+ * Both directions of every relation are stored, each under its own
+ * qgroupid, so walking the relations alongside the sorted records hands
+ * every qgroup its parents and children already sorted, without a
+ * lookup.  Relations of a qgroup with no INFO item are dropped.
+ */
+int
+qgroup_collect_graph(int fd, struct qgroup_graph *g)
+{
+    struct qgroup_relation *rels = NULL;
+    size_t nrels = 0, np = 0, nc = 0, j;
+
+    memset(g, 0, sizeof(*g));
+    if (scan_quota_tree(fd, &g->recs, &g->n, &rels, &nrels) < 0)
+        return -1;
+
+    for (j = 0; j < nrels; j++) {
+        if (QGROUP_LEVEL(rels[j].dst) > QGROUP_LEVEL(rels[j].src))
+            np++;
+        else
+            nc++;
+    }
+
+    g->parent_offsets = malloc((g->n + 1) * sizeof(uint64_t));
+    g->child_offsets = malloc((g->n + 1) * sizeof(uint64_t));
+    g->parents = malloc((np ? np : 1) * sizeof(uint64_t));
+    g->children = malloc((nc ? nc : 1) * sizeof(uint64_t));
+    if (!g->parent_offsets || !g->child_offsets ||
+        !g->parents || !g->children) {
+        free(rels);
+        qgroup_graph_free(g);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    np = nc = j = 0;
+    g->parent_offsets[0] = g->child_offsets[0] = 0;
+    for (size_t i = 0; i < g->n; i++) {
+        uint64_t id = g->recs[i].qgroupid;
+
+        while (j < nrels && rels[j].src < id)
+            j++;
+        for (; j < nrels && rels[j].src == id; j++) {
+            if (QGROUP_LEVEL(rels[j].dst) > QGROUP_LEVEL(id))
+                g->parents[np++] = rels[j].dst;
+            else
+                g->children[nc++] = rels[j].dst;
+        }
+        g->parent_offsets[i + 1] = np;
+        g->child_offsets[i + 1] = nc;
+    }
+    g->nparents = np;
+    g->nchildren = nc;
+    free(rels);
+    return 0;
+}
+
+void
+qgroup_graph_free(struct qgroup_graph *g)
+{
+    free(g->recs);
+    free(g->parent_offsets);
+    free(g->parents);
+    free(g->child_offsets);
+    free(g->children);
+    memset(g, 0, sizeof(*g));
+}
+
+/* -- QgroupInfo type ----------------------------------------------- */
+
+/*
+ * One qgroup as a fixed-size object.  qgroup_info() used to return
+ * dicts, so the read-only mapping protocol is kept: info["rfer"],
+ * keys()/values()/items()/get(), iteration over the key names,
+ * dict(info), and equality with the equivalent dict.
+ */
+typedef struct {
+    PyObject_HEAD
+    struct qgroup_record rec;
+} QgroupInfoObject;
+
+#define QGROUP_FIELD(name) \
+    {#name, offsetof(QgroupInfoObject, rec.name)}
+
+static const struct {
+    const char *name;
+    size_t offset;
+} qgroup_fields[] = {
+    QGROUP_FIELD(qgroupid),
+    QGROUP_FIELD(rfer),
+    QGROUP_FIELD(excl),
+    QGROUP_FIELD(rfer_cmpr),
+    QGROUP_FIELD(excl_cmpr),
+    QGROUP_FIELD(max_rfer),
+    QGROUP_FIELD(max_excl),
+};
+
+#define QGROUP_NFIELDS \
+    ((Py_ssize_t)(sizeof(qgroup_fields) / sizeof(qgroup_fields[0])))
+
+static uint64_t
+field_value(QgroupInfoObject *self, Py_ssize_t i)
+{
+    return *(uint64_t *)((char *)self + qgroup_fields[i].offset);
+}
+
+/* index of the field named *key*, or -1 (no exception) if none */
+static Py_ssize_t
+field_index(PyObject *key)
+{
+    if (!PyUnicode_Check(key))
+        return -1;
+    for (Py_ssize_t i = 0; i < QGROUP_NFIELDS; i++)
+        if (PyUnicode_CompareWithASCIIString(key, qgroup_fields[i].name) == 0)
+            return i;
+    return -1;
+}
+
+static void
+QgroupInfo_dealloc(QgroupInfoObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static PyObject *
+QgroupInfo_repr(QgroupInfoObject *self)
+{
+    return PyUnicode_FromFormat(
+        "QgroupInfo(qgroupid=%llu/%llu, rfer=%llu, excl=%llu)",
+        (unsigned long long)(self->rec.qgroupid >> 48),
+        (unsigned long long)(self->rec.qgroupid & ((1ULL << 48) - 1)),
+        (unsigned long long)self->rec.rfer,
+        (unsigned long long)self->rec.excl);
+}
+
+static Py_ssize_t
+QgroupInfo_length(QgroupInfoObject *self)
+{
+    return QGROUP_NFIELDS;
+}
+
+static PyObject *
+QgroupInfo_subscript(QgroupInfoObject *self, PyObject *key)
+{
+    Py_ssize_t i = field_index(key);
+
+    if (i < 0) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(field_value(self, i));
+}
+
+static int
+QgroupInfo_contains(QgroupInfoObject *self, PyObject *key)
+{
+    return field_index(key) >= 0;
+}
+
+static PyObject *
+QgroupInfo_iter(QgroupInfoObject *self)
+{
+    quota_state *st = PyType_GetModuleState(Py_TYPE(self));
+
+    return PyObject_GetIter(st->info_fields);
+}
+
+static PyObject *
+QgroupInfo_keys(QgroupInfoObject *self, PyObject *Py_UNUSED(a))
+{
+    quota_state *st = PyType_GetModuleState(Py_TYPE(self));
+
+    return PySequence_List(st->info_fields);
+}
+
+static PyObject *
+QgroupInfo_values(QgroupInfoObject *self, PyObject *Py_UNUSED(a))
+{
+    PyObject *list = PyList_New(QGROUP_NFIELDS);
+
+    for (Py_ssize_t i = 0; list && i < QGROUP_NFIELDS; i++) {
+        PyObject *v = PyLong_FromUnsignedLongLong(field_value(self, i));
+        if (!v) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, v);
+    }
+    return list;
+}
+
+static PyObject *
+QgroupInfo_items(QgroupInfoObject *self, PyObject *Py_UNUSED(a))
+{
+    quota_state *st = PyType_GetModuleState(Py_TYPE(self));
+    PyObject *list = PyList_New(QGROUP_NFIELDS);
+
+    for (Py_ssize_t i = 0; list && i < QGROUP_NFIELDS; i++) {
+        PyObject *t = Py_BuildValue(
+            "OK", PyTuple_GET_ITEM(st->info_fields, i),
+            (unsigned long long)field_value(self, i));
+        if (!t) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, t);
+    }
+    return list;
+}
+
+static PyObject *
+QgroupInfo_get(QgroupInfoObject *self, PyObject *const *args,
+               Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"key", "default", NULL};
+    static FastArgsParser parser = {kw, "O|O", "get"};
+    PyObject *key, *dflt = Py_None;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &key, &dflt))
+        return NULL;
+
+    Py_ssize_t i = field_index(key);
+    if (i < 0)
+        return Py_NewRef(dflt);
+    return PyLong_FromUnsignedLongLong(field_value(self, i));
+}
+
+static PyObject *
+QgroupInfo_as_dict(QgroupInfoObject *self, PyObject *Py_UNUSED(a))
+{
+    quota_state *st = PyType_GetModuleState(Py_TYPE(self));
+    PyObject *d = PyDict_New();
+
+    for (Py_ssize_t i = 0; d && i < QGROUP_NFIELDS; i++) {
+        PyObject *v = PyLong_FromUnsignedLongLong(field_value(self, i));
+        if (!v || PyDict_SetItem(d, PyTuple_GET_ITEM(st->info_fields, i),
+                                 v) < 0)
+            Py_CLEAR(d);
+        Py_XDECREF(v);
+    }
+    return d;
+}
+
+static PyObject *
+QgroupInfo_richcompare(QgroupInfoObject *self, PyObject *other, int op)
+{
+    if (op != Py_EQ && op != Py_NE)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    if (Py_IS_TYPE(other, Py_TYPE(self))) {
+        QgroupInfoObject *o = (QgroupInfoObject *)other;
+        int eq = memcmp(&self->rec, &o->rec, sizeof(self->rec)) == 0;
+        return PyBool_FromLong(op == Py_EQ ? eq : !eq);
+    }
+    if (PyDict_Check(other)) {
+        PyObject *d = QgroupInfo_as_dict(self, NULL);
+        if (!d)
+            return NULL;
+        PyObject *r = PyObject_RichCompare(d, other, op);
+        Py_DECREF(d);
+        return r;
+    }
+    Py_RETURN_NOTIMPLEMENTED;
+}
+
+#define RECORD_MEMBER(name) \
+    {#name, T_ULONGLONG, offsetof(QgroupInfoObject, rec.name), READONLY, NULL}
+
+static PyMemberDef QgroupInfo_members[] = {
+    RECORD_MEMBER(qgroupid),
+    RECORD_MEMBER(rfer),
+    RECORD_MEMBER(excl),
+    RECORD_MEMBER(rfer_cmpr),
+    RECORD_MEMBER(excl_cmpr),
+    RECORD_MEMBER(max_rfer),
+    RECORD_MEMBER(max_excl),
+    {NULL}
+};
+
+static PyMethodDef QgroupInfo_methods[] = {
+    {"keys", (PyCFunction)QgroupInfo_keys, METH_NOARGS,
+     "keys() -> list[str]\n\nThe field names, as for a dict."},
+    {"values", (PyCFunction)QgroupInfo_values, METH_NOARGS,
+     "values() -> list[int]\n\nThe field values, as for a dict."},
+    {"items", (PyCFunction)QgroupInfo_items, METH_NOARGS,
+     "items() -> list[tuple[str, int]]\n\n"
+     "(name, value) pairs, as for a dict."},
+    {"get", (PyCFunction)QgroupInfo_get, METH_FASTCALL | METH_KEYWORDS,
+     "get(key: str, default: object = None) -> object\n\n"
+     "The value of field key, or default if there is no such field."},
+    {"as_dict", (PyCFunction)QgroupInfo_as_dict, METH_NOARGS,
+     "as_dict() -> dict[str, int]\n\n"
+     "A dict in the format qgroup_info() used to return."},
+    {NULL}
+};
+
+static PyType_Slot QgroupInfo_slots[] = {
+    {Py_tp_dealloc,     QgroupInfo_dealloc},
+    {Py_tp_repr,        QgroupInfo_repr},
+    {Py_tp_hash,        PyObject_HashNotImplemented},
+    {Py_tp_iter,        QgroupInfo_iter},
+    {Py_tp_richcompare, QgroupInfo_richcompare},
+    {Py_mp_length,      QgroupInfo_length},
+    {Py_mp_subscript,   QgroupInfo_subscript},
+    {Py_sq_contains,    QgroupInfo_contains},
+    {Py_tp_doc,         "Usage and limits of one qgroup."},
+    {Py_tp_members,     QgroupInfo_members},
+    {Py_tp_methods,     QgroupInfo_methods},
+    {0, NULL}
+};
+
+PyType_Spec QgroupInfo_spec = {
+    .name      = "pybtrfs.QgroupInfo",
+    .basicsize = sizeof(QgroupInfoObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+                 Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots     = QgroupInfo_slots,
+};
+
+PyObject *
+QgroupInfo_from_record(quota_state *st, const struct qgroup_record *r)
+{
+    PyTypeObject *type = st->QgroupInfoType;
+    QgroupInfoObject *self = (QgroupInfoObject *)type->tp_alloc(type, 0);
+
+    if (!self)
+        return NULL;
+    self->rec = *r;
+    return (PyObject *)self;
+}
+
+PyObject *
+QgroupInfo_field_names(void)
+{
+    PyObject *names = PyTuple_New(QGROUP_NFIELDS);
+
+    for (Py_ssize_t i = 0; names && i < QGROUP_NFIELDS; i++) {
+        PyObject *name = PyUnicode_InternFromString(qgroup_fields[i].name);
+        if (!name) {
+            Py_CLEAR(names);
+            break;
+        }
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    return names;
+}
@@ -0,0 +1,555 @@
+#include "quota.h"
+#include "search.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* records fetched per GIL release when iterating with __next__ */
+#define QGROUP_ITER_BATCH 256
+
+/*
+ * Each cursor keeps one buffer of this size for the whole iteration, so
+ * memory stays flat however many qgroups there are.
+ */
+#define QGROUP_ITER_BUF_SIZE (64 * 1024)
+
+#define QGROUP_LEVEL_MAX 0xffff
+
+/* -- bounded scan of the quota tree -------------------------------- */
+
+/*
+ * INFO and LIMIT items are walked by two cursors in step, each keyed on
+ * [objectid 0, its own type, qgroupid range]: the level and id bounds
+ * become the offset range of both keys and min_transid goes into the
+ * INFO key, so the kernel skips what the caller filtered out.  LIMIT
+ * items are never rewritten when usage changes, so their cursor ignores
+ * min_transid and seeks to the qgroups the INFO cursor produced.
+ */
+struct qgroup_scan {
+    uint64_t min_id;
+    uint64_t max_id;
+    int level;                /* -1 for every level */
+    uint64_t min_transid;
+    struct tree_search info;
+    struct tree_search limit;
+    int limit_held;           /* limit_rec holds an unmatched LIMIT item */
+    int limit_end;
+    struct qgroup_record limit_rec;
+};
+
+static void
+scan_key(const struct qgroup_scan *sc, uint8_t type, uint64_t min_transid,
+         struct btrfs_ioctl_search_key *key)
+{
+    uint64_t lo = 0, hi = (uint64_t)QGROUP_LEVEL_MAX << QGROUP_LEVEL_SHIFT;
+
+    if (sc->level >= 0)
+        lo = hi = (uint64_t)sc->level << QGROUP_LEVEL_SHIFT;
+
+    memset(key, 0, sizeof(*key));
+    key->tree_id = BTRFS_QUOTA_TREE_OBJECTID;
+    key->min_objectid = 0;
+    key->max_objectid = 0;
+    key->min_type = type;
+    key->max_type = type;
+    key->min_offset = lo | sc->min_id;
+    key->max_offset = hi | sc->max_id;
+    key->min_transid = min_transid;
+    key->max_transid = (uint64_t)-1;
+}
+
+static int
+qgroup_scan_init(struct qgroup_scan *sc, int fd)
+{
+    struct btrfs_ioctl_search_key key;
+
+    scan_key(sc, BTRFS_QGROUP_INFO_KEY, sc->min_transid, &key);
+    if (tree_search_init(&sc->info, fd, &key, QGROUP_ITER_BUF_SIZE) < 0)
+        return -1;
+    scan_key(sc, BTRFS_QGROUP_LIMIT_KEY, 0, &key);
+    if (tree_search_init(&sc->limit, fd, &key, QGROUP_ITER_BUF_SIZE) < 0) {
+        tree_search_release(&sc->info);
+        return -1;
+    }
+    sc->limit_held = sc->limit_end = 0;
+    return 0;
+}
+
+static void
+qgroup_scan_release(struct qgroup_scan *sc)
+{
+    tree_search_release(&sc->info);
+    tree_search_release(&sc->limit);
+}
+
+/* Fill in the limits of *r* from the LIMIT cursor, if it has any. */
+static int
+scan_limit(struct qgroup_scan *sc, struct qgroup_record *r)
+{
+    const struct btrfs_ioctl_search_header *h;
+    const void *item;
+
+    for (;;) {
+        if (!sc->limit_held) {
+            if (sc->limit_end)
+                return 0;
+            tree_search_seek(&sc->limit, r->qgroupid);
+            int ret = tree_search_next(&sc->limit, &h, &item);
+            if (ret <= 0) {
+                sc->limit_end = 1;
+                return ret;
+            }
+
+            const struct btrfs_qgroup_limit_item *lim = item;
+            if (h->len < sizeof(*lim))
+                continue;
+            sc->limit_rec.qgroupid = h->offset;
+            sc->limit_rec.max_rfer = le64toh(lim->max_rfer);
+            sc->limit_rec.max_excl = le64toh(lim->max_excl);
+            sc->limit_held = 1;
+        }
+        if (sc->limit_rec.qgroupid < r->qgroupid) {
+            sc->limit_held = 0;
+            continue;
+        }
+        if (sc->limit_rec.qgroupid == r->qgroupid) {
+            r->max_rfer = sc->limit_rec.max_rfer;
+            r->max_excl = sc->limit_rec.max_excl;
+            sc->limit_held = 0;
+        }
+        return 0;
+    }
+}
+
+/*
+ * Read up to *want* qgroups in qgroupid order into *out*.  Runs without
+ * the GIL.  *got* is always set; returns 0, or -1 with errno set after
+ * delivering the records read before the failure.
+ */
+static int
+qgroup_scan_fetch(struct qgroup_scan *sc, struct qgroup_record *out,
+                  size_t want, size_t *got)
+{
+    const struct btrfs_ioctl_search_header *h;
+    const void *item;
+    size_t n = 0;
+    int ret = 0;
+
+    while (n < want && (ret = tree_search_next(&sc->info, &h, &item)) > 0) {
+        const struct btrfs_qgroup_info_item *info = item;
+        uint64_t id = h->offset & QGROUP_ID_MASK;
+        uint64_t level = h->offset >> QGROUP_LEVEL_SHIFT;
+
+        if (h->len < sizeof(*info))
+            continue;
+        /* without a level the range spans ids outside the bounds */
+        if (id < sc->min_id) {
+            tree_search_seek(&sc->info,
+                             (level << QGROUP_LEVEL_SHIFT) | sc->min_id);
+            continue;
+        }
+        if (id > sc->max_id) {
+            if (level < QGROUP_LEVEL_MAX)
+                tree_search_seek(&sc->info,
+                                 ((level + 1) << QGROUP_LEVEL_SHIFT) |
+                                 sc->min_id);
+            continue;
+        }
+        /* the kernel filters whole leaves; items carry their own */
+        if (le64toh(info->generation) < sc->min_transid)
+            continue;
+
+        struct qgroup_record *r = &out[n];
+        memset(r, 0, sizeof(*r));
+        r->qgroupid = h->offset;
+        r->rfer = le64toh(info->rfer);
+        r->excl = le64toh(info->excl);
+        r->rfer_cmpr = le64toh(info->rfer_cmpr);
+        r->excl_cmpr = le64toh(info->excl_cmpr);
+        if ((ret = scan_limit(sc, r)) < 0)
+            break;
+        n++;
+    }
+    *got = n;
+    return ret < 0 ? -1 : 0;
+}
+
+/* -- QgroupIterator type ------------------------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    struct qgroup_scan scan;
+    int fd;                     /* -1 once closed */
+    PyObject *path;             /* for errors; NULL for a descriptor */
+    /* read-ahead buffer for __next__ */
+    struct qgroup_record *buf;
+    size_t buf_pos;
+    size_t buf_len;
+    /* errno of a failure after a partial batch, raised on the next call */
+    int pending_errno;
+    /* a call is using the scan; see QgroupIterator_acquire() */
+    int busy;
+} QgroupIteratorObject;
+
+static void
+QgroupIterator_release_scan(QgroupIteratorObject *self)
+{
+    PyMem_Free(self->buf);
+    self->buf = NULL;
+    self->buf_pos = self->buf_len = 0;
+    if (self->fd >= 0) {
+        qgroup_scan_release(&self->scan);
+        close(self->fd);
+        self->fd = -1;
+    }
+}
+
+static PyObject *
+QgroupIterator_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    QgroupIteratorObject *self =
+        (QgroupIteratorObject *)type->tp_alloc(type, 0);
+
+    if (self)
+        self->fd = -1;
+    return (PyObject *)self;
+}
+
+static void
+QgroupIterator_dealloc(QgroupIteratorObject *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    QgroupIterator_release_scan(self);
+    Py_XDECREF(self->path);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+static int
+QgroupIterator_init(QgroupIteratorObject *self, PyObject *args,
+                    PyObject *kwds)
+{
+    static char *kw[] = {"path", "min_id", "max_id", "level",
+                         "min_transid", NULL};
+    PyObject *path, *level_obj = Py_None;
+    unsigned long long min_id = 0, max_id = QGROUP_ID_MASK, min_transid = 0;
+    long level = -1;
+    struct target t;
+    struct qgroup_scan scan;
+    PyObject *path_obj = NULL;
+    int fd, busy;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$KKOK", kw, &path,
+                                     &min_id, &max_id, &level_obj,
+                                     &min_transid))
+        return -1;
+
+    if (max_id > QGROUP_ID_MASK) {
+        PyErr_SetString(PyExc_ValueError, "max_id must be below 2**48");
+        return -1;
+    }
+    if (min_id > max_id) {
+        PyErr_SetString(PyExc_ValueError, "min_id must not exceed max_id");
+        return -1;
+    }
+    if (level_obj != Py_None) {
+        level = PyLong_AsLong(level_obj);
+        if (level == -1 && PyErr_Occurred())
+            return -1;
+        if (level < 0 || level > QGROUP_LEVEL_MAX) {
+            PyErr_SetString(PyExc_ValueError,
+                            "level must be between 0 and 65535");
+            return -1;
+        }
+    }
+
+    /* the iterator outlives the call, so it keeps a descriptor of its own */
+    if (target_open(path, &t) < 0)
+        return -1;
+    fd = t.fd;
+    if (!t.owned && (fd = fcntl(t.fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    if (t.path && !(path_obj = PyOS_FSPath(t.path))) {
+        close(fd);
+        return -1;
+    }
+
+    /* built aside, then swapped in only if no call is using the old scan */
+    memset(&scan, 0, sizeof(scan));
+    scan.min_id = min_id;
+    scan.max_id = max_id;
+    scan.level = (int)level;
+    scan.min_transid = min_transid;
+    if (qgroup_scan_init(&scan, fd) < 0) {
+        close(fd);
+        Py_XDECREF(path_obj);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    if (!busy) {
+        QgroupIterator_release_scan(self);
+        self->scan = scan;
+        self->fd = fd;
+        self->pending_errno = 0;
+        Py_XSETREF(self->path, path_obj);
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (busy) {
+        qgroup_scan_release(&scan);
+        close(fd);
+        Py_XDECREF(path_obj);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "QgroupIterator is in use by another thread");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Claim the iterator for one call.  The critical section is suspended
+ * while records are fetched without the GIL, so the claim is kept in
+ * busy, as SubvolumeIterator does.
+ */
+static int
+QgroupIterator_acquire(QgroupIteratorObject *self)
+{
+    int ret = -1;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->busy)
+        PyErr_SetString(PyExc_RuntimeError,
+                        "QgroupIterator is in use by another thread");
+    else if (self->fd < 0)
+        PyErr_SetString(PyExc_ValueError, "iterator is closed");
+    else {
+        self->busy = 1;
+        ret = 0;
+    }
+    Py_END_CRITICAL_SECTION();
+    return ret;
+}
+
+static void
+QgroupIterator_release(QgroupIteratorObject *self)
+{
+    Py_BEGIN_CRITICAL_SECTION(self);
+    self->busy = 0;
+    Py_END_CRITICAL_SECTION();
+}
+
+/*
+ * Fetch up to *want* records with a single GIL release.  A failure is
+ * kept in pending_errno so records read before it are delivered first.
+ */
+static size_t
+QgroupIterator_fetch(QgroupIteratorObject *self, struct qgroup_record *out,
+                     size_t want)
+{
+    size_t got;
+    int ret;
+
+    if (self->pending_errno)
+        return 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = qgroup_scan_fetch(&self->scan, out, want, &got);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0)
+        self->pending_errno = errno ? errno : EIO;
+    return got;
+}
+
+/* Raise a deferred error; with none pending this signals StopIteration. */
+static PyObject *
+QgroupIterator_raise_pending(QgroupIteratorObject *self)
+{
+    struct target t = {.fd = self->fd, .owned = 0, .path = self->path};
+
+    if (!self->pending_errno)
+        return NULL;
+    errno = self->pending_errno;
+    self->pending_errno = 0;
+    return target_error(&t);
+}
+
+static PyObject *
+QgroupIterator_next_entry(QgroupIteratorObject *self)
+{
+    if (self->buf_pos == self->buf_len) {
+        if (!self->buf) {
+            self->buf = PyMem_Malloc(QGROUP_ITER_BATCH * sizeof(*self->buf));
+            if (!self->buf)
+                return PyErr_NoMemory();
+        }
+        self->buf_pos = 0;
+        self->buf_len = QgroupIterator_fetch(self, self->buf,
+                                             QGROUP_ITER_BATCH);
+        if (!self->buf_len)
+            return QgroupIterator_raise_pending(self);
+    }
+
+    return QgroupInfo_from_record(PyType_GetModuleState(Py_TYPE(self)),
+                                  &self->buf[self->buf_pos++]);
+}
+
+static PyObject *
+QgroupIterator_next(QgroupIteratorObject *self)
+{
+    if (QgroupIterator_acquire(self) < 0)
+        return NULL;
+    PyObject *result = QgroupIterator_next_entry(self);
+    QgroupIterator_release(self);
+    return result;
+}
+
+static PyObject *
+QgroupIterator_take(QgroupIteratorObject *self, Py_ssize_t want)
+{
+    quota_state *st = PyType_GetModuleState(Py_TYPE(self));
+
+    /* hand out read-ahead left by __next__ first, then fetch the rest */
+    size_t buffered = self->buf_len - self->buf_pos;
+    if (buffered > (size_t)want)
+        buffered = (size_t)want;
+    struct qgroup_record *head = self->buf ? self->buf + self->buf_pos : NULL;
+    self->buf_pos += buffered;
+
+    struct qgroup_record *fresh = NULL;
+    size_t rest = (size_t)want - buffered, got = 0;
+
+    if (rest) {
+        fresh = PyMem_Malloc(rest * sizeof(*fresh));
+        if (!fresh)
+            return PyErr_NoMemory();
+        got = QgroupIterator_fetch(self, fresh, rest);
+    }
+
+    size_t total = buffered + got;
+    if (!total) {
+        PyMem_Free(fresh);
+        if (self->pending_errno)
+            return QgroupIterator_raise_pending(self);
+        return PyList_New(0);
+    }
+
+    PyObject *list = PyList_New((Py_ssize_t)total);
+    for (size_t i = 0; list && i < total; i++) {
+        PyObject *info = QgroupInfo_from_record(
+            st, i < buffered ? &head[i] : &fresh[i - buffered]);
+        if (!info) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, info);
+    }
+    PyMem_Free(fresh);
+    return list;
+}
+
+static PyObject *
+QgroupIterator_next_batch(QgroupIteratorObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"n", NULL};
+    static FastArgsParser parser = {kw, "|n", "next_batch"};
+    Py_ssize_t want = QGROUP_ITER_BATCH;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &want))
+        return NULL;
+    if (want <= 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be positive");
+        return NULL;
+    }
+    if (QgroupIterator_acquire(self) < 0)
+        return NULL;
+    PyObject *result = QgroupIterator_take(self, want);
+    QgroupIterator_release(self);
+    return result;
+}
+
+/* close / context-manager */
+
+static PyObject *
+QgroupIterator_close(QgroupIteratorObject *self, PyObject *Py_UNUSED(a))
+{
+    int busy;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    busy = self->busy;
+    if (!busy)
+        QgroupIterator_release_scan(self);
+    Py_END_CRITICAL_SECTION();
+
+    if (busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "QgroupIterator is in use by another thread");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+QgroupIterator_enter(QgroupIteratorObject *self, PyObject *Py_UNUSED(a))
+{
+    return Py_NewRef(self);
+}
+
+static PyObject *
+QgroupIterator_exit(QgroupIteratorObject *self, PyObject *args)
+{
+    return QgroupIterator_close(self, NULL);
+}
+
+/* -- type tables --------------------------------------------------- */
+
+static PyMethodDef QgroupIterator_methods[] = {
+    {"next_batch", (PyCFunction)QgroupIterator_next_batch,
+     METH_FASTCALL | METH_KEYWORDS,
+     "next_batch(n: int = 256) -> list[QgroupInfo]\n\n"
+     "Return up to n qgroups, fetched with a single GIL release.\n"
+     "An empty list means the iterator is exhausted."},
+    {"close",     (PyCFunction)QgroupIterator_close, METH_NOARGS,
+     "close() -> None\n\nClose the iterator and release resources."},
+    {"__enter__", (PyCFunction)QgroupIterator_enter, METH_NOARGS,
+     "__enter__() -> QgroupIterator\n\nEnter the context manager."},
+    {"__exit__",  (PyCFunction)QgroupIterator_exit,  METH_VARARGS,
+     "__exit__(*args) -> None\n\nExit the context manager and close the iterator."},
+    {NULL}
+};
+
+static PyType_Slot QgroupIterator_slots[] = {
+    {Py_tp_dealloc,  QgroupIterator_dealloc},
+    {Py_tp_doc,      "QgroupIterator(path: str | int, *, min_id: int = 0, "
+                     "max_id: int = 2**48 - 1, level: int | None = None, "
+                     "min_transid: int = 0)\n\n"
+                     "Stream QgroupInfo objects in qgroupid order.\n\n"
+                     "Only qgroups whose id part lies in [min_id, max_id], "
+                     "on the given level if\nany, and whose usage changed "
+                     "in transaction min_transid or later are\nread; the "
+                     "bounds go into the tree search key."},
+    {Py_tp_iter,     PyObject_SelfIter},
+    {Py_tp_iternext, QgroupIterator_next},
+    {Py_tp_methods,  QgroupIterator_methods},
+    {Py_tp_init,     QgroupIterator_init},
+    {Py_tp_new,      QgroupIterator_new},
+    {0, NULL}
+};
+
+PyType_Spec QgroupIterator_spec = {
+    .name      = "pybtrfs.QgroupIterator",
+    .basicsize = sizeof(QgroupIteratorObject),
+    .flags     = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots     = QgroupIterator_slots,
+};
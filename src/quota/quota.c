@@ -1,39 +1,86 @@
-#define PY_SSIZE_T_CLEAN
-#include <Python.h>
+#include "quota.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <endian.h>
 
+#include "deadline.h"
+
 #include "kernel-shared/uapi/btrfs.h"
 #include "kernel-shared/uapi/btrfs_tree.h"
 
 /* -- helper -------------------------------------------------------- */
 
-static int
-open_path(const char *path)
+int
+target_open(PyObject *obj, struct target *t)
 {
-    int fd = open(path, O_RDONLY);
-    if (fd < 0)
-        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
-    return fd;
+    if (PyLong_Check(obj)) {
+        long fd = PyLong_AsLong(obj);
+        if (fd == -1 && PyErr_Occurred())
+            return -1;
+        if (fd < 0 || fd > INT_MAX) {
+            PyErr_SetString(PyExc_ValueError, "invalid file descriptor");
+            return -1;
+        }
+        t->fd = (int)fd;
+        t->owned = 0;
+        t->path = NULL;
+        return 0;
+    }
+
+    PyObject *bytes;
+    if (!PyUnicode_FSConverter(obj, &bytes))
+        return -1;
+
+    int fd;
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(PyBytes_AS_STRING(bytes), O_RDONLY | O_CLOEXEC);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(bytes);
+
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, obj);
+        return -1;
+    }
+    t->fd = fd;
+    t->owned = 1;
+    t->path = obj;
+    return 0;
+}
+
+void
+target_close(struct target *t)
+{
+    if (t->owned) {
+        int saved_errno = errno;
+        close(t->fd);
+        errno = saved_errno;
+    }
+}
+
+PyObject *
+target_error(struct target *t)
+{
+    if (t->path)
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, t->path);
+    return PyErr_SetFromErrno(PyExc_OSError);
 }
 
 /* -- quota_enable(path) -------------------------------------------- */
 
 PyDoc_STRVAR(quota_enable_doc,
-"quota_enable(path: str) -> None\n\n"
+"quota_enable(path: str | int) -> None\n\n"
 "Enable btrfs quotas on the filesystem at *path*.\n\n"
 "Calls BTRFS_IOC_QUOTA_CTL with BTRFS_QUOTA_CTL_ENABLE.");
 
 static PyObject *
-pybtrfs_quota_enable(PyObject *self, PyObject *args)
+pybtrfs_quota_enable(PyObject *self, PyObject *path)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_enable", &path))
-        return NULL;
-
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_quota_ctl_args qargs = {
@@ -42,12 +89,12 @@ pybtrfs_quota_enable(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_CTL, &qargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QUOTA_CTL, &qargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -55,19 +102,15 @@ pybtrfs_quota_enable(PyObject *self, PyObject *args)
 /* -- quota_enable_simple(path) ------------------------------------- */
 
 PyDoc_STRVAR(quota_enable_simple_doc,
-"quota_enable_simple(path: str) -> None\n\n"
+"quota_enable_simple(path: str | int) -> None\n\n"
 "Enable simple quotas (squota) on the filesystem at *path*.\n\n"
 "Calls BTRFS_IOC_QUOTA_CTL with BTRFS_QUOTA_CTL_ENABLE_SIMPLE_QUOTA.");
 
 static PyObject *
-pybtrfs_quota_enable_simple(PyObject *self, PyObject *args)
+pybtrfs_quota_enable_simple(PyObject *self, PyObject *path)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_enable_simple", &path))
-        return NULL;
-
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_quota_ctl_args qargs = {
@@ -76,12 +119,12 @@ pybtrfs_quota_enable_simple(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_CTL, &qargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QUOTA_CTL, &qargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -89,19 +132,15 @@ pybtrfs_quota_enable_simple(PyObject *self, PyObject *args)
 /* -- quota_disable(path) ------------------------------------------- */
 
 PyDoc_STRVAR(quota_disable_doc,
-"quota_disable(path: str) -> None\n\n"
+"quota_disable(path: str | int) -> None\n\n"
 "Disable btrfs quotas on the filesystem at *path*.\n\n"
 "Calls BTRFS_IOC_QUOTA_CTL with BTRFS_QUOTA_CTL_DISABLE.");
 
 static PyObject *
-pybtrfs_quota_disable(PyObject *self, PyObject *args)
+pybtrfs_quota_disable(PyObject *self, PyObject *path)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_disable", &path))
-        return NULL;
-
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_quota_ctl_args qargs = {
@@ -110,12 +149,12 @@ pybtrfs_quota_disable(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_CTL, &qargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QUOTA_CTL, &qargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -123,19 +162,15 @@ pybtrfs_quota_disable(PyObject *self, PyObject *args)
 /* -- quota_rescan(path) -------------------------------------------- */
 
 PyDoc_STRVAR(quota_rescan_doc,
-"quota_rescan(path: str) -> None\n\n"
+"quota_rescan(path: str | int) -> None\n\n"
 "Start a quota rescan on the filesystem at *path*.\n\n"
 "Calls BTRFS_IOC_QUOTA_RESCAN.");
 
 static PyObject *
-pybtrfs_quota_rescan(PyObject *self, PyObject *args)
+pybtrfs_quota_rescan(PyObject *self, PyObject *path)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_rescan", &path))
-        return NULL;
-
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_quota_rescan_args rargs;
@@ -143,12 +178,12 @@ pybtrfs_quota_rescan(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_RESCAN, &rargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QUOTA_RESCAN, &rargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -156,19 +191,15 @@ pybtrfs_quota_rescan(PyObject *self, PyObject *args)
 /* -- quota_rescan_status(path) ------------------------------------- */
 
 PyDoc_STRVAR(quota_rescan_status_doc,
-"quota_rescan_status(path: str) -> dict\n\n"
+"quota_rescan_status(path: str | int) -> dict\n\n"
 "Return the current quota rescan status as ``{\"flags\": int, \"progress\": int}``.\n\n"
 "Calls BTRFS_IOC_QUOTA_RESCAN_STATUS.");
 
 static PyObject *
-pybtrfs_quota_rescan_status(PyObject *self, PyObject *args)
+pybtrfs_quota_rescan_status(PyObject *self, PyObject *path)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_rescan_status", &path))
-        return NULL;
-
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_quota_rescan_args rargs;
@@ -176,65 +207,98 @@ pybtrfs_quota_rescan_status(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_RESCAN_STATUS, &rargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QUOTA_RESCAN_STATUS, &rargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     return Py_BuildValue("{s:K,s:K}",
                          "flags",    (unsigned long long)rargs.flags,
                          "progress", (unsigned long long)rargs.progress);
 }
 
-/* -- quota_rescan_wait(path) --------------------------------------- */
+/* -- quota_rescan_wait(path, timeout=None) ------------------------- */
+
+/* longest sleep between rescan status polls */
+#define RESCAN_POLL_MAX_MS 250
 
 PyDoc_STRVAR(quota_rescan_wait_doc,
-"quota_rescan_wait(path: str) -> None\n\n"
+"quota_rescan_wait(path: str | int, timeout: float | None = None) -> bool\n\n"
 "Block until the current quota rescan completes.\n\n"
-"Calls BTRFS_IOC_QUOTA_RESCAN_WAIT (releases the GIL).");
+"Polls BTRFS_IOC_QUOTA_RESCAN_STATUS with a backoff instead of blocking\n"
+"in BTRFS_IOC_QUOTA_RESCAN_WAIT, so signal handlers (KeyboardInterrupt)\n"
+"run while a long rescan is going. Returns True once no rescan is\n"
+"running, or False if timeout seconds pass first.");
 
 static PyObject *
-pybtrfs_quota_rescan_wait(PyObject *self, PyObject *args)
+pybtrfs_quota_rescan_wait(PyObject *self, PyObject *const *args,
+                          Py_ssize_t nargs, PyObject *kwnames)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:quota_rescan_wait", &path))
+    static char *kw[] = {"path", "timeout", NULL};
+    static FastArgsParser parser = {kw, "O|O", "quota_rescan_wait"};
+    PyObject *path, *timeout = Py_None;
+    double deadline;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &timeout))
+        return NULL;
+    if (deadline_init(timeout, &deadline) < 0)
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
-    int ret;
-    Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QUOTA_RESCAN_WAIT, NULL);
-    Py_END_ALLOW_THREADS
+    PyObject *result = NULL;
+    for (long ms = 1;; ms = ms * 2 > RESCAN_POLL_MAX_MS ? RESCAN_POLL_MAX_MS
+                                                         : ms * 2) {
+        struct btrfs_ioctl_quota_rescan_args rargs;
+        memset(&rargs, 0, sizeof(rargs));
 
-    close(fd);
-    if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        int ret;
+        Py_BEGIN_ALLOW_THREADS
+        ret = ioctl(t.fd, BTRFS_IOC_QUOTA_RESCAN_STATUS, &rargs);
+        Py_END_ALLOW_THREADS
 
-    Py_RETURN_NONE;
+        if (ret < 0) {
+            target_error(&t);
+            break;
+        }
+        if (!rargs.flags) {
+            result = Py_NewRef(Py_True);
+            break;
+        }
+        int r = deadline_sleep(deadline, ms);
+        if (r) {
+            if (r > 0)
+                result = Py_NewRef(Py_False);
+            break;
+        }
+    }
+
+    target_close(&t);
+    return result;
 }
 
 /* -- qgroup_create(path, qgroupid) -------------------------------- */
 
 PyDoc_STRVAR(qgroup_create_doc,
-"qgroup_create(path: str, qgroupid: int) -> None\n\n"
+"qgroup_create(path: str | int, qgroupid: int) -> None\n\n"
 "Create a new qgroup.\n\n"
 "Calls BTRFS_IOC_QGROUP_CREATE with create=1.");
 
 static PyObject *
-pybtrfs_qgroup_create(PyObject *self, PyObject *args)
+pybtrfs_qgroup_create(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    const char *path;
+    static FastArgsParser parser = {NULL, "OK", "qgroup_create"};
+    PyObject *path;
     unsigned long long qgroupid;
-    if (!PyArg_ParseTuple(args, "sK:qgroup_create", &path, &qgroupid))
+    if (!fastargs_parse(&parser, args, nargs, NULL, &path, &qgroupid))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_qgroup_create_args cargs = {
@@ -244,12 +308,12 @@ pybtrfs_qgroup_create(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QGROUP_CREATE, &cargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QGROUP_CREATE, &cargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -257,20 +321,21 @@ pybtrfs_qgroup_create(PyObject *self, PyObject *args)
 /* -- qgroup_destroy(path, qgroupid) ------------------------------- */
 
 PyDoc_STRVAR(qgroup_destroy_doc,
-"qgroup_destroy(path: str, qgroupid: int) -> None\n\n"
+"qgroup_destroy(path: str | int, qgroupid: int) -> None\n\n"
 "Destroy an existing qgroup.\n\n"
 "Calls BTRFS_IOC_QGROUP_CREATE with create=0.");
 
 static PyObject *
-pybtrfs_qgroup_destroy(PyObject *self, PyObject *args)
+pybtrfs_qgroup_destroy(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    const char *path;
+    static FastArgsParser parser = {NULL, "OK", "qgroup_destroy"};
+    PyObject *path;
     unsigned long long qgroupid;
-    if (!PyArg_ParseTuple(args, "sK:qgroup_destroy", &path, &qgroupid))
+    if (!fastargs_parse(&parser, args, nargs, NULL, &path, &qgroupid))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_qgroup_create_args cargs = {
@@ -280,12 +345,12 @@ pybtrfs_qgroup_destroy(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QGROUP_CREATE, &cargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QGROUP_CREATE, &cargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -293,20 +358,21 @@ pybtrfs_qgroup_destroy(PyObject *self, PyObject *args)
 /* -- qgroup_assign(path, src, dst) --------------------------------- */
 
 PyDoc_STRVAR(qgroup_assign_doc,
-"qgroup_assign(path: str, src: int, dst: int) -> None\n\n"
+"qgroup_assign(path: str | int, src: int, dst: int) -> None\n\n"
 "Assign qgroup *src* as a child of qgroup *dst*.\n\n"
 "Calls BTRFS_IOC_QGROUP_ASSIGN with assign=1.");
 
 static PyObject *
-pybtrfs_qgroup_assign(PyObject *self, PyObject *args)
+pybtrfs_qgroup_assign(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    const char *path;
+    static FastArgsParser parser = {NULL, "OKK", "qgroup_assign"};
+    PyObject *path;
     unsigned long long src, dst;
-    if (!PyArg_ParseTuple(args, "sKK:qgroup_assign", &path, &src, &dst))
+    if (!fastargs_parse(&parser, args, nargs, NULL, &path, &src, &dst))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_qgroup_assign_args aargs = {
@@ -317,12 +383,12 @@ pybtrfs_qgroup_assign(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QGROUP_ASSIGN, &aargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QGROUP_ASSIGN, &aargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -330,20 +396,21 @@ pybtrfs_qgroup_assign(PyObject *self, PyObject *args)
 /* -- qgroup_remove(path, src, dst) --------------------------------- */
 
 PyDoc_STRVAR(qgroup_remove_doc,
-"qgroup_remove(path: str, src: int, dst: int) -> None\n\n"
+"qgroup_remove(path: str | int, src: int, dst: int) -> None\n\n"
 "Remove qgroup *src* from parent qgroup *dst*.\n\n"
 "Calls BTRFS_IOC_QGROUP_ASSIGN with assign=0.");
 
 static PyObject *
-pybtrfs_qgroup_remove(PyObject *self, PyObject *args)
+pybtrfs_qgroup_remove(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    const char *path;
+    static FastArgsParser parser = {NULL, "OKK", "qgroup_remove"};
+    PyObject *path;
     unsigned long long src, dst;
-    if (!PyArg_ParseTuple(args, "sKK:qgroup_remove", &path, &src, &dst))
+    if (!fastargs_parse(&parser, args, nargs, NULL, &path, &src, &dst))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_qgroup_assign_args aargs = {
@@ -354,12 +421,12 @@ pybtrfs_qgroup_remove(PyObject *self, PyObject *args)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QGROUP_ASSIGN, &aargs);
+    ret = ioctl(t.fd, BTRFS_IOC_QGROUP_ASSIGN, &aargs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
@@ -367,27 +434,28 @@ pybtrfs_qgroup_remove(PyObject *self, PyObject *args)
 /* -- qgroup_limit(path, qgroupid, max_rfer=0, max_excl=0) --------- */
 
 PyDoc_STRVAR(qgroup_limit_doc,
-"qgroup_limit(path: str, qgroupid: int, max_rfer: int = 0, max_excl: int = 0) -> None\n\n"
+"qgroup_limit(path: str | int, qgroupid: int, max_rfer: int = 0, max_excl: int = 0) -> None\n\n"
 "Set quota limits for *qgroupid*. A value of 0 clears the limit.\n\n"
 "Calls BTRFS_IOC_QGROUP_LIMIT.");
 
 static PyObject *
-pybtrfs_qgroup_limit(PyObject *self, PyObject *args, PyObject *kwargs)
+pybtrfs_qgroup_limit(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     PyObject *kwnames)
 {
-    const char *path;
+    PyObject *path;
     unsigned long long qgroupid;
     unsigned long long max_rfer = 0;
     unsigned long long max_excl = 0;
 
     static char *kwlist[] = {"path", "qgroupid", "max_rfer", "max_excl", NULL};
+    static FastArgsParser parser = {kwlist, "OK|KK", "qgroup_limit"};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sK|KK:qgroup_limit",
-                                     kwlist, &path, &qgroupid,
-                                     &max_rfer, &max_excl))
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &qgroupid,
+                        &max_rfer, &max_excl))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
     struct btrfs_ioctl_qgroup_limit_args largs;
@@ -405,244 +473,554 @@ pybtrfs_qgroup_limit(PyObject *self, PyObject *args, PyObject *kwargs)
 
     int ret;
     Py_BEGIN_ALLOW_THREADS
-    ret = ioctl(fd, BTRFS_IOC_QGROUP_LIMIT, &largs);
+    ret = ioctl(t.fd, BTRFS_IOC_QGROUP_LIMIT, &largs);
     Py_END_ALLOW_THREADS
 
-    close(fd);
+    target_close(&t);
     if (ret < 0)
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return target_error(&t);
 
     Py_RETURN_NONE;
 }
 
-/* -- qgroup_info(path) → list[dict] ------------------------------- */
+/* -- qgroup_batch(path, ops, rescan=True) ------------------------- */
+
+PyDoc_STRVAR(qgroup_batch_doc,
+"qgroup_batch(path: str | int, ops: list[tuple], rescan: bool = True) "
+"-> tuple[list[OSError | None], bool, OSError | None]\n\n"
+"Run many qgroup operations on one file descriptor, in order, with the\n"
+"GIL released for the whole batch.  Each op is one of:\n\n"
+"    (\"create\", qgroupid)\n"
+"    (\"destroy\", qgroupid)\n"
+"    (\"assign\", src, dst)\n"
+"    (\"remove\", src, dst)\n"
+"    (\"limit\", qgroupid, max_rfer=0, max_excl=0)\n\n"
+"Returns (results, needs_rescan, rescan_error).  A failure does not\n"
+"stop the batch: results has one entry per op, None on success or the\n"
+"OSError it raised.  needs_rescan is true if an assign or remove left\n"
+"the accounting inconsistent.  They do not rescan by themselves; with\n"
+"*rescan* true a single BTRFS_IOC_QUOTA_RESCAN is started after the\n"
+"last op if needed (see quota_rescan_wait()), and a rescan already in\n"
+"progress counts as started.  Any other error starting it is returned\n"
+"as rescan_error, not raised, since the ops have taken effect; then,\n"
+"or with *rescan* false, the caller is left to start the rescan.");
+
+enum qgroup_op_kind {
+    QGROUP_OP_CREATE,
+    QGROUP_OP_DESTROY,
+    QGROUP_OP_ASSIGN,
+    QGROUP_OP_REMOVE,
+    QGROUP_OP_LIMIT,
+};
+
+static const struct {
+    const char *name;
+    Py_ssize_t min_args;
+    Py_ssize_t max_args;
+} qgroup_op_kinds[] = {
+    [QGROUP_OP_CREATE]  = {"create",  1, 1},
+    [QGROUP_OP_DESTROY] = {"destroy", 1, 1},
+    [QGROUP_OP_ASSIGN]  = {"assign",  2, 2},
+    [QGROUP_OP_REMOVE]  = {"remove",  2, 2},
+    [QGROUP_OP_LIMIT]   = {"limit",   1, 3},
+};
 
-PyDoc_STRVAR(qgroup_info_doc,
-"qgroup_info(path: str) -> list[dict]\n\n"
-"Return a list of dicts describing every qgroup on the filesystem.\n\n"
-"Each dict contains: qgroupid, rfer, excl, rfer_cmpr, excl_cmpr,\n"
-"max_rfer, max_excl.\n\n"
-"Uses BTRFS_IOC_TREE_SEARCH on the quota tree.");
+#define QGROUP_OP_NKINDS \
+    (sizeof(qgroup_op_kinds) / sizeof(qgroup_op_kinds[0]))
+
+struct qgroup_op {
+    enum qgroup_op_kind kind;
+    uint64_t args[3];   /* qgroupid or src, dst; limits default to 0 */
+    int err_no;
+};
+
+/* Copy ops[i] into *op*, checking its shape; raises on a bad entry. */
+static int
+qgroup_op_parse(PyObject *item, Py_ssize_t i, struct qgroup_op *op)
+{
+    PyObject *seq = PySequence_Fast(item, "");
+    if (!seq) {
+        PyErr_Format(PyExc_TypeError, "ops[%zd] must be a tuple", i);
+        return -1;
+    }
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **v = PySequence_Fast_ITEMS(seq);
+    size_t k = QGROUP_OP_NKINDS;
+
+    if (n > 0 && PyUnicode_Check(v[0]))
+        for (k = 0; k < QGROUP_OP_NKINDS; k++)
+            if (PyUnicode_CompareWithASCIIString(
+                    v[0], qgroup_op_kinds[k].name) == 0)
+                break;
+    if (k == QGROUP_OP_NKINDS) {
+        PyErr_Format(PyExc_ValueError,
+                     "ops[%zd]: unknown qgroup operation %R", i,
+                     n > 0 ? v[0] : Py_None);
+        goto fail;
+    }
+    if (n - 1 < qgroup_op_kinds[k].min_args ||
+        n - 1 > qgroup_op_kinds[k].max_args) {
+        PyErr_Format(PyExc_TypeError,
+                     "ops[%zd]: wrong number of arguments for %s", i,
+                     qgroup_op_kinds[k].name);
+        goto fail;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->kind = (enum qgroup_op_kind)k;
+    for (Py_ssize_t j = 1; j < n; j++) {
+        op->args[j - 1] = PyLong_AsUnsignedLongLong(v[j]);
+        if (op->args[j - 1] == (uint64_t)-1 && PyErr_Occurred())
+            goto fail;
+    }
+    Py_DECREF(seq);
+    return 0;
+
+fail:
+    Py_DECREF(seq);
+    return -1;
+}
+
+/*
+ * Issue every op on *fd*; runs without the GIL.  Returns whether an
+ * assign or remove reported (ioctl > 0) that a rescan is needed.
+ */
+static int
+qgroup_batch_run(int fd, struct qgroup_op *ops, size_t n)
+{
+    int needs_rescan = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        struct qgroup_op *op = &ops[i];
+        int ret;
+
+        switch (op->kind) {
+        case QGROUP_OP_CREATE:
+        case QGROUP_OP_DESTROY: {
+            struct btrfs_ioctl_qgroup_create_args cargs = {
+                .create = op->kind == QGROUP_OP_CREATE,
+                .qgroupid = op->args[0],
+            };
+            ret = ioctl(fd, BTRFS_IOC_QGROUP_CREATE, &cargs);
+            break;
+        }
+        case QGROUP_OP_ASSIGN:
+        case QGROUP_OP_REMOVE: {
+            struct btrfs_ioctl_qgroup_assign_args aargs = {
+                .assign = op->kind == QGROUP_OP_ASSIGN,
+                .src = op->args[0],
+                .dst = op->args[1],
+            };
+            ret = ioctl(fd, BTRFS_IOC_QGROUP_ASSIGN, &aargs);
+            if (ret > 0)
+                needs_rescan = 1;
+            break;
+        }
+        case QGROUP_OP_LIMIT: {
+            struct btrfs_ioctl_qgroup_limit_args largs;
+            memset(&largs, 0, sizeof(largs));
+            largs.qgroupid = op->args[0];
+            if (op->args[1]) {
+                largs.lim.flags |= BTRFS_QGROUP_LIMIT_MAX_RFER;
+                largs.lim.max_referenced = op->args[1];
+            }
+            if (op->args[2]) {
+                largs.lim.flags |= BTRFS_QGROUP_LIMIT_MAX_EXCL;
+                largs.lim.max_exclusive = op->args[2];
+            }
+            ret = ioctl(fd, BTRFS_IOC_QGROUP_LIMIT, &largs);
+            break;
+        }
+        default:
+            ret = -1;
+            errno = EINVAL;
+        }
+        op->err_no = ret < 0 ? errno : 0;
+    }
+    return needs_rescan;
+}
+
+/* The OSError an op (or the rescan) failed with, as an instance. */
+static PyObject *
+qgroup_batch_error(const struct target *t, int err_no)
+{
+    return PyObject_CallFunction(PyExc_OSError, "isO", err_no,
+                                 strerror(err_no),
+                                 t->path ? t->path : Py_None);
+}
 
 static PyObject *
-pybtrfs_qgroup_info(PyObject *self, PyObject *args)
+pybtrfs_qgroup_batch(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     PyObject *kwnames)
 {
-    const char *path;
-    if (!PyArg_ParseTuple(args, "s:qgroup_info", &path))
+    static char *kw[] = {"path", "ops", "rescan", NULL};
+    static FastArgsParser parser = {kw, "OO|p", "qgroup_batch"};
+    PyObject *path, *ops_arg, *seq, *results, *rescan_error = NULL;
+    struct qgroup_op *ops;
+    int rescan = 1, needs_rescan, rescan_errno = 0;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &ops_arg,
+                        &rescan))
         return NULL;
 
-    int fd = open_path(path);
-    if (fd < 0)
+    seq = PySequence_Fast(ops_arg, "ops must be an iterable");
+    if (!seq)
         return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    ops = PyMem_Calloc((size_t)n + 1, sizeof(*ops));
+    if (!ops) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (qgroup_op_parse(PySequence_Fast_GET_ITEM(seq, i), i,
+                            &ops[i]) < 0) {
+            Py_DECREF(seq);
+            PyMem_Free(ops);
+            return NULL;
+        }
+    }
+    Py_DECREF(seq);
 
-    /* accumulator: qgroupid -> dict */
-    PyObject *accum = PyDict_New();
-    if (!accum) {
-        close(fd);
+    struct target t;
+    if (target_open(path, &t) < 0) {
+        PyMem_Free(ops);
         return NULL;
     }
 
-    struct btrfs_ioctl_search_args sargs;
-    struct btrfs_ioctl_search_key *sk = &sargs.key;
-
-    memset(&sargs, 0, sizeof(sargs));
-    sk->tree_id = BTRFS_QUOTA_TREE_OBJECTID;
-    sk->min_objectid = 0;
-    sk->max_objectid = (__u64)-1;
-    sk->min_offset = 0;
-    sk->max_offset = (__u64)-1;
-    sk->min_transid = 0;
-    sk->max_transid = (__u64)-1;
-    sk->min_type = BTRFS_QGROUP_INFO_KEY;
-    sk->max_type = BTRFS_QGROUP_LIMIT_KEY;
-    sk->nr_items = 4096;
-
-    while (1) {
-        int ret;
-        Py_BEGIN_ALLOW_THREADS
-        ret = ioctl(fd, BTRFS_IOC_TREE_SEARCH, &sargs);
-        Py_END_ALLOW_THREADS
+    Py_BEGIN_ALLOW_THREADS
+    needs_rescan = qgroup_batch_run(t.fd, ops, (size_t)n);
+    if (needs_rescan && rescan) {
+        struct btrfs_ioctl_quota_rescan_args rargs;
+        memset(&rargs, 0, sizeof(rargs));
+        /* one already running picks up the new relations too */
+        if (ioctl(t.fd, BTRFS_IOC_QUOTA_RESCAN, &rargs) < 0 &&
+            errno != EINPROGRESS)
+            rescan_errno = errno;
+    }
+    Py_END_ALLOW_THREADS
 
-        if (ret < 0) {
-            close(fd);
-            Py_DECREF(accum);
-            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    results = PyList_New(n);
+    for (Py_ssize_t i = 0; results && i < n; i++) {
+        PyObject *r = ops[i].err_no ? qgroup_batch_error(&t, ops[i].err_no)
+                                    : Py_NewRef(Py_None);
+        if (!r) {
+            Py_CLEAR(results);
+            break;
         }
+        PyList_SET_ITEM(results, i, r);
+    }
+    if (results)
+        rescan_error = rescan_errno ? qgroup_batch_error(&t, rescan_errno)
+                                    : Py_NewRef(Py_None);
+
+    target_close(&t);
+    PyMem_Free(ops);
+    if (!rescan_error) {
+        Py_XDECREF(results);
+        return NULL;
+    }
+    return Py_BuildValue("(NON)", results,
+                         needs_rescan ? Py_True : Py_False, rescan_error);
+}
 
-        if (sk->nr_items == 0)
-            break;
+/* -- qgroup_info(path) → list[QgroupInfo] ------------------------ */
 
-        char *buf = sargs.buf;
-        unsigned int i;
-        for (i = 0; i < sk->nr_items; i++) {
-            struct btrfs_ioctl_search_header *sh =
-                (struct btrfs_ioctl_search_header *)buf;
-            char *item = buf + sizeof(*sh);
-
-            PyObject *key = PyLong_FromUnsignedLongLong(sh->offset);
-            if (!key)
-                goto error;
-
-            /* get-or-create dict for this qgroupid */
-            PyObject *entry = PyDict_GetItemWithError(accum, key);
-            if (!entry) {
-                if (PyErr_Occurred()) {
-                    Py_DECREF(key);
-                    goto error;
-                }
-                entry = Py_BuildValue(
-                    "{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
-                    "qgroupid",  (unsigned long long)sh->offset,
-                    "rfer",      0ULL,
-                    "excl",      0ULL,
-                    "rfer_cmpr", 0ULL,
-                    "excl_cmpr", 0ULL,
-                    "max_rfer",  0ULL,
-                    "max_excl",  0ULL);
-                if (!entry) {
-                    Py_DECREF(key);
-                    goto error;
-                }
-                if (PyDict_SetItem(accum, key, entry) < 0) {
-                    Py_DECREF(entry);
-                    Py_DECREF(key);
-                    goto error;
-                }
-                Py_DECREF(entry);  /* accum owns it now */
-                entry = PyDict_GetItem(accum, key);
-            }
+PyDoc_STRVAR(qgroup_info_doc,
+"qgroup_info(path: str | int) -> list[QgroupInfo]\n\n"
+"Return a QgroupInfo for every qgroup on the filesystem, by qgroupid.\n\n"
+"Each has the fields qgroupid, rfer, excl, rfer_cmpr, excl_cmpr,\n"
+"max_rfer and max_excl, readable as attributes or, like the dicts this\n"
+"used to return, as info[\"rfer\"].\n\n"
+"Reads the quota tree with BTRFS_IOC_TREE_SEARCH_V2 and a large buffer,\n"
+"without the GIL.");
 
-            if (sh->type == BTRFS_QGROUP_INFO_KEY &&
-                sh->len >= sizeof(struct btrfs_qgroup_info_item)) {
-                struct btrfs_qgroup_info_item *info =
-                    (struct btrfs_qgroup_info_item *)item;
-                PyObject *val;
-
-                val = PyLong_FromUnsignedLongLong(le64toh(info->rfer));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "rfer", val);
-                Py_DECREF(val);
-
-                val = PyLong_FromUnsignedLongLong(le64toh(info->excl));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "excl", val);
-                Py_DECREF(val);
-
-                val = PyLong_FromUnsignedLongLong(le64toh(info->rfer_cmpr));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "rfer_cmpr", val);
-                Py_DECREF(val);
-
-                val = PyLong_FromUnsignedLongLong(le64toh(info->excl_cmpr));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "excl_cmpr", val);
-                Py_DECREF(val);
-            }
-            else if (sh->type == BTRFS_QGROUP_LIMIT_KEY &&
-                     sh->len >= sizeof(struct btrfs_qgroup_limit_item)) {
-                struct btrfs_qgroup_limit_item *lim =
-                    (struct btrfs_qgroup_limit_item *)item;
-                PyObject *val;
-
-                val = PyLong_FromUnsignedLongLong(le64toh(lim->max_rfer));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "max_rfer", val);
-                Py_DECREF(val);
-
-                val = PyLong_FromUnsignedLongLong(le64toh(lim->max_excl));
-                if (!val) { Py_DECREF(key); goto error; }
-                PyDict_SetItemString(entry, "max_excl", val);
-                Py_DECREF(val);
-            }
+static PyObject *
+pybtrfs_qgroup_info(PyObject *self, PyObject *path)
+{
+    quota_state *st = get_quota_state(self);
+    struct qgroup_record *recs = NULL;
+    size_t n = 0;
+    int ret;
 
-            Py_DECREF(key);
+    struct target t;
+    if (target_open(path, &t) < 0)
+        return NULL;
 
-            /* advance to next search result */
-            buf = item + sh->len;
+    Py_BEGIN_ALLOW_THREADS
+    ret = qgroup_collect(t.fd, &recs, &n);
+    Py_END_ALLOW_THREADS
 
-            /* update search key for pagination */
-            sk->min_objectid = sh->objectid;
-            sk->min_type = sh->type;
-            sk->min_offset = sh->offset;
-        }
+    if (ret < 0) {
+        target_error(&t);
+        target_close(&t);
+        return NULL;
+    }
+    target_close(&t);
 
-        /* advance past last item to continue search */
-        if (sk->min_offset < (__u64)-1)
-            sk->min_offset++;
-        else if (sk->min_type < BTRFS_QGROUP_LIMIT_KEY)
-            sk->min_type++;
-        else if (sk->min_objectid < (__u64)-1)
-            sk->min_objectid++;
-        else
+    PyObject *list = PyList_New((Py_ssize_t)n);
+    for (size_t i = 0; list && i < n; i++) {
+        PyObject *info = QgroupInfo_from_record(st, &recs[i]);
+        if (!info) {
+            Py_CLEAR(list);
             break;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, info);
+    }
+    free(recs);
+    return list;
+}
 
-        sk->nr_items = 4096;
+/* -- qgroup_graph(path) → dict ------------------------------------ */
+
+PyDoc_STRVAR(qgroup_graph_doc,
+"qgroup_graph(path: str | int) -> dict[str, object]\n\n"
+"Return usage and the qgroup hierarchy, read in one quota tree scan.\n\n"
+"\"qgroups\" is the list qgroup_info() returns and \"qgroupid\" the same\n"
+"ids as a uint64 memoryview.  The relations are in compressed sparse\n"
+"row form, as uint64 memoryviews: the parents of qgroups[i] are\n"
+"parents[parent_offsets[i]:parent_offsets[i + 1]], and children and\n"
+"child_offsets work the same way.  Each slice is sorted by qgroupid.");
+
+/*
+ * Hand *data* over to a new column in *dict*.  The array is always
+ * consumed: with dict NULL (an earlier column failed) it is just freed.
+ */
+static int
+add_column(quota_state *st, PyObject *dict, const char *name,
+           uint64_t *data, size_t n)
+{
+    if (!dict) {
+        free(data);
+        return -1;
     }
 
-    close(fd);
+    PyObject *view = column_view(st->ColumnType, data, (Py_ssize_t)n, 0,
+                                 'Q', sizeof(*data));
+    if (!view)
+        return -1;
+    int ret = PyDict_SetItemString(dict, name, view);
+    Py_DECREF(view);
+    return ret;
+}
+
+static PyObject *
+pybtrfs_qgroup_graph(PyObject *self, PyObject *path)
+{
+    quota_state *st = get_quota_state(self);
+    struct qgroup_graph g;
+    uint64_t *ids = NULL;
+    int ret;
 
-    /* convert dict-of-dicts → list-of-dicts */
-    PyObject *values = PyDict_Values(accum);
-    Py_DECREF(accum);
-    if (!values)
+    struct target t;
+    if (target_open(path, &t) < 0)
         return NULL;
 
-    PyObject *result = PySequence_List(values);
-    Py_DECREF(values);
-    return result;
+    Py_BEGIN_ALLOW_THREADS
+    ret = qgroup_collect_graph(t.fd, &g);
+    if (ret == 0 && !(ids = malloc((g.n ? g.n : 1) * sizeof(*ids)))) {
+        qgroup_graph_free(&g);
+        errno = ENOMEM;
+        ret = -1;
+    }
+    for (size_t i = 0; ret == 0 && i < g.n; i++)
+        ids[i] = g.recs[i].qgroupid;
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0) {
+        target_error(&t);
+        target_close(&t);
+        return NULL;
+    }
+    target_close(&t);
 
-error:
-    close(fd);
-    Py_DECREF(accum);
-    return NULL;
+    PyObject *list = PyList_New((Py_ssize_t)g.n);
+    for (size_t i = 0; list && i < g.n; i++) {
+        PyObject *info = QgroupInfo_from_record(st, &g.recs[i]);
+        if (!info) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, info);
+    }
+
+    PyObject *dict = list ? PyDict_New() : NULL;
+    if (dict && PyDict_SetItemString(dict, "qgroups", list) < 0)
+        Py_CLEAR(dict);
+    Py_XDECREF(list);
+
+    /* each column takes its array, so only the records are left to free */
+    if (add_column(st, dict, "qgroupid", ids, g.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "parent_offsets", g.parent_offsets, g.n + 1) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "parents", g.parents, g.nparents) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "child_offsets", g.child_offsets, g.n + 1) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "children", g.children, g.nchildren) < 0)
+        Py_CLEAR(dict);
+    free(g.recs);
+    return dict;
+}
+
+/* -- subvolume_usage(path) → dict --------------------------------- */
+
+PyDoc_STRVAR(subvolume_usage_doc,
+"subvolume_usage(path: str | int, top: int = 0) -> dict[str, memoryview | bytes]\n\n"
+"Return every subvolume below *top* (0: the one containing *path*) with\n"
+"the usage and limits of its level-0 qgroup, in columns.\n\n"
+"The subvolumes are in the order subvolume_columns() lists them.  'id',\n"
+"'rfer', 'excl', 'max_rfer' and 'max_excl' are uint64 ('Q') memoryviews,\n"
+"zero for a subvolume without a qgroup.  Path i is\n"
+"path_data[path_offsets[i]:path_offsets[i + 1]].  The root tree and the\n"
+"quota tree are each read in one sweep and joined without the GIL.\n"
+"Requires CAP_SYS_ADMIN.");
+
+static PyObject *
+pybtrfs_subvolume_usage(PyObject *self, PyObject *const *args,
+                        Py_ssize_t nargs, PyObject *kwnames)
+{
+    static char *kw[] = {"path", "top", NULL};
+    static FastArgsParser parser = {kw, "O|K", "subvolume_usage"};
+    quota_state *st = get_quota_state(self);
+    PyObject *path;
+    uint64_t top = 0;
+    struct subvol_usage u;
+    int ret;
+
+    if (!fastargs_parse(&parser, args, nargs, kwnames, &path, &top))
+        return NULL;
+
+    struct target t;
+    if (target_open(path, &t) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = subvol_usage_collect(t.fd, top, &u);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0) {
+        target_error(&t);
+        target_close(&t);
+        return NULL;
+    }
+    target_close(&t);
+
+    PyObject *dict = PyDict_New();
+    PyObject *blob = PyBytes_FromStringAndSize(
+        u.path_data, (Py_ssize_t)u.path_offsets[u.n]);
+    free(u.path_data);
+    if (dict && (!blob || PyDict_SetItemString(dict, "path_data", blob) < 0))
+        Py_CLEAR(dict);
+    Py_XDECREF(blob);
+
+    if (add_column(st, dict, "id", u.id, u.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "rfer", u.rfer, u.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "excl", u.excl, u.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "max_rfer", u.max_rfer, u.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "max_excl", u.max_excl, u.n) < 0)
+        Py_CLEAR(dict);
+    if (add_column(st, dict, "path_offsets", u.path_offsets, u.n + 1) < 0)
+        Py_CLEAR(dict);
+    return dict;
 }
 
 /* -- method table -------------------------------------------------- */
 
 static PyMethodDef quota_methods[] = {
     {"quota_enable",        (PyCFunction)pybtrfs_quota_enable,
-     METH_VARARGS, quota_enable_doc},
+     METH_O, quota_enable_doc},
     {"quota_enable_simple", (PyCFunction)pybtrfs_quota_enable_simple,
-     METH_VARARGS, quota_enable_simple_doc},
+     METH_O, quota_enable_simple_doc},
     {"quota_disable",       (PyCFunction)pybtrfs_quota_disable,
-     METH_VARARGS, quota_disable_doc},
+     METH_O, quota_disable_doc},
     {"quota_rescan",        (PyCFunction)pybtrfs_quota_rescan,
-     METH_VARARGS, quota_rescan_doc},
+     METH_O, quota_rescan_doc},
     {"quota_rescan_status", (PyCFunction)pybtrfs_quota_rescan_status,
-     METH_VARARGS, quota_rescan_status_doc},
+     METH_O, quota_rescan_status_doc},
     {"quota_rescan_wait",   (PyCFunction)pybtrfs_quota_rescan_wait,
-     METH_VARARGS, quota_rescan_wait_doc},
+     METH_FASTCALL | METH_KEYWORDS, quota_rescan_wait_doc},
     {"qgroup_create",       (PyCFunction)pybtrfs_qgroup_create,
-     METH_VARARGS, qgroup_create_doc},
+     METH_FASTCALL, qgroup_create_doc},
     {"qgroup_destroy",      (PyCFunction)pybtrfs_qgroup_destroy,
-     METH_VARARGS, qgroup_destroy_doc},
+     METH_FASTCALL, qgroup_destroy_doc},
     {"qgroup_assign",       (PyCFunction)pybtrfs_qgroup_assign,
-     METH_VARARGS, qgroup_assign_doc},
+     METH_FASTCALL, qgroup_assign_doc},
     {"qgroup_remove",       (PyCFunction)pybtrfs_qgroup_remove,
-     METH_VARARGS, qgroup_remove_doc},
+     METH_FASTCALL, qgroup_remove_doc},
     {"qgroup_limit",        (PyCFunction)pybtrfs_qgroup_limit,
-     METH_VARARGS | METH_KEYWORDS, qgroup_limit_doc},
+     METH_FASTCALL | METH_KEYWORDS, qgroup_limit_doc},
+    {"qgroup_batch",        (PyCFunction)pybtrfs_qgroup_batch,
+     METH_FASTCALL | METH_KEYWORDS, qgroup_batch_doc},
     {"qgroup_info",         (PyCFunction)pybtrfs_qgroup_info,
-     METH_VARARGS, qgroup_info_doc},
+     METH_O, qgroup_info_doc},
+    {"qgroup_graph",        (PyCFunction)pybtrfs_qgroup_graph,
+     METH_O, qgroup_graph_doc},
+    {"subvolume_usage",     (PyCFunction)pybtrfs_subvolume_usage,
+     METH_FASTCALL | METH_KEYWORDS, subvolume_usage_doc},
     {NULL, NULL, 0, NULL},
 };
 
 /* -- module definition --------------------------------------------- */
 
-static struct PyModuleDef quota_module = {
-    PyModuleDef_HEAD_INIT,
-    .m_name    = "pybtrfs.quota",
-    .m_doc     = "Low-level btrfs quota / qgroup ioctl wrappers.",
-    .m_size    = -1,
-    .m_methods = quota_methods,
-};
+static int
+quota_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    quota_state *st = get_quota_state(m);
 
-PyMODINIT_FUNC
-PyInit_quota(void)
+    Py_VISIT(st->QgroupInfoType);
+    Py_VISIT(st->QgroupIteratorType);
+    Py_VISIT(st->ColumnType);
+    Py_VISIT(st->info_fields);
+    return 0;
+}
+
+static int
+quota_clear(PyObject *m)
 {
-    PyObject *m = PyModule_Create(&quota_module);
-    if (!m)
-        return NULL;
+    quota_state *st = get_quota_state(m);
+
+    Py_CLEAR(st->QgroupInfoType);
+    Py_CLEAR(st->QgroupIteratorType);
+    Py_CLEAR(st->ColumnType);
+    Py_CLEAR(st->info_fields);
+    return 0;
+}
+
+static void
+quota_free(void *m)
+{
+    quota_clear((PyObject *)m);
+}
+
+static int
+quota_exec(PyObject *m)
+{
+    quota_state *st = get_quota_state(m);
+
+    st->QgroupInfoType = (PyTypeObject *)
+        PyType_FromModuleAndSpec(m, &QgroupInfo_spec, NULL);
+    if (!st->QgroupInfoType ||
+        PyModule_AddType(m, st->QgroupInfoType) < 0)
+        return -1;
+    st->QgroupIteratorType = (PyTypeObject *)
+        PyType_FromModuleAndSpec(m, &QgroupIterator_spec, NULL);
+    if (!st->QgroupIteratorType ||
+        PyModule_AddType(m, st->QgroupIteratorType) < 0)
+        return -1;
+    st->ColumnType = (PyTypeObject *)
+        PyType_FromModuleAndSpec(m, &Column_spec, NULL);
+    if (!st->ColumnType)
+        return -1;
+    st->info_fields = QgroupInfo_field_names();
+    if (!st->info_fields)
+        return -1;
 
     /* quota control commands */
     PyModule_AddIntMacro(m, BTRFS_QUOTA_CTL_ENABLE);
@@ -661,5 +1039,36 @@ PyInit_quota(void)
     PyModule_AddIntMacro(m, BTRFS_QGROUP_LIMIT_RSV_RFER);
     PyModule_AddIntMacro(m, BTRFS_QGROUP_LIMIT_RSV_EXCL);
 
-    return m;
+    return 0;
+}
+
+static PyModuleDef_Slot quota_slots[] = {
+    {Py_mod_exec, quota_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    /* calls work on their own descriptor; QgroupIterator locks itself */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef quota_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name     = "pybtrfs.quota",
+    .m_doc      = "Low-level btrfs quota / qgroup ioctl wrappers.\n\n"
+                 "Every function accepts a path or an open file descriptor.",
+    .m_size     = sizeof(quota_state),
+    .m_methods  = quota_methods,
+    .m_slots    = quota_slots,
+    .m_traverse = quota_traverse,
+    .m_clear    = quota_clear,
+    .m_free     = quota_free,
+};
+
+PyMODINIT_FUNC
+PyInit_quota(void)
+{
+    return PyModuleDef_Init(&quota_module);
 }
@@ -0,0 +1,142 @@
+#ifndef PYBTRFS_QUOTA_H
+#define PYBTRFS_QUOTA_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <stdint.h>
+
+#include "column.h"
+#include "fastargs.h"
+
+/*
+ * Per-object locking for free-threaded builds.  With the GIL, and before
+ * 3.13, the critical section is a plain block.
+ */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+/*
+ * Per-module state.  Module functions reach it through their module
+ * argument, methods through the type of self.
+ */
+typedef struct {
+    PyTypeObject *QgroupInfoType;
+    PyTypeObject *QgroupIteratorType;
+    PyTypeObject *ColumnType;
+    PyObject *info_fields;      /* tuple of the QgroupInfo key names */
+} quota_state;
+
+static inline quota_state *
+get_quota_state(PyObject *module)
+{
+    return (quota_state *)PyModule_GetState(module);
+}
+
+/*
+ * Every function takes either a path or an already open file descriptor
+ * (e.g. Filesystem.fileno()); only descriptors opened here are closed.
+ * Defined in quota.c.
+ */
+struct target {
+    int fd;
+    int owned;
+    PyObject *path;   /* borrowed; NULL for a caller's descriptor */
+};
+
+int target_open(PyObject *obj, struct target *t);
+void target_close(struct target *t);
+PyObject *target_error(struct target *t);
+
+/* -- qgroups — defined in qgroup_info.c ---------------------------- */
+
+/* a qgroupid is level << QGROUP_LEVEL_SHIFT | id */
+#define QGROUP_LEVEL_SHIFT 48
+#define QGROUP_ID_MASK     ((1ULL << QGROUP_LEVEL_SHIFT) - 1)
+
+/* one qgroup, merged from its INFO and LIMIT items */
+struct qgroup_record {
+    uint64_t qgroupid;
+    uint64_t rfer;
+    uint64_t excl;
+    uint64_t rfer_cmpr;
+    uint64_t excl_cmpr;
+    uint64_t max_rfer;
+    uint64_t max_excl;
+};
+
+/*
+ * Read every qgroup from the quota tree with BTRFS_IOC_TREE_SEARCH_V2.
+ * Runs without the GIL.  Returns 0 with a malloc'd array sorted by
+ * qgroupid in *out, or -1 with errno set.
+ */
+int qgroup_collect(int fd, struct qgroup_record **out, size_t *n);
+
+/* one RELATION item, stored once under each of the two qgroupids */
+struct qgroup_relation {
+    uint64_t src;   /* the key's qgroupid */
+    uint64_t dst;   /* the qgroup it is related to */
+};
+
+/*
+ * Every qgroup plus the hierarchy, in compressed sparse row form: the
+ * parents of recs[i] are parents[parent_offsets[i]:parent_offsets[i + 1]],
+ * likewise for children, both sorted by qgroupid.  All arrays malloc'd.
+ */
+struct qgroup_graph {
+    struct qgroup_record *recs;
+    size_t n;
+    uint64_t *parent_offsets;   /* n + 1 entries */
+    uint64_t *parents;
+    size_t nparents;
+    uint64_t *child_offsets;    /* n + 1 entries */
+    uint64_t *children;
+    size_t nchildren;
+};
+
+/*
+ * Like qgroup_collect(), also reading the RELATION items in the same
+ * tree search.  Returns 0, or -1 with errno set and *g* empty.
+ */
+int qgroup_collect_graph(int fd, struct qgroup_graph *g);
+void qgroup_graph_free(struct qgroup_graph *g);
+
+extern PyType_Spec QgroupInfo_spec;
+PyObject *QgroupInfo_from_record(quota_state *st,
+                                 const struct qgroup_record *r);
+/* new tuple of the field names, in key order */
+PyObject *QgroupInfo_field_names(void);
+
+/* -- streaming — defined in qgroup_iterator.c ----------------------- */
+
+extern PyType_Spec QgroupIterator_spec;
+
+/* -- per-subvolume usage — defined in usage.c ---------------------- */
+
+/*
+ * Every subvolume below a top, sorted by path, with the counters of its
+ * level-0 qgroup (zeros if it has none) in parallel malloc'd arrays.
+ * Path i is path_data[path_offsets[i]:path_offsets[i + 1]].
+ */
+struct subvol_usage {
+    size_t n;
+    uint64_t *id;
+    uint64_t *rfer;
+    uint64_t *excl;
+    uint64_t *max_rfer;
+    uint64_t *max_excl;
+    uint64_t *path_offsets;     /* n + 1 entries */
+    char *path_data;
+};
+
+/*
+ * Scan the root tree and the quota tree and join them.  *top* 0 means
+ * the subvolume containing *fd*.  Runs without the GIL and needs
+ * CAP_SYS_ADMIN.  Returns 0, or -1 with errno set and *u* empty.
+ */
+int subvol_usage_collect(int fd, uint64_t top, struct subvol_usage *u);
+void subvol_usage_free(struct subvol_usage *u);
+
+#endif /* PYBTRFS_QUOTA_H */
@@ -0,0 +1,105 @@
+#include "quota.h"
+#include "rootscan.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Binary search of the level-0 qgroup of subvolume *id*. */
+static const struct qgroup_record *
+find_qgroup(const struct qgroup_record *recs, size_t n, uint64_t id)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (recs[mid].qgroupid == id)
+            return &recs[mid];
+        if (recs[mid].qgroupid < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+void
+subvol_usage_free(struct subvol_usage *u)
+{
+    free(u->id);
+    free(u->rfer);
+    free(u->excl);
+    free(u->max_rfer);
+    free(u->max_excl);
+    free(u->path_offsets);
+    free(u->path_data);
+    memset(u, 0, sizeof(*u));
+}
+
+/*
+ * One sweep of the root tree for the subvolumes and one of the quota
+ * tree for the counters, joined on the level-0 qgroupid, which is the
+ * subvolume ID.  The qgroups come back sorted, so each subvolume finds
+ * its counters by binary search.
+ */
+int
+subvol_usage_collect(int fd, uint64_t top, struct subvol_usage *u)
+{
+    struct subvol_scan scan;
+    struct qgroup_record *recs = NULL;
+    size_t nrecs = 0, n, total = 0;
+    int err;
+
+    memset(u, 0, sizeof(*u));
+    if (subvol_scan(fd, top, 0, &scan))
+        return -1;
+    if (qgroup_collect(fd, &recs, &nrecs) < 0) {
+        err = errno;
+        subvol_scan_free(&scan);
+        errno = err;
+        return -1;
+    }
+
+    n = scan.n;
+    for (size_t i = 0; i < n; i++)
+        total += strlen(scan.entries[i].path);
+
+    /* +1 so that empty listings still get non-NULL arrays */
+    u->n = n;
+    u->id = malloc(n * sizeof(uint64_t) + 1);
+    u->rfer = malloc(n * sizeof(uint64_t) + 1);
+    u->excl = malloc(n * sizeof(uint64_t) + 1);
+    u->max_rfer = malloc(n * sizeof(uint64_t) + 1);
+    u->max_excl = malloc(n * sizeof(uint64_t) + 1);
+    u->path_offsets = malloc((n + 1) * sizeof(uint64_t));
+    u->path_data = malloc(total + 1);
+    if (!u->id || !u->rfer || !u->excl || !u->max_rfer || !u->max_excl ||
+        !u->path_offsets || !u->path_data) {
+        subvol_usage_free(u);
+        subvol_scan_free(&scan);
+        free(recs);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint64_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct subvol_entry *e = &scan.entries[i];
+        const struct qgroup_record *r = find_qgroup(recs, nrecs, e->info.id);
+        size_t len = strlen(e->path);
+
+        u->id[i] = e->info.id;
+        u->rfer[i] = r ? r->rfer : 0;
+        u->excl[i] = r ? r->excl : 0;
+        u->max_rfer[i] = r ? r->max_rfer : 0;
+        u->max_excl[i] = r ? r->max_excl : 0;
+        u->path_offsets[i] = off;
+        memcpy(u->path_data + off, e->path, len);
+        off += len;
+    }
+    u->path_offsets[n] = off;
+
+    subvol_scan_free(&scan);
+    free(recs);
+    return 0;
+}
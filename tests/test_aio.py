@@ -0,0 +1,110 @@
+import asyncio
+import gc
+import os
+import weakref
+
+import pytest
+
+import pybtrfs
+from pybtrfs import aio
+
+
+def test_snapshot_and_delete(subvol):
+    with open(os.path.join(subvol, "data.txt"), "w") as f:
+        f.write("aio")
+    snaps = [os.path.join(subvol, f"snap{i}") for i in range(16)]
+
+    async def main():
+        await asyncio.gather(*(aio.create_snapshot(subvol, s) for s in snaps))
+        assert all(pybtrfs.is_subvolume(s) for s in snaps)
+        await asyncio.gather(*(aio.delete_subvolume(s) for s in snaps))
+
+    asyncio.run(main())
+    assert not any(os.path.exists(s) for s in snaps)
+
+
+def test_snapshot_read_only(subvol):
+    snap = os.path.join(subvol, "ro")
+    asyncio.run(aio.create_snapshot(subvol, snap, read_only=True))
+    assert pybtrfs.get_subvolume_read_only(snap)
+    pybtrfs.set_subvolume_read_only(snap, False)
+
+
+def test_error(subvol):
+    with pytest.raises(pybtrfs.BtrfsUtilError):
+        asyncio.run(aio.delete_subvolume(os.path.join(subvol, "missing")))
+
+
+def test_sync(btrfs):
+    async def main():
+        await aio.sync(btrfs)
+        await aio.sync(btrfs, coalesce=True)
+        transid = await aio.start_sync(btrfs)
+        await aio.wait_sync(btrfs, transid)
+        return transid
+
+    assert asyncio.run(main()) > 0
+
+
+def test_quota_rescan_wait_not_btrfs():
+    with pytest.raises(OSError):
+        asyncio.run(aio.quota_rescan_wait("/proc"))
+
+
+def test_cancel(btrfs):
+    async def main():
+        tasks = [asyncio.ensure_future(aio.sync(btrfs)) for _ in range(200)]
+        await asyncio.sleep(0)
+        for task in tasks:
+            task.cancel()
+        await asyncio.gather(*tasks, return_exceptions=True)
+        assert all(task.cancelled() for task in tasks)
+        # dropped requests do not hold up the pool
+        await asyncio.wait_for(aio.sync(btrfs), 60)
+
+    asyncio.run(main())
+
+
+def test_subvolume_batches(subvol):
+    names = [f"b{i:02d}" for i in range(20)]
+    pybtrfs.create_subvolumes([os.path.join(subvol, n) for n in names])
+
+    async def main():
+        return [b async for b in aio.subvolume_batches(subvol, info=True,
+                                                      n=8)]
+
+    batches = asyncio.run(main())
+    assert [len(b) for b in batches] == [8, 8, 4]
+    paths = sorted(p for b in batches for p, _ in b)
+    assert paths == names
+    assert all(isinstance(i, pybtrfs.SubvolumeInfo) for b in batches
+               for _, i in b)
+
+
+def test_shutdown(btrfs):
+    async def main():
+        await aio.start_sync(btrfs)
+        await aio.shutdown()
+        # a fresh pool is started on demand
+        await aio.sync(btrfs)
+        await aio.shutdown()
+
+    asyncio.run(main())
+
+
+def test_closed_loop_released(btrfs):
+    async def main():
+        transid = await aio.start_sync(btrfs)
+        pending = asyncio.ensure_future(aio.wait_sync(btrfs, transid))
+        await asyncio.sleep(0)
+        return pending
+
+    loop = asyncio.new_event_loop()
+    pending = loop.run_until_complete(main())
+    ref = weakref.ref(loop)
+    # neither shutdown() nor the request finishing: the loop still goes
+    pending._log_destroy_pending = False
+    loop.close()
+    del loop, pending
+    gc.collect()
+    assert ref() is None
@@ -0,0 +1,146 @@
+import os
+import threading
+import time
+
+import pytest
+
+import pybtrfs
+
+
+@pytest.fixture
+def fs(btrfs):
+    with pybtrfs.Filesystem(btrfs) as handle:
+        yield handle
+
+
+class TestFilesystemHandle:
+    def test_fs_info(self, fs, btrfs):
+        assert fs.path == btrfs
+        assert isinstance(fs.fsid, bytes)
+        assert len(fs.fsid) == 16
+        assert fs.nodesize >= 4096
+        assert fs.sectorsize >= 4096
+        assert fs.num_devices >= 1
+        assert fs.csum_type in (
+            pybtrfs.CsumType.CRC32, pybtrfs.CsumType.XXHASH,
+            pybtrfs.CsumType.SHA256, pybtrfs.CsumType.BLAKE2,
+        )
+
+    def test_fileno(self, fs):
+        assert fs.fileno() >= 0
+        assert not fs.closed
+
+    def test_close(self, btrfs):
+        fs = pybtrfs.Filesystem(btrfs)
+        fs.close()
+        assert fs.closed
+        with pytest.raises(ValueError):
+            fs.subvolume_id()
+        fs.close()
+
+    def test_close_while_in_use(self, btrfs):
+        fs = pybtrfs.Filesystem(btrfs)
+        errors = []
+
+        def worker():
+            try:
+                while True:
+                    fs.sync()
+            except ValueError:
+                pass
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=worker) for _ in range(4)]
+        for t in threads:
+            t.start()
+        time.sleep(0.1)
+        fs.close()
+        for t in threads:
+            t.join()
+        # calls still running finished on the handle fd, not a reused one
+        assert errors == []
+        assert fs.closed
+
+    def test_context_manager_closes(self, btrfs):
+        with pybtrfs.Filesystem(btrfs) as fs:
+            pass
+        assert fs.closed
+
+    def test_not_btrfs(self, tmp_path):
+        with pytest.raises(pybtrfs.BtrfsUtilError):
+            pybtrfs.Filesystem(str(tmp_path))
+
+    def test_missing(self, btrfs):
+        with pytest.raises(pybtrfs.BtrfsUtilError):
+            pybtrfs.Filesystem(os.path.join(btrfs, "_no_such_dir"))
+
+    def test_repr(self, fs, btrfs):
+        assert btrfs in repr(fs)
+
+
+class TestFilesystemSubvolumes:
+    def test_matches_module(self, fs, btrfs, subvol):
+        name = os.path.basename(subvol)
+        assert fs.is_subvolume(name) is True
+        assert fs.subvolume_id(name) == pybtrfs.subvolume_id(subvol)
+        assert fs.subvolume_info(name).uuid == \
+            pybtrfs.subvolume_info(subvol).uuid
+        assert fs.subvolume_id() == pybtrfs.subvolume_id(btrfs)
+        assert fs.get_default_subvolume() == \
+            pybtrfs.get_default_subvolume(btrfs)
+
+    def test_info_by_id(self, fs, subvol):
+        sid = pybtrfs.subvolume_id(subvol)
+        assert fs.subvolume_info(id=sid).id == sid
+        assert fs.subvolume_path(id=sid) == \
+            pybtrfs.subvolume_path(subvol)
+
+    def test_create_delete_nested(self, fs, subvol):
+        rel = os.path.join(os.path.basename(subvol), "fs_child")
+        fs.create_subvolume(rel)
+        assert pybtrfs.is_subvolume(os.path.join(subvol, "fs_child"))
+        fs.delete_subvolume(rel)
+        assert not os.path.exists(os.path.join(subvol, "fs_child"))
+
+    def test_snapshot_read_only(self, fs, subvol):
+        name = os.path.basename(subvol)
+        snap = name + "_fs_snap"
+        fs.create_snapshot(name, snap, read_only=True)
+        try:
+            assert fs.get_subvolume_read_only(snap) is True
+            assert fs.subvolume_info(snap).parent_uuid == \
+                fs.subvolume_info(name).uuid
+        finally:
+            fs.set_subvolume_read_only(snap, False)
+            fs.delete_subvolume(snap)
+
+    def test_list(self, fs, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "listed"))
+        sid = pybtrfs.subvolume_id(subvol)
+        assert fs.subvolume_list(top=sid) == \
+            pybtrfs.subvolume_list(subvol)
+
+    def test_find_by_uuid(self, fs, subvol):
+        info = pybtrfs.subvolume_info(subvol)
+        assert fs.find_subvolume_by_uuid(info.uuid) == info.id
+        assert fs.find_subvolumes_by_uuid([info.uuid]) == [info.id]
+
+    def test_deleted_subvolumes(self, fs):
+        assert isinstance(fs.deleted_subvolumes(), list)
+
+
+class TestFilesystemSync:
+    def test_sync(self, fs):
+        fs.sync()
+
+    def test_sync_coalesce(self, fs):
+        fs.sync(coalesce=True)
+
+    def test_start_wait(self, fs):
+        transid = fs.start_sync()
+        assert transid > 0
+        fs.wait_sync(transid)
+
+    def test_wait_sync_timeout(self, fs):
+        assert fs.wait_sync(fs.start_sync(), timeout=60) is True
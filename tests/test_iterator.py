@@ -1,4 +1,7 @@
 import os
+import threading
+
+import pytest
 
 import pybtrfs
 
@@ -77,6 +80,78 @@ class TestSubvolumeIterator:
             pass
 
 
+class TestSubvolumeIteratorBatch:
+    def test_next_batch(self, subvol):
+        for name in ("a", "b", "c"):
+            pybtrfs.create_subvolume(os.path.join(subvol, name))
+
+        with pybtrfs.SubvolumeIterator(subvol) as it:
+            first = it.next_batch(2)
+            second = it.next_batch(2)
+            assert it.next_batch() == []
+
+        assert len(first) == 2
+        assert len(second) == 1
+        assert sorted(p for p, _ in first + second) == ["a", "b", "c"]
+
+    def test_next_batch_info(self, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "batchinfo"))
+
+        with pybtrfs.SubvolumeIterator(subvol, info=True) as it:
+            items = it.next_batch(10)
+
+        assert len(items) == 1
+        path, info = items[0]
+        assert path == "batchinfo"
+        assert isinstance(info, pybtrfs.SubvolumeInfo)
+
+    def test_mixed_next_and_batch(self, subvol):
+        for name in ("m1", "m2", "m3"):
+            pybtrfs.create_subvolume(os.path.join(subvol, name))
+
+        with pybtrfs.SubvolumeIterator(subvol) as it:
+            head = next(it)
+            rest = it.next_batch(10)
+
+        assert sorted([head[0]] + [p for p, _ in rest]) == ["m1", "m2", "m3"]
+
+    def test_next_batch_invalid(self, subvol):
+        with pybtrfs.SubvolumeIterator(subvol) as it:
+            with pytest.raises(ValueError):
+                it.next_batch(0)
+
+    def test_next_batch_after_close(self, subvol):
+        it = pybtrfs.SubvolumeIterator(subvol)
+        it.close()
+        with pytest.raises(ValueError):
+            it.next_batch()
+
+    def test_next_batch_shared(self, subvol):
+        names = [f"t{i:03d}" for i in range(64)]
+        pybtrfs.create_subvolumes([os.path.join(subvol, n) for n in names])
+        seen = []
+
+        def consume(it):
+            while True:
+                try:
+                    batch = it.next_batch(3)
+                except RuntimeError:
+                    continue  # another thread is advancing it
+                if not batch:
+                    return
+                seen.extend(p for p, _ in batch)
+
+        with pybtrfs.SubvolumeIterator(subvol) as it:
+            threads = [threading.Thread(target=consume, args=(it,))
+                       for _ in range(8)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+        assert sorted(seen) == names
+
+
 class TestSubvolumeIteratorTop:
     def test_top_5(self, btrfs):
         """Iterate from FS tree root (id=5)."""
@@ -100,6 +100,10 @@ class TestMkfsSingleDevice:
         result = mkfs(loop_device, force=True, no_discard=True)
         assert result["uuid"]
 
+    def test_mkfs_with_timeout(self, loop_device):
+        result = mkfs(loop_device, force=True, timeout=60)
+        assert result["num_bytes"] > 0
+
     def test_force_overwrite(self, loop_device):
         mkfs(loop_device, force=True)
         # Second mkfs with force should succeed
@@ -137,6 +141,10 @@ class TestMkfsErrors:
         with pytest.raises(ValueError, match="label too long"):
             mkfs(loop_device, label="x" * 256, force=True)
 
+    def test_bad_timeout(self, loop_device):
+        with pytest.raises(ValueError, match="timeout"):
+            mkfs(loop_device, force=True, timeout=-1)
+
 
 class TestConstants:
     def test_csum_types_are_int(self):
@@ -1,4 +1,10 @@
+import re
+import sys
+
+import pytest
+
 import pybtrfs
+from pybtrfs import quota
 
 
 def test_import():
@@ -29,3 +35,61 @@ def test_qgroup_inherit_add():
     qg.add_group(0)
     qg.add_group(1)
     assert qg.get_groups() == [0, 1]
+
+
+def test_qgroup_inherit_add_positional_only():
+    qg = pybtrfs.QgroupInherit()
+    with pytest.raises(TypeError):
+        qg.add_group(qgroupid=1)
+    with pytest.raises(TypeError):
+        qg.add_group(1, 2)
+
+
+@pytest.mark.parametrize("call, message", [
+    (lambda: pybtrfs.subvolume_info(), "missing required argument 'path'"),
+    (lambda: pybtrfs.subvolume_info("/", 5, 6), "at most 2 positional"),
+    (lambda: pybtrfs.subvolume_info("/", path="/"), "given by name ('path')"),
+    (lambda: pybtrfs.subvolume_info("/", ids=5), "'ids' is an invalid keyword"),
+    (lambda: pybtrfs.subvolume_info(b"/"), "argument 'path' must be str"),
+    (lambda: pybtrfs.subvolume_info("/", id=1.0), "argument 'id' must be int"),
+    (lambda: pybtrfs.create_subvolume("/x", qgroup_inherit=[]),
+     "must be pybtrfs.QgroupInherit"),
+    (lambda: pybtrfs.find_subvolume_by_uuid("/", "uuid"), "must be bytes"),
+    (lambda: quota.qgroup_limit("/", 0, max_excl="1"), "must be int"),
+])
+def test_argument_errors(call, message):
+    with pytest.raises(TypeError, match=re.escape(message)):
+        call()
+
+
+def test_argument_embedded_nul():
+    with pytest.raises(ValueError):
+        pybtrfs.is_subvolume("/\0")
+
+
+def test_argument_runtime_keyword():
+    # keyword names not interned by the compiler still match
+    kwargs = {"".join(["pa", "th"]): "/\0"}
+    with pytest.raises(ValueError):
+        pybtrfs.is_subvolume(**kwargs)
+
+
+def test_import_in_isolated_interpreter():
+    interpreters = pytest.importorskip("concurrent.interpreters")
+    interp = interpreters.create()
+    try:
+        interp.exec(
+            f"import sys; sys.path[:] = {sys.path!r}\n"
+            "import pybtrfs\n"
+            "qg = pybtrfs.QgroupInherit()\n"
+            "qg.add_group(1)\n"
+            "assert qg.get_groups() == [1]\n"
+            "try:\n"
+            "    pybtrfs.subvolume_id('/nonexistent')\n"
+            "except pybtrfs.BtrfsUtilError:\n"
+            "    pass\n"
+        )
+    finally:
+        interp.close()
+    # the main interpreter's types are untouched
+    assert pybtrfs.QgroupInherit().get_groups() == []
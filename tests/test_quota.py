@@ -109,6 +109,14 @@ class TestQuotaRescan:
         quota_rescan(quota_enabled)
         quota_rescan_wait(quota_enabled)
 
+    def test_rescan_wait_timeout(self, quota_enabled):
+        quota_rescan(quota_enabled)
+        assert quota_rescan_wait(quota_enabled, timeout=60) is True
+
+    def test_rescan_wait_bad_timeout(self, quota_enabled):
+        with pytest.raises(ValueError):
+            quota_rescan_wait(quota_enabled, timeout=-1)
+
     def test_rescan_status(self, quota_enabled):
         status = quota_rescan_status(quota_enabled)
         assert isinstance(status, dict)
@@ -138,6 +146,23 @@ class TestQgroupInfo:
             for v in entry.values():
                 assert isinstance(v, int)
 
+    def test_qgroup_info_objects(self, quota_enabled):
+        info = qgroup_info(quota_enabled)
+        assert all(isinstance(e, pybtrfs.QgroupInfo) for e in info)
+        ids = [e.qgroupid for e in info]
+        assert ids == sorted(ids)
+        for entry in info:
+            assert entry.rfer == entry["rfer"]
+            assert entry.max_excl == entry.get("max_excl")
+            assert dict(entry) == entry.as_dict() == entry
+
+    def test_missing_key(self, quota_enabled):
+        entry = qgroup_info(quota_enabled)[0]
+        assert "nope" not in entry
+        assert entry.get("nope") is None
+        with pytest.raises(KeyError):
+            entry["nope"]
+
 
 class TestQgroupCreateDestroy:
     def test_create_and_destroy(self, quota_enabled):
@@ -182,6 +207,144 @@ class TestQgroupAssignRemove:
         qgroup_destroy(quota_enabled, parent)
 
 
+class TestQgroupBatch:
+    def test_provision(self, quota_enabled):
+        parent = (1 << 48) | 2
+        subvol_path = os.path.join(quota_enabled, "sub_batch")
+        pybtrfs.create_subvolume(subvol_path)
+        child = pybtrfs.subvolume_id(subvol_path)
+        try:
+            results, needs_rescan, rescan_error = pybtrfs.qgroup_batch(
+                quota_enabled, [
+                    ("create", parent),
+                    ("assign", child, parent),
+                    ("limit", parent, 1 << 30),
+                ])
+            assert results == [None, None, None]
+            assert isinstance(needs_rescan, bool)
+            assert rescan_error is None
+            quota_rescan_wait(quota_enabled)
+
+            entry = next(e for e in qgroup_info(quota_enabled)
+                         if e.qgroupid == parent)
+            assert entry.max_rfer == 1 << 30
+
+            results, _, rescan_error = pybtrfs.qgroup_batch(quota_enabled, [
+                ("remove", child, parent),
+                ("destroy", parent),
+            ])
+            assert results == [None, None]
+            assert rescan_error is None
+        finally:
+            quota_rescan_wait(quota_enabled)
+            pybtrfs.delete_subvolume(subvol_path)
+
+    def test_failures_do_not_stop_batch(self, quota_enabled):
+        qgid = (1 << 48) | 3
+        results, needs_rescan, _ = pybtrfs.qgroup_batch(quota_enabled, [
+            ("destroy", qgid),          # does not exist yet
+            ("create", qgid),
+            ("destroy", qgid),
+        ])
+        assert needs_rescan is False
+        assert isinstance(results[0], OSError)
+        assert results[0].filename == quota_enabled
+        assert results[1:] == [None, None]
+
+    def test_no_rescan(self, quota_enabled):
+        parent = (1 << 48) | 4
+        subvol_path = os.path.join(quota_enabled, "sub_batch_norescan")
+        pybtrfs.create_subvolume(subvol_path)
+        child = pybtrfs.subvolume_id(subvol_path)
+        try:
+            _, needs_rescan, rescan_error = pybtrfs.qgroup_batch(
+                quota_enabled, [("create", parent), ("assign", child, parent)],
+                rescan=False,
+            )
+            assert rescan_error is None
+            if needs_rescan:
+                quota_rescan(quota_enabled)
+            quota_rescan_wait(quota_enabled)
+            pybtrfs.qgroup_batch(quota_enabled, [
+                ("remove", child, parent),
+                ("destroy", parent),
+            ])
+        finally:
+            quota_rescan_wait(quota_enabled)
+            pybtrfs.delete_subvolume(subvol_path)
+
+    def test_bad_ops(self, quota_enabled):
+        with pytest.raises(ValueError):
+            pybtrfs.qgroup_batch(quota_enabled, [("frobnicate", 1)])
+        with pytest.raises(TypeError):
+            pybtrfs.qgroup_batch(quota_enabled, [("assign", 1)])
+        with pytest.raises(TypeError):
+            pybtrfs.qgroup_batch(quota_enabled, [5])
+
+
+class TestQgroupGraph:
+    def test_relations(self, quota_enabled):
+        parent = (1 << 48) | 1
+        qgroup_create(quota_enabled, parent)
+        subvol_path = os.path.join(quota_enabled, "sub_graph")
+        pybtrfs.create_subvolume(subvol_path)
+        child = pybtrfs.subvolume_id(subvol_path)
+        qgroup_assign(quota_enabled, child, parent)
+        try:
+            g = pybtrfs.qgroup_graph(quota_enabled)
+            assert g["qgroups"] == qgroup_info(quota_enabled)
+            ids = list(g["qgroupid"])
+            assert ids == [e.qgroupid for e in g["qgroups"]]
+
+            po, co = g["parent_offsets"], g["child_offsets"]
+            assert po.format == co.format == "Q"
+            assert len(po) == len(co) == len(ids) + 1
+
+            p, c = ids.index(parent), ids.index(child)
+            assert list(g["parents"][po[c]:po[c + 1]]) == [parent]
+            assert list(g["children"][co[p]:co[p + 1]]) == [child]
+            assert po[p] == po[p + 1] and co[c] == co[c + 1]
+        finally:
+            qgroup_remove(quota_enabled, child, parent)
+            pybtrfs.delete_subvolume(subvol_path)
+            qgroup_destroy(quota_enabled, parent)
+
+    def test_no_relations(self, quota_enabled):
+        g = pybtrfs.qgroup_graph(quota_enabled)
+        assert len(g["parents"]) == len(g["children"]) == 0
+        assert set(g["parent_offsets"]) == {0}
+
+
+class TestSubvolumeUsage:
+    def test_joins_qgroups(self, quota_enabled):
+        subvol_path = os.path.join(quota_enabled, "sub_usage")
+        pybtrfs.create_subvolume(subvol_path)
+        try:
+            subvol_id = pybtrfs.subvolume_id(subvol_path)
+            qgroup_limit(quota_enabled, subvol_id, max_rfer=1 << 30)
+
+            u = pybtrfs.subvolume_usage(quota_enabled)
+            assert u["id"].format == "Q"
+            off, data = u["path_offsets"], u["path_data"]
+            paths = [data[off[i]:off[i + 1]].decode()
+                     for i in range(len(u["id"]))]
+            assert paths == ["sub_usage"]
+            assert u["id"][0] == subvol_id
+
+            q = next(e for e in qgroup_info(quota_enabled)
+                     if e.qgroupid == subvol_id)
+            for key in ("rfer", "excl", "max_rfer", "max_excl"):
+                assert u[key][0] == q[key]
+            assert u["max_rfer"][0] == 1 << 30
+        finally:
+            pybtrfs.delete_subvolume(subvol_path)
+
+    def test_empty(self, quota_enabled):
+        u = pybtrfs.subvolume_usage(quota_enabled)
+        assert len(u["id"]) == 0
+        assert list(u["path_offsets"]) == [0]
+
+
 class TestQgroupLimit:
     def test_set_max_rfer(self, quota_enabled):
         # get the default qgroup for root subvol (0/5)
@@ -223,6 +386,92 @@ class TestQgroupLimit:
         assert entry["max_excl"] == 100 * 1024 * 1024
 
 
+class TestQgroupIterator:
+    def test_matches_qgroup_info(self, quota_enabled):
+        qgid = (1 << 48) | 10
+        qgroup_create(quota_enabled, qgid)
+        qgroup_limit(quota_enabled, qgid, max_rfer=1 << 20)
+        try:
+            with pybtrfs.QgroupIterator(quota_enabled) as it:
+                assert list(it) == qgroup_info(quota_enabled)
+        finally:
+            qgroup_destroy(quota_enabled, qgid)
+
+    def test_bounds(self, quota_enabled):
+        ids = [(1 << 48) | i for i in range(10, 15)]
+        for qgid in ids:
+            qgroup_create(quota_enabled, qgid)
+        try:
+            it = pybtrfs.QgroupIterator(
+                quota_enabled, level=1, min_id=11, max_id=13,
+            )
+            assert [e.qgroupid for e in it.next_batch(2)] == ids[1:3]
+            assert [e.qgroupid for e in it] == ids[3:4]
+            it.close()
+
+            level0 = list(pybtrfs.QgroupIterator(quota_enabled, level=0))
+            assert level0 and all(e.qgroupid >> 48 == 0 for e in level0)
+
+            # without a level the id bounds apply on every level
+            found = list(pybtrfs.QgroupIterator(
+                quota_enabled, min_id=12, max_id=12,
+            ))
+            assert [e.qgroupid for e in found] == [ids[2]]
+        finally:
+            for qgid in ids:
+                qgroup_destroy(quota_enabled, qgid)
+
+    def test_min_transid(self, quota_enabled):
+        it = pybtrfs.QgroupIterator(quota_enabled, min_transid=1 << 62)
+        assert it.next_batch() == []
+
+    def test_bad_bounds(self, quota_enabled):
+        with pytest.raises(ValueError):
+            pybtrfs.QgroupIterator(quota_enabled, min_id=5, max_id=4)
+        with pytest.raises(ValueError):
+            pybtrfs.QgroupIterator(quota_enabled, max_id=1 << 48)
+        with pytest.raises(ValueError):
+            pybtrfs.QgroupIterator(quota_enabled, level=1 << 16)
+
+    def test_closed(self, quota_enabled):
+        it = pybtrfs.QgroupIterator(quota_enabled)
+        it.close()
+        with pytest.raises(ValueError):
+            next(it)
+
+
+class TestFileDescriptor:
+    def test_functions_accept_fd(self, quota_enabled):
+        fd = os.open(quota_enabled, os.O_RDONLY)
+        try:
+            assert qgroup_info(fd) == qgroup_info(quota_enabled)
+            quota_rescan_status(fd)
+        finally:
+            os.close(fd)
+
+    def test_filesystem_methods(self, quota_enabled):
+        qgid = (1 << 48) | 77
+        with pybtrfs.Filesystem(quota_enabled) as fs:
+            fs.qgroup_create(qgid)
+            fs.qgroup_limit(qgid, max_rfer=1 << 20)
+            entry = next(e for e in fs.qgroup_info()
+                         if e["qgroupid"] == qgid)
+            assert entry["max_rfer"] == 1 << 20
+            fs.qgroup_destroy(qgid)
+
+    def test_filesystem_methods_own_fd(self, quota_enabled):
+        fds = len(os.listdir("/proc/self/fd"))
+        with pybtrfs.Filesystem(quota_enabled) as fs:
+            handle = fs.fileno()
+            fs.qgroup_info()
+            with fs.qgroup_iterator() as it:
+                list(it)
+            assert fs.fileno() == handle
+        assert len(os.listdir("/proc/self/fd")) == fds
+        with pytest.raises(ValueError):
+            fs.qgroup_info()
+
+
 class TestConstants:
     def test_quota_ctl_values(self):
         assert QuotaCtl.ENABLE == 1
@@ -65,6 +65,82 @@ class TestStressSubvolumes:
                 pass
 
 
+    def test_create_bulk(self, btrfs):
+        root = _fresh_root(btrfs, "_stress_sv_bulk")
+        # spread over a few parent directories
+        for d in range(4):
+            os.mkdir(os.path.join(root, f"d{d}"))
+        paths = [
+            os.path.join(root, f"d{i % 4}", f"sv_{i:05d}")
+            for i in range(CONCURRENCY)
+        ]
+
+        try:
+            results = pybtrfs.create_subvolumes(paths, workers=WORKERS)
+            failed = [e for e in results if e is not None]
+            assert not failed, f"create errors: {failed[:5]}"
+            assert len(results) == CONCURRENCY
+
+            found = pybtrfs.subvolume_list(root)
+            assert len(found) == CONCURRENCY
+        finally:
+            try:
+                pybtrfs.delete_subvolume(root, recursive=True)
+            except Exception:
+                pass
+
+    def test_delete_tree(self, btrfs):
+        root = _fresh_root(btrfs, "_stress_sv_tree")
+        # two levels below root: CONCURRENCY // 10 parents, 9 children each
+        parents = [
+            os.path.join(root, f"p_{i:05d}") for i in range(CONCURRENCY // 10)
+        ]
+        assert pybtrfs.create_subvolumes(parents, workers=WORKERS) == (
+            [None] * len(parents))
+        children = [
+            os.path.join(p, f"c_{j}") for p in parents for j in range(9)
+        ]
+        assert pybtrfs.create_subvolumes(children, workers=WORKERS) == (
+            [None] * len(children))
+
+        seen = []
+        failures = pybtrfs.delete_subvolume_tree(
+            root, workers=WORKERS,
+            progress=lambda done, total: seen.append((done, total)),
+        )
+        assert failures == []
+        assert not os.path.exists(root)
+        total = 1 + len(parents) + len(children)
+        assert seen[-1] == (total, total)
+
+    def test_snapshot_tree(self, btrfs):
+        root = _fresh_root(btrfs, "_stress_sv_snap_tree")
+        source = os.path.join(root, "source")
+        pybtrfs.create_subvolume(source)
+        parents = [
+            os.path.join(source, f"p_{i:05d}")
+            for i in range(CONCURRENCY // 10)
+        ]
+        assert pybtrfs.create_subvolumes(parents, workers=WORKERS) == (
+            [None] * len(parents))
+        children = [
+            os.path.join(p, f"c_{j}") for p in parents for j in range(9)
+        ]
+        assert pybtrfs.create_subvolumes(children, workers=WORKERS) == (
+            [None] * len(children))
+
+        try:
+            dest = os.path.join(root, "copy")
+            ids = pybtrfs.create_snapshot_tree(source, dest, workers=WORKERS)
+            assert len(ids) == 1 + len(parents) + len(children)
+
+            copied = {info.id for _, info in pybtrfs.subvolume_list(
+                dest, info=True)}
+            assert copied | {pybtrfs.subvolume_id(dest)} == ids
+        finally:
+            pybtrfs.delete_subvolume_tree(root, workers=WORKERS)
+
+
 class TestStressSnapshots:
     def test_snapshot_threaded(self, btrfs):
         root = _fresh_root(btrfs, "_stress_snap")
@@ -145,6 +221,41 @@ class TestStressSnapshots:
             except Exception:
                 pass
 
+    def test_snapshot_bulk(self, btrfs):
+        root = _fresh_root(btrfs, "_stress_snap_bulk")
+        source = os.path.join(root, "source")
+        pybtrfs.create_subvolume(source)
+
+        with open(os.path.join(source, "payload.txt"), "w") as f:
+            f.write("snapshot stress data")
+
+        snap_paths = [
+            os.path.join(root, f"snap_{i:05d}") for i in range(CONCURRENCY)
+        ]
+
+        try:
+            results = pybtrfs.create_snapshots(
+                source, snap_paths, workers=WORKERS,
+            )
+            failed = [r for r in results if not isinstance(r, int)]
+            assert not failed, f"snapshot create errors: {failed[:5]}"
+            assert len(results) == CONCURRENCY
+
+            src_info = pybtrfs.subvolume_info(source)
+            for p, transid in zip(snap_paths, results):
+                info = pybtrfs.subvolume_info(p)
+                assert info.parent_uuid == src_info.uuid
+                assert info.otransid == transid
+
+            for p in snap_paths[:100]:
+                with open(os.path.join(p, "payload.txt")) as f:
+                    assert f.read() == "snapshot stress data"
+        finally:
+            try:
+                pybtrfs.delete_subvolume(root, recursive=True)
+            except Exception:
+                pass
+
     def test_snapshot_read_only_threaded(self, btrfs):
         root = _fresh_root(btrfs, "_stress_snap_ro")
         source = os.path.join(root, "source")
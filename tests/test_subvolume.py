@@ -1,3 +1,5 @@
+import array
+import errno
 import os
 
 import pytest
@@ -58,6 +60,22 @@ class TestSubvolumeInfo:
         assert info.parent_id >= 5
         assert info.generation > 0
 
+    def test_lazy_fields_cached(self, subvol):
+        info = pybtrfs.subvolume_info(subvol)
+        assert info.uuid is info.uuid
+        assert info.ctime is info.ctime
+        assert len(info.parent_uuid) == 16
+        assert len(info.received_uuid) == 16
+        for name in ("ctime", "otime", "stime", "rtime"):
+            assert isinstance(getattr(info, name), float)
+
+    def test_read_only(self, subvol):
+        info = pybtrfs.subvolume_info(subvol)
+        with pytest.raises(AttributeError):
+            info.uuid = b"\0" * 16
+        with pytest.raises(AttributeError):
+            info.id = 1
+
     def test_repr(self, subvol):
         info = pybtrfs.subvolume_info(subvol)
         r = repr(info)
@@ -74,6 +92,157 @@ class TestSubvolumeInfo:
             pybtrfs.subvolume_info(btrfs, 99999999)
 
 
+class TestSubvolumeList:
+    def test_matches_iterator(self, subvol):
+        for rel in ("a", "a/b", "c"):
+            pybtrfs.create_subvolume(os.path.join(subvol, rel))
+        os.makedirs(os.path.join(subvol, "dir", "deeper"))
+        pybtrfs.create_subvolume(os.path.join(subvol, "dir", "deeper", "d"))
+
+        with pybtrfs.SubvolumeIterator(subvol) as it:
+            expected = sorted(it)
+
+        assert pybtrfs.subvolume_list(subvol) == expected
+        assert [p for p, _ in expected] == [
+            "a", "a/b", "c", "dir/deeper/d",
+        ]
+
+    def test_info(self, subvol):
+        child = os.path.join(subvol, "listinfo")
+        pybtrfs.create_subvolume(child)
+
+        items = pybtrfs.subvolume_list(subvol, info=True)
+        assert len(items) == 1
+        path, info = items[0]
+        ref = pybtrfs.subvolume_info(child)
+        assert path == "listinfo"
+        assert isinstance(info, pybtrfs.SubvolumeInfo)
+        assert info.id == ref.id
+        assert info.parent_id == ref.parent_id
+        assert info.uuid == ref.uuid
+        assert info.generation == ref.generation
+
+    def test_top(self, btrfs, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "x"))
+        sid = pybtrfs.subvolume_id(subvol)
+
+        assert [p for p, _ in pybtrfs.subvolume_list(btrfs, top=sid)] == ["x"]
+
+    def test_empty(self, subvol):
+        assert pybtrfs.subvolume_list(subvol) == []
+
+    def test_min_transid(self, subvol):
+        old = os.path.join(subvol, "old")
+        pybtrfs.create_subvolume(old)
+        pybtrfs.sync(subvol)
+        since = pybtrfs.subvolume_info(old).generation + 1
+
+        pybtrfs.create_subvolume(os.path.join(subvol, "new"))
+        pybtrfs.create_subvolume(os.path.join(old, "nested"))
+        pybtrfs.sync(subvol)
+
+        items = pybtrfs.subvolume_list(subvol, info=True, min_transid=since)
+        paths = [p for p, _ in items]
+        assert "new" in paths
+        assert "old/nested" in paths
+        assert all(info.generation >= since for _, info in items)
+
+    def test_min_transid_nothing_changed(self, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "still"))
+        transid = pybtrfs.start_sync(subvol)
+        pybtrfs.wait_sync(subvol, transid)
+
+        assert pybtrfs.subvolume_list(subvol, min_transid=transid + 1) == []
+
+
+class TestSubvolumeColumns:
+    def test_matches_list(self, subvol):
+        for rel in ("a", "a/b", "c"):
+            pybtrfs.create_subvolume(os.path.join(subvol, rel))
+
+        items = pybtrfs.subvolume_list(subvol, info=True)
+        cols = pybtrfs.subvolume_columns(subvol)
+        n = len(items)
+
+        for key in ("id", "parent_id", "generation", "ctransid",
+                    "otransid", "flags"):
+            assert cols[key].format == "Q"
+            assert cols[key].tolist() == [getattr(i, key) for _, i in items]
+        assert cols["otime"].tolist() == [int(i.otime) for _, i in items]
+
+        assert cols["uuid"].shape == (n, 16)
+        raw = cols["uuid"].tobytes()
+        assert [raw[k * 16:(k + 1) * 16] for k in range(n)] == \
+            [i.uuid for _, i in items]
+
+        off = cols["path_offsets"].tolist()
+        data = cols["path_data"]
+        assert len(off) == n + 1
+        assert [data[off[k]:off[k + 1]].decode() for k in range(n)] == \
+            [p for p, _ in items]
+
+    def test_read_only(self, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "ro"))
+        cols = pybtrfs.subvolume_columns(subvol)
+        assert cols["id"].readonly
+        with pytest.raises(TypeError):
+            cols["id"][0] = 1
+
+    def test_empty(self, subvol):
+        cols = pybtrfs.subvolume_columns(subvol)
+        assert cols["id"].tolist() == []
+        assert cols["uuid"].shape == (0, 16)
+        assert cols["path_offsets"].tolist() == [0]
+        assert cols["path_data"] == b""
+
+
+class TestFindByUuid:
+    def test_by_uuid(self, btrfs, subvol):
+        info = pybtrfs.subvolume_info(subvol)
+        assert pybtrfs.find_subvolume_by_uuid(btrfs, info.uuid) == info.id
+
+    def test_parent_uuid(self, btrfs, subvol):
+        snap = os.path.join(btrfs, "_test_find_snap")
+        pybtrfs.create_snapshot(subvol, snap)
+        try:
+            parent = pybtrfs.subvolume_info(snap).parent_uuid
+            assert pybtrfs.find_subvolume_by_uuid(btrfs, parent) == \
+                pybtrfs.subvolume_id(subvol)
+        finally:
+            pybtrfs.delete_subvolume(snap)
+
+    def test_not_found(self, btrfs):
+        assert pybtrfs.find_subvolume_by_uuid(btrfs, os.urandom(16)) is None
+        assert pybtrfs.find_subvolume_by_received_uuid(
+            btrfs, os.urandom(16)) is None
+
+    def test_bad_length(self, btrfs):
+        with pytest.raises(ValueError):
+            pybtrfs.find_subvolume_by_uuid(btrfs, b"short")
+
+    def test_batch(self, btrfs, subvol):
+        ids, uuids = [], []
+        for name in ("u1", "u2", "u3"):
+            path = os.path.join(subvol, name)
+            pybtrfs.create_subvolume(path)
+            info = pybtrfs.subvolume_info(path)
+            ids.append(info.id)
+            uuids.append(info.uuid)
+
+        missing = os.urandom(16)
+        result = pybtrfs.find_subvolumes_by_uuid(
+            btrfs, uuids[:2] + [missing] + uuids[2:])
+        assert result == ids[:2] + [None] + ids[2:]
+
+    def test_batch_received(self, btrfs, subvol):
+        uuid = pybtrfs.subvolume_info(subvol).uuid
+        assert pybtrfs.find_subvolumes_by_uuid(
+            btrfs, [uuid], received=True) == [None]
+
+    def test_batch_empty(self, btrfs):
+        assert pybtrfs.find_subvolumes_by_uuid(btrfs, []) == []
+
+
 class TestReadOnly:
     def test_default_not_readonly(self, subvol):
         assert pybtrfs.get_subvolume_read_only(subvol) is False
@@ -125,6 +294,83 @@ class TestCreateDelete:
         assert not os.path.exists(outer)
 
 
+class TestCreateSubvolumes:
+    def test_create_many(self, subvol):
+        os.mkdir(os.path.join(subvol, "dir"))
+        paths = [os.path.join(subvol, n) for n in ("a", "b", "dir/c")]
+
+        assert pybtrfs.create_subvolumes(paths, workers=2) == [None] * 3
+        assert all(pybtrfs.is_subvolume(p) for p in paths)
+
+    def test_per_path_errors(self, subvol):
+        ok = os.path.join(subvol, "ok")
+        pybtrfs.create_subvolume(os.path.join(subvol, "exists"))
+        paths = [
+            os.path.join(subvol, "exists"),
+            ok,
+            os.path.join(subvol, "missing_dir", "x"),
+        ]
+
+        results = pybtrfs.create_subvolumes(paths)
+        assert isinstance(results[0], pybtrfs.BtrfsUtilError)
+        assert results[0].errno == errno.EEXIST
+        assert results[1] is None
+        assert isinstance(results[2], pybtrfs.BtrfsUtilError)
+        assert results[2].errno == errno.ENOENT
+        assert pybtrfs.is_subvolume(ok)
+
+    def test_empty(self):
+        assert pybtrfs.create_subvolumes([]) == []
+
+    def test_bad_workers(self, subvol):
+        with pytest.raises(ValueError):
+            pybtrfs.create_subvolumes([os.path.join(subvol, "x")],
+                                      workers=-1)
+
+
+class TestCreateSnapshots:
+    def test_create_many(self, subvol):
+        os.mkdir(os.path.join(subvol, "dir"))
+        with open(os.path.join(subvol, "f"), "w") as f:
+            f.write("x")
+        source = os.path.join(subvol, "src")
+        pybtrfs.create_subvolume(source)
+        paths = [os.path.join(subvol, n) for n in ("a", "b", "dir/c")]
+
+        results = pybtrfs.create_snapshots(source, paths, workers=2)
+        assert len(results) == 3
+        for p, transid in zip(paths, results):
+            info = pybtrfs.subvolume_info(p)
+            assert info.otransid == transid
+            assert info.parent_uuid == pybtrfs.subvolume_info(source).uuid
+
+    def test_read_only(self, subvol):
+        paths = [os.path.join(subvol, n) for n in ("a", "b")]
+        results = pybtrfs.create_snapshots(subvol, paths, read_only=True)
+        assert all(isinstance(r, int) for r in results)
+        for p in paths:
+            assert pybtrfs.get_subvolume_read_only(p) is True
+            pybtrfs.set_subvolume_read_only(p, False)
+
+    def test_per_path_errors(self, subvol):
+        pybtrfs.create_subvolume(os.path.join(subvol, "exists"))
+        paths = [
+            os.path.join(subvol, "exists"),
+            os.path.join(subvol, "ok"),
+            os.path.join(subvol, "missing_dir", "x"),
+        ]
+
+        results = pybtrfs.create_snapshots(subvol, paths)
+        assert results[0].errno == errno.EEXIST
+        assert isinstance(results[1], int)
+        assert results[2].errno == errno.ENOENT
+
+    def test_missing_source(self, subvol):
+        with pytest.raises(pybtrfs.BtrfsUtilError):
+            pybtrfs.create_snapshots(os.path.join(subvol, "nope"),
+                                     [os.path.join(subvol, "x")])
+
+
 class TestSnapshot:
     def test_snapshot(self, subvol, btrfs):
         snap = os.path.join(btrfs, "_test_snap")
@@ -141,6 +387,22 @@ class TestSnapshot:
             except Exception:
                 pass
 
+    def test_snapshot_async(self, subvol, btrfs):
+        snaps = [os.path.join(btrfs, f"_test_snap_async{i}") for i in range(3)]
+        try:
+            transids = [pybtrfs.create_snapshot_async(subvol, s)
+                        for s in snaps]
+            assert pybtrfs.commit_group(btrfs, transids) == max(transids)
+            for snap, transid in zip(snaps, transids):
+                assert pybtrfs.is_subvolume(snap)
+                assert pybtrfs.subvolume_info(snap).otransid == transid
+        finally:
+            for snap in snaps:
+                try:
+                    pybtrfs.delete_subvolume(snap)
+                except Exception:
+                    pass
+
     def test_snapshot_read_only(self, subvol, btrfs):
         snap = os.path.join(btrfs, "_test_snap_ro")
         try:
@@ -154,7 +416,156 @@ class TestSnapshot:
                 pass
 
 
+def _tree(btrfs, name, payload=None):
+    """Create a seven-subvolume tree; write payload to a/dir/x/f if given."""
+    top = os.path.join(btrfs, name)
+    pybtrfs.create_subvolume(top)
+    for a in ("a", "b"):
+        pybtrfs.create_subvolume(os.path.join(top, a))
+        os.mkdir(os.path.join(top, a, "dir"))
+        for c in ("x", "y"):
+            pybtrfs.create_subvolume(os.path.join(top, a, "dir", c))
+    if payload is not None:
+        with open(os.path.join(top, "a", "dir", "x", "f"), "w") as f:
+            f.write(payload)
+    return top
+
+
+class TestDeleteSubvolumeTree:
+    def test_delete_tree(self, btrfs):
+        top = _tree(btrfs, "_test_tree")
+        calls = []
+
+        failures = pybtrfs.delete_subvolume_tree(
+            top, workers=4, progress=lambda done, total: calls.append(
+                (done, total)),
+        )
+        assert failures == []
+        assert not os.path.exists(top)
+        assert calls[-1] == (7, 7)
+        assert [d for d, _ in calls] == sorted(d for d, _ in calls)
+
+    def test_not_subvolume(self, subvol):
+        plain = os.path.join(subvol, "plain")
+        os.mkdir(plain)
+        with pytest.raises(pybtrfs.BtrfsUtilError):
+            pybtrfs.delete_subvolume_tree(plain)
+        assert pybtrfs.is_subvolume(subvol)
+
+    def test_progress_raises(self, btrfs):
+        top = _tree(btrfs, "_test_tree_cancel")
+
+        calls = []
+
+        def stop(done, total):
+            calls.append((done, total))
+            raise RuntimeError("stop")
+
+        try:
+            with pytest.raises(RuntimeError):
+                pybtrfs.delete_subvolume_tree(top, workers=1, progress=stop)
+            done, total = calls[0]
+            assert done < total
+        finally:
+            if os.path.exists(top):
+                pybtrfs.delete_subvolume(top, recursive=True)
+
+    def test_bad_progress(self, subvol):
+        with pytest.raises(TypeError):
+            pybtrfs.delete_subvolume_tree(subvol, progress=1)
+
+
+class TestCreateSnapshotTree:
+    def _subvolumes(self, top):
+        return sorted(path for path, _ in pybtrfs.SubvolumeIterator(top))
+
+    def test_snapshot_tree(self, btrfs):
+        top = _tree(btrfs, "_test_snap_tree", "data")
+        dest = os.path.join(btrfs, "_test_snap_tree_copy")
+        try:
+            ids = pybtrfs.create_snapshot_tree(top, dest, workers=4)
+            assert len(ids) == 7
+            assert pybtrfs.subvolume_id(dest) in ids
+            assert self._subvolumes(dest) == self._subvolumes(top)
+            with open(os.path.join(dest, "a", "dir", "x", "f")) as f:
+                assert f.read() == "data"
+            assert not pybtrfs.get_subvolume_read_only(dest)
+        finally:
+            pybtrfs.delete_subvolume_tree(dest)
+            pybtrfs.delete_subvolume_tree(top)
+
+    def test_read_only(self, btrfs):
+        top = _tree(btrfs, "_test_snap_tree_ro")
+        dest = os.path.join(btrfs, "_test_snap_tree_ro_copy")
+        try:
+            pybtrfs.create_snapshot_tree(top, dest, read_only=True)
+            assert pybtrfs.get_subvolume_read_only(dest)
+            assert pybtrfs.get_subvolume_read_only(
+                os.path.join(dest, "b", "dir", "y"))
+        finally:
+            for path, _ in pybtrfs.SubvolumeIterator(dest):
+                pybtrfs.set_subvolume_read_only(os.path.join(dest, path),
+                                                False)
+            pybtrfs.set_subvolume_read_only(dest, False)
+            pybtrfs.delete_subvolume_tree(dest)
+            pybtrfs.delete_subvolume_tree(top)
+
+    def test_destination_exists(self, subvol):
+        dest = os.path.join(subvol, "dest")
+        os.mkdir(dest)
+        with pytest.raises(pybtrfs.BtrfsUtilError) as exc:
+            pybtrfs.create_snapshot_tree(subvol, dest)
+        assert exc.value.errno == errno.EEXIST
+
+
 class TestDeletedSubvolumes:
     def test_returns_list(self, btrfs):
         ids = pybtrfs.deleted_subvolumes(btrfs)
         assert isinstance(ids, list)
+
+
+class TestDeletedSubvolumesArray:
+    def test_returns_memoryview(self, btrfs):
+        ids = pybtrfs.deleted_subvolumes_array(btrfs)
+        assert isinstance(ids, memoryview)
+        assert ids.format == "Q"
+        assert ids.readonly
+        # the cleaner only ever shrinks the list
+        assert set(pybtrfs.deleted_subvolumes(btrfs)) <= set(ids.tolist())
+
+    def test_count_only(self, btrfs):
+        count = pybtrfs.deleted_subvolumes_array(btrfs, count_only=True)
+        assert isinstance(count, int)
+        assert count >= 0
+
+    def test_array_module(self, btrfs):
+        ids = array.array("Q", pybtrfs.deleted_subvolumes_array(btrfs))
+        assert ids.itemsize == 8
+
+
+class TestWaitSubvolumesCleaned:
+    def test_wait_deleted(self, btrfs):
+        path = os.path.join(btrfs, "_test_wait_cleaned")
+        pybtrfs.create_subvolume(path)
+        subvol_id = pybtrfs.subvolume_id(path)
+        pybtrfs.delete_subvolume(path)
+        pybtrfs.sync(btrfs)
+
+        assert pybtrfs.wait_subvolumes_cleaned(btrfs, [subvol_id],
+                                               timeout=60) is True
+        assert subvol_id not in pybtrfs.deleted_subvolumes(btrfs)
+
+    def test_wait_all(self, btrfs):
+        assert pybtrfs.wait_subvolumes_cleaned(btrfs) is True
+        assert pybtrfs.deleted_subvolumes(btrfs) == []
+
+    def test_not_deleted(self, subvol):
+        subvol_id = pybtrfs.subvolume_id(subvol)
+        assert pybtrfs.wait_subvolumes_cleaned(subvol, [subvol_id]) is True
+
+    def test_empty_ids(self, btrfs):
+        assert pybtrfs.wait_subvolumes_cleaned(btrfs, [], timeout=0) is True
+
+    def test_bad_timeout(self, btrfs):
+        with pytest.raises(ValueError):
+            pybtrfs.wait_subvolumes_cleaned(btrfs, timeout=-1)
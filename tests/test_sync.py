@@ -1,3 +1,7 @@
+from concurrent.futures import ThreadPoolExecutor
+
+import pytest
+
 import pybtrfs
 
 
@@ -5,6 +9,19 @@ def test_sync(btrfs):
     pybtrfs.sync(btrfs)
 
 
+def test_sync_coalesce(btrfs):
+    with ThreadPoolExecutor(16) as pool:
+        results = list(pool.map(
+            lambda _: pybtrfs.sync(btrfs, coalesce=True), range(64),
+        ))
+    assert results == [None] * 64
+
+
+def test_sync_coalesce_not_btrfs():
+    with pytest.raises(pybtrfs.BtrfsUtilError):
+        pybtrfs.sync("/proc", coalesce=True)
+
+
 def test_start_and_wait_sync(btrfs):
     transid = pybtrfs.start_sync(btrfs)
     assert isinstance(transid, int)
@@ -14,3 +31,25 @@ def test_start_and_wait_sync(btrfs):
 
 def test_wait_sync_zero(btrfs):
     pybtrfs.wait_sync(btrfs, 0)
+
+
+def test_wait_sync_timeout(btrfs):
+    transid = pybtrfs.start_sync(btrfs)
+    assert pybtrfs.wait_sync(btrfs, transid, timeout=60) is True
+
+
+def test_wait_sync_bad_timeout(btrfs):
+    with pytest.raises(ValueError):
+        pybtrfs.wait_sync(btrfs, timeout=-1)
+
+
+def test_commit_group(btrfs):
+    first = pybtrfs.start_sync(btrfs)
+    second = pybtrfs.start_sync(btrfs)
+    assert pybtrfs.commit_group(btrfs, [second, first]) == max(first, second)
+
+
+def test_commit_group_empty(btrfs):
+    transid = pybtrfs.commit_group(btrfs, [])
+    assert isinstance(transid, int)
+    assert transid > 0